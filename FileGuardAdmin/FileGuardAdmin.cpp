@@ -80,13 +80,17 @@ namespace fileguard {
     
     struct Rule {
         FG_RULE_CODE code;
+        ULONG operations;
         std::wstring_view path_expression;
+        std::wstring_view image_expression;
         const std::shared_ptr<char[]> buf; 
 
         Rule(FG_RULE_CODE code,
+            ULONG operations,
             std::wstring_view path_expression, 
+            std::wstring_view image_expression,
             const std::shared_ptr<char[]> buf):
-            code(code), path_expression(path_expression), buf(buf) { }
+            code(code), operations(operations), path_expression(path_expression), image_expression(image_expression), buf(buf) { }
     };
 
     FG_RULE_MAJOR_CODE RuleMajorNameToCode(std::wstring& major_name) {
@@ -121,12 +125,49 @@ namespace fileguard {
         return L"";
     }
 
+    const std::vector<std::pair<std::wstring, ULONG>> kRuleOperationNames = {
+        { L"create", FG_RULE_OPERATION_CREATE },
+        { L"write", FG_RULE_OPERATION_WRITE },
+        { L"rename", FG_RULE_OPERATION_RENAME },
+        { L"delete", FG_RULE_OPERATION_DELETE },
+        { L"truncate", FG_RULE_OPERATION_TRUNCATE },
+        { L"fsctl", FG_RULE_OPERATION_FSCTL },
+    };
+
+    std::optional<ULONG> RuleOperationNamesToMask(std::wstring operation_names) {
+        std::transform(operation_names.begin(), operation_names.end(), operation_names.begin(),
+            [](wchar_t c) { return std::tolower(c); });
+
+        ULONG operations = 0;
+        std::wstringstream stream(operation_names);
+        std::wstring name;
+        while (std::getline(stream, name, L',')) {
+            auto it = std::find_if(kRuleOperationNames.begin(), kRuleOperationNames.end(),
+                [&name](const auto& operation) { return operation.first == name; });
+            if (it == kRuleOperationNames.end()) return std::nullopt;
+            operations |= it->second;
+        }
+
+        return operations;
+    }
+
+    std::wstring RuleOperationNames(ULONG operations) {
+        std::wstring names;
+        for (const auto& operation : kRuleOperationNames) {
+            if (0 == (operations & operation.second)) continue;
+            if (!names.empty()) names += L"|";
+            names += operation.first;
+        }
+        return names;
+    }
+
     std::wstring MajorIRPName(UCHAR major_irp_code) {
         const UCHAR IRP_MJ_CREATE = 0x00;
         const UCHAR IRP_MJ_CLOSE = 0x02;
         const UCHAR IRP_MJ_WRITE = 0x04;
         const UCHAR IRP_MJ_SET_INFORMATION = 0x06;
         const UCHAR IRP_MJ_FILE_SYSTEM_CONTROL = 0x0d;
+        const UCHAR IRP_MJ_CLEANUP = 0x12;
 
         switch (major_irp_code) {
         case IRP_MJ_CREATE: return L"IRP_MJ_CREATE";
@@ -134,6 +175,8 @@ namespace fileguard {
         case IRP_MJ_WRITE: return L"IRP_MJ_WRITE";
         case IRP_MJ_SET_INFORMATION: return L"IRP_MJ_SET_INFORMATION";
         case IRP_MJ_FILE_SYSTEM_CONTROL: return L"IRP_MJ_FILE_SYSTEM_CONTROL";
+        case IRP_MJ_CLEANUP: return L"IRP_MJ_CLEANUP";
+        case FG_MONITOR_MAJOR_CREATE_SECTION: return L"IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION";
         default: return L"Unknown";
         }
     }
@@ -144,12 +187,14 @@ namespace fileguard {
         while (buf_size > 0) {
             auto rule_ptr = reinterpret_cast<FG_RULE*>(rule_offset_ptr);
             auto rule = std::make_unique<Rule>(rule_ptr->Code,
+                                               rule_ptr->Operations,
                                                std::wstring_view(rule_ptr->PathExpression, rule_ptr->PathExpressionSize/sizeof(wchar_t)),
+                                               std::wstring_view(FG_RULE_IMAGE_EXPRESSION(rule_ptr), rule_ptr->ImageExpressionSize/sizeof(wchar_t)),
                                                buf);
             rules.push_back(std::move(rule));
             
-            rule_offset_ptr = rule_offset_ptr + sizeof(FG_RULE) + rule_ptr->PathExpressionSize;
-            buf_size -= sizeof(FG_RULE) + rule_ptr->PathExpressionSize;
+            rule_offset_ptr = rule_offset_ptr + FG_RULE_SIZE(rule_ptr);
+            buf_size -= FG_RULE_SIZE(rule_ptr);
         }
 
         return rules;
@@ -190,22 +235,36 @@ namespace fileguard {
             return SUCCEEDED(hr) ? std::nullopt : std::make_optional(hr);
         }
         
-        std::variant<bool, HRESULT> AddSingleRule(FG_RULE_CODE& code, std::wstring rule_path_expression) {
-            FGL_RULE rule{ code, rule_path_expression.c_str()};
+        std::variant<bool, HRESULT> AddSingleRule(FG_RULE_CODE& code, ULONG operations, std::wstring rule_path_expression, std::wstring rule_image_expression) {
+            FGL_RULE rule{ code, rule_path_expression.c_str(), rule_image_expression.empty() ? nullptr : rule_image_expression.c_str(), operations };
             BOOLEAN added = FALSE;
             auto hr = FglAddSingleRule(port_, &rule, &added);
             if (FAILED(hr)) return hr;
             return bool(added);
         }
 
-        std::variant<bool, HRESULT> RemoveSingleRule(FG_RULE_CODE& code, std::wstring rule_path_expression) {
-            FGL_RULE rule{ code, rule_path_expression.c_str() };
+        std::variant<bool, HRESULT> RemoveSingleRule(FG_RULE_CODE& code, ULONG operations, std::wstring rule_path_expression, std::wstring rule_image_expression) {
+            FGL_RULE rule{ code, rule_path_expression.c_str(), rule_image_expression.empty() ? nullptr : rule_image_expression.c_str(), operations };
             BOOLEAN removed = FALSE;
             auto hr = FglRemoveSingleRule(port_, &rule, &removed);
             if (FAILED(hr)) return hr;
             return bool(removed);
         }
 
+        std::variant<bool, HRESULT> AddFileIdRule(FG_RULE_CODE& code, std::wstring file_path) {
+            BOOLEAN added = FALSE;
+            auto hr = FglAddFileIdRule(port_, code, file_path.c_str(), &added);
+            if (FAILED(hr)) return hr;
+            return bool(added);
+        }
+
+        std::variant<bool, HRESULT> RemoveFileIdRule(FG_RULE_CODE& code, std::wstring file_path) {
+            BOOLEAN removed = FALSE;
+            auto hr = FglRemoveFileIdRule(port_, code, file_path.c_str(), &removed);
+            if (FAILED(hr)) return hr;
+            return bool(removed);
+        }
+
         std::variant<std::vector<std::unique_ptr<Rule>>, HRESULT> QueryRules() {
             unsigned short amount = 0;
             unsigned long size = 0ul;
@@ -237,6 +296,16 @@ namespace fileguard {
             return cleanRules;
         }
 
+        std::optional<HRESULT> AddTrustedProcess(unsigned long pid) {
+            auto hr = FglAddTrustedProcess(port_, pid);
+            return SUCCEEDED(hr) ? std::nullopt : std::make_optional(hr);
+        }
+
+        std::optional<HRESULT> RemoveTrustedProcess(unsigned long pid) {
+            auto hr = FglRemoveTrustedProcess(port_, pid);
+            return SUCCEEDED(hr) ? std::nullopt : std::make_optional(hr);
+        }
+
     private:
         std::atomic<HANDLE> port_ = INVALID_HANDLE_VALUE;
 
@@ -272,17 +341,23 @@ namespace fileguard {
             detach_cmd->callback([&]() { hr = CommandDetach(volume); });
 
             auto add_cmd = app.add_subcommand("add", "Add a rule");
-            std::wstring major_type, minor_type, expr;
+            std::wstring major_type, minor_type, expr, image, file, ops;
             add_cmd->add_option("--major-type", major_type, "Rule major type")->required();
             add_cmd->add_option("--minor-type", minor_type, "Rule minor type")->default_val("monitored");
-            add_cmd->add_option("--expr", expr, "Rule path expression")->required();
-            add_cmd->callback([&]() { hr = CommandAdd(major_type, minor_type, expr); });
+            auto add_expr_opt = add_cmd->add_option("--expr", expr, "Rule path expression");
+            add_cmd->add_option("--image", image, "Rule process image expression, '!' prefix excludes the image");
+            auto add_file_opt = add_cmd->add_option("--file", file, "Existing file matched by its id instead of a path expression")->excludes(add_expr_opt);
+            add_cmd->add_option("--ops", ops, "Operations the rule is narrowed to: create,write,rename,delete,truncate,fsctl")->excludes(add_file_opt);
+            add_cmd->callback([&]() { hr = CommandAdd(major_type, minor_type, expr, image, file, ops); });
 
             auto remove_cmd = app.add_subcommand("remove", "Remove a rule");
             remove_cmd->add_option("--major-type", major_type, "Rule major type")->required();
             remove_cmd->add_option("--minor-type", minor_type, "Rule minor type")->default_val("monitored");
-            remove_cmd->add_option("--expr", expr, "Rule path expression")->required();
-            remove_cmd->callback([&]() { hr = CommandRemove(major_type, expr, minor_type); });
+            auto remove_expr_opt = remove_cmd->add_option("--expr", expr, "Rule path expression");
+            remove_cmd->add_option("--image", image, "Rule process image expression");
+            auto remove_file_opt = remove_cmd->add_option("--file", file, "Existing file matched by its id")->excludes(remove_expr_opt);
+            remove_cmd->add_option("--ops", ops, "Operations the rule is narrowed to")->excludes(remove_file_opt);
+            remove_cmd->callback([&]() { hr = CommandRemove(major_type, minor_type, expr, image, file, ops); });
 
             auto query_cmd = app.add_subcommand("query", "Query all rules and output it");
             std::wstring format = L"list";
@@ -302,6 +377,15 @@ namespace fileguard {
             auto cleanup_cmd = app.add_subcommand("cleanup", "Cleanup all rules");
             cleanup_cmd->callback([&]() { hr = CommandCleanup(); });
 
+            auto trust_cmd = app.add_subcommand("trust", "Exempt a running process from all rules");
+            unsigned long pid = 0ul;
+            trust_cmd->add_option("--pid", pid, "Process id")->required();
+            trust_cmd->callback([&]() { hr = CommandTrust(pid); });
+
+            auto untrust_cmd = app.add_subcommand("untrust", "Revoke the exemption of a trusted process");
+            untrust_cmd->add_option("--pid", pid, "Process id")->required();
+            untrust_cmd->callback([&]() { hr = CommandUntrust(pid); });
+
             CLI11_PARSE(app, argc_, argv_);
 
             return hr;
@@ -438,7 +522,7 @@ namespace fileguard {
             return S_OK;
         }
 
-        HRESULT CommandAdd(std::wstring& major_type, std::wstring& minor_type, std::wstring& expr) {
+        HRESULT CommandAdd(std::wstring& major_type, std::wstring& minor_type, std::wstring& expr, std::wstring& image, std::wstring& file, std::wstring& ops) {
             FG_RULE_CODE code;
             code.Major = RuleMajorNameToCode(major_type);
             code.Minor = RuleMinorNameToCode(minor_type);
@@ -448,7 +532,19 @@ namespace fileguard {
                 return E_INVALIDARG;
             }
             
-            auto result = core_client_->AddSingleRule(code, expr);
+            if (expr.empty() == file.empty()) {
+                std::wcerr << "error: either `--expr` or `--file` is required" << std::endl;
+                return E_INVALIDARG;
+            }
+
+            auto operations = RuleOperationNamesToMask(ops);
+            if (!operations.has_value()) {
+                std::wcerr << "error: invalid rule operations: `" << ops << "`\n";
+                return E_INVALIDARG;
+            }
+
+            auto result = file.empty() ? core_client_->AddSingleRule(code, *operations, expr, image) 
+                                       : core_client_->AddFileIdRule(code, file);
             if (auto added = std::get_if<bool>(&result)) {
                 if (*added) std::wcout << L"Add rule successfully" << std::endl;
                 else std::wcout << L"Rule already exist" << std::endl;
@@ -459,7 +555,7 @@ namespace fileguard {
             return S_OK;
         }
 
-        HRESULT CommandRemove(std::wstring& major_type, std::wstring& minor_type, std::wstring& expr) {
+        HRESULT CommandRemove(std::wstring& major_type, std::wstring& minor_type, std::wstring& expr, std::wstring& image, std::wstring& file, std::wstring& ops) {
             FG_RULE_CODE code;
             code.Major = RuleMajorNameToCode(major_type);
             code.Minor = RuleMinorNameToCode(minor_type);
@@ -469,7 +565,19 @@ namespace fileguard {
                 return E_INVALIDARG;
             }
 
-            auto result = core_client_->RemoveSingleRule(code, expr);
+            if (expr.empty() == file.empty()) {
+                std::wcerr << "error: either `--expr` or `--file` is required" << std::endl;
+                return E_INVALIDARG;
+            }
+
+            auto operations = RuleOperationNamesToMask(ops);
+            if (!operations.has_value()) {
+                std::wcerr << "error: invalid rule operations: `" << ops << "`\n";
+                return E_INVALIDARG;
+            }
+
+            auto result = file.empty() ? core_client_->RemoveSingleRule(code, *operations, expr, image) 
+                                       : core_client_->RemoveFileIdRule(code, file);
             if (auto removed = std::get_if<bool>(&result)) {
                 if (*removed) std::wcout << L"Remove rule successfully" << std::endl;
                 else std::wcout << "Rule not found" << std::endl;
@@ -496,7 +604,7 @@ namespace fileguard {
             }
 
             // Output rules query result.
-            if (format == L"csv") std::wcout << "major_code,minor_code,expression" << std::endl;
+            if (format == L"csv") std::wcout << "major_code,minor_code,operations,expression,image" << std::endl;
             
             auto total_rules = rules->size();
             auto index = 0;
@@ -505,13 +613,17 @@ namespace fileguard {
                     if (format == L"csv") {
                         std::wcout << RuleMajorName(rule->code) << ","
                                    << RuleMinorName(rule->code) << ","
-                                   << rule->path_expression
+                                   << RuleOperationNames(rule->operations) << ","
+                                   << rule->path_expression << ","
+                                   << rule->image_expression
                                    << std::endl;
                     } else if (format == L"list") {
                         std::wcout << "     index: " << index << "/" << total_rules << std::endl
                                    << "major type: " << RuleMajorName(rule->code) << std::endl
                                    << "minor type: " << RuleMinorName(rule->code) << std::endl
+                                   << "operations: " << RuleOperationNames(rule->operations) << std::endl
                                    << "expression: " << rule->path_expression << std::endl
+                                   << "     image: " << (rule->image_expression.empty() ? L"*" : rule->image_expression) << std::endl
                                    << std::endl;
                         index++;
                     }
@@ -536,7 +648,7 @@ namespace fileguard {
             }
 
             // Output matched rules result.
-            if (format == L"csv") std::wcout << "major_code,minor_code,expression" << std::endl;
+            if (format == L"csv") std::wcout << "major_code,minor_code,operations,expression,image" << std::endl;
 
             auto total_rules = rules->size();
             auto index = 0;
@@ -545,13 +657,17 @@ namespace fileguard {
                     if (format == L"csv") {
                         std::wcout << RuleMajorName(rule->code) << ","
                                    << RuleMinorName(rule->code) << ","
-                                   << rule->path_expression
+                                   << RuleOperationNames(rule->operations) << ","
+                                   << rule->path_expression << ","
+                                   << rule->image_expression
                                    << std::endl;
                     } else if (format == L"list") {
                         std::wcout << "     index: " << index << "/" << total_rules << std::endl
                                    << "major type: " << RuleMajorName(rule->code) << std::endl
                                    << "minor type: " << RuleMinorName(rule->code) << std::endl
+                                   << "operations: " << RuleOperationNames(rule->operations) << std::endl
                                    << "expression: " << rule->path_expression << std::endl
+                                   << "     image: " << (rule->image_expression.empty() ? L"*" : rule->image_expression) << std::endl
                                    << std::endl;
                         index++;
                     }
@@ -569,7 +685,7 @@ namespace fileguard {
             volatile BOOLEAN end = FALSE;
             FGL_MONITOR_RECORD_CALLBACK callback = NULL;
             if (format == L"csv") {
-                std::wcout << "major_irp,requestor_pid,requestor_tid,record_time,volume_serial_number,file_id,rule_major_type,rule_minor_type,rule_expression,file_path"
+                std::wcout << "major_irp,requestor_pid,requestor_tid,record_time,repeat_count,writes,write_bytes,truncates,renames,denied,volume_serial_number,file_id,rule_major_type,rule_minor_type,rule_expression,file_path"
                            << std::endl;
                 callback = [](FG_MONITOR_RECORD *record) {
                     FILETIME filetime;
@@ -584,6 +700,12 @@ namespace fileguard {
                                << record->RequestorPid << L","
                                << record->RequestorTid << L","
                                << SYSTEMTIME(local_systemtime) << L","
+                               << record->RepeatCount << L","
+                               << record->Summary.Writes << L","
+                               << record->Summary.WriteBytes << L","
+                               << record->Summary.Truncates << L","
+                               << record->Summary.Renames << L","
+                               << record->Summary.Denied << L","
                                << record->FileIdDescriptor.VolumeSerialNumber << L","
                                << record->FileIdDescriptor.FileId.FileId64.QuadPart << L","
                                << RuleMajorName(record->RuleCode) << L","
@@ -606,6 +728,12 @@ namespace fileguard {
                                << L"       requestor_pid: " << record->RequestorPid << std::endl
                                << L"       requestor_tid: " << record->RequestorTid << std::endl
                                << L"         record_time: " << SYSTEMTIME(local_systemtime) << std::endl
+                               << L"        repeat_count: " << record->RepeatCount << std::endl
+                               << L"              writes: " << record->Summary.Writes << std::endl
+                               << L"         write_bytes: " << record->Summary.WriteBytes << std::endl
+                               << L"           truncates: " << record->Summary.Truncates << std::endl
+                               << L"             renames: " << record->Summary.Renames << std::endl
+                               << L"              denied: " << record->Summary.Denied << std::endl
                                << L"volume_serial_number: " << record->FileIdDescriptor.VolumeSerialNumber << std::endl
                                << L"             file_id: " << record->FileIdDescriptor.FileId.FileId64.QuadPart << std::endl
                                << L"          rule_major: " << RuleMajorName(record->RuleCode) << std::endl
@@ -634,6 +762,30 @@ namespace fileguard {
                        << std::endl;
             return S_OK;
         }
+
+        HRESULT CommandTrust(unsigned long pid) {
+            auto result = core_client_->AddTrustedProcess(pid);
+            if (result) {
+                auto hr = result.value();
+                std::wcerr << L"error: trust process " << pid << L" failed, hresult: " << HEX(hr) << std::endl;
+                return hr;
+            }
+
+            std::wcout << L"Trust process successfully" << std::endl;
+            return S_OK;
+        }
+
+        HRESULT CommandUntrust(unsigned long pid) {
+            auto result = core_client_->RemoveTrustedProcess(pid);
+            if (result) {
+                auto hr = result.value();
+                std::wcerr << L"error: untrust process " << pid << L" failed, hresult: " << HEX(hr) << std::endl;
+                return hr;
+            }
+
+            std::wcout << L"Untrust process successfully" << std::endl;
+            return S_OK;
+        }
     };
 }
 
@@ -0,0 +1,143 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    AttachPolicy.h
+
+Abstract:
+
+    The volume attach policy and its evaluation. The policy only compares the type
+    and the name of a volume, so it is also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __ATTACH_POLICY_H__
+#define __ATTACH_POLICY_H__
+
+//
+// Volume attach policy, configured by the `AttachPolicy`, `AttachFileSystems`,
+// `AttachDeviceTypes` and `AttachVolumes` registry values.
+//
+#define FG_ATTACH_ON_DEMAND ((ULONG)0x01) // Attach only to volumes targeted by a rule.
+
+#define FG_ATTACH_DISK      ((ULONG)0x01)
+#define FG_ATTACH_REMOVABLE ((ULONG)0x02)
+#define FG_ATTACH_CD_ROM    ((ULONG)0x04)
+#define FG_ATTACH_NETWORK   ((ULONG)0x08)
+
+#define FG_ATTACH_FILE_SYSTEM(_type_) ((ULONG)1 << (_type_))
+
+#define FG_ATTACH_DEFAULT_FILE_SYSTEMS FG_ATTACH_FILE_SYSTEM(FLT_FSTYPE_NTFS)
+#define FG_ATTACH_DEFAULT_DEVICE_TYPES (FG_ATTACH_DISK | FG_ATTACH_REMOVABLE | FG_ATTACH_CD_ROM | FG_ATTACH_NETWORK)
+
+typedef struct _FG_ATTACH_POLICY {
+
+    ULONG Flags;       // FG_ATTACH_ON_DEMAND.
+    ULONG FileSystems; // FG_ATTACH_FILE_SYSTEM bits of the attached file system types.
+    ULONG DeviceTypes; // FG_ATTACH_* bits of the attached volume device types.
+
+    //
+    // Upcased expressions of the attached volume device names, all volumes are
+    // attached if there is none.
+    //
+    ULONG VolumeExpressionsAmount;
+    PUNICODE_STRING VolumeExpressions;
+
+} FG_ATTACH_POLICY, *PFG_ATTACH_POLICY;
+
+FORCEINLINE
+BOOLEAN
+FgcIsVolumeAttachable(
+    _In_ CONST FG_ATTACH_POLICY *Policy,
+    _In_ DEVICE_TYPE VolumeDeviceType,
+    _In_ FLT_FILESYSTEM_TYPE VolumeFilesystemType,
+    _In_ BOOLEAN Removable,
+    _In_ PCUNICODE_STRING VolumeName
+    )
+/*++
+
+Routine Description:
+
+    This routine evaluates the attach policy for a volume.
+
+Arguments:
+
+    Policy               - The attach policy.
+    VolumeDeviceType     - Device type of the volume.
+    VolumeFilesystemType - File system type of the volume.
+    Removable            - TRUE if the volume is on removable media.
+    VolumeName           - Upcased device name of the volume.
+
+Return Value:
+
+    TRUE if the volume is attached by the policy.
+
+--*/
+{
+    ULONG deviceType = 0ul;
+    ULONG idx = 0ul;
+
+    if ((ULONG)VolumeFilesystemType >= sizeof(ULONG) * 8 ||
+        !FlagOn(Policy->FileSystems, FG_ATTACH_FILE_SYSTEM(VolumeFilesystemType))) {
+        return FALSE;
+    }
+
+    switch (VolumeDeviceType) {
+    case FILE_DEVICE_DISK_FILE_SYSTEM:
+        deviceType = Removable ? FG_ATTACH_REMOVABLE : FG_ATTACH_DISK;
+        break;
+
+    case FILE_DEVICE_CD_ROM_FILE_SYSTEM:
+        deviceType = FG_ATTACH_CD_ROM;
+        break;
+
+    case FILE_DEVICE_NETWORK_FILE_SYSTEM:
+        deviceType = FG_ATTACH_NETWORK;
+        break;
+
+    default:
+        return FALSE;
+    }
+
+    if (!FlagOn(Policy->DeviceTypes, deviceType)) return FALSE;
+
+    if (0ul == Policy->VolumeExpressionsAmount) return TRUE;
+
+    for (idx = 0ul; idx < Policy->VolumeExpressionsAmount; idx++) {
+        if (FsRtlIsNameInExpression(&Policy->VolumeExpressions[idx], (PUNICODE_STRING)VolumeName, TRUE, NULL)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+#endif
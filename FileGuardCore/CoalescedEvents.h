@@ -0,0 +1,255 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    CoalescedEvents.h
+
+Abstract:
+
+    The coalescing window of the monitor events of a file. The routines only fold
+    events into the window and take the record it stands for, the caller provides
+    the time and the lock, so they are also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __COALESCED_EVENTS_H__
+#define __COALESCED_EVENTS_H__
+
+//
+// The last event not coalesced opens a window, the identical events in the window
+// are counted and recorded as one record when it expires.
+//
+typedef struct _FGC_COALESCED_WINDOW {
+
+    //
+    // Process, IRP major function and rule of the event which opened the window,
+    // and the time it was opened.
+    //
+    ULONG_PTR RequestorPid;
+    UCHAR MajorFunction;
+    ULONG RuleId;
+    LONGLONG WindowStart;
+
+    //
+    // Identical events counted in the window. The thread and the minor function
+    // are the ones of the first event counted.
+    //
+    ULONG Repeats;
+    ULONG_PTR RequestorTid;
+    UCHAR MinorFunction;
+    LONGLONG FirstTime;
+    LONGLONG LastTime;
+
+} FGC_COALESCED_WINDOW, *PFGC_COALESCED_WINDOW;
+
+FORCEINLINE
+BOOLEAN
+FgcIsEventInCoalescedWindow(
+    _In_ CONST FGC_COALESCED_WINDOW *Window,
+    _In_ ULONG_PTR RequestorPid,
+    _In_ UCHAR MajorFunction,
+    _In_ ULONG RuleId,
+    _In_ LONGLONG Now,
+    _In_ LONGLONG Length
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether an event is identical to the one which opened the
+    window and the window has not expired.
+
+Arguments:
+
+    Window        - The coalescing window of the file.
+    RequestorPid  - Process of the event.
+    MajorFunction - IRP major function of the event.
+    RuleId        - Id of the rule matched by the event.
+    Now           - Time of the event.
+    Length        - Length of the window, in the unit of the times.
+
+Return Value:
+
+    TRUE if the event is coalesced into the window.
+
+--*/
+{
+    return Window->RequestorPid == RequestorPid &&
+           Window->MajorFunction == MajorFunction &&
+           Window->RuleId == RuleId &&
+           Now - Window->WindowStart < Length;
+}
+
+FORCEINLINE
+BOOLEAN
+FgcIsCoalescedWindowExpired(
+    _In_ CONST FGC_COALESCED_WINDOW *Window,
+    _In_ LONGLONG Now,
+    _In_ LONGLONG Length
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether the window has expired, the events counted in it
+    are then recorded.
+
+Arguments:
+
+    Window - The coalescing window of the file.
+    Now    - The current time.
+    Length - Length of the window, in the unit of the times.
+
+Return Value:
+
+    TRUE if the window has expired.
+
+--*/
+{
+    return Now - Window->WindowStart >= Length;
+}
+
+FORCEINLINE
+BOOLEAN
+FgcCoalesceEvent(
+    _Inout_ PFGC_COALESCED_WINDOW Window,
+    _In_ ULONG_PTR RequestorTid,
+    _In_ UCHAR MinorFunction,
+    _In_ LONGLONG Now
+    )
+/*++
+
+Routine Description:
+
+    This routine counts an event in the window, the event must be in the window.
+
+Arguments:
+
+    Window        - The coalescing window of the file.
+    RequestorTid  - Thread of the event.
+    MinorFunction - IRP minor function of the event.
+    Now           - Time of the event.
+
+Return Value:
+
+    TRUE if it is the first event counted, the caller then keeps the rule of the
+    window referenced until the events are taken.
+
+--*/
+{
+    BOOLEAN first = (0UL == Window->Repeats);
+
+    if (first) {
+        Window->RequestorTid = RequestorTid;
+        Window->MinorFunction = MinorFunction;
+        Window->FirstTime = Now;
+    }
+
+    Window->Repeats++;
+    Window->LastTime = Now;
+
+    return first;
+}
+
+FORCEINLINE
+VOID
+FgcOpenCoalescedWindow(
+    _Inout_ PFGC_COALESCED_WINDOW Window,
+    _In_ ULONG_PTR RequestorPid,
+    _In_ UCHAR MajorFunction,
+    _In_ ULONG RuleId,
+    _In_ LONGLONG Now
+    )
+/*++
+
+Routine Description:
+
+    This routine opens a new window with an event which is recorded by itself, the
+    events counted in the previous window must have been taken.
+
+Arguments:
+
+    Window        - The coalescing window of the file.
+    RequestorPid  - Process of the event.
+    MajorFunction - IRP major function of the event.
+    RuleId        - Id of the rule matched by the event.
+    Now           - Time of the event.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    Window->RequestorPid = RequestorPid;
+    Window->MajorFunction = MajorFunction;
+    Window->RuleId = RuleId;
+    Window->WindowStart = Now;
+}
+
+FORCEINLINE
+VOID
+FgcTakeCoalescedWindow(
+    _Inout_ PFGC_COALESCED_WINDOW Window,
+    _Out_ FG_MONITOR_RECORD *Header
+    )
+/*++
+
+Routine Description:
+
+    This routine takes the events counted in the window as the header of a record,
+    the caller fills in the rule of the record.
+
+Arguments:
+
+    Window - The coalescing window of the file, it has events counted.
+    Header - The header of the record.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    RtlZeroMemory(Header, sizeof(FG_MONITOR_RECORD));
+
+    Header->MajorFunction = Window->MajorFunction;
+    Header->MinorFunction = Window->MinorFunction;
+    Header->RequestorPid = Window->RequestorPid;
+    Header->RequestorTid = Window->RequestorTid;
+    Header->RecordTime.QuadPart = Window->FirstTime;
+    Header->LastRecordTime.QuadPart = Window->LastTime;
+    Header->RepeatCount = Window->Repeats;
+
+    Window->Repeats = 0UL;
+}
+
+#endif
@@ -143,9 +143,12 @@ FgcControlMessageNotifyCallback(
     FG_MESSAGE_TYPE commandType = 0;
     PFG_MESSAGE message = NULL;
     PFG_MESSAGE_RESULT result = NULL;
-    BOOLEAN acceptable = FALSE;
+    BOOLEAN acceptable = FALSE, affected = FALSE;
     USHORT ruleAmount = 0;
     UNICODE_STRING pathName = { 0 };
+    LONG rulesGeneration = 0l, queryGeneration = 0l;
+    BOOLEAN queryIfChanged = FALSE;
+    ULONG batchSize = 0ul, batchDelay = 0ul, sendTimeout = 0ul, coalesceWindow = 0ul;
 
     UNREFERENCED_PARAMETER(ConnectionCookie);
 
@@ -161,6 +164,12 @@ FgcControlMessageNotifyCallback(
 
     *ReturnSize = 0;
 
+    //
+    // The generation is read before the rules are, so the rules returned are never
+    // older than the generation reported with them.
+    //
+    rulesGeneration = ReadAcquire(&Globals.RulesGeneration);
+
     switch (commandType) {
     case GetCoreVersion:
 
@@ -231,6 +240,9 @@ FgcControlMessageNotifyCallback(
             }
 
             result->AffectedRulesAmount = ruleAmount;
+            if (ruleAmount > 0) {
+                FgcUpdateVolumeAttachments();
+            }
 
         } except(EXCEPTION_EXECUTE_HANDLER) {
             resultStatus = GetExceptionCode();
@@ -249,6 +261,21 @@ FgcControlMessageNotifyCallback(
             break;
         }
 
+        try {
+            queryIfChanged = message->QueryIfChanged;
+            queryGeneration = message->RulesGeneration;
+        } except(EXCEPTION_EXECUTE_HANDLER) {
+            resultStatus = GetExceptionCode();
+            LOG_ERROR("NTSTATUS: 0x%08x, read query rules message failed", resultStatus);
+            break;
+        }
+
+        if (queryIfChanged && queryGeneration == rulesGeneration) {
+            result->Rules.RulesAmount = 0;
+            result->Rules.RulesSize = 0ul;
+            break;
+        }
+
         resultStatus = FgcGetRules(&Globals.RulesList, 
                                   Globals.RulesListLock,
                                   (FG_RULE*)result->Rules.RulesBuffer, 
@@ -310,6 +337,173 @@ FgcControlMessageNotifyCallback(
         }
         
         result->AffectedRulesAmount = FgcCleanupRuleEntriesList(Globals.RulesListLock, &Globals.RulesList);
+        result->AffectedRulesAmount += FgcCleanupFileIdRuleTable(&Globals.FileIdRules);
+        if (result->AffectedRulesAmount > 0) {
+            FgcUpdateVolumeAttachments();
+        }
+        break;
+
+    case AddTrustedProcess:
+    case RemoveTrustedProcess:
+
+        //
+        // Exempt a process from all rules or revoke the exemption.
+        //
+
+        if (NULL == Output) status = STATUS_INVALID_PARAMETER_4;
+        if (OutputSize < sizeof(FG_MESSAGE_RESULT)) status = STATUS_INVALID_PARAMETER_5;
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, message invalid parameter", status);
+            break;
+        }
+
+        if (AddTrustedProcess == commandType) {
+            resultStatus = FgcAddTrustedProcess(&Globals.TrustedProcesses, ULongToHandle(message->ProcessId));
+        } else {
+            resultStatus = FgcRemoveTrustedProcess(&Globals.TrustedProcesses, ULongToHandle(message->ProcessId));
+        }
+        break;
+
+    case AddFileIdRule:
+    case RemoveFileIdRule:
+
+        //
+        // Add or remove a rule which matches a file by its id.
+        //
+
+        if (NULL == Output) status = STATUS_INVALID_PARAMETER_4;
+        if (OutputSize < sizeof(FG_MESSAGE_RESULT)) status = STATUS_INVALID_PARAMETER_5;
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, message invalid parameter", status);
+            break;
+        }
+
+        try {
+            if (InputSize < FIELD_OFFSET(FG_MESSAGE, FilePath) + (ULONG)message->FilePathSize) {
+                resultStatus = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            if (AddFileIdRule == commandType) {
+                pathName.Length = message->FilePathSize;
+                pathName.MaximumLength = message->FilePathSize;
+                pathName.Buffer = message->FilePath;
+                resultStatus = FgcAddFileIdRule(&Globals.FileIdRules,
+                                                &message->FileIdDescriptor,
+                                                message->FileIdRuleCode,
+                                                &pathName,
+                                                &affected);
+            } else {
+                resultStatus = FgcRemoveFileIdRule(&Globals.FileIdRules,
+                                                   &message->FileIdDescriptor,
+                                                   message->FileIdRuleCode,
+                                                   &affected);
+            }
+
+            result->AffectedRulesAmount = affected ? 1ul : 0ul;
+            if (affected) {
+                FgcUpdateVolumeAttachments();
+            }
+
+        } except(EXCEPTION_EXECUTE_HANDLER) {
+            resultStatus = GetExceptionCode();
+            LOG_ERROR("NTSTATUS: 0x%08x, change file id rule failed", resultStatus);
+            break;
+        }
+
+        break;
+
+    case SetMonitorBatching:
+
+        //
+        // Change the monitor records batching, it applies from the next batch.
+        //
+
+        if (NULL == Output) status = STATUS_INVALID_PARAMETER_4;
+        if (OutputSize < sizeof(FG_MESSAGE_RESULT)) status = STATUS_INVALID_PARAMETER_5;
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, message invalid parameter", status);
+            break;
+        }
+
+        try {
+            batchSize = message->MonitorBatchSize;
+            batchDelay = message->MonitorBatchDelay;
+        } except(EXCEPTION_EXECUTE_HANDLER) {
+            resultStatus = GetExceptionCode();
+            LOG_ERROR("NTSTATUS: 0x%08x, set monitor batching failed", resultStatus);
+            break;
+        }
+
+        if (batchSize > FG_MONITOR_BATCH_SIZE_MAX || batchDelay > FG_MONITOR_BATCH_DELAY_MAX) {
+            resultStatus = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        InterlockedExchange((__volatile LONG*)&Globals.MonitorBatchSize, batchSize);
+        InterlockedExchange((__volatile LONG*)&Globals.MonitorBatchDelay, batchDelay);
+        LOG_INFO("Set monitor batching size: %lu, delay: %lu", batchSize, batchDelay);
+        break;
+
+    case SetMonitorSendTimeout:
+
+        //
+        // Change how long a records message waits for a client receive.
+        //
+
+        if (NULL == Output) status = STATUS_INVALID_PARAMETER_4;
+        if (OutputSize < sizeof(FG_MESSAGE_RESULT)) status = STATUS_INVALID_PARAMETER_5;
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, message invalid parameter", status);
+            break;
+        }
+
+        try {
+            sendTimeout = message->MonitorSendTimeout;
+        } except(EXCEPTION_EXECUTE_HANDLER) {
+            resultStatus = GetExceptionCode();
+            LOG_ERROR("NTSTATUS: 0x%08x, set monitor send timeout failed", resultStatus);
+            break;
+        }
+
+        if (sendTimeout > FG_MONITOR_SEND_TIMEOUT_MAX) {
+            resultStatus = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        InterlockedExchange((__volatile LONG*)&Globals.MonitorSendTimeout, sendTimeout);
+        LOG_INFO("Set monitor send timeout: %lu", sendTimeout);
+        break;
+
+    case SetMonitorCoalescing:
+
+        //
+        // Change the window identical monitor events are coalesced in, the events
+        // already coalesced are recorded once the new window expired.
+        //
+
+        if (NULL == Output) status = STATUS_INVALID_PARAMETER_4;
+        if (OutputSize < sizeof(FG_MESSAGE_RESULT)) status = STATUS_INVALID_PARAMETER_5;
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, message invalid parameter", status);
+            break;
+        }
+
+        try {
+            coalesceWindow = message->MonitorCoalesceWindow;
+        } except(EXCEPTION_EXECUTE_HANDLER) {
+            resultStatus = GetExceptionCode();
+            LOG_ERROR("NTSTATUS: 0x%08x, set monitor coalescing failed", resultStatus);
+            break;
+        }
+
+        if (coalesceWindow > FG_MONITOR_COALESCE_WINDOW_MAX) {
+            resultStatus = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        InterlockedExchange((__volatile LONG*)&Globals.MonitorCoalesceWindow, coalesceWindow);
+        LOG_INFO("Set monitor coalesce window: %lu", coalesceWindow);
         break;
         
     default:
@@ -321,6 +515,7 @@ FgcControlMessageNotifyCallback(
     if(NULL != result) {
         result->ResultCode = RtlNtStatusToDosError(resultStatus);
         result->ResultSize = sizeof(FG_MESSAGE_RESULT) + resultVariableSize;
+        result->RulesGeneration = rulesGeneration;
         *ReturnSize = sizeof(FG_MESSAGE_RESULT) + resultVariableSize;
     } else {
         *ReturnSize = 0;
@@ -342,18 +537,44 @@ FgcMonitorPortConnectCallback(
     _Flt_ConnectionCookie_Outptr_ PVOID* ConnectionCookie
     )
 {
+    NTSTATUS status = STATUS_SUCCESS;
+    FG_MONITOR_CONNECTION_CONTEXT connection = { 0 };
+    PFG_MONITOR_SUBSCRIBER subscriber = NULL;
+
     UNREFERENCED_PARAMETER(CorePortCookie);
-    UNREFERENCED_PARAMETER(ConnectionContext);
-    UNREFERENCED_PARAMETER(ContextBytes);
-    UNREFERENCED_PARAMETER(ConnectionCookie);
 
     PAGED_CODE();
 
-    Globals.MonitorClientPort = ClientPort;
-    Globals.MonitorContext->ClientPort = ClientPort;
-    KeSetEvent(&Globals.MonitorContext->EventPortConnected, 0, FALSE);
+    //
+    // A client passing a channel setup receives the records through a channel the
+    // core creates, its event is referenced here since this callback runs in the
+    // client process, the client maps the buffer by QueryMonitorChannel. A client
+    // passing only the channel setup subscribes to all records.
+    //
+    if (NULL != ConnectionContext) {
+
+        if (ContextBytes >= sizeof(FG_MONITOR_CONNECTION_CONTEXT)) {
+            connection = *(PFG_MONITOR_CONNECTION_CONTEXT)ConnectionContext;
+        } else if (ContextBytes >= sizeof(FG_MONITOR_CHANNEL_SETUP)) {
+            connection.Channel = *(PFG_MONITOR_CHANNEL_SETUP)ConnectionContext;
+        } else {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    status = FgcConnectMonitorSubscriber(Globals.MonitorContext,
+                                         ClientPort,
+                                         NULL != ConnectionContext ? &connection : NULL,
+                                         &subscriber);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, connect monitor subscriber failed", status);
+        return status;
+    }
 
-    LOG_INFO("Monitor communication port connected");
+    *ConnectionCookie = subscriber;
+
+    LOG_INFO("Monitor communication port connected, channel: %s",
+             NULL != subscriber->Channel ? "TRUE" : "FALSE");
 
     return STATUS_SUCCESS;
 }
@@ -363,15 +584,109 @@ FgcMonitorPortDisconnectCallback(
     _In_opt_ PVOID ConnectionCookie
     ) 
 {
-    UNREFERENCED_PARAMETER(ConnectionCookie);
+    PAGED_CODE();
+
+    if (NULL == ConnectionCookie) return;
+
+    FgcDisconnectMonitorSubscriber(Globals.MonitorContext, (PFG_MONITOR_SUBSCRIBER)ConnectionCookie);
+}
+
+NTSTATUS
+FgcMonitorMessageNotifyCallback(
+    _In_opt_ PVOID ConnectionCookie,
+    _In_reads_bytes_opt_(InputSize) PVOID Input,
+    _In_ ULONG InputSize,
+    _Out_writes_bytes_to_opt_(OutputSize, *ReturnSize) PVOID Output,
+    _In_ ULONG OutputSize,
+    _Out_ PULONG ReturnSize
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS, resultStatus = STATUS_SUCCESS;
+    ULONG resultVariableSize = 0ul;
+    PFG_MESSAGE message = NULL;
+    PFG_MESSAGE_RESULT result = NULL;
+    LONG rulesGeneration = 0l;
+    ULONG firstRuleId = 0ul;
+    PVOID channelBuffer = NULL;
 
     PAGED_CODE();
 
-    KeClearEvent(&Globals.MonitorContext->EventPortConnected);
+    if (NULL == Input) return STATUS_INVALID_PARAMETER_2;
+    if (InputSize < sizeof(FG_MESSAGE)) return STATUS_INVALID_PARAMETER_3;
+    if (NULL == Output) return STATUS_INVALID_PARAMETER_4;
+    if (OutputSize < sizeof(FG_MESSAGE_RESULT)) return STATUS_INVALID_PARAMETER_5;
+    if (NULL == ReturnSize) return STATUS_INVALID_PARAMETER_6;
 
-    FltCloseClientPort(Globals.Filter, &Globals.MonitorClientPort);
-    Globals.MonitorClientPort = NULL;
-    Globals.MonitorContext->ClientPort = NULL;
+    message = (PFG_MESSAGE)Input;
+    result = (PFG_MESSAGE_RESULT)Output;
+
+    *ReturnSize = 0;
 
-    LOG_INFO("Monitor communication port disconnected");
+    rulesGeneration = ReadAcquire(&Globals.RulesGeneration);
+
+    switch (message->Type) {
+    case QueryRuleDictionary:
+
+        //
+        // Resolve the rule ids of the monitor records, the rules only grow in ids so
+        // the client fetches the new ones incrementally.
+        //
+        try {
+            firstRuleId = message->FirstRuleId;
+        } except(EXCEPTION_EXECUTE_HANDLER) {
+            resultStatus = GetExceptionCode();
+            LOG_ERROR("NTSTATUS: 0x%08x, read query rule dictionary message failed", resultStatus);
+            break;
+        }
+
+        resultStatus = FgcGetRuleDictionary(&Globals.RulesList,
+                                            Globals.RulesListLock,
+                                            &Globals.FileIdRules,
+                                            firstRuleId,
+                                            (FG_RULE*)result->Rules.RulesBuffer,
+                                            OutputSize - sizeof(FG_MESSAGE_RESULT),
+                                            &result->Rules.RulesAmount,
+                                            &result->Rules.RulesSize);
+        if (NT_SUCCESS(resultStatus)) {
+            resultVariableSize = result->Rules.RulesSize;
+        } else if (STATUS_BUFFER_TOO_SMALL != resultStatus) {
+            LOG_ERROR("NTSTATUS: 0x%08x, get rule dictionary failed", resultStatus);
+        }
+
+        break;
+
+    case QueryMonitorChannel:
+
+        //
+        // The channel view is mapped into the client sending the query, this callback
+        // runs in its context.
+        //
+        if (NULL == ConnectionCookie) {
+            resultStatus = STATUS_NOT_FOUND;
+            break;
+        }
+
+        resultStatus = FgcMapMonitorSubscriberChannel(Globals.MonitorContext,
+                                                      (PFG_MONITOR_SUBSCRIBER)ConnectionCookie,
+                                                      &channelBuffer);
+        if (NT_SUCCESS(resultStatus)) {
+            result->MonitorChannelBuffer = (ULONGLONG)(ULONG_PTR)channelBuffer;
+        } else {
+            LOG_ERROR("NTSTATUS: 0x%08x, map monitor channel failed", resultStatus);
+        }
+
+        break;
+
+    default:
+
+        DBG_WARNING("Unknown monitor command type: '%d'", message->Type);
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    result->ResultCode = RtlNtStatusToDosError(resultStatus);
+    result->ResultSize = sizeof(FG_MESSAGE_RESULT) + resultVariableSize;
+    result->RulesGeneration = rulesGeneration;
+    *ReturnSize = sizeof(FG_MESSAGE_RESULT) + resultVariableSize;
+
+    return status;
 }
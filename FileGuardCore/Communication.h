@@ -87,12 +87,23 @@ FgcMonitorPortDisconnectCallback(
     _In_opt_ PVOID ConnectionCookie
     );
 
+NTSTATUS
+FgcMonitorMessageNotifyCallback(
+    _In_opt_ PVOID ConnectionCookie,
+    _In_reads_bytes_opt_(InputBytes) PVOID Input,
+    _In_ ULONG InputBytes,
+    _Out_writes_bytes_to_opt_(OutputBytes, *ReturnSize) PVOID Output,
+    _In_ ULONG OutputBytes,
+    _Out_ PULONG ReturnSize
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FgcControlPortConnectCallback)
 #pragma alloc_text(PAGE, FgcControlPortDisconnectCallback)
 #pragma alloc_text(PAGE, FgcControlMessageNotifyCallback)
 #pragma alloc_text(PAGE, FgcMonitorPortConnectCallback)
 #pragma alloc_text(PAGE, FgcMonitorPortDisconnectCallback)
+#pragma alloc_text(PAGE, FgcMonitorMessageNotifyCallback)
 #endif
 
 #endif
\ No newline at end of file
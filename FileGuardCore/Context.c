@@ -55,8 +55,16 @@ FgcCleanupFileContext(
 
     DBG_TRACE("Cleanup file context, address: '%p'", Context);
 
-    if (NULL != fileContext->FileNameInfo) {
-        FltReleaseFileNameInformation(InterlockedExchangePointer(&fileContext->FileNameInfo, NULL));
+    if (NULL != fileContext->FileName) {
+        FgcFreeUnicodeString(InterlockedExchangePointer(&fileContext->FileName, NULL));
+    }
+
+    //
+    // A file with events coalesced is referenced until they are recorded.
+    //
+    if (NULL != fileContext->Coalesced) {
+        FLT_ASSERT(!fileContext->Coalesced->Queued && NULL == fileContext->Coalesced->Rule);
+        FgcFreeBuffer(fileContext->Coalesced);
     }
 
     if (NULL != fileContext->Rule) {
@@ -64,6 +72,689 @@ FgcCleanupFileContext(
     }
 }
 
+_Check_return_
+NTSTATUS
+FgcSetFileContextName(
+    _In_ PFG_FILE_CONTEXT FileContext,
+    _In_ PCUNICODE_STRING FileName
+    )
+/*++
+
+Routine Description:
+
+    This routine keeps a copy of the file name in the file context if it has none.
+    The name is copied rather than the name information referenced, so the context
+    does not pin an entry of the filter manager name cache.
+
+Arguments:
+
+    FileContext - File context to keep the name in.
+    FileName    - Opened name of the file.
+
+Return Value:
+
+    STATUS_SUCCESS - Success, the file context has a name.
+    Other          - Failure, the name could not be allocated.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PVOID buffer = NULL;
+    PUNICODE_STRING fileName = NULL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NULL != FileContext);
+    FLT_ASSERT(NULL != FileName);
+
+    if (NULL != FileContext->FileName) return STATUS_SUCCESS;
+    if (0 == FileName->Length) return STATUS_INVALID_PARAMETER_2;
+
+    status = FgcAllocateBufferEx(&buffer,
+                                 POOL_FLAG_NON_PAGED,
+                                 FG_FILE_CONTEXT_NAME_SIZE(FileName->Length),
+                                 FG_UNICODE_STRING_NON_PAGED_TAG);
+    if (!NT_SUCCESS(status)) return status;
+
+    fileName = FgcInitializeFileContextName(buffer, FileName);
+
+    //
+    // Another open of the stream may have set the name meanwhile.
+    //
+    if (!FgcPublishFileContextName(&FileContext->FileName, fileName, &Globals.FileContextStatistics)) {
+        FgcFreeUnicodeString(fileName);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+PFG_COALESCED_EVENTS
+FgcGetFileContextCoalescedEvents(
+    _In_ PFG_FILE_CONTEXT FileContext
+    )
+/*++
+
+Routine Description:
+
+    This routine gets the coalesced events of a file, they are allocated by the
+    first event coalesced. Only the files of monitored rules coalesce events, the
+    other file contexts never carry them.
+
+Arguments:
+
+    FileContext - File context of the events.
+
+Return Value:
+
+    The coalesced events of the file, NULL if they could not be allocated.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFG_COALESCED_EVENTS coalesced = NULL, oldCoalesced = NULL;
+
+    FLT_ASSERT(NULL != FileContext);
+
+    coalesced = ReadPointerNoFence((PVOID volatile*)&FileContext->Coalesced);
+    if (NULL != coalesced) return coalesced;
+
+    status = FgcAllocateBufferEx(&coalesced,
+                                 POOL_FLAG_NON_PAGED,
+                                 sizeof(FG_COALESCED_EVENTS),
+                                 FG_COALESCED_EVENTS_NON_PAGED_TAG);
+    if (!NT_SUCCESS(status)) {
+        DBG_ERROR("NTSTATUS: '0x%08x', allocate coalesced events failed", status);
+        return NULL;
+    }
+
+    KeInitializeSpinLock(&coalesced->Lock);
+    coalesced->FileContext = FileContext;
+
+    //
+    // Another event of the file may have allocated them meanwhile.
+    //
+    oldCoalesced = InterlockedCompareExchangePointer((PVOID volatile*)&FileContext->Coalesced, coalesced, NULL);
+    if (NULL != oldCoalesced) {
+        FgcFreeBuffer(coalesced);
+        return oldCoalesced;
+    }
+
+    InterlockedIncrement64(&Globals.FileContextStatistics.CoalescedEvents);
+
+    return coalesced;
+}
+
+_Check_return_
+NTSTATUS
+FgcSetupFileContext(
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
+    _In_opt_ FGC_RULE *Rule,
+    _In_ LONG Generation,
+    _In_ BOOLEAN Replace,
+    _Outptr_ PFG_FILE_CONTEXT *FileContext
+    )
+/*++
+
+Routine Description:
+
+    This routine creates the file context of a stream with the verdict of a rule
+    match and sets it. The rule of a file context never changes, a new verdict is
+    set by replacing the context, so a callback holding a reference to the context
+    can use its rule without any lock.
+
+Arguments:
+
+    Instance    - The instance of the stream.
+    FileObject  - The file object of the stream.
+    Rule        - Optional, the rule matched, it is referenced by the context.
+    Generation  - The rules generation which the rule was matched in.
+    Replace     - TRUE to replace the context of the stream, FALSE to keep the
+                  context of the stream if it has one.
+    FileContext - A pointer to a variable that receives the context of the stream,
+                  it must be released by the caller.
+
+Return Value:
+
+    STATUS_SUCCESS - Success.
+    Other          - Failure.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFG_FILE_CONTEXT fileContext = NULL, oldFileContext = NULL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NULL != FileContext);
+
+    *FileContext = NULL;
+
+    status = FltAllocateContext(Globals.Filter, 
+                                FLT_FILE_CONTEXT, 
+                                sizeof(FG_FILE_CONTEXT), 
+                                NonPagedPool,
+                                &fileContext);
+    if (!NT_SUCCESS(status)) {
+        DBG_ERROR("NTSTATUS: '0x%08x', allocate file context failed", status);
+        return status;
+    }
+
+    RtlZeroMemory(fileContext, sizeof(FG_FILE_CONTEXT));
+    InterlockedIncrement64(&Globals.FileContextStatistics.Contexts);
+
+    if (NULL != Rule) {
+        FgcReferenceRule(Rule);
+        fileContext->Rule = Rule;
+        fileContext->Operations = (LONG)Rule->Operations;
+    }
+
+    fileContext->Generation = Generation;
+
+    status = FltSetFileContext(Instance,
+                               FileObject,
+                               Replace ? FLT_SET_CONTEXT_REPLACE_IF_EXISTS : FLT_SET_CONTEXT_KEEP_IF_EXISTS,
+                               fileContext,
+                               Replace ? NULL : &oldFileContext);
+    if (STATUS_FLT_CONTEXT_ALREADY_DEFINED == status) {
+        FltReleaseContext(fileContext);
+        *FileContext = oldFileContext;
+        return STATUS_SUCCESS;
+    }
+
+    if (!NT_SUCCESS(status)) {
+        DBG_ERROR("NTSTATUS: '0x%08x', set file context failed", status);
+        FltReleaseContext(fileContext);
+        return status;
+    }
+
+    DBG_TRACE("File context '%p' setup, rule: %p", fileContext, Rule);
+
+    *FileContext = fileContext;
+
+    return STATUS_SUCCESS;
+}
+
+/*-------------------------------------------------------------
+    Stream handle context structure and routines.
+-------------------------------------------------------------*/
+
+VOID
+FgcCleanupHandleContext(
+    _In_ PFLT_CONTEXT Context,
+    _In_ FLT_CONTEXT_TYPE ContextType
+    )
+{
+    PFG_HANDLE_CONTEXT handleContext = (PFG_HANDLE_CONTEXT)Context;
+
+    UNREFERENCED_PARAMETER(ContextType);
+
+    PAGED_CODE();
+
+    DBG_TRACE("Cleanup handle context, address: '%p'", Context);
+
+    if (NULL != handleContext->Rule) {
+        FgcReleaseRule(handleContext->Rule);
+    }
+}
+
+/*-------------------------------------------------------------
+    Instance context structure and routines.
+-------------------------------------------------------------*/
+
+static
+LONG
+FgcCountVolumeRules(
+    _In_ PCUNICODE_STRING VolumeName
+    )
+{
+    LIST_ENTRY *entry = NULL, *next = NULL;
+    FGC_RULE_ENTRY *ruleEntry = NULL;
+    LONG rulesAmount = 0l;
+
+    LIST_FOR_EACH_SAFE(entry, next, &Globals.RulesList) {
+        ruleEntry = CONTAINING_RECORD(entry, FGC_RULE_ENTRY, List);
+        if (FgcIsRuleAppliedToVolume(ruleEntry->Rule, VolumeName)) rulesAmount++;
+    }
+
+    return rulesAmount;
+}
+
+static
+VOID
+FgcRebuildInstanceRules(
+    _Inout_ PFG_INSTANCE_CONTEXT InstanceContext,
+    _In_ LONG Generation
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFGC_RULE_SUBSET rules = NULL, oldRules = NULL;
+    LONG rulesAmount = 0l;
+
+    //
+    // The caller holds the rules list lock.
+    //
+    status = FgcCreateVolumeRuleSubset(&Globals.RulesList,
+                                       Generation,
+                                       InstanceContext->VolumeName,
+                                       &rules);
+    if (NT_SUCCESS(status)) {
+        rulesAmount = (LONG)rules->RulesAmount;
+    } else {
+        LOG_WARNING("NTSTATUS: 0x%08x, build rules partition of volume '%wZ' failed", status, InstanceContext->VolumeName);
+        rulesAmount = FgcCountVolumeRules(InstanceContext->VolumeName);
+    }
+
+    FltAcquirePushLockExclusive(InstanceContext->RulesLock);
+    oldRules = InstanceContext->Rules;
+    InstanceContext->Rules = rules;
+    InterlockedExchange(&InstanceContext->RulesAmount, rulesAmount);
+    InterlockedExchange(&InstanceContext->FileIdRulesAmount, 
+                        FgcCountVolumeFileIdRules(&Globals.FileIdRules, InstanceContext->VolumeSerialNumber));
+    FltReleasePushLock(InstanceContext->RulesLock);
+
+    if (NULL != oldRules) {
+        FgcReleaseRuleSubset(oldRules);
+    }
+}
+
+VOID
+FgcCleanupInstanceContext(
+    _In_ PFLT_CONTEXT Context,
+    _In_ FLT_CONTEXT_TYPE ContextType
+    )
+{
+    PFG_INSTANCE_CONTEXT instanceContext = (PFG_INSTANCE_CONTEXT)Context;
+    ULONG idx = 0ul;
+
+    UNREFERENCED_PARAMETER(ContextType);
+
+    PAGED_CODE();
+
+    DBG_TRACE("Cleanup instance context, address: '%p'", Context);
+
+    if (NULL != instanceContext->List.Flink) {
+        FltAcquirePushLockExclusive(Globals.InstanceContextsListLock);
+        RemoveEntryList(&instanceContext->List);
+        FltReleasePushLock(Globals.InstanceContextsListLock);
+    }
+
+    if (NULL != instanceContext->Rules) {
+        FgcReleaseRuleSubset(instanceContext->Rules);
+    }
+
+    if (NULL != instanceContext->RulesLock) {
+        FgcFreePushLock(instanceContext->RulesLock);
+    }
+
+    for (; idx < FG_UNRULED_DIRECTORIES_AMOUNT; idx++) {
+        if (NULL != instanceContext->UnruledDirectories[idx].DirectoryName) {
+            FgcFreeUnicodeString(instanceContext->UnruledDirectories[idx].DirectoryName);
+        }
+    }
+
+    if (NULL != instanceContext->UnruledDirectoriesLock) {
+        FgcFreePushLock(instanceContext->UnruledDirectoriesLock);
+    }
+
+    if (NULL != instanceContext->VolumeName) {
+        FgcFreeUnicodeString(instanceContext->VolumeName);
+    }
+}
+
+_Check_return_
+NTSTATUS
+FgcSetupInstanceContext(
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PCUNICODE_STRING VolumeName,
+    _In_opt_ CONST ULONGLONG *VolumeSerialNumber
+    )
+/*++
+
+Routine Description:
+
+    This routine creates the context of a new instance, builds the partition of
+    the rules which could apply to its volume and links it to the instance
+    contexts list.
+
+Arguments:
+
+    Instance           - The new instance.
+    VolumeName         - Device name of the instance volume.
+    VolumeSerialNumber - The 64-bit serial number of the volume, NULL if it could
+                         not be queried. The 32-bit serial number reported by
+                         FileFsVolumeInformation is used instead.
+
+Return Value:
+
+    STATUS_SUCCESS - Success.
+    Other          - Failure.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFG_INSTANCE_CONTEXT instanceContext = NULL;
+    IO_STATUS_BLOCK ioStatus = { 0 };
+    struct {
+        FILE_FS_VOLUME_INFORMATION Information;
+        WCHAR VolumeLabel[MAXIMUM_VOLUME_LABEL_LENGTH / sizeof(WCHAR)];
+    } volumeInformation = { 0 };
+
+    PAGED_CODE();
+
+    if (NULL == VolumeSerialNumber) {
+        status = FltQueryVolumeInformation(Instance,
+                                           &ioStatus,
+                                           &volumeInformation,
+                                           sizeof(volumeInformation),
+                                           FileFsVolumeInformation);
+        if (!NT_SUCCESS(status) && STATUS_BUFFER_OVERFLOW != status) {
+            LOG_ERROR("NTSTATUS: 0x%08x, query volume information failed", status);
+            goto Cleanup;
+        }
+    }
+
+    status = FltAllocateContext(Globals.Filter,
+                                FLT_INSTANCE_CONTEXT,
+                                sizeof(FG_INSTANCE_CONTEXT),
+                                PagedPool,
+                                &instanceContext);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate instance context failed", status);
+        goto Cleanup;
+    }
+
+    RtlZeroMemory(instanceContext, sizeof(FG_INSTANCE_CONTEXT));
+
+    instanceContext->VolumeSerialNumber = NULL != VolumeSerialNumber ? 
+                                          *VolumeSerialNumber : 
+                                          volumeInformation.Information.VolumeSerialNumber;
+
+    status = FgcAllocateUnicodeString(VolumeName->Length, &instanceContext->VolumeName);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate volume name string failed", status);
+        goto Cleanup;
+    }
+
+    status = RtlUpcaseUnicodeString(instanceContext->VolumeName, VolumeName, FALSE);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, upcase volume name string failed", status);
+        goto Cleanup;
+    }
+
+    status = FgcCreatePushLock(&instanceContext->RulesLock);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, create instance rules lock failed", status);
+        goto Cleanup;
+    }
+
+    status = FgcCreatePushLock(&instanceContext->UnruledDirectoriesLock);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, create instance unruled directories lock failed", status);
+        goto Cleanup;
+    }
+
+    //
+    // The rules list lock is held until the context is linked, so no rules
+    // change can be missed by the partition.
+    //
+    FltAcquirePushLockShared(Globals.RulesListLock);
+
+    FgcRebuildInstanceRules(instanceContext, ReadNoFence(&Globals.RulesGeneration));
+
+    FltAcquirePushLockExclusive(Globals.InstanceContextsListLock);
+    InsertTailList(&Globals.InstanceContextsList, &instanceContext->List);
+    FltReleasePushLock(Globals.InstanceContextsListLock);
+
+    FltReleasePushLock(Globals.RulesListLock);
+
+    status = FltSetInstanceContext(Instance, FLT_SET_CONTEXT_KEEP_IF_EXISTS, instanceContext, NULL);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, set instance context failed", status);
+        goto Cleanup;
+    }
+
+    LOG_INFO("Instance context of volume '%wZ' (serial: 0x%016llx) set, %ld rule(s) applied", 
+             VolumeName, 
+             instanceContext->VolumeSerialNumber,
+             instanceContext->RulesAmount);
+
+Cleanup:
+
+    if (NULL != instanceContext) {
+        FltReleaseContext(instanceContext);
+    }
+
+    return status;
+}
+
+VOID
+FgcRebuildInstanceContexts(
+    _In_ LONG Generation
+    )
+/*++
+
+Routine Description:
+
+    This routine rebuilds the rules partition of the volume of each instance. The
+    caller holds the rules list lock exclusively and publishes the new rules
+    generation only once this returns, so a create which sees the new generation
+    never sees the rules amount of the former partition.
+
+Arguments:
+
+    Generation - The rules generation the changed rules list is published with.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    LIST_ENTRY *entry = NULL, *next = NULL;
+    PFG_INSTANCE_CONTEXT instanceContext = NULL;
+
+    PAGED_CODE();
+
+    FltAcquirePushLockShared(Globals.InstanceContextsListLock);
+
+    LIST_FOR_EACH_SAFE(entry, next, &Globals.InstanceContextsList) {
+        instanceContext = CONTAINING_RECORD(entry, FG_INSTANCE_CONTEXT, List);
+        FgcRebuildInstanceRules(instanceContext, Generation);
+    }
+
+    FltReleasePushLock(Globals.InstanceContextsListLock);
+}
+
+VOID
+FgcUpdateInstanceFileIdRules(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine recounts the file id rules of the volume of each instance. It is
+    called after the file id rules changed and before the new rules generation is
+    published. The count is taken under the instance rules lock, so concurrent
+    recounts are applied in order and the last one sees the last change.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    LIST_ENTRY *entry = NULL, *next = NULL;
+    PFG_INSTANCE_CONTEXT instanceContext = NULL;
+
+    PAGED_CODE();
+
+    FltAcquirePushLockShared(Globals.InstanceContextsListLock);
+
+    LIST_FOR_EACH_SAFE(entry, next, &Globals.InstanceContextsList) {
+        instanceContext = CONTAINING_RECORD(entry, FG_INSTANCE_CONTEXT, List);
+
+        FltAcquirePushLockExclusive(instanceContext->RulesLock);
+        InterlockedExchange(&instanceContext->FileIdRulesAmount,
+                            FgcCountVolumeFileIdRules(&Globals.FileIdRules, instanceContext->VolumeSerialNumber));
+        FltReleasePushLock(instanceContext->RulesLock);
+    }
+
+    FltReleasePushLock(Globals.InstanceContextsListLock);
+}
+
+PFGC_RULE_SUBSET
+FgcGetInstanceRules(
+    _In_ PFG_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    This routine gets the rules partition of an instance volume.
+
+Arguments:
+
+    InstanceContext - The instance context.
+
+Return Value:
+
+    The referenced rules partition, the caller releases it by FgcReleaseRuleSubset.
+    NULL if the partition is not built.
+
+--*/
+{
+    PFGC_RULE_SUBSET rules = NULL;
+
+    PAGED_CODE();
+
+    FltAcquirePushLockShared(InstanceContext->RulesLock);
+    rules = InstanceContext->Rules;
+    if (NULL != rules) {
+        FgcReferenceRuleSubset(rules);
+    }
+    FltReleasePushLock(InstanceContext->RulesLock);
+
+    return rules;
+}
+
+BOOLEAN
+FgcIsDirectoryRuled(
+    _In_ PFG_INSTANCE_CONTEXT InstanceContext,
+    _In_opt_ PFGC_RULE_SUBSET VolumeRules,
+    _In_ PCUNICODE_STRING DirectoryPath
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether any rule could match a file under a directory of
+    an instance volume. A negative verdict is cached in the instance context until
+    the rules partition of the volume is rebuilt, so renames into the same directory
+    are answered by a single lookup.
+
+Arguments:
+
+    InstanceContext - The instance context of the directory volume.
+    VolumeRules     - The rules partition of the volume, NULL if it is not built.
+    DirectoryPath   - The directory path on the volume ending with a separator,
+                      in any case.
+
+Return Value:
+
+    TRUE if any rule could match files under the directory, otherwise FALSE.
+    Without a rules partition or a volume name the directory is always treated
+    as ruled.
+
+--*/
+{
+    PFG_UNRULED_DIRECTORY_ENTRY entry = NULL;
+    PUNICODE_STRING directoryName = NULL, oldDirectoryName = NULL;
+    ULONG hash = 0ul;
+    BOOLEAN cached = FALSE;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NULL != InstanceContext);
+    FLT_ASSERT(NULL != DirectoryPath);
+
+    if (NULL == VolumeRules || NULL == InstanceContext->VolumeName) return TRUE;
+
+    if (!NT_SUCCESS(RtlHashUnicodeString(DirectoryPath, TRUE, HASH_STRING_ALGORITHM_DEFAULT, &hash))) {
+        return FgcIsRuleSubsetAppliedToDirectory(VolumeRules, InstanceContext->VolumeName, DirectoryPath);
+    }
+
+    entry = FgcGetUnruledDirectoryEntry(InstanceContext->UnruledDirectories, hash);
+
+    FltAcquirePushLockShared(InstanceContext->UnruledDirectoriesLock);
+    cached = FgcIsUnruledDirectoryCached(entry, VolumeRules->Generation, DirectoryPath);
+    FltReleasePushLock(InstanceContext->UnruledDirectoriesLock);
+
+    if (cached) return FALSE;
+
+    if (FgcIsRuleSubsetAppliedToDirectory(VolumeRules, InstanceContext->VolumeName, DirectoryPath)) return TRUE;
+
+    //
+    // The verdict replaces whatever the entry held, failing to allocate it only
+    // costs a later lookup.
+    //
+    if (NT_SUCCESS(FgcAllocateUnicodeString(DirectoryPath->Length, &directoryName))) {
+        RtlCopyUnicodeString(directoryName, DirectoryPath);
+
+        FltAcquirePushLockExclusive(InstanceContext->UnruledDirectoriesLock);
+        oldDirectoryName = FgcCacheUnruledDirectory(entry, directoryName, VolumeRules->Generation);
+        FltReleasePushLock(InstanceContext->UnruledDirectoriesLock);
+
+        if (NULL != oldDirectoryName) {
+            FgcFreeUnicodeString(oldDirectoryName);
+        }
+    }
+
+    return FALSE;
+}
+
+LONG
+FgcGetVolumeRulesAmount(
+    _In_ PCUNICODE_STRING VolumeName,
+    _In_opt_ CONST ULONGLONG *VolumeSerialNumber
+    )
+/*++
+
+Routine Description:
+
+    This routine counts the rules which could apply to a volume that may have no
+    instance yet. Only the file id rules of the volume are counted, every file id
+    rule is counted for a volume whose serial number is unknown.
+
+Arguments:
+
+    VolumeName         - Upcased device name of the volume.
+    VolumeSerialNumber - The 64-bit serial number of the volume, NULL if unknown.
+
+Return Value:
+
+    Amount of the rules which could apply to the volume.
+
+--*/
+{
+    LONG rulesAmount = 0l;
+
+    PAGED_CODE();
+
+    FltAcquirePushLockShared(Globals.RulesListLock);
+    rulesAmount = FgcCountVolumeRules(VolumeName);
+    FltReleasePushLock(Globals.RulesListLock);
+
+    if (NULL == VolumeSerialNumber) return rulesAmount + ReadNoFence(&Globals.FileIdRules.RulesAmount);
+
+    return rulesAmount + FgcCountVolumeFileIdRules(&Globals.FileIdRules, *VolumeSerialNumber);
+}
+
 /*-------------------------------------------------------------
     Callback context structure and routines
 -------------------------------------------------------------*/
@@ -78,11 +769,15 @@ FgcAllocateCompletionContext(
     NTSTATUS status = STATUS_SUCCESS;
     PFG_COMPLETION_CONTEXT completionContext = NULL;
 
-    status = FgcAllocateBufferEx(&completionContext, 
-                                POOL_FLAG_PAGED, 
-                                sizeof(FG_COMPLETION_CONTEXT), 
-                                FG_COMPLETION_CONTEXT_PAGED_TAG);
-    if (NT_SUCCESS(status)) {
+    //
+    // Every matched create allocates a completion context, it comes from a lookaside
+    // list rather than the pool.
+    //
+    completionContext = ExAllocateFromLookasideListEx(&Globals.CompletionContextsLookaside);
+    if (NULL == completionContext) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    } else {
+        RtlZeroMemory(completionContext, sizeof(FG_COMPLETION_CONTEXT));
         completionContext->MajorFunction = MajorFunction;
         *CompletionContext = completionContext;
     }
@@ -41,30 +41,231 @@ Environment:
 #ifndef __CONTEXT_H__
 #define __CONTEXT_H__
 
+#include "FileContextName.h"
+#include "CoalescedEvents.h"
+#include "HandleSummary.h"
+#include "UnruledDirectories.h"
+
 /*-------------------------------------------------------------
     File context structure and routines.
 -------------------------------------------------------------*/
 
+typedef struct _FG_COALESCED_EVENTS FG_COALESCED_EVENTS, *PFG_COALESCED_EVENTS;
+
 typedef struct _FG_FILE_CONTEXT {
 
     //
-    // File name inforamtion.
+    // Opened name of the file, a single allocation kept for the records of a file
+    // with a rule. NULL if no rule matched the file by its name.
     //
-    volatile PFLT_FILE_NAME_INFORMATION FileNameInfo;
+    volatile PUNICODE_STRING FileName;
 
     //
-    // The policy of the rule.
+    // The policy of the rule, NULL if no rule matched the file. It is set when the
+    // context is created and never changes, a new verdict replaces the context.
     //
     FGC_RULE* Rule;
 
+    //
+    // The operation classes the rule is enforced on, zero if no rule matched the
+    // file. Callbacks test it before looking at the rule.
+    //
+    __volatile LONG Operations;
+
+    //
+    // The rules generation which the rule was matched in, the cached verdict
+    // is reused by later opens of the file until the rules change.
+    //
+    __volatile LONG Generation;
+
+    //
+    // Monitor events of the file coalesced in the current window, NULL until the
+    // first event of a monitored rule is coalesced.
+    //
+    PFG_COALESCED_EVENTS volatile Coalesced;
+
 } FG_FILE_CONTEXT, *PFG_FILE_CONTEXT;
 
+//
+// Monitor events of a file coalesced by FgcCoalesceRuleMatched, allocated apart
+// from the file context, which references it until the context is freed.
+//
+typedef struct _FG_COALESCED_EVENTS {
+
+    KSPIN_LOCK Lock;
+
+    FGC_COALESCED_WINDOW Window;
+
+    //
+    // The rule of the events counted in the window, referenced while there is any.
+    //
+    FGC_RULE *Rule;
+
+    //
+    // The file context of the events. It is linked in the coalesced list of the
+    // monitor context while `Queued`, the file context is referenced meanwhile.
+    //
+    PFG_FILE_CONTEXT FileContext;
+    LIST_ENTRY List;
+    BOOLEAN Queued;
+
+} FG_COALESCED_EVENTS, *PFG_COALESCED_EVENTS;
+
+//
+// The file name is not queried for a file matched by a file id rule, the path kept
+// in the rule is used instead.
+//
+#define FgcGetFileContextName(_context_) (NULL != (_context_)->FileName ? \
+                                          (_context_)->FileName : (_context_)->Rule->PathExpression)
+
+#define FgcIsFileContextOperationApplied(_context_, _operation_) \
+    FlagOn((ULONG)ReadNoFence(&(_context_)->Operations), (_operation_))
+
 VOID
 FgcCleanupFileContext(
     _In_ PFLT_CONTEXT Context,
     _In_ FLT_CONTEXT_TYPE ContextType
     );
 
+_Check_return_
+NTSTATUS
+FgcSetFileContextName(
+    _In_ PFG_FILE_CONTEXT FileContext,
+    _In_ PCUNICODE_STRING FileName
+    );
+
+PFG_COALESCED_EVENTS
+FgcGetFileContextCoalescedEvents(
+    _In_ PFG_FILE_CONTEXT FileContext
+    );
+
+_Check_return_
+NTSTATUS
+FgcSetupFileContext(
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
+    _In_opt_ FGC_RULE *Rule,
+    _In_ LONG Generation,
+    _In_ BOOLEAN Replace,
+    _Outptr_ PFG_FILE_CONTEXT *FileContext
+    );
+
+/*-------------------------------------------------------------
+    Stream handle context structure and routines.
+-------------------------------------------------------------*/
+
+//
+// Set on the handles of the files with a monitored rule if handle summaries are
+// enabled, the requests of the handle are counted instead of being recorded one
+// by one, and recorded as a summary when the handle is cleaned up.
+//
+typedef struct _FG_HANDLE_CONTEXT {
+
+    //
+    // The rule of the file when the handle was opened.
+    //
+    FGC_RULE *Rule;
+
+    //
+    // Requests of the handle, updated with interlocked operations.
+    //
+    FG_MONITOR_HANDLE_SUMMARY Summary;
+
+} FG_HANDLE_CONTEXT, *PFG_HANDLE_CONTEXT;
+
+VOID
+FgcCleanupHandleContext(
+    _In_ PFLT_CONTEXT Context,
+    _In_ FLT_CONTEXT_TYPE ContextType
+    );
+
+/*-------------------------------------------------------------
+    Instance context structure and routines.
+-------------------------------------------------------------*/
+
+typedef struct _FG_INSTANCE_CONTEXT {
+
+    //
+    // This field is used to link to the global instance contexts list.
+    //
+    LIST_ENTRY List;
+
+    //
+    // Upcased device name of the volume.
+    //
+    PUNICODE_STRING VolumeName;
+
+    //
+    // Amount of rules which could match files on the volume, creates on
+    // the volume are skipped before any name query while it is zero.
+    //
+    __volatile LONG RulesAmount;
+
+    //
+    // Partition of the rules which could match files on the volume, NULL if
+    // it could not be built and the whole rule list has to be matched.
+    //
+    PFGC_RULE_SUBSET Rules;
+    PEX_PUSH_LOCK RulesLock;
+
+    //
+    // Serial number of the volume as FileIdInformation reports it and amount of
+    // the file id rules of the volume, file ids are only queried while there is any.
+    //
+    ULONGLONG VolumeSerialNumber;
+    __volatile LONG FileIdRulesAmount;
+
+    //
+    // Directories recently found to have no rule under them, indexed by the hash
+    // of the path. Renames into them are allowed without matching the rules.
+    //
+    FG_UNRULED_DIRECTORY_ENTRY UnruledDirectories[FG_UNRULED_DIRECTORIES_AMOUNT];
+    PEX_PUSH_LOCK UnruledDirectoriesLock;
+
+} FG_INSTANCE_CONTEXT, *PFG_INSTANCE_CONTEXT;
+
+VOID
+FgcCleanupInstanceContext(
+    _In_ PFLT_CONTEXT Context,
+    _In_ FLT_CONTEXT_TYPE ContextType
+    );
+
+_Check_return_
+NTSTATUS
+FgcSetupInstanceContext(
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PCUNICODE_STRING VolumeName,
+    _In_opt_ CONST ULONGLONG *VolumeSerialNumber
+    );
+
+VOID
+FgcRebuildInstanceContexts(
+    _In_ LONG Generation
+    );
+
+VOID
+FgcUpdateInstanceFileIdRules(
+    VOID
+    );
+
+PFGC_RULE_SUBSET
+FgcGetInstanceRules(
+    _In_ PFG_INSTANCE_CONTEXT InstanceContext
+    );
+
+LONG
+FgcGetVolumeRulesAmount(
+    _In_ PCUNICODE_STRING VolumeName,
+    _In_opt_ CONST ULONGLONG *VolumeSerialNumber
+    );
+
+BOOLEAN
+FgcIsDirectoryRuled(
+    _In_ PFG_INSTANCE_CONTEXT InstanceContext,
+    _In_opt_ PFGC_RULE_SUBSET VolumeRules,
+    _In_ PCUNICODE_STRING DirectoryPath
+    );
+
 /*-------------------------------------------------------------
     Callback context structure and routines
 -------------------------------------------------------------*/
@@ -81,6 +282,15 @@ typedef struct _FG_COMPLETION_CONTEXT {
         struct {
             PFLT_FILE_NAME_INFORMATION FileNameInfo;
             FGC_RULE *MatchedRule;
+            LONG Generation;
+
+            //
+            // The open is matched in the post-operation, FileNameInfo and
+            // MatchedRule are NULL. The verdict cached in the file context
+            // only applies to it if it is cacheable.
+            //
+            BOOLEAN Deferred;
+            BOOLEAN Cacheable;
         } Create;
 
         struct {
@@ -98,8 +308,21 @@ FgcAllocateCompletionContext(
     _Inout_ PFG_COMPLETION_CONTEXT* CompletionContext
     );
 
-#define FgFreeCompletionContext(_context_) FgcFreeBuffer((_context_));
+#define FgFreeCompletionContext(_context_) ExFreeToLookasideListEx(&Globals.CompletionContextsLookaside, (_context_));
 
 #pragma warning(pop)
 
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, FgcSetFileContextName)
+#pragma alloc_text(PAGE, FgcSetupFileContext)
+#pragma alloc_text(PAGE, FgcCleanupHandleContext)
+#pragma alloc_text(PAGE, FgcCleanupInstanceContext)
+#pragma alloc_text(PAGE, FgcSetupInstanceContext)
+#pragma alloc_text(PAGE, FgcRebuildInstanceContexts)
+#pragma alloc_text(PAGE, FgcUpdateInstanceFileIdRules)
+#pragma alloc_text(PAGE, FgcGetInstanceRules)
+#pragma alloc_text(PAGE, FgcGetVolumeRulesAmount)
+#pragma alloc_text(PAGE, FgcIsDirectoryRuled)
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,141 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    CreateDecision.h
+
+Abstract:
+
+    Decisions of the create callbacks which only depend on the state cached by
+    the filter and on the parameters of the open. They touch no kernel object, so
+    they are also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __CREATE_DECISION_H__
+#define __CREATE_DECISION_H__
+
+//
+// How a deferred open is matched after the file system opened it.
+//
+typedef enum _FGC_DEFERRED_CREATE_MATCH {
+    DeferredCreateMatchCached = 0,  // The verdict cached in the file context is enforced.
+    DeferredCreateMatchName,        // The opened name is queried and matched, then the file id.
+    DeferredCreateMatchParent,      // The name is only matched if a rule applies under the parent.
+    DeferredCreateMatchFileId       // Only the file id rules could match the open.
+} FGC_DEFERRED_CREATE_MATCH;
+
+FORCEINLINE
+FGC_DEFERRED_CREATE_MATCH
+FgcGetDeferredCreateMatch(
+    _In_ BOOLEAN Cacheable,
+    _In_ LONG CachedGeneration,
+    _In_ BOOLEAN CachedRuled,
+    _In_ LONG RulesGeneration,
+    _In_ LONG PathRulesAmount
+    )
+/*++
+
+Routine Description:
+
+    This routine decides how a deferred open is matched. The verdict cached in the
+    file context of the stream is always checked first, the name is only queried
+    once the rules changed since it was cached. A context holding a rule is never
+    replaced by a verdict made without the name, the rule may have been matched by
+    the name of another link of the file.
+
+Arguments:
+
+    Cacheable        - TRUE if the stream has a file context whose verdict applies
+                       to the open.
+    CachedGeneration - The rules generation the cached verdict was made from.
+    CachedRuled      - TRUE if the file context holds a rule.
+    RulesGeneration  - The current rules generation.
+    PathRulesAmount  - Amount of path rules which could match files on the volume.
+
+Return Value:
+
+    How the open is matched.
+
+--*/
+{
+    if (Cacheable && CachedGeneration == RulesGeneration) return DeferredCreateMatchCached;
+    if (0 == PathRulesAmount) return DeferredCreateMatchFileId;
+    if (Cacheable && CachedRuled) return DeferredCreateMatchName;
+
+    return DeferredCreateMatchParent;
+}
+
+FORCEINLINE
+BOOLEAN
+FgcIsCreateRolledBack(
+    _In_ ULONG Disposition,
+    _In_ ULONG_PTR Information,
+    _In_ FG_RULE_CODE Code,
+    _In_ ULONG Operations
+    )
+/*++
+
+Routine Description:
+
+    This routine decides whether the file created by an open is deleted again in
+    post-create. A readonly file must not be created, but whether an open-if
+    creates the file is only known once the file system reports it, the open is
+    not denied before it for the file may exist.
+
+Arguments:
+
+    Disposition - The create disposition of the open.
+    Information - The information the file system completed the open with.
+    Code        - The code of the rule matched by the open.
+    Operations  - The compiled operation classes of the rule.
+
+Return Value:
+
+    TRUE if the created file is deleted and the open fails, otherwise FALSE.
+
+--*/
+{
+    if (RuleMajorReadonly != Code.Major || 0 == (Operations & FG_RULE_OPERATION_CREATE)) return FALSE;
+    if (FILE_CREATED != Information) return FALSE;
+
+    switch (Disposition) {
+    case FILE_SUPERSEDE:
+    case FILE_CREATE:
+    case FILE_OPEN_IF:
+    case FILE_OVERWRITE_IF:
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+#endif
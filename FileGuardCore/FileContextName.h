@@ -0,0 +1,165 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    FileContextName.h
+
+Abstract:
+
+    Names kept by the file contexts and the memory they take. A name is stored once
+    per stream, as a single allocation of its string header and buffer. The routines
+    only lay out, publish and count names, so they are also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __FILE_CONTEXT_NAME_H__
+#define __FILE_CONTEXT_NAME_H__
+
+//
+// Memory taken by the file contexts since the driver loaded, logged on unload.
+//
+typedef struct _FGC_FILE_CONTEXT_STATISTICS {
+    __volatile LONG64 Contexts;  // File contexts created.
+    __volatile LONG64 Names;     // Names kept by the file contexts.
+    __volatile LONG64 NameBytes; // Bytes of the names kept, with their string header.
+    __volatile LONG64 CoalescedEvents; // Coalesced events allocated for monitored files.
+} FGC_FILE_CONTEXT_STATISTICS, *PFGC_FILE_CONTEXT_STATISTICS;
+
+//
+// Size of the allocation of a name of `_length_` bytes.
+//
+#define FG_FILE_CONTEXT_NAME_SIZE(_length_) (sizeof(UNICODE_STRING) + (SIZE_T)(_length_))
+
+FORCEINLINE
+PUNICODE_STRING
+FgcInitializeFileContextName(
+    _Out_writes_bytes_(FG_FILE_CONTEXT_NAME_SIZE(Name->Length)) PVOID Buffer,
+    _In_ PCUNICODE_STRING Name
+    )
+/*++
+
+Routine Description:
+
+    This routine lays out a copy of a name in an allocation of the size given by
+    FG_FILE_CONTEXT_NAME_SIZE, the string header followed by its buffer.
+
+Arguments:
+
+    Buffer - The allocation of the name.
+    Name   - The name to be copied.
+
+Return Value:
+
+    The copy of the name, it is freed with the allocation.
+
+--*/
+{
+    PUNICODE_STRING name = (PUNICODE_STRING)Buffer;
+
+    name->Length = Name->Length;
+    name->MaximumLength = Name->Length;
+    name->Buffer = (PWCHAR)((PUCHAR)Buffer + sizeof(UNICODE_STRING));
+    RtlCopyMemory(name->Buffer, Name->Buffer, Name->Length);
+
+    return name;
+}
+
+FORCEINLINE
+BOOLEAN
+FgcPublishFileContextName(
+    _Inout_ PUNICODE_STRING volatile *Slot,
+    _In_ PUNICODE_STRING Name,
+    _Inout_ PFGC_FILE_CONTEXT_STATISTICS Statistics
+    )
+/*++
+
+Routine Description:
+
+    This routine sets the name of a file context if it has none and counts it. The
+    opens of a stream race to set its name, the first one wins.
+
+Arguments:
+
+    Slot       - The name field of the file context.
+    Name       - The name laid out by FgcInitializeFileContextName.
+    Statistics - The statistics the name is counted in.
+
+Return Value:
+
+    TRUE if the name is set, FALSE if the context has a name, then the caller frees
+    the one given.
+
+--*/
+{
+    if (NULL != InterlockedCompareExchangePointer((PVOID volatile*)Slot, Name, NULL)) return FALSE;
+
+    InterlockedIncrement64(&Statistics->Names);
+    InterlockedAdd64(&Statistics->NameBytes, (LONG64)FG_FILE_CONTEXT_NAME_SIZE(Name->MaximumLength));
+
+    return TRUE;
+}
+
+FORCEINLINE
+LONG64
+FgcGetAverageFileContextSize(
+    _In_ CONST FGC_FILE_CONTEXT_STATISTICS *Statistics,
+    _In_ SIZE_T ContextSize,
+    _In_ SIZE_T CoalescedEventsSize
+    )
+/*++
+
+Routine Description:
+
+    This routine computes the average memory taken by a file context, its name and
+    coalesced events included.
+
+Arguments:
+
+    Statistics          - The statistics of the file contexts.
+    ContextSize         - Size of a file context.
+    CoalescedEventsSize - Size of the coalesced events of a file.
+
+Return Value:
+
+    The average size in bytes, zero if no file context was created.
+
+--*/
+{
+    LONG64 contexts = ReadNoFence64(&Statistics->Contexts);
+
+    if (0ll == contexts) return 0ll;
+
+    return (contexts * (LONG64)ContextSize +
+            ReadNoFence64(&Statistics->NameBytes) +
+            ReadNoFence64(&Statistics->CoalescedEvents) * (LONG64)CoalescedEventsSize) / contexts;
+}
+
+#endif
@@ -50,11 +50,22 @@ CONST FLT_OPERATION_REGISTRATION FgcOperationCallbacks[] = {
       FgcPreCreateCallback,
       FgcPostCreateCallback },
 
+    //
+    // A paging write is issued by the thread flushing the pages rather than the writer,
+    // it can not be matched against the process of a rule. The writes through a handle
+    // are checked before they are cached, the writes through a mapped view are checked
+    // when the writable section of the file is created.
+    //
     { IRP_MJ_WRITE,
-      0,
+      FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO,
       FgcPreWriteCallback,
       NULL },
 
+    { IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION,
+      0,
+      FgcPreAcquireForSectionSynchronizationCallback,
+      NULL },
+
     { IRP_MJ_SET_INFORMATION,
       0,
       FgcPreSetInformationCallback,
@@ -65,9 +76,19 @@ CONST FLT_OPERATION_REGISTRATION FgcOperationCallbacks[] = {
       FgcPreFileSystemControlCallback,
       NULL },
 
+    { IRP_MJ_CLEANUP,
+      0,
+      FgcPreCleanupCallback,
+      NULL },
+
     { IRP_MJ_OPERATION_END }
 };
 
+//
+// Callbacks of the operation classes selected by the configuration.
+//
+FLT_OPERATION_REGISTRATION FgcFilteredOperationCallbacks[ARRAYSIZE(FgcOperationCallbacks)];
+
 const FLT_CONTEXT_REGISTRATION FgContextRegistration[] = {
 
     { FLT_FILE_CONTEXT,
@@ -76,6 +97,18 @@ const FLT_CONTEXT_REGISTRATION FgContextRegistration[] = {
       sizeof(FG_FILE_CONTEXT),
       FG_FILE_CONTEXT_PAGED_TAG },
 
+    { FLT_INSTANCE_CONTEXT,
+      0,
+      FgcCleanupInstanceContext,
+      sizeof(FG_INSTANCE_CONTEXT),
+      FG_INSTANCE_CONTEXT_PAGED_TAG },
+
+    { FLT_STREAMHANDLE_CONTEXT,
+      0,
+      FgcCleanupHandleContext,
+      sizeof(FG_HANDLE_CONTEXT),
+      FG_HANDLE_CONTEXT_PAGED_TAG },
+
     { FLT_CONTEXT_END }
 };
 
@@ -90,7 +123,7 @@ CONST FLT_REGISTRATION FilterRegistration = {
     0,                              // Flags
 
     FgContextRegistration,      // Context
-    FgcOperationCallbacks,       // Operation callbacks
+    FgcFilteredOperationCallbacks, // Operation callbacks
 
     FgcUnload,                   // MiniFilterUnload
     FgcInstanceSetup,            // InstanceSetup
@@ -105,7 +138,75 @@ CONST FLT_REGISTRATION FilterRegistration = {
 
 DRIVER_INITIALIZE DriverEntry;
 
+static
+VOID
+FgcSelectOperationCallbacks(
+    _In_ ULONG FilteredOperations
+    );
+
 #pragma alloc_text(INIT, DriverEntry)
+#pragma alloc_text(INIT, FgcSelectOperationCallbacks)
+
+static
+VOID
+FgcSelectOperationCallbacks(
+    _In_ ULONG FilteredOperations
+    )
+/*++
+
+Routine Descrition:
+
+    This routine copies the callbacks of the filtered operation classes into the
+    operation registration of the filter. Creates are always filtered.
+
+Arguments:
+
+    FilteredOperations - FG_FILTER_* classes filtered besides creates.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG idx = 0ul, filteredIdx = 0ul;
+    ULONG operationClass = 0ul;
+
+    for (idx = 0ul; IRP_MJ_OPERATION_END != FgcOperationCallbacks[idx].MajorFunction; idx++) {
+
+        switch (FgcOperationCallbacks[idx].MajorFunction) {
+        case IRP_MJ_WRITE:
+        case IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION:
+            operationClass = FG_FILTER_WRITE;
+            break;
+
+        case IRP_MJ_SET_INFORMATION:
+            operationClass = FG_FILTER_SET_INFORMATION;
+            break;
+
+        case IRP_MJ_FILE_SYSTEM_CONTROL:
+            operationClass = FG_FILTER_FILE_SYSTEM_CONTROL;
+            break;
+
+        case IRP_MJ_CLEANUP:
+            operationClass = FG_FILTER_CLEANUP;
+            break;
+
+        default:
+            operationClass = 0ul;
+            break;
+        }
+
+        if (0ul != operationClass && !FlagOn(FilteredOperations, operationClass)) {
+            LOG_INFO("Operation 0x%02x is not filtered", FgcOperationCallbacks[idx].MajorFunction);
+            continue;
+        }
+
+        FgcFilteredOperationCallbacks[filteredIdx++] = FgcOperationCallbacks[idx];
+    }
+
+    FgcFilteredOperationCallbacks[filteredIdx].MajorFunction = IRP_MJ_OPERATION_END;
+}
 
 NTSTATUS
 DriverEntry(
@@ -119,6 +220,7 @@ DriverEntry(
     UNICODE_STRING portName = { 0 };
     PFG_MONITOR_CONTEXT monitorContext = NULL;
     HANDLE monitorHandle = NULL;
+    BOOLEAN processNotifyRoutineSet = FALSE;
 
     PAGED_CODE();
 
@@ -128,6 +230,13 @@ DriverEntry(
 #else
     Globals.LogLevel = LOG_LEVEL_DEFAULT;
 #endif
+    Globals.FilteredOperations = FG_FILTER_DEFAULT;
+    Globals.AttachPolicy.FileSystems = FG_ATTACH_DEFAULT_FILE_SYSTEMS;
+    Globals.AttachPolicy.DeviceTypes = FG_ATTACH_DEFAULT_DEVICE_TYPES;
+    Globals.MonitorBatchSize = FG_MONITOR_BATCH_SIZE_DEFAULT;
+    Globals.MonitorBatchDelay = FG_MONITOR_BATCH_DELAY_DEFAULT;
+    Globals.MonitorSendTimeout = FG_MONITOR_SEND_TIMEOUT_DEFAULT;
+    Globals.MonitorCoalesceWindow = FG_MONITOR_COALESCE_WINDOW_DEFAULT;
 
     LOG_INFO("Start to load FileGuardCore driver, version: v%d.%d.%d.%d",
         FG_CORE_VERSION_MAJOR, FG_CORE_VERSION_MINOR, FG_CORE_VERSION_PATCH, FG_CORE_VERSION_BUILD);
@@ -144,8 +253,7 @@ DriverEntry(
             leave;
         }
 
-        Globals.MonitorRecordsAllocated = 0ul;
-        Globals.MaxMonitorRecordsAllocated = MAXUSHORT;
+        FgcSelectOperationCallbacks(Globals.FilteredOperations);
 
         Globals.AcceptDetach = FALSE;
         Globals.AcceptUnload = FALSE;
@@ -157,8 +265,58 @@ DriverEntry(
         InitializeListHead(&Globals.RulesList);
         FgcCreatePushLock(&Globals.RulesListLock);
 
-        InitializeListHead(&Globals.MonitorRecordsQueue);
-        KeInitializeSpinLock(&Globals.MonitorRecordsQueueLock);
+        InitializeListHead(&Globals.InstanceContextsList);
+        status = FgcCreatePushLock(&Globals.InstanceContextsListLock);
+        if (!NT_SUCCESS(status)) {
+            DBG_ERROR("NTSTATUS: '0x%08x', create instance contexts list lock failed", status);
+            leave;
+        }
+
+        status = FgcInitializeMonitorRings(&Globals.MonitorRings);
+        if (!NT_SUCCESS(status)) {
+            DBG_ERROR("NTSTATUS: '0x%08x', initialize monitor rings failed", status);
+            leave;
+        }
+
+        status = FgcInitializeTrustedProcessTable(&Globals.TrustedProcesses);
+        if (!NT_SUCCESS(status)) {
+            DBG_ERROR("NTSTATUS: '0x%08x', initialize trusted process table failed", status);
+            leave;
+        }
+
+        status = FgcInitializeFileIdRuleTable(&Globals.FileIdRules);
+        if (!NT_SUCCESS(status)) {
+            DBG_ERROR("NTSTATUS: '0x%08x', initialize file id rule table failed", status);
+            leave;
+        }
+
+        status = FgcInitializeProcessCache(&Globals.ProcessCache);
+        if (!NT_SUCCESS(status)) {
+            DBG_ERROR("NTSTATUS: '0x%08x', initialize process cache failed", status);
+            leave;
+        }
+
+        //
+        // Lookaside lists of the fixed size allocations on the create path. The list
+        // head is a lock free SList, so an allocation costs one interlocked operation
+        // on a hit, and the pool already serves small misses from its per processor
+        // lists. A per processor cache of our own would only add a second layer of
+        // the same thing, the hit rate logged on unload tells whether it is needed.
+        //
+        status = ExInitializeLookasideListEx(&Globals.CompletionContextsLookaside,
+                                             NULL,
+                                             NULL,
+                                             PagedPool,
+                                             0,
+                                             sizeof(FG_COMPLETION_CONTEXT),
+                                             FG_COMPLETION_CONTEXT_PAGED_TAG,
+                                             0);
+        if (!NT_SUCCESS(status)) {
+            DBG_ERROR("NTSTATUS: '0x%08x', initialize completion contexts lookaside failed", status);
+            leave;
+        }
+
+        Globals.CompletionContextsLookasideInitialized = TRUE;
 
         //
         // Register filter driver.
@@ -214,8 +372,8 @@ DriverEntry(
                                             NULL,
                                             FgcMonitorPortConnectCallback,
                                             FgcMonitorPortDisconnectCallback,
-                                            NULL,
-                                            1);
+                                            FgcMonitorMessageNotifyCallback,
+                                            FG_MONITOR_SUBSCRIBERS_MAX);
         if (!NT_SUCCESS(status)) {
             DBG_ERROR("NTSTATUS: '0x%08x', create monitor communication port failed", status);
             leave;
@@ -226,8 +384,7 @@ DriverEntry(
         //
 
         status = FgcCreateMonitorStartContext(Globals.Filter,
-                                             &Globals.MonitorRecordsQueue,
-                                             &Globals.MonitorRecordsQueueLock,
+                                             &Globals.MonitorRings,
                                              &monitorContext);
         if (!NT_SUCCESS(status) || NULL == monitorContext) {
             DBG_ERROR("NTSTATUS: '0x%08x', create monitor start context failed", status);
@@ -258,6 +415,17 @@ DriverEntry(
                                   NULL);
         ZwClose(monitorHandle);
 
+        //
+        // Process exit notification drops the cached process identities.
+        //
+        status = PsSetCreateProcessNotifyRoutine(FgcProcessNotifyRoutine, FALSE);
+        if (!NT_SUCCESS(status)) {
+            DBG_ERROR("NTSTATUS: '0x%08x', set process notify routine failed", status);
+            leave;
+        }
+
+        processNotifyRoutineSet = TRUE;
+
         // Start filter driver.
         status = FltStartFiltering(Globals.Filter);
 
@@ -276,6 +444,9 @@ DriverEntry(
             if (NULL != Globals.Filter)
                 FltUnregisterFilter(Globals.Filter);
 
+            if (processNotifyRoutineSet)
+                PsSetCreateProcessNotifyRoutine(FgcProcessNotifyRoutine, TRUE);
+
             if (NULL != Globals.MonitorContext) {
                 InterlockedExchangeBoolean(&Globals.MonitorContext->EndMonitorFlag, FALSE);
                 KeSetEvent(&Globals.MonitorContext->EventPortConnected, 0, FALSE);
@@ -286,7 +457,19 @@ DriverEntry(
             if (NULL != Globals.MonitorThreadObject)
                 ObReferenceObject(Globals.MonitorThreadObject);
 
-            FgcCleanupMonitorRecords();
+            FgcFreeMonitorRings(&Globals.MonitorRings);
+
+            FgcDeleteLookasideLists();
+
+            FgcFreeProcessCache(&Globals.ProcessCache);
+
+            FgcFreeFileIdRuleTable(&Globals.FileIdRules);
+
+            FgcFreeTrustedProcessTable(&Globals.TrustedProcesses);
+
+            FgcFreePushLock(Globals.InstanceContextsListLock);
+
+            FgcFreeAttachPolicy(&Globals.AttachPolicy);
         } 
 
         if (NULL != securityDescriptor) FltFreeSecurityDescriptor(securityDescriptor);
@@ -323,8 +506,14 @@ FgcUnload(
         FltCloseCommunicationPort(Globals.MonitorCorePort);
     }
 
-    if (NULL != Globals.MonitorClientPort) {
-        FltCloseClientPort(Globals.Filter, &Globals.MonitorClientPort);
+    if (NULL != Globals.MonitorContext) {
+        FgcDisconnectMonitorSubscribers(Globals.MonitorContext);
+
+        //
+        // The files with coalesced events are referenced until they are recorded, the
+        // references must be released before the filter unregisters.
+        //
+        FgcCloseCoalescedEvents(Globals.MonitorContext);
     }
 
     if (NULL != Globals.Filter) {
@@ -333,6 +522,16 @@ FgcUnload(
 
     DBG_INFO("Unregister filter successfully");
 
+    LOG_INFO("File contexts created: %lld, names kept: %lld, coalesced events: %lld, average context size: %lld bytes",
+             Globals.FileContextStatistics.Contexts,
+             Globals.FileContextStatistics.Names,
+             Globals.FileContextStatistics.CoalescedEvents,
+             FgcGetAverageFileContextSize(&Globals.FileContextStatistics,
+                                          sizeof(FG_FILE_CONTEXT),
+                                          sizeof(FG_COALESCED_EVENTS)));
+
+    PsSetCreateProcessNotifyRoutine(FgcProcessNotifyRoutine, TRUE);
+
     //
     // Stop the monitor thread.
     //
@@ -341,6 +540,7 @@ FgcUnload(
 
     InterlockedExchangeBoolean(&Globals.MonitorContext->EndMonitorFlag, TRUE);
     KeSetEvent(&Globals.MonitorContext->EventPortConnected, 0, FALSE);
+    KeSetEvent(&Globals.MonitorContext->EventBatchReady, 0, FALSE);
     KeSetEvent(&Globals.MonitorContext->EventWakeMonitor, 0, FALSE);
 
     if (NULL != Globals.MonitorThreadObject) {
@@ -365,13 +565,177 @@ FgcUnload(
         FgcFreePushLock(Globals.RulesListLock);
     }
 
-    FgcCleanupMonitorRecords();
+    FgcFreeMonitorRings(&Globals.MonitorRings);
+
+    FgcDeleteLookasideLists();
+
+    FgcFreeProcessCache(&Globals.ProcessCache);
+
+    FgcFreeFileIdRuleTable(&Globals.FileIdRules);
+
+    FgcFreeTrustedProcessTable(&Globals.TrustedProcesses);
+
+    FgcFreePushLock(Globals.InstanceContextsListLock);
+
+    FgcFreeAttachPolicy(&Globals.AttachPolicy);
 
     LOG_INFO("Unload driver successfully");
 
     return status;
 }
 
+static
+NTSTATUS
+FgcQueryVolumeName(
+    _In_ PFLT_VOLUME Volume,
+    _Outptr_ PUNICODE_STRING *VolumeName
+    )
+/*++
+
+Routine Description:
+
+    This routine queries the upcased device name of a volume.
+
+Arguments:
+
+    Volume     - The volume.
+    VolumeName - A pointer to a variable that receives the name, the caller frees
+                 it by FgcFreeUnicodeString.
+
+Return Value:
+
+    Returns the status of this operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG volumeNameSize = 0ul;
+    PUNICODE_STRING volumeName = NULL;
+
+    PAGED_CODE();
+
+    status = FltGetVolumeName(Volume, NULL, &volumeNameSize);
+    if (!NT_SUCCESS(status) && STATUS_BUFFER_TOO_SMALL != status) {
+        LOG_ERROR("NTSTATUS: 0x%08x, get volume name suze failed", status);
+        return status;
+    }
+    
+    status = FgcAllocateUnicodeString((USHORT)volumeNameSize, &volumeName);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate volume name string failed", status);
+        return status;
+    }
+    
+    status = FltGetVolumeName(Volume, volumeName, NULL);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, get volume name failed", status);
+        FgcFreeUnicodeString(volumeName);
+        return status;
+    }
+
+    RtlUpcaseUnicodeString(volumeName, volumeName, FALSE);
+
+    *VolumeName = volumeName;
+
+    return status;
+}
+
+static
+NTSTATUS
+FgcQueryVolumeSerialNumber(
+    _In_opt_ PFLT_INSTANCE Instance,
+    _In_ PCUNICODE_STRING VolumeName,
+    _Out_ PULONGLONG VolumeSerialNumber
+    )
+/*++
+
+Routine Description:
+
+    This routine queries the serial number of a volume as FileIdInformation reports
+    it, the file id rules are keyed by it. FileFsVolumeInformation only reports the
+    low 32 bits of the serial number of an NTFS or ReFS volume.
+
+Arguments:
+
+    Instance           - The instance below which the root directory of the volume
+                         is opened, NULL to open it from the top of the stack.
+    VolumeName         - Device name of the volume.
+    VolumeSerialNumber - A pointer to a variable that receives the serial number.
+
+Return Value:
+
+    Returns the status of this operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PUNICODE_STRING rootName = NULL;
+    OBJECT_ATTRIBUTES attributes = { 0 };
+    IO_STATUS_BLOCK ioStatus = { 0 };
+    HANDLE rootHandle = NULL;
+    FILE_ID_INFORMATION fileIdInformation = { 0 };
+
+    PAGED_CODE();
+
+    *VolumeSerialNumber = 0ull;
+
+    if ((ULONG)VolumeName->Length + sizeof(WCHAR) > MAXUSHORT) return STATUS_NAME_TOO_LONG;
+
+    status = FgcAllocateUnicodeString(VolumeName->Length + sizeof(WCHAR), &rootName);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate volume root name string failed", status);
+        return status;
+    }
+
+    RtlCopyUnicodeString(rootName, VolumeName);
+    rootName->Buffer[rootName->Length / sizeof(WCHAR)] = L'\\';
+    rootName->Length += sizeof(WCHAR);
+
+    InitializeObjectAttributes(&attributes, rootName, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    status = FltCreateFile(Globals.Filter,
+                           Instance,
+                           &rootHandle,
+                           FILE_READ_ATTRIBUTES | SYNCHRONIZE,
+                           &attributes,
+                           &ioStatus,
+                           NULL,
+                           FILE_ATTRIBUTE_NORMAL,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           FILE_OPEN,
+                           FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+                           NULL,
+                           0ul,
+                           IO_IGNORE_SHARE_ACCESS_CHECK);
+    if (!NT_SUCCESS(status)) {
+        rootHandle = NULL;
+        LOG_WARNING("NTSTATUS: 0x%08x, open volume root '%wZ' failed", status, rootName);
+        goto Cleanup;
+    }
+
+    status = ZwQueryInformationFile(rootHandle,
+                                    &ioStatus,
+                                    &fileIdInformation,
+                                    sizeof(FILE_ID_INFORMATION),
+                                    FileIdInformation);
+    if (!NT_SUCCESS(status)) {
+        LOG_WARNING("NTSTATUS: 0x%08x, query volume root '%wZ' file id failed", status, rootName);
+        goto Cleanup;
+    }
+
+    *VolumeSerialNumber = fileIdInformation.VolumeSerialNumber;
+
+Cleanup:
+
+    if (NULL != rootHandle) {
+        FltClose(rootHandle);
+    }
+
+    FgcFreeUnicodeString(rootName);
+
+    return status;
+}
+
 NTSTATUS
 FgcInstanceSetup(
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
@@ -404,42 +768,66 @@ Return Value:
 --*/
 {
     NTSTATUS status = STATUS_SUCCESS;
-    ULONG volumeNameSize = 0ul;
     PUNICODE_STRING volumeName = NULL;
-
-    UNREFERENCED_PARAMETER(Flags);
-    UNREFERENCED_PARAMETER(VolumeDeviceType);
+    UCHAR propertiesBuffer[sizeof(FLT_VOLUME_PROPERTIES) + 512] = { 0 };
+    PFLT_VOLUME_PROPERTIES properties = (PFLT_VOLUME_PROPERTIES)propertiesBuffer;
+    ULONG propertiesLength = 0ul;
+    ULONGLONG volumeSerialNumber = 0ull;
+    BOOLEAN removable = FALSE, serialQueried = FALSE;
 
     PAGED_CODE();
 
     LOG_INFO("Start setup a instance for the volume");
 
-    if (FLT_FSTYPE_NTFS != VolumeFilesystemType) {
-        LOG_WARNING("Attempt to attach to a non NTFS file system");
-        status = STATUS_FLT_DO_NOT_ATTACH;
+    status = FgcQueryVolumeName(FltObjects->Volume, &volumeName);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, query volume name failed", status);
         goto Cleanup;
     }
 
-    status = FltGetVolumeName(FltObjects->Volume, NULL, &volumeNameSize);
-    if (!NT_SUCCESS(status) && STATUS_BUFFER_TOO_SMALL != status) {
-        LOG_ERROR("NTSTATUS: 0x%08x, get volume name suze failed", status);
-        goto Cleanup;
+    status = FltGetVolumeProperties(FltObjects->Volume, properties, sizeof(propertiesBuffer), &propertiesLength);
+    if (NT_SUCCESS(status) || STATUS_BUFFER_OVERFLOW == status) {
+        removable = BooleanFlagOn(properties->DeviceCharacteristics, FILE_REMOVABLE_MEDIA);
+    } else {
+        LOG_WARNING("NTSTATUS: 0x%08x, get volume properties failed", status);
     }
-    
-    status = FgcAllocateUnicodeString((USHORT)volumeNameSize, &volumeName);
-    if (!NT_SUCCESS(status)) {
-        LOG_ERROR("NTSTATUS: 0x%08x, allocate volume name string failed", status);
+
+    if (!FgcIsVolumeAttachable(&Globals.AttachPolicy, VolumeDeviceType, VolumeFilesystemType, removable, volumeName)) {
+        LOG_INFO("Volume '%wZ' is not attached by the policy, device type: 0x%08x, file system type: %d",
+                 volumeName, VolumeDeviceType, VolumeFilesystemType);
+        status = STATUS_FLT_DO_NOT_ATTACH;
         goto Cleanup;
     }
-    
-    status = FltGetVolumeName(FltObjects->Volume, volumeName, NULL);
-    if (!NT_SUCCESS(status)) {
-        LOG_ERROR("NTSTATUS: 0x%08x, get volume name failed", status);
+
+    //
+    // The file id rules of the volume are told apart from the ones of other volumes
+    // by the full serial number, without it every file id rule is counted.
+    //
+    serialQueried = NT_SUCCESS(FgcQueryVolumeSerialNumber(FltObjects->Instance, volumeName, &volumeSerialNumber));
+
+    //
+    // A volume without rules is attached on demand, when the first rule targeting
+    // it is added.
+    //
+    if (FlagOn(Globals.AttachPolicy.Flags, FG_ATTACH_ON_DEMAND) && 
+        !FlagOn(Flags, FLTFL_INSTANCE_SETUP_MANUAL_ATTACHMENT) &&
+        0 == FgcGetVolumeRulesAmount(volumeName, serialQueried ? &volumeSerialNumber : NULL)) {
+        LOG_INFO("Volume '%wZ' is attached on demand", volumeName);
+        status = STATUS_FLT_DO_NOT_ATTACH;
         goto Cleanup;
     }
 
     LOG_INFO("Setup instance for volume: '%wZ'", volumeName);
 
+    //
+    // Without an instance context every create on the volume is matched against the rules.
+    //
+    status = FgcSetupInstanceContext(FltObjects->Instance, volumeName, serialQueried ? &volumeSerialNumber : NULL);
+    if (!NT_SUCCESS(status)) {
+        LOG_WARNING("NTSTATUS: 0x%08x, setup instance context failed", status);
+        status = STATUS_SUCCESS;
+    }
+
 Cleanup:
 
     if (NULL != volumeName) {
@@ -455,7 +843,9 @@ FgcInstanceQueryTeardown(
     _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags
     )
 {
-    UNREFERENCED_PARAMETER(FltObjects);
+    NTSTATUS status = STATUS_FLT_DO_NOT_DETACH;
+    PFG_INSTANCE_CONTEXT instanceContext = NULL;
+
     UNREFERENCED_PARAMETER(Flags);
 
     PAGED_CODE();
@@ -464,7 +854,21 @@ FgcInstanceQueryTeardown(
         return STATUS_SUCCESS;
     }
 
-    return STATUS_FLT_DO_NOT_DETACH;
+    //
+    // An instance attached on demand is detached when the last rule targeting its
+    // volume is removed.
+    //
+    if (FlagOn(Globals.AttachPolicy.Flags, FG_ATTACH_ON_DEMAND) &&
+        NT_SUCCESS(FltGetInstanceContext(FltObjects->Instance, &instanceContext))) {
+        if (0 == ReadNoFence(&instanceContext->RulesAmount) && 
+            0 == ReadNoFence(&instanceContext->FileIdRulesAmount)) {
+            status = STATUS_SUCCESS;
+        }
+
+        FltReleaseContext(instanceContext);
+    }
+
+    return status;
 }
 
 VOID
@@ -495,6 +899,156 @@ FgcInstanceTeardownComplete(
     LOG_INFO("Instance teardown completed");
 }
 
+static
+NTSTATUS
+FgcQueryRegistryULong(
+    _In_ HANDLE Key,
+    _In_ PCWSTR Name,
+    _Inout_ PULONG Value
+    )
+/*++
+
+Routine Descrition:
+
+    This routine reads a REG_DWORD value, the value is left unchanged if it does not exist.
+
+Arguments:
+
+    Key   - The opened registry key.
+    Name  - Name of the value.
+    Value - A pointer to a variable that receives the value.
+
+Return Value:
+
+    Returns the status of this operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    UNICODE_STRING valueName = { 0 };
+    UCHAR buffer[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(ULONG)] = { 0 };
+    PKEY_VALUE_PARTIAL_INFORMATION value = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
+    ULONG resultLength = 0L;
+
+    PAGED_CODE();
+
+    RtlInitUnicodeString(&valueName, Name);
+
+    status = ZwQueryValueKey(Key,
+                             &valueName,
+                             KeyValuePartialInformation,
+                             value,
+                             sizeof(buffer),
+                             &resultLength);
+    if (!NT_SUCCESS(status)) return status;
+    if (REG_DWORD != value->Type || sizeof(ULONG) != value->DataLength) return STATUS_OBJECT_TYPE_MISMATCH;
+
+    *Value = *(PULONG)value->Data;
+
+    return status;
+}
+
+static
+NTSTATUS
+FgcQueryAttachVolumeExpressions(
+    _In_ HANDLE Key,
+    _Inout_ PFG_ATTACH_POLICY Policy
+    )
+/*++
+
+Routine Descrition:
+
+    This routine reads the REG_MULTI_SZ `AttachVolumes` value into upcased volume
+    name expressions of the attach policy.
+
+Arguments:
+
+    Key    - The opened registry key.
+    Policy - The attach policy to receive the expressions.
+
+Return Value:
+
+    Returns the status of this operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    UNICODE_STRING valueName = RTL_CONSTANT_STRING(L"AttachVolumes");
+    PKEY_VALUE_PARTIAL_INFORMATION value = NULL;
+    ULONG valueLength = 0ul;
+    PWCHAR strings = NULL;
+    ULONG stringsLength = 0ul, idx = 0ul, start = 0ul;
+    ULONG expressionsAmount = 0ul;
+    PUNICODE_STRING expressions = NULL;
+    PWCHAR expressionsBuffer = NULL;
+
+    PAGED_CODE();
+
+    status = ZwQueryValueKey(Key, &valueName, KeyValuePartialInformation, NULL, 0, &valueLength);
+    if (STATUS_BUFFER_TOO_SMALL != status && STATUS_BUFFER_OVERFLOW != status) return status;
+
+    status = FgcAllocateBufferEx(&value, POOL_FLAG_PAGED, valueLength, FG_BUFFER_PAGED_TAG);
+    if (!NT_SUCCESS(status)) return status;
+
+    status = ZwQueryValueKey(Key, &valueName, KeyValuePartialInformation, value, valueLength, &valueLength);
+    if (!NT_SUCCESS(status)) goto Cleanup;
+
+    if (REG_MULTI_SZ != value->Type) {
+        status = STATUS_OBJECT_TYPE_MISMATCH;
+        goto Cleanup;
+    }
+
+    strings = (PWCHAR)value->Data;
+    stringsLength = value->DataLength / sizeof(WCHAR);
+
+    for (idx = 0ul; idx < stringsLength; idx++) {
+        if (L'\0' == strings[idx] && idx > start) expressionsAmount++;
+        if (L'\0' == strings[idx]) start = idx + 1;
+    }
+
+    if (0ul == expressionsAmount) goto Cleanup;
+
+    //
+    // The expressions and their upcased buffers are a single allocation.
+    //
+    status = FgcAllocateBufferEx(&expressions,
+                                 POOL_FLAG_PAGED,
+                                 expressionsAmount * sizeof(UNICODE_STRING) + stringsLength * sizeof(WCHAR),
+                                 FG_UNICODE_STRING_PAGED_TAG);
+    if (!NT_SUCCESS(status)) goto Cleanup;
+
+    expressionsBuffer = Add2Ptr(expressions, expressionsAmount * sizeof(UNICODE_STRING));
+    expressionsAmount = 0ul;
+
+    for (idx = 0ul, start = 0ul; idx < stringsLength; idx++) {
+        if (L'\0' != strings[idx]) {
+            expressionsBuffer[idx] = RtlUpcaseUnicodeChar(strings[idx]);
+            continue;
+        }
+
+        if (idx > start) {
+            expressions[expressionsAmount].Buffer = &expressionsBuffer[start];
+            expressions[expressionsAmount].Length = (USHORT)((idx - start) * sizeof(WCHAR));
+            expressions[expressionsAmount].MaximumLength = expressions[expressionsAmount].Length;
+            LOG_INFO("Attach volume expression: '%wZ'", &expressions[expressionsAmount]);
+            expressionsAmount++;
+        }
+
+        start = idx + 1;
+    }
+
+    Policy->VolumeExpressions = expressions;
+    Policy->VolumeExpressionsAmount = expressionsAmount;
+
+Cleanup:
+
+    if (NULL != value) {
+        FgcFreeBuffer(value);
+    }
+
+    return status;
+}
+
 _Check_return_
 NTSTATUS
 FgcSetConfiguration(
@@ -519,11 +1073,6 @@ Return Value:
     NTSTATUS status = STATUS_SUCCESS;
     OBJECT_ATTRIBUTES attributes = { 0 };
     HANDLE driverRegKey = NULL;
-    UNICODE_STRING valueName = { 0 };
-    UCHAR buffer[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(ULONG)] = { 0 };
-    PKEY_VALUE_PARTIAL_INFORMATION value = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
-    ULONG valueLength = sizeof(buffer);
-    ULONG resultLength = 0L;
 
     PAGED_CODE();
 
@@ -541,22 +1090,85 @@ Return Value:
     //
     // Read log level from registry.
     //
-    RtlInitUnicodeString(&valueName, L"LogLevel");
+    status = FgcQueryRegistryULong(driverRegKey, L"LogLevel", &Globals.LogLevel);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: '0x%08x', read log level registry configuration failed", status);
+    }
 
-    status = ZwQueryValueKey(driverRegKey,
-                             &valueName,
-                             KeyValuePartialInformation,
-                             value,
-                             valueLength,
-                             &resultLength);
-    if (NT_SUCCESS(status)) {
-        Globals.LogLevel = *(PULONG)value->Data;
-    } else {
+    //
+    // Read filtered operation classes from registry, all of them are filtered by default.
+    //
+    status = FgcQueryRegistryULong(driverRegKey, L"FilteredOperations", &Globals.FilteredOperations);
+    if (!NT_SUCCESS(status) && STATUS_OBJECT_NAME_NOT_FOUND != status) {
+        LOG_ERROR("NTSTATUS: '0x%08x', read filtered operations registry configuration failed", status);
+    }
 
-        LOG_ERROR("NTSTATUS: '0x%08x', read log level registry configuration failed", status);
-        status = STATUS_SUCCESS;
+    //
+    // Read volume attach policy from registry, the defaults attach to all NTFS volumes.
+    //
+    status = FgcQueryRegistryULong(driverRegKey, L"AttachPolicy", &Globals.AttachPolicy.Flags);
+    if (!NT_SUCCESS(status) && STATUS_OBJECT_NAME_NOT_FOUND != status) {
+        LOG_ERROR("NTSTATUS: '0x%08x', read attach policy registry configuration failed", status);
+    }
+
+    status = FgcQueryRegistryULong(driverRegKey, L"AttachFileSystems", &Globals.AttachPolicy.FileSystems);
+    if (!NT_SUCCESS(status) && STATUS_OBJECT_NAME_NOT_FOUND != status) {
+        LOG_ERROR("NTSTATUS: '0x%08x', read attach file systems registry configuration failed", status);
+    }
+
+    status = FgcQueryRegistryULong(driverRegKey, L"AttachDeviceTypes", &Globals.AttachPolicy.DeviceTypes);
+    if (!NT_SUCCESS(status) && STATUS_OBJECT_NAME_NOT_FOUND != status) {
+        LOG_ERROR("NTSTATUS: '0x%08x', read attach device types registry configuration failed", status);
+    }
+
+    status = FgcQueryAttachVolumeExpressions(driverRegKey, &Globals.AttachPolicy);
+    if (!NT_SUCCESS(status) && STATUS_OBJECT_NAME_NOT_FOUND != status) {
+        LOG_ERROR("NTSTATUS: '0x%08x', read attach volumes registry configuration failed", status);
+    }
+
+    //
+    // Read monitor records batching from registry, it can be changed at runtime too.
+    //
+    status = FgcQueryRegistryULong(driverRegKey, L"MonitorBatchSize", (PULONG)&Globals.MonitorBatchSize);
+    if (!NT_SUCCESS(status) && STATUS_OBJECT_NAME_NOT_FOUND != status) {
+        LOG_ERROR("NTSTATUS: '0x%08x', read monitor batch size registry configuration failed", status);
     }
 
+    status = FgcQueryRegistryULong(driverRegKey, L"MonitorBatchDelay", (PULONG)&Globals.MonitorBatchDelay);
+    if (!NT_SUCCESS(status) && STATUS_OBJECT_NAME_NOT_FOUND != status) {
+        LOG_ERROR("NTSTATUS: '0x%08x', read monitor batch delay registry configuration failed", status);
+    }
+
+    if (Globals.MonitorBatchSize > FG_MONITOR_BATCH_SIZE_MAX ||
+        Globals.MonitorBatchDelay > FG_MONITOR_BATCH_DELAY_MAX) {
+        LOG_WARNING("Monitor batching size: %lu, delay: %lu out of range, defaults are used",
+                    Globals.MonitorBatchSize, Globals.MonitorBatchDelay);
+        Globals.MonitorBatchSize = FG_MONITOR_BATCH_SIZE_DEFAULT;
+        Globals.MonitorBatchDelay = FG_MONITOR_BATCH_DELAY_DEFAULT;
+    }
+
+    status = FgcQueryRegistryULong(driverRegKey, L"MonitorSendTimeout", (PULONG)&Globals.MonitorSendTimeout);
+    if (!NT_SUCCESS(status) && STATUS_OBJECT_NAME_NOT_FOUND != status) {
+        LOG_ERROR("NTSTATUS: '0x%08x', read monitor send timeout registry configuration failed", status);
+    }
+
+    if (Globals.MonitorSendTimeout > FG_MONITOR_SEND_TIMEOUT_MAX) {
+        LOG_WARNING("Monitor send timeout: %lu out of range, default is used", Globals.MonitorSendTimeout);
+        Globals.MonitorSendTimeout = FG_MONITOR_SEND_TIMEOUT_DEFAULT;
+    }
+
+    status = FgcQueryRegistryULong(driverRegKey, L"MonitorCoalesceWindow", (PULONG)&Globals.MonitorCoalesceWindow);
+    if (!NT_SUCCESS(status) && STATUS_OBJECT_NAME_NOT_FOUND != status) {
+        LOG_ERROR("NTSTATUS: '0x%08x', read monitor coalesce window registry configuration failed", status);
+    }
+
+    if (Globals.MonitorCoalesceWindow > FG_MONITOR_COALESCE_WINDOW_MAX) {
+        LOG_WARNING("Monitor coalesce window: %lu out of range, default is used", Globals.MonitorCoalesceWindow);
+        Globals.MonitorCoalesceWindow = FG_MONITOR_COALESCE_WINDOW_DEFAULT;
+    }
+
+    status = STATUS_SUCCESS;
+
 Cleanup:
 
     if (NULL != driverRegKey) {
@@ -565,3 +1177,178 @@ Cleanup:
 
     return status;
 }
+
+VOID
+FgcDeleteLookasideLists(
+    VOID
+    )
+/*++
+
+Routine Descrition:
+
+    This routine logs the hit rate of the lookaside lists and deletes them.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (Globals.CompletionContextsLookasideInitialized) {
+        LOG_INFO("Completion contexts lookaside allocates: %lu, misses: %lu",
+                 Globals.CompletionContextsLookaside.L.TotalAllocates,
+                 Globals.CompletionContextsLookaside.L.AllocateMisses);
+
+        ExDeleteLookasideListEx(&Globals.CompletionContextsLookaside);
+        Globals.CompletionContextsLookasideInitialized = FALSE;
+    }
+}
+
+VOID
+FgcUpdateVolumeAttachments(
+    VOID
+    )
+/*++
+
+Routine Descrition:
+
+    This routine attaches to the volumes targeted by a rule and detaches from the
+    volumes no rule targets any more, it is called after the rules changed while
+    volumes are attached on demand.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFLT_VOLUME *volumes = NULL;
+    ULONG volumesAmount = 0ul, idx = 0ul;
+    PFLT_INSTANCE instance = NULL;
+    PFG_INSTANCE_CONTEXT instanceContext = NULL;
+    PUNICODE_STRING volumeName = NULL;
+    ULONGLONG volumeSerialNumber = 0ull;
+    LONG rulesAmount = 0l;
+
+    PAGED_CODE();
+
+    if (!FlagOn(Globals.AttachPolicy.Flags, FG_ATTACH_ON_DEMAND)) return;
+
+    status = FltEnumerateVolumes(Globals.Filter, NULL, 0ul, &volumesAmount);
+    if (STATUS_BUFFER_TOO_SMALL != status) {
+        if (!NT_SUCCESS(status)) LOG_ERROR("NTSTATUS: 0x%08x, enumerate volumes failed", status);
+        return;
+    }
+
+    status = FgcAllocateBufferEx(&volumes, POOL_FLAG_PAGED, volumesAmount * sizeof(PFLT_VOLUME), FG_BUFFER_PAGED_TAG);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate volumes buffer failed", status);
+        return;
+    }
+
+    status = FltEnumerateVolumes(Globals.Filter, volumes, volumesAmount, &volumesAmount);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, enumerate volumes failed", status);
+        FgcFreeBuffer(volumes);
+        return;
+    }
+
+    for (idx = 0ul; idx < volumesAmount; idx++) {
+
+        status = FgcQueryVolumeName(volumes[idx], &volumeName);
+        if (NT_SUCCESS(status)) {
+
+            status = FltGetVolumeInstanceFromName(Globals.Filter, volumes[idx], NULL, &instance);
+            if (NT_SUCCESS(status)) {
+
+                //
+                // The instance context knows the serial number of its volume.
+                //
+                if (NT_SUCCESS(FltGetInstanceContext(instance, &instanceContext))) {
+                    rulesAmount = FgcGetVolumeRulesAmount(volumeName, &instanceContext->VolumeSerialNumber);
+                    FltReleaseContext(instanceContext);
+                    instanceContext = NULL;
+                } else {
+                    rulesAmount = FgcGetVolumeRulesAmount(volumeName, NULL);
+                }
+
+                FltObjectDereference(instance);
+                instance = NULL;
+
+                if (0 == rulesAmount) {
+                    status = FltDetachVolume(Globals.Filter, volumes[idx], NULL);
+                    LOG_INFO("NTSTATUS: 0x%08x, detach volume '%wZ' without rules", status, volumeName);
+                }
+
+            } else {
+
+                //
+                // The serial number of a volume without an instance is only queried
+                // when the file id rules are all that could target it.
+                //
+                rulesAmount = FgcGetVolumeRulesAmount(volumeName, NULL);
+                if (0 != rulesAmount &&
+                    rulesAmount == ReadNoFence(&Globals.FileIdRules.RulesAmount) &&
+                    NT_SUCCESS(FgcQueryVolumeSerialNumber(NULL, volumeName, &volumeSerialNumber))) {
+                    rulesAmount = FgcGetVolumeRulesAmount(volumeName, &volumeSerialNumber);
+                }
+
+                //
+                // The instance setup still applies the rest of the attach policy.
+                //
+                if (0 != rulesAmount) {
+                    status = FltAttachVolume(Globals.Filter, volumes[idx], NULL, NULL);
+                    LOG_INFO("NTSTATUS: 0x%08x, attach volume '%wZ' targeted by %d rule(s)", status, volumeName, rulesAmount);
+                }
+            }
+
+            FgcFreeUnicodeString(volumeName);
+            volumeName = NULL;
+        }
+
+        FltObjectDereference(volumes[idx]);
+    }
+
+    FgcFreeBuffer(volumes);
+}
+
+VOID
+FgcFreeAttachPolicy(
+    _Inout_ PFG_ATTACH_POLICY Policy
+    )
+/*++
+
+Routine Descrition:
+
+    This routine frees the volume expressions of the attach policy.
+
+Arguments:
+
+    Policy - The attach policy.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (NULL != Policy->VolumeExpressions) {
+        FgcFreeBuffer(Policy->VolumeExpressions);
+        Policy->VolumeExpressions = NULL;
+    }
+
+    Policy->VolumeExpressionsAmount = 0ul;
+}
@@ -44,12 +44,16 @@ Environment:
 #include <dontuse.h>
 
 #include "FileGuard.h"
+#include "FileGuardCodec.h"
+#include "FileGuardChannel.h"
 #include "Utilities.h"
 #include "Rule.h"
+#include "Process.h"
 #include "Operations.h"
 #include "Context.h"
 #include "Communication.h"
 #include "Monitor.h"
+#include "AttachPolicy.h"
 
 //
 // FileGuardCore version information.
@@ -63,12 +67,31 @@ Environment:
 // Memory pool tags.
 //
 #define FG_BUFFER_NON_PAGED_TAG               'Fgnb'
+#define FG_BUFFER_PAGED_TAG                   'Fgpb'
 #define FG_UNICODE_STRING_NON_PAGED_TAG       'FGus'
+#define FG_UNICODE_STRING_PAGED_TAG           'FGps'
 #define FG_PUSHLOCK_NON_PAGED_TAG             'FGNr'
 #define FG_RULE_ENTRY_PAGED_TAG               'Fgre'
+#define FG_RULE_SUBSET_PAGED_TAG              'Fgrs'
+#define FG_PROCESS_ENTRY_PAGED_TAG            'Fgpe'
 #define FG_COMPLETION_CONTEXT_PAGED_TAG       'Fgct'
 #define FG_FILE_CONTEXT_PAGED_TAG             'Fgfc'
-#define FG_MONITOR_RECORD_ENTRY_NON_PAGED_TAG 'Fgmr'
+#define FG_INSTANCE_CONTEXT_PAGED_TAG         'Fgic'
+#define FG_HANDLE_CONTEXT_PAGED_TAG           'Fghc'
+#define FG_MONITOR_RING_NON_PAGED_TAG         'Fgmr'
+#define FG_COALESCED_EVENTS_NON_PAGED_TAG     'Fgce'
+
+//
+// Operation classes filtered besides creates, selected by the `FilteredOperations`
+// registry value. The callbacks of an unselected class are not registered at all,
+// trading the protection depth for throughput.
+//
+#define FG_FILTER_WRITE               ((ULONG)0x01) // Writes and creation of writable sections.
+#define FG_FILTER_SET_INFORMATION     ((ULONG)0x02)
+#define FG_FILTER_FILE_SYSTEM_CONTROL ((ULONG)0x04)
+#define FG_FILTER_CLEANUP             ((ULONG)0x08) // Summarize the activity of monitored handles on cleanup.
+#define FG_FILTER_DEFAULT             (FG_FILTER_WRITE | FG_FILTER_SET_INFORMATION | FG_FILTER_FILE_SYSTEM_CONTROL | \
+                                       FG_FILTER_CLEANUP)
 
 NTSTATUS
 FgcUnload(
@@ -107,6 +130,21 @@ FgcSetConfiguration(
     _In_ PUNICODE_STRING RegistryPath
     );
 
+VOID
+FgcUpdateVolumeAttachments(
+    VOID
+    );
+
+VOID
+FgcFreeAttachPolicy(
+    _Inout_ PFG_ATTACH_POLICY Policy
+    );
+
+VOID
+FgcDeleteLookasideLists(
+    VOID
+    );
+
 EXTERN_C_END
 
 // Assign text sections for each routine.
@@ -117,6 +155,9 @@ EXTERN_C_END
 #pragma alloc_text(PAGE, FgcInstanceTeardownStart)
 #pragma alloc_text(PAGE, FgcInstanceTeardownComplete)
 #pragma alloc_text(PAGE, FgcSetConfiguration)
+#pragma alloc_text(PAGE, FgcUpdateVolumeAttachments)
+#pragma alloc_text(PAGE, FgcFreeAttachPolicy)
+#pragma alloc_text(PAGE, FgcDeleteLookasideLists)
 #endif
 
 //
@@ -125,6 +166,8 @@ EXTERN_C_END
 typedef struct _FG_CORE_GLOBALS {
 
     ULONG LogLevel;
+    ULONG FilteredOperations; // FG_FILTER_* classes filtered besides creates.
+    FG_ATTACH_POLICY AttachPolicy;
 
     PFLT_FILTER Filter;
 
@@ -134,22 +177,39 @@ typedef struct _FG_CORE_GLOBALS {
     LIST_ENTRY RulesList;
     PEX_PUSH_LOCK RulesListLock;
 
+    LIST_ENTRY InstanceContextsList;        // Contexts of all attached instances.
+    PEX_PUSH_LOCK InstanceContextsListLock;
+
     PFLT_PORT ControlCorePort;   // Communication port exported for CannotAdmin.
     PFLT_PORT ControlClientPort; // Communication port that CannotAdmin connecting to.
 
-    PFLT_PORT MonitorClientPort; // Monitor client port.
     PFLT_PORT MonitorCorePort;   // Monitor core port.
     PFG_MONITOR_CONTEXT MonitorContext;
     PETHREAD MonitorThreadObject;
 
-    ULONG MaxMonitorRecordsAllocated;
-    __volatile ULONG MonitorRecordsAllocated;
-    LIST_ENTRY MonitorRecordsQueue;
-    KSPIN_LOCK MonitorRecordsQueueLock;
+    FG_MONITOR_RINGS MonitorRings; // Per processor rings of the records to be sent.
+
+    __volatile ULONG MonitorBatchSize;      // Bytes pending on a processor that wake the monitor at once.
+    __volatile ULONG MonitorBatchDelay;     // Milliseconds the monitor waits for a batch at most.
+    __volatile ULONG MonitorSendTimeout;    // Milliseconds a records message waits for a client receive.
+    __volatile ULONG MonitorCoalesceWindow; // Milliseconds identical monitor events of a file are coalesced in.
 
     ULONG MaxRuleEntriesAllocated;         // Maximum of rule entries that can be allocated.
     __volatile ULONG RuleEntriesAllocated; // Amount of rule entries allocated.
 
+    __volatile LONG RulesGeneration;          // Bumped on every change of the rules list.
+    __volatile LONG LastRuleId;               // Id of the latest rule created, ids are never reused.
+    __volatile LONG ProcessScopedRulesAmount; // Amount of rules with an image expression.
+
+    FGC_TRUSTED_PROCESS_TABLE TrustedProcesses; // Processes exempted from all rules.
+    FGC_PROCESS_CACHE ProcessCache;             // Requestor process identity and rule subset cache.
+    FGC_FILE_ID_RULE_TABLE FileIdRules;         // Rules keyed by volume serial number and file id.
+
+    FGC_FILE_CONTEXT_STATISTICS FileContextStatistics; // Memory taken by the file contexts.
+
+    LOOKASIDE_LIST_EX CompletionContextsLookaside; // Completion contexts of the matched creates.
+    BOOLEAN CompletionContextsLookasideInitialized;
+
 } FG_CORE_GLOBALS, *PFG_CORE_GLOBALS;
 
 extern FG_CORE_GLOBALS Globals;
@@ -0,0 +1,153 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    FileIdRuleTable.h
+
+Abstract:
+
+    Buckets of the file id rule table. Entries are keyed by the full 64-bit volume
+    serial number and the 128-bit file id, the callers hold the table lock. The
+    buckets only use list and memory primitives, so they are also built by the
+    host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __FILE_ID_RULE_TABLE_H__
+#define __FILE_ID_RULE_TABLE_H__
+
+#define FG_FILE_ID_RULE_TABLE_BUCKETS 256
+
+//
+// Volumes are told apart by the serial number reported by FileIdInformation, which
+// is 64-bit on NTFS and ReFS. 64-bit file ids are zero extended.
+//
+typedef struct _FGC_FILE_ID_RULE_ENTRY {
+
+    //
+    // This field is used to link to table bucket.
+    //
+    LIST_ENTRY List;
+
+    FILE_ID_128 FileId;
+
+    ULONGLONG VolumeSerialNumber;
+
+    FGC_RULE *Rule;
+
+} FGC_FILE_ID_RULE_ENTRY, *PFGC_FILE_ID_RULE_ENTRY;
+
+typedef struct _FGC_FILE_ID_RULE_TABLE {
+
+    PEX_PUSH_LOCK Lock;
+
+    __volatile LONG RulesAmount;
+
+    LIST_ENTRY Buckets[FG_FILE_ID_RULE_TABLE_BUCKETS];
+
+} FGC_FILE_ID_RULE_TABLE, *PFGC_FILE_ID_RULE_TABLE;
+
+FORCEINLINE
+ULONG
+FgcFileIdRuleBucket(
+    _In_ ULONGLONG VolumeSerialNumber,
+    _In_ CONST FILE_ID_128 *FileId
+    )
+{
+    ULONGLONG halves[2] = { 0 };
+
+    RtlCopyMemory(halves, FileId->Identifier, sizeof(halves));
+
+    return (ULONG)((halves[0] ^ halves[1] ^ VolumeSerialNumber) * 0x9E3779B97F4A7C15ull >> 56) &
+           (FG_FILE_ID_RULE_TABLE_BUCKETS - 1);
+}
+
+FORCEINLINE
+PFGC_FILE_ID_RULE_ENTRY
+FgcLookupFileIdRuleEntry(
+    _In_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ ULONGLONG VolumeSerialNumber,
+    _In_ CONST FILE_ID_128 *FileId
+    )
+{
+    PLIST_ENTRY bucket = NULL, listEntry = NULL;
+    PFGC_FILE_ID_RULE_ENTRY entry = NULL;
+
+    bucket = &Table->Buckets[FgcFileIdRuleBucket(VolumeSerialNumber, FileId)];
+    for (listEntry = bucket->Flink; listEntry != bucket; listEntry = listEntry->Flink) {
+        entry = CONTAINING_RECORD(listEntry, FGC_FILE_ID_RULE_ENTRY, List);
+        if (VolumeSerialNumber == entry->VolumeSerialNumber &&
+            RtlEqualMemory(FileId, &entry->FileId, sizeof(FILE_ID_128))) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+FORCEINLINE
+BOOLEAN
+FgcInsertFileIdRuleEntry(
+    _Inout_ PFGC_FILE_ID_RULE_TABLE Table,
+    _Inout_ PFGC_FILE_ID_RULE_ENTRY Entry
+    )
+{
+    if (NULL != FgcLookupFileIdRuleEntry(Table, Entry->VolumeSerialNumber, &Entry->FileId)) return FALSE;
+
+    InsertHeadList(&Table->Buckets[FgcFileIdRuleBucket(Entry->VolumeSerialNumber, &Entry->FileId)], &Entry->List);
+    InterlockedIncrement(&Table->RulesAmount);
+
+    return TRUE;
+}
+
+FORCEINLINE
+LONG
+FgcCountFileIdRuleEntries(
+    _In_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ ULONGLONG VolumeSerialNumber
+    )
+{
+    PLIST_ENTRY listEntry = NULL;
+    ULONG idx = 0ul;
+    LONG rulesAmount = 0l;
+
+    for (; idx < FG_FILE_ID_RULE_TABLE_BUCKETS; idx++) {
+        for (listEntry = Table->Buckets[idx].Flink; listEntry != &Table->Buckets[idx]; listEntry = listEntry->Flink) {
+            if (VolumeSerialNumber == CONTAINING_RECORD(listEntry, FGC_FILE_ID_RULE_ENTRY, List)->VolumeSerialNumber) {
+                rulesAmount++;
+            }
+        }
+    }
+
+    return rulesAmount;
+}
+
+#endif
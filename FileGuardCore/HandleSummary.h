@@ -0,0 +1,155 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    HandleSummary.h
+
+Abstract:
+
+    The counters of the handles summarized in a single monitor record when they
+    are closed. They only update the summary of a handle context, so they are
+    also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __HANDLE_SUMMARY_H__
+#define __HANDLE_SUMMARY_H__
+
+FORCEINLINE
+VOID
+FgcCountHandleWrite(
+    _Inout_ PFG_MONITOR_HANDLE_SUMMARY Summary,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    This routine counts a write request of a summarized handle. The requests of a
+    handle may be issued by many threads at once.
+
+Arguments:
+
+    Summary - The summary of the handle context.
+    Length  - Bytes length of the write request.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    InterlockedIncrement((volatile LONG*)&Summary->Writes);
+    InterlockedAdd64((volatile LONG64*)&Summary->WriteBytes, Length);
+}
+
+FORCEINLINE
+VOID
+FgcCountHandleOperation(
+    _Inout_ PFG_MONITOR_HANDLE_SUMMARY Summary,
+    _In_ ULONG Operation
+    )
+/*++
+
+Routine Description:
+
+    This routine counts a set information request of a summarized handle by the
+    operation class it belongs to. The other classes are not summarized.
+
+Arguments:
+
+    Summary   - The summary of the handle context.
+    Operation - FG_RULE_OPERATION_* class of the request.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    if (FG_RULE_OPERATION_RENAME == Operation) {
+        InterlockedIncrement((volatile LONG*)&Summary->Renames);
+    } else if (FG_RULE_OPERATION_TRUNCATE == Operation) {
+        InterlockedIncrement((volatile LONG*)&Summary->Truncates);
+    }
+}
+
+FORCEINLINE
+VOID
+FgcCountHandleDenied(
+    _Inout_ PFG_MONITOR_HANDLE_SUMMARY Summary
+    )
+/*++
+
+Routine Description:
+
+    This routine counts a request of a summarized handle failed by the rule, it
+    is counted by its class as well.
+
+Arguments:
+
+    Summary - The summary of the handle context.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    InterlockedIncrement((volatile LONG*)&Summary->Denied);
+}
+
+FORCEINLINE
+BOOLEAN
+FgcIsHandleSummaryEmpty(
+    _In_ CONST FG_MONITOR_HANDLE_SUMMARY *Summary
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether a summarized handle had any request counted, a
+    handle without any only has its open recorded.
+
+Arguments:
+
+    Summary - The summary copied from the handle context on cleanup.
+
+Return Value:
+
+    TRUE if no request was counted.
+
+--*/
+{
+    return 0UL == (Summary->Writes | Summary->Truncates | Summary->Renames | Summary->Denied);
+}
+
+#endif
@@ -39,11 +39,221 @@ Environment:
 #include "FileGuardCore.h"
 #include "Monitor.h"
 
-#pragma warning(push)
-#pragma warning(disable: 6001)
+_Check_return_
+NTSTATUS
+FgcInitializeMonitorRings(
+    _Out_ PFG_MONITOR_RINGS Rings
+    )
+/*++
+
+Routine Description:
+
+    This routine allocates a monitor record ring for each processor.
+
+Arguments:
+
+    Rings - Pointer to the rings to be initialized.
+
+Return Value:
+
+    STATUS_SUCCESS                - Success.
+    STATUS_INVALID_PARAMETER_1    - Failure. The 'Rings' parameter is NULL.
+    STATUS_INSUFFICIENT_RESOURCES - Failure. Unable to allocate memory.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG ringsAmount = 0UL;
+    ULONG idx = 0UL;
+
+    PAGED_CODE();
+
+    if (NULL == Rings) return STATUS_INVALID_PARAMETER_1;
+
+    RtlZeroMemory(Rings, sizeof(FG_MONITOR_RINGS));
+
+    ringsAmount = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    status = FgcAllocateBufferEx(&Rings->Rings,
+                                 POOL_FLAG_NON_PAGED | POOL_FLAG_CACHE_ALIGNED,
+                                 sizeof(FG_MONITOR_RING) * ringsAmount,
+                                 FG_MONITOR_RING_NON_PAGED_TAG);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate monitor rings failed", status);
+        goto Cleanup;
+    }
+
+    Rings->RingsAmount = ringsAmount;
+
+    for (idx = 0UL; idx < ringsAmount; idx++) {
+
+        //
+        // The buffer is zeroed by the allocation, every entry starts free.
+        //
+        status = FgcAllocateBufferEx(&Rings->Rings[idx].Buffer,
+                                     POOL_FLAG_NON_PAGED,
+                                     FG_MONITOR_RING_SIZE,
+                                     FG_MONITOR_RING_NON_PAGED_TAG);
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, allocate monitor ring buffer failed", status);
+            goto Cleanup;
+        }
+    }
+
+Cleanup:
+
+    if (!NT_SUCCESS(status)) {
+        FgcFreeMonitorRings(Rings);
+    }
+
+    return status;
+}
+
+VOID
+FgcFreeMonitorRings(
+    _Inout_ PFG_MONITOR_RINGS Rings
+    )
+/*++
+
+Routine Description:
+
+    This routine logs the drop counters of the monitor record rings and frees them,
+    the records still in the rings are discarded.
+
+Arguments:
+
+    Rings - Pointer to the rings to be freed.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    FG_MONITOR_RING *ring = NULL;
+    ULONG idx = 0UL;
+
+    PAGED_CODE();
+
+    if (NULL == Rings || NULL == Rings->Rings) return;
+
+    for (idx = 0UL; idx < Rings->RingsAmount; idx++) {
+
+        ring = &Rings->Rings[idx];
+
+        if (0 != ring->Dropped) {
+            LOG_INFO("Monitor ring of processor %lu dropped: %lld, overflows: %lu",
+                     idx, ring->Dropped, ring->Overflows);
+        }
+
+        if (NULL != ring->Buffer) {
+            FgcFreeBuffer(ring->Buffer);
+        }
+    }
+
+    FgcFreeBuffer(Rings->Rings);
+    RtlZeroMemory(Rings, sizeof(FG_MONITOR_RINGS));
+}
+
+BOOLEAN
+FgcIsMonitorRingsEmpty(
+    _In_ PFG_MONITOR_RINGS Rings
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether all monitor record rings are drained.
+
+Arguments:
+
+    Rings - Pointer to the rings.
+
+Return Value:
+
+    TRUE if no ring holds a reserved entry.
+
+--*/
+{
+    FG_MONITOR_RING *ring = NULL;
+    ULONG idx = 0UL;
+
+    for (idx = 0UL; idx < Rings->RingsAmount; idx++) {
+        ring = &Rings->Rings[idx];
+        if (ReadAcquire64(&ring->Head) != ring->Tail) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+FgcPublishMonitorRecord(
+    _In_ CONST FG_MONITOR_RECORD *Header,
+    _In_ CONST UNICODE_STRING *FilePath,
+    _In_opt_ CONST UNICODE_STRING *RenameFilePath
+    )
+{
+    ULONG recordSize = 0UL;
+    ULONG reserved = 0UL;
+    ULONG fill = 0UL;
+    ULONG batchSize = 0UL;
+    FG_MONITOR_CONTEXT *context = Globals.MonitorContext;
+    FG_MONITOR_RING *ring = NULL;
+    FG_MONITOR_RING_ENTRY *entry = NULL;
+    FG_MONITOR_RECORD *record = NULL;
+    CHAR *filePathPtr = NULL;
+
+    recordSize = sizeof(FG_MONITOR_RECORD) +
+                 FilePath->Length +
+                 (NULL != RenameFilePath ? RenameFilePath->Length : 0);
+
+    ring = &Globals.MonitorRings.Rings[KeGetCurrentProcessorNumberEx(NULL) % Globals.MonitorRings.RingsAmount];
+
+    //
+    // A record larger than a records message could never be sent, in any encoding.
+    //
+    if (recordSize + FG_MONITOR_COMPACT_HEADER_MAX > FG_MONITOR_SEND_RECORD_BUFFER_SIZE ||
+        !FgcReserveMonitorRingEntry(ring,
+                                    (ULONG)FG_MONITOR_RING_ENTRY_SIZE(recordSize),
+                                    &entry,
+                                    &reserved,
+                                    &fill)) {
+        InterlockedIncrement64(&ring->Dropped);
+        return;
+    }
+
+    record = &entry->Record;
+    RtlCopyMemory(record, Header, sizeof(FG_MONITOR_RECORD));
+
+    filePathPtr = (CHAR*)record->Buffer;
+    RtlCopyMemory(filePathPtr, FilePath->Buffer, FilePath->Length);
+    record->FilePathSize = FilePath->Length;
+
+    if (NULL != RenameFilePath) {
+        filePathPtr += FilePath->Length;
+        RtlCopyMemory(filePathPtr, RenameFilePath->Buffer, RenameFilePath->Length);
+        record->RenameFilePathSize = RenameFilePath->Length;
+    }
+
+    //
+    // The publication is a full barrier, it is ordered before the read of the wake
+    // pending flag that the monitor thread resets before checking the rings.
+    //
+    InterlockedExchange(&entry->State, FG_MONITOR_RING_ENTRY_RECORD);
+
+    batchSize = ReadNoFence((volatile LONG*)&Globals.MonitorBatchSize);
+    if (FgcIsMonitorBatchReady(fill, reserved, batchSize)) {
+        KeSetEvent(&context->EventBatchReady, 0, FALSE);
+    }
 
-#define FgcFreeMonitorRecordEntry(_entry_) InterlockedDecrement((volatile LONG*)&Globals.MonitorRecordsAllocated); \
-                                           FgcFreeBuffer((_entry_))
+    if (0 == ReadNoFence(&context->WakePending) &&
+        0 == InterlockedExchange(&context->WakePending, 1)) {
+        KeSetEvent(&context->EventWakeMonitor, 0, FALSE);
+    }
+}
 
 _Check_return_
 NTSTATUS
@@ -59,94 +269,659 @@ FgcRecordRuleMatched(
 
 Routine Description:
 
-    This routine allocates a monitor record entry.
+    This routine writes a monitor record into the ring of the current processor.
+    A record that does not fit in the ring is dropped and counted, the operation
+    is not failed for it.
 
 Arguments:
 
     MajorFunction      - IRP major function.
     MinorFunction      - IRP minior function.
-    RequestorPid       - IO requestor process id.
-    RequestorTid       - IO requestor thread id.
-    IoStatus           - IO status.
     FileIdDescriptor   - File id descriptor.
-    RenameFilePath     - Rename file path.
     FilePath           - File path.
+    RenameFilePath     - Rename file path.
+    Rule               - The matched rule.
 
 Return Value:
 
     STATUS_SUCCESS - Success.
     Other          - Error status.
 
+--*/
+{
+    FG_MONITOR_RECORD header = { 0 };
+
+    if (NULL == FilePath) return STATUS_INVALID_PARAMETER_4;
+
+    header.MajorFunction = MajorFunction;
+    header.MinorFunction = MinorFunction;
+    header.RequestorPid = (ULONG_PTR)PsGetCurrentProcessId();
+    header.RequestorTid = (ULONG_PTR)PsGetCurrentThreadId();
+    KeQuerySystemTime(&header.RecordTime);
+    header.LastRecordTime = header.RecordTime;
+    header.RepeatCount = 1UL;
+
+    if (NULL != FileIdDescriptor) {
+        RtlCopyMemory(&header.FileIdDescriptor,
+                      FileIdDescriptor,
+                      sizeof(FG_FILE_ID_DESCRIPTOR));
+    }
+
+    //
+    // The rule is referred to by its id, the client resolves the expression through
+    // the rule dictionary instead of receiving it with every record.
+    //
+    header.RuleCode = Rule->Code;
+    header.RuleId = Rule->Id;
+
+    FgcPublishMonitorRecord(&header, FilePath, RenameFilePath);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FgcRecordHandleSummary(
+    _In_ CONST UNICODE_STRING *FilePath,
+    _In_ CONST FGC_RULE *Rule,
+    _In_ CONST FG_MONITOR_HANDLE_SUMMARY *Summary
+    )
+/*++
+
+Routine Description:
+
+    This routine writes the summary record of a handle cleaned up into the ring of
+    the current processor, in place of the records of the requests of the handle.
+
+Arguments:
+
+    FilePath - File path.
+    Rule     - The rule of the file when the handle was opened.
+    Summary  - Requests of the handle.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    FG_MONITOR_RECORD header = { 0 };
+
+    header.MajorFunction = IRP_MJ_CLEANUP;
+    header.RequestorPid = (ULONG_PTR)PsGetCurrentProcessId();
+    header.RequestorTid = (ULONG_PTR)PsGetCurrentThreadId();
+    KeQuerySystemTime(&header.RecordTime);
+    header.LastRecordTime = header.RecordTime;
+    header.RepeatCount = 1UL;
+    header.RuleCode = Rule->Code;
+    header.RuleId = Rule->Id;
+    RtlCopyMemory(&header.Summary, Summary, sizeof(FG_MONITOR_HANDLE_SUMMARY));
+
+    FgcPublishMonitorRecord(&header, FilePath, NULL);
+}
+
+static
+VOID
+FgcTakeCoalescedEvents(
+    _Inout_ PFG_COALESCED_EVENTS Coalesced,
+    _Out_ FG_MONITOR_RECORD *Header,
+    _Outptr_ FGC_RULE **Rule
+    )
+{
+    FgcTakeCoalescedWindow(&Coalesced->Window, Header);
+
+    Header->RuleCode = Coalesced->Rule->Code;
+    Header->RuleId = Coalesced->Rule->Id;
+
+    *Rule = Coalesced->Rule;
+
+    Coalesced->Rule = NULL;
+}
+
+static
+VOID
+FgcRecordCoalescedEvents(
+    _In_ PFG_FILE_CONTEXT FileContext,
+    _In_ CONST FG_MONITOR_RECORD *Header,
+    _In_ FGC_RULE *Rule
+    )
+{
+    //
+    // The rule of the file may have been replaced since, the one the events matched
+    // is kept referenced with them.
+    //
+    FgcPublishMonitorRecord(Header,
+                            NULL != FileContext->FileName ? FileContext->FileName : Rule->PathExpression,
+                            NULL);
+
+    FgcReleaseRule(Rule);
+}
+
+BOOLEAN
+FgcCoalesceRuleMatched(
+    _In_ PFG_FILE_CONTEXT FileContext,
+    _In_ UCHAR MajorFunction,
+    _In_ UCHAR MinorFunction,
+    _In_ FGC_RULE *Rule
+    )
+/*++
+
+Routine Description:
+
+    This routine coalesces a monitor event into the events of the file identical to
+    it, if a coalescing window is set and the rule is monitored. An event of another
+    process, IRP major function or rule, or after the window expired, records the
+    events coalesced so far and opens a new window, the caller records it as usual.
+    The events coalesced are recorded by the monitor thread once the window expired
+    otherwise. The coalesced events of a file are allocated by its first event.
+
+Arguments:
+
+    FileContext   - File context of the event.
+    MajorFunction - IRP major function.
+    MinorFunction - IRP minor function.
+    Rule          - The matched rule.
+
+Return Value:
+
+    TRUE if the event is coalesced, FALSE if the caller has to record it.
+
+--*/
+{
+    FG_MONITOR_CONTEXT *context = Globals.MonitorContext;
+    FG_COALESCED_EVENTS *coalesced = NULL;
+    FG_MONITOR_RECORD header = { 0 };
+    FGC_RULE *coalescedRule = NULL;
+    ULONG_PTR requestorPid = (ULONG_PTR)PsGetCurrentProcessId();
+    LARGE_INTEGER now = { 0 };
+    LONGLONG window = 0LL;
+    KIRQL oldIrql = PASSIVE_LEVEL;
+    BOOLEAN queued = FALSE;
+    BOOLEAN wake = FALSE;
+    BOOLEAN coalescedEvent = FALSE;
+
+    if (RuleMinorMonitored != Rule->Code.Minor) return FALSE;
+
+    window = 10000LL * ReadNoFence((volatile LONG*)&Globals.MonitorCoalesceWindow);
+    if (0LL == window) return FALSE;
+
+    coalesced = FgcGetFileContextCoalescedEvents(FileContext);
+    if (NULL == coalesced) return FALSE;
+
+    KeQuerySystemTime(&now);
+
+    KeAcquireSpinLock(&coalesced->Lock, &oldIrql);
+
+    if (FgcIsEventInCoalescedWindow(&coalesced->Window, requestorPid, MajorFunction, Rule->Id, now.QuadPart, window)) {
+
+        //
+        // The first event coalesced links the file to the monitor, a file still linked
+        // since its previous window is not linked again.
+        //
+        queued = coalesced->Queued;
+        if (!queued) {
+            KeAcquireSpinLockAtDpcLevel(&context->CoalescedListLock);
+            if (!context->CoalescedListClosed) {
+                FltReferenceContext(FileContext);
+                InsertTailList(&context->CoalescedList, &coalesced->List);
+                coalesced->Queued = TRUE;
+                queued = TRUE;
+                wake = TRUE;
+            }
+            KeReleaseSpinLockFromDpcLevel(&context->CoalescedListLock);
+        }
+
+        if (queued) {
+            if (FgcCoalesceEvent(&coalesced->Window,
+                                 (ULONG_PTR)PsGetCurrentThreadId(),
+                                 MinorFunction,
+                                 now.QuadPart)) {
+                FgcReferenceRule(Rule);
+                coalesced->Rule = Rule;
+            }
+
+            coalescedEvent = TRUE;
+        }
+
+    } else {
+
+        if (0UL != coalesced->Window.Repeats) {
+            FgcTakeCoalescedEvents(coalesced, &header, &coalescedRule);
+        }
+
+        FgcOpenCoalescedWindow(&coalesced->Window, requestorPid, MajorFunction, Rule->Id, now.QuadPart);
+    }
+
+    KeReleaseSpinLock(&coalesced->Lock, oldIrql);
+
+    if (NULL != coalescedRule) {
+        FgcRecordCoalescedEvents(FileContext, &header, coalescedRule);
+    }
+
+    //
+    // The monitor thread waits for the window of the file to expire once it is woken,
+    // the wake is published as the one of a record.
+    //
+    if (wake &&
+        0 == ReadNoFence(&context->WakePending) &&
+        0 == InterlockedExchange(&context->WakePending, 1)) {
+        KeSetEvent(&context->EventWakeMonitor, 0, FALSE);
+    }
+
+    return coalescedEvent;
+}
+
+BOOLEAN
+FgcFlushCoalescedEvents(
+    _In_ PFG_MONITOR_CONTEXT Context,
+    _In_ BOOLEAN Force
+    )
+/*++
+
+Routine Description:
+
+    This routine records the coalesced events of the files whose window expired and
+    unlinks the files without coalesced events left.
+
+Arguments:
+
+    Context - The monitor context.
+    Force   - Record the coalesced events of all files, their window expired or not.
+
+Return Value:
+
+    TRUE if files are left linked for their window to expire.
+
+--*/
+{
+    LIST_ENTRY pending = { 0 };
+    LIST_ENTRY kept = { 0 };
+    PLIST_ENTRY entry = NULL;
+    FG_COALESCED_EVENTS *coalesced = NULL;
+    FG_FILE_CONTEXT *fileContext = NULL;
+    FG_MONITOR_RECORD header = { 0 };
+    FGC_RULE *coalescedRule = NULL;
+    LARGE_INTEGER now = { 0 };
+    LONGLONG window = 0LL;
+    KIRQL oldIrql = PASSIVE_LEVEL;
+    BOOLEAN queued = FALSE;
+    BOOLEAN closed = FALSE;
+
+    InitializeListHead(&pending);
+    InitializeListHead(&kept);
+
+    //
+    // The files are taken off the list to be recorded without the list lock, they stay
+    // marked as queued so no producer links them again meanwhile.
+    //
+    KeAcquireSpinLock(&Context->CoalescedListLock, &oldIrql);
+    if (!IsListEmpty(&Context->CoalescedList)) {
+        AppendTailList(&pending, &Context->CoalescedList);
+        RemoveEntryList(&Context->CoalescedList);
+        InitializeListHead(&Context->CoalescedList);
+    }
+    KeReleaseSpinLock(&Context->CoalescedListLock, oldIrql);
+
+    while (!IsListEmpty(&pending)) {
+
+        window = 10000LL * ReadNoFence((volatile LONG*)&Globals.MonitorCoalesceWindow);
+        KeQuerySystemTime(&now);
+
+        while (!IsListEmpty(&pending)) {
+
+            entry = RemoveHeadList(&pending);
+            coalesced = CONTAINING_RECORD(entry, FG_COALESCED_EVENTS, List);
+            fileContext = coalesced->FileContext;
+            coalescedRule = NULL;
+
+            KeAcquireSpinLock(&coalesced->Lock, &oldIrql);
+
+            if (0UL != coalesced->Window.Repeats &&
+                (Force || FgcIsCoalescedWindowExpired(&coalesced->Window, now.QuadPart, window))) {
+                FgcTakeCoalescedEvents(coalesced, &header, &coalescedRule);
+            }
+
+            queued = (0UL != coalesced->Window.Repeats);
+            coalesced->Queued = queued;
+
+            KeReleaseSpinLock(&coalesced->Lock, oldIrql);
+
+            if (NULL != coalescedRule) {
+                FgcRecordCoalescedEvents(fileContext, &header, coalescedRule);
+            }
+
+            if (queued) {
+                InsertTailList(&kept, entry);
+            } else {
+                FltReleaseContext(fileContext);
+            }
+        }
+
+        if (IsListEmpty(&kept)) {
+            break;
+        }
+
+        //
+        // The files kept are linked back, unless the list was closed meanwhile, then
+        // they are recorded at once.
+        //
+        KeAcquireSpinLock(&Context->CoalescedListLock, &oldIrql);
+        closed = Context->CoalescedListClosed;
+        if (!closed) {
+            AppendTailList(&Context->CoalescedList, &kept);
+            RemoveEntryList(&kept);
+            InitializeListHead(&kept);
+        }
+        KeReleaseSpinLock(&Context->CoalescedListLock, oldIrql);
+
+        if (closed) {
+            AppendTailList(&pending, &kept);
+            RemoveEntryList(&kept);
+            InitializeListHead(&kept);
+            Force = TRUE;
+        } else {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static
+BOOLEAN
+FgcIsCoalescedListLinked(
+    _In_ PFG_MONITOR_CONTEXT Context
+    )
+{
+    KIRQL oldIrql = PASSIVE_LEVEL;
+    BOOLEAN linked = FALSE;
+
+    KeAcquireSpinLock(&Context->CoalescedListLock, &oldIrql);
+    linked = !IsListEmpty(&Context->CoalescedList);
+    KeReleaseSpinLock(&Context->CoalescedListLock, oldIrql);
+
+    return linked;
+}
+
+VOID
+FgcCloseCoalescedEvents(
+    _In_ PFG_MONITOR_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    This routine closes the coalesced list and records the events coalesced so far,
+    the references to the file contexts are released before the filter unregisters.
+
+Arguments:
+
+    Context - The monitor context.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    KIRQL oldIrql = PASSIVE_LEVEL;
+
+    KeAcquireSpinLock(&Context->CoalescedListLock, &oldIrql);
+    Context->CoalescedListClosed = TRUE;
+    KeReleaseSpinLock(&Context->CoalescedListLock, oldIrql);
+
+    (VOID)FgcFlushCoalescedEvents(Context, TRUE);
+}
+
+_Check_return_
+NTSTATUS
+FgcCreateMonitorChannel(
+    _In_ CONST FG_MONITOR_CHANNEL_SETUP *Setup,
+    _Outptr_ PFG_MONITOR_CHANNEL *Channel
+    )
+/*++
+
+Routine Description:
+
+    This routine creates the channel buffer of a monitor client as a section owned
+    by the driver and maps it into the system space, it must be called in the context
+    of the client process which the event handle belongs to. The client maps its own
+    view of the section by FgcMapMonitorChannel, no page of it is ever locked.
+
+Arguments:
+
+    Setup   - The channel setup passed by the client.
+    Channel - A pointer to a variable that receives the channel.
+
+Return Value:
+
+    STATUS_SUCCESS                - Success.
+    STATUS_INVALID_PARAMETER      - Failure. The buffer size is invalid.
+    STATUS_INSUFFICIENT_RESOURCES - Failure. Unable to allocate memory.
+    Other                         - Failure. The section can not be created or the
+                                    event is inaccessible.
+
 --*/
 {
     NTSTATUS status = STATUS_SUCCESS;
-    SIZE_T allocateSize = 0;
-    FG_MONITOR_RECORD_ENTRY *recordEntry = NULL;
-    CHAR *filePathPtr = NULL;
+    FG_MONITOR_CHANNEL *channel = NULL;
+    OBJECT_ATTRIBUTES attributes = { 0 };
+    LARGE_INTEGER sectionSize = { 0 };
+    HANDLE sectionHandle = NULL;
+    SIZE_T viewSize = 0;
+    ULONG bufferSize = 0UL;
+    ULONG dataSize = 0UL;
+    HANDLE eventHandle = NULL;
 
-    if (NULL == FilePath) return STATUS_INVALID_PARAMETER_5;
+    PAGED_CODE();
+
+    if (NULL == Setup) return STATUS_INVALID_PARAMETER_1;
+    if (NULL == Channel) return STATUS_INVALID_PARAMETER_2;
+
+    bufferSize = Setup->BufferSize;
+    eventHandle = (HANDLE)(ULONG_PTR)Setup->Event;
+
+    if (bufferSize <= sizeof(FG_MONITOR_CHANNEL_HEADER)) return STATUS_INVALID_PARAMETER;
+
+    dataSize = bufferSize - sizeof(FG_MONITOR_CHANNEL_HEADER);
+    if (dataSize < FG_MONITOR_CHANNEL_DATA_SIZE_MIN ||
+        dataSize > FG_MONITOR_CHANNEL_DATA_SIZE_MAX ||
+        0UL != (dataSize & (dataSize - 1))) {
+        return STATUS_INVALID_PARAMETER;
+    }
 
-    if (Globals.MonitorRecordsAllocated >= Globals.MaxMonitorRecordsAllocated) {
-        return STATUS_NO_MORE_ENTRIES;
+    status = FgcAllocateBuffer(&channel, sizeof(FG_MONITOR_CHANNEL));
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate monitor channel failed", status);
+        goto Cleanup;
     }
 
-    allocateSize = sizeof(FG_MONITOR_RECORD_ENTRY) + 
-                   FilePath->Length + 
-                   Rule->PathExpression->Length;
+    RtlZeroMemory(channel, sizeof(FG_MONITOR_CHANNEL));
 
-    status = FgcAllocateBufferEx(&recordEntry, 
-                                 POOL_FLAG_PAGED, 
-                                 allocateSize,
-                                 FG_MONITOR_RECORD_ENTRY_NON_PAGED_TAG);
+    //
+    // A pagefile backed section, the monitor thread writes its system view at passive
+    // level, so the pages can be paged out like any client memory.
+    //
+    InitializeObjectAttributes(&attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+    sectionSize.QuadPart = bufferSize;
+
+    status = ZwCreateSection(&sectionHandle,
+                             SECTION_MAP_READ | SECTION_MAP_WRITE | SECTION_QUERY,
+                             &attributes,
+                             &sectionSize,
+                             PAGE_READWRITE,
+                             SEC_COMMIT,
+                             NULL);
     if (!NT_SUCCESS(status)) {
-        LOG_ERROR("NTSTATUS: 0x%08x, allocate monitor record entry failed", status);
-        return status;
+        LOG_ERROR("NTSTATUS: 0x%08x, create monitor channel section failed", status);
+        goto Cleanup;
     }
 
-    InterlockedIncrement((volatile LONG*)&Globals.MonitorRecordsAllocated);
-    
-    recordEntry->Record.MajorFunction = MajorFunction;
-    recordEntry->Record.MinorFunction = MinorFunction;
-    recordEntry->Record.RequestorPid = (ULONG_PTR)PsGetCurrentProcessId();
-    recordEntry->Record.RequestorTid = (ULONG_PTR)PsGetCurrentThreadId();
-    KeQuerySystemTime(&recordEntry->Record.RecordTime);
+    status = ObReferenceObjectByHandle(sectionHandle,
+                                       SECTION_MAP_READ | SECTION_MAP_WRITE,
+                                       *MmSectionObjectType,
+                                       KernelMode,
+                                       &channel->Section,
+                                       NULL);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, reference monitor channel section failed", status);
+        goto Cleanup;
+    }
 
-    if (NULL != FileIdDescriptor) {
-        RtlCopyMemory(&recordEntry->Record.FileIdDescriptor, 
-                      FileIdDescriptor, 
-                      sizeof(FG_FILE_ID_DESCRIPTOR));
+    status = MmMapViewInSystemSpace(channel->Section, &channel->Header, &viewSize);
+    if (!NT_SUCCESS(status)) {
+        channel->Header = NULL;
+        LOG_ERROR("NTSTATUS: 0x%08x, map monitor channel section failed", status);
+        goto Cleanup;
+    }
+
+    status = ObReferenceObjectByHandle(eventHandle,
+                                       EVENT_MODIFY_STATE,
+                                       *ExEventObjectType,
+                                       UserMode,
+                                       &channel->Event,
+                                       NULL);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, reference monitor channel event failed", status);
+        goto Cleanup;
+    }
+
+    channel->Data = FG_MONITOR_CHANNEL_DATA(channel->Header);
+    channel->DataSize = dataSize;
+
+    channel->Header->DataSize = dataSize;
+    WriteRelease64(&channel->Header->Tail, 0LL);
+    WriteRelease64(&channel->Header->Head, 0LL);
+
+    *Channel = channel;
+
+Cleanup:
+
+    if (NULL != sectionHandle) {
+        ZwClose(sectionHandle);
     }
 
-    recordEntry->Record.RuleCode = Rule->Code;
+    if (!NT_SUCCESS(status) && NULL != channel) {
+        FgcFreeMonitorChannel(channel);
+    }
+
+    return status;
+}
+
+VOID
+FgcFreeMonitorChannel(
+    _In_ PFG_MONITOR_CHANNEL Channel
+    )
+/*++
+
+Routine Description:
+
+    This routine unmaps the system view of the channel buffer of a monitor client and
+    frees the channel. The views mapped into the client stay valid until the client
+    unmaps them or exits, the section is deleted with the last of them.
+
+Arguments:
+
+    Channel - The channel to be freed.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (NULL == Channel) return;
+
+    if (NULL != Channel->Event) {
+        ObDereferenceObject(Channel->Event);
+    }
+
+    if (NULL != Channel->Header) {
+        MmUnmapViewInSystemSpace(Channel->Header);
+    }
+
+    if (NULL != Channel->Section) {
+        ObDereferenceObject(Channel->Section);
+    }
+
+    FgcFreeBuffer(Channel);
+}
+
+_Check_return_
+NTSTATUS
+FgcMapMonitorChannel(
+    _In_ PFG_MONITOR_CHANNEL Channel,
+    _Out_ PVOID *Buffer
+    )
+/*++
+
+Routine Description:
+
+    This routine maps a view of the channel buffer into the current process, it is
+    called in the context of the client asking for it. The view belongs to the client,
+    it is unmapped by the client or when the client exits.
+
+Arguments:
+
+    Channel - The channel to be mapped.
+    Buffer  - A pointer to a variable that receives the address of the view.
+
+Return Value:
+
+    STATUS_SUCCESS - Success.
+    Other          - Failure. The view can not be mapped.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    HANDLE sectionHandle = NULL;
+    PVOID buffer = NULL;
+    SIZE_T viewSize = 0;
+
+    PAGED_CODE();
+
+    *Buffer = NULL;
 
-    filePathPtr = (CHAR*)recordEntry->Record.Buffer;
-    RtlCopyMemory(filePathPtr, Rule->PathExpression->Buffer, Rule->PathExpression->Length);
-    recordEntry->Record.RulePathExpressionSize = Rule->PathExpression->Length;
-    
-    filePathPtr += Rule->PathExpression->Length;
-    RtlCopyMemory(filePathPtr, FilePath->Buffer, FilePath->Length);
-    recordEntry->Record.FilePathSize = FilePath->Length;
+    status = ObOpenObjectByPointer(Channel->Section,
+                                   OBJ_KERNEL_HANDLE,
+                                   NULL,
+                                   SECTION_MAP_READ | SECTION_MAP_WRITE,
+                                   *MmSectionObjectType,
+                                   KernelMode,
+                                   &sectionHandle);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, open monitor channel section failed", status);
+        return status;
+    }
 
-    if (NULL != RenameFilePath) {
-        filePathPtr += FilePath->Length;
-        RtlCopyMemory(filePathPtr, RenameFilePath->Buffer, RenameFilePath->Length);
-        recordEntry->Record.RenameFilePathSize = RenameFilePath->Length;
+    status = ZwMapViewOfSection(sectionHandle,
+                                ZwCurrentProcess(),
+                                &buffer,
+                                0,
+                                0,
+                                NULL,
+                                &viewSize,
+                                ViewUnmap,
+                                0,
+                                PAGE_READWRITE);
+    ZwClose(sectionHandle);
+
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, map monitor channel view failed", status);
+        return status;
     }
 
-    ExInterlockedInsertTailList(&Globals.MonitorRecordsQueue, &recordEntry->List, &Globals.MonitorRecordsQueueLock);
-    KeSetEvent(&Globals.MonitorContext->EventWakeMonitor, 0, FALSE);
+    *Buffer = buffer;
 
-    return status;
+    return STATUS_SUCCESS;
 }
 
-#pragma warning(pop)
-
 _Check_return_
 NTSTATUS
 FgcCreateMonitorStartContext(
     _In_ PFLT_FILTER Filter,
-    _In_ LIST_ENTRY *RecordsQueue,
-    _In_ KSPIN_LOCK *RecordsQueueLock,
+    _In_ PFG_MONITOR_RINGS Rings,
     _In_ PFG_MONITOR_CONTEXT *Context
     )
 /*++
@@ -158,11 +933,9 @@ Routine Description:
 Arguments:
 
     Filter           - Pointer to the filter structure.
-                     
-    RecordsQueue     - A pointer to monitor records queue that save records what need be 
-                       send to user-mode application.
 
-    RecordsQueueLock - Lock of record queue.
+    Rings            - A pointer to the per processor rings of the records what need be
+                       send to user-mode application.
 
     Context          - A pointer to a variable that receives the monitor context.
 
@@ -170,8 +943,8 @@ Return Value:
 
     STATUS_SUCCESS                - Success.
     STATUS_INVALID_PARAMETER_1    - Failure. The 'Filter' parameter is NULL.
-    STATUS_INVALID_PARAMETER_2    - Failure. The 'RecordsQueue' parameter is NULL.
-    STATUS_INVALID_PARAMETER_3    - Failure. The 'QueueMutex' parameter is NULL.
+    STATUS_INVALID_PARAMETER_2    - Failure. The 'Rings' parameter is NULL.
+    STATUS_INVALID_PARAMETER_3    - Failure. The 'Context' parameter is NULL.
     STATUS_INSUFFICIENT_RESOURCES - Failure. Unable to allocate memory.
 
 --*/
@@ -182,7 +955,7 @@ Return Value:
     PAGED_CODE();
 
     if (NULL == Filter) return STATUS_INVALID_PARAMETER_1;
-    if (NULL == RecordsQueue) return STATUS_INVALID_PARAMETER_2;
+    if (NULL == Rings) return STATUS_INVALID_PARAMETER_2;
     if (NULL == Context) return STATUS_INVALID_PARAMETER_3;
 
     status = FgcAllocateBuffer(&context, sizeof(FG_MONITOR_CONTEXT));
@@ -191,22 +964,24 @@ Return Value:
         goto Cleanup;
     }
 
-    status = FgcAllocateBuffer(&context->MessageBody, sizeof(FG_RECORDS_MESSAGE_BODY));
+    status = FgcCreatePushLock(&context->SubscribersLock);
     if (!NT_SUCCESS(status)) {
-        LOG_ERROR("NTSTATUS: 0x%08x, allocate monitor message body failed", status);
+        LOG_ERROR("NTSTATUS: 0x%08x, create monitor subscribers lock failed", status);
         goto Cleanup;
     }
 
     context->Filter = Filter;
-    context->ClientPort = NULL;
-    context->RecordsQueue = RecordsQueue;
-    context->RecordsQueueLock = RecordsQueueLock;
+    context->Rings = Rings;
     //
     // Initialize monitor thread control event.
     //
     KeInitializeEvent(&context->EventWakeMonitor, NotificationEvent, FALSE);
+    KeInitializeEvent(&context->EventBatchReady, NotificationEvent, FALSE);
     KeInitializeEvent(&context->EventPortConnected, NotificationEvent, FALSE);
 
+    InitializeListHead(&context->CoalescedList);
+    KeInitializeSpinLock(&context->CoalescedListLock);
+
     //
     // Initialize daemon flag.
     //
@@ -225,6 +1000,297 @@ Cleanup:
     return status;
 }
 
+_Check_return_
+NTSTATUS
+FgcConnectMonitorSubscriber(
+    _In_ PFG_MONITOR_CONTEXT Context,
+    _In_ PFLT_PORT ClientPort,
+    _In_opt_ CONST FG_MONITOR_CONNECTION_CONTEXT *Connection,
+    _Outptr_ PFG_MONITOR_SUBSCRIBER *Subscriber
+    )
+/*++
+
+Routine Description:
+
+    This routine takes a free subscriber slot for a monitor port connection. The
+    channel buffer of the client is mapped here, the caller must run in the client
+    process.
+
+Arguments:
+
+    Context    - Pointer to the monitor context.
+
+    ClientPort - The client port of the connection.
+
+    Connection - The connection context of the client, a subscriber without one
+                 receives all records through records messages. It is captured
+                 before the call.
+
+    Subscriber - A pointer to a variable that receives the subscriber.
+
+Return Value:
+
+    STATUS_SUCCESS                - Success.
+    STATUS_INVALID_PARAMETER      - Failure. The filter of the connection is invalid.
+    STATUS_TOO_MANY_SESSIONS      - Failure. All subscriber slots are taken.
+    STATUS_INSUFFICIENT_RESOURCES - Failure. Unable to allocate memory.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFG_MONITOR_SUBSCRIBER subscriber = NULL;
+    PFG_MONITOR_CHANNEL channel = NULL;
+    PFG_RECORDS_MESSAGE_BODY messageBody = NULL;
+    FG_MONITOR_FILTER filter = { 0 };
+    ULONG idx = 0UL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NULL != Context);
+    FLT_ASSERT(NULL != ClientPort);
+    FLT_ASSERT(NULL != Subscriber);
+
+    if (NULL != Connection) {
+
+        filter = Connection->Filter;
+
+        if (Connection->Encoding > FG_MONITOR_ENCODING_MAXIMUM ||
+            filter.ProcessIdsAmount > FG_MONITOR_FILTER_PROCESS_IDS_MAX ||
+            filter.RuleIdsAmount > FG_MONITOR_FILTER_RULE_IDS_MAX ||
+            filter.PathPrefixSize > sizeof(filter.PathPrefix) ||
+            0 != filter.PathPrefixSize % sizeof(WCHAR)) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        //
+        // The prefix is matched case insensitive against the file paths.
+        //
+        for (idx = 0UL; idx < filter.PathPrefixSize / sizeof(WCHAR); idx++) {
+            filter.PathPrefix[idx] = RtlUpcaseUnicodeChar(filter.PathPrefix[idx]);
+        }
+    }
+
+    if (NULL != Connection && 0UL != Connection->Channel.BufferSize) {
+        status = FgcCreateMonitorChannel(&Connection->Channel, &channel);
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, create monitor channel failed", status);
+            goto Cleanup;
+        }
+    } else {
+        status = FgcAllocateBuffer(&messageBody, sizeof(FG_RECORDS_MESSAGE_BODY));
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, allocate monitor message body failed", status);
+            goto Cleanup;
+        }
+    }
+
+    FltAcquirePushLockExclusive(Context->SubscribersLock);
+
+    for (idx = 0UL; idx < FG_MONITOR_SUBSCRIBERS_MAX; idx++) {
+        if (NULL == Context->Subscribers[idx].ClientPort) {
+            subscriber = &Context->Subscribers[idx];
+            break;
+        }
+    }
+
+    if (NULL != subscriber) {
+
+        RtlZeroMemory(subscriber, sizeof(FG_MONITOR_SUBSCRIBER));
+        subscriber->ClientPort = ClientPort;
+        subscriber->Filter = filter;
+        subscriber->Channel = channel;
+        subscriber->MessageBody = messageBody;
+        subscriber->Encoding = NULL != Connection ? Connection->Encoding : FG_MONITOR_ENCODING_RECORD;
+        if (NULL != messageBody) {
+            messageBody->Encoding = subscriber->Encoding;
+        }
+
+        if (1UL == ++Context->SubscribersAmount) {
+            KeSetEvent(&Context->EventPortConnected, 0, FALSE);
+        }
+    }
+
+    FltReleasePushLock(Context->SubscribersLock);
+
+    if (NULL == subscriber) {
+        status = STATUS_TOO_MANY_SESSIONS;
+        goto Cleanup;
+    }
+
+    *Subscriber = subscriber;
+
+Cleanup:
+
+    if (!NT_SUCCESS(status)) {
+        if (NULL != channel) {
+            FgcFreeMonitorChannel(channel);
+        }
+
+        if (NULL != messageBody) {
+            FgcFreeBuffer(messageBody);
+        }
+    }
+
+    return status;
+}
+
+VOID
+FgcDisconnectMonitorSubscriber(
+    _In_ PFG_MONITOR_CONTEXT Context,
+    _In_ PFG_MONITOR_SUBSCRIBER Subscriber
+    )
+/*++
+
+Routine Description:
+
+    This routine frees the subscriber slot of a monitor port connection and closes
+    its client port. Nothing is done if the slot was freed already.
+
+Arguments:
+
+    Context    - Pointer to the monitor context.
+
+    Subscriber - The subscriber to be disconnected.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PFLT_PORT clientPort = NULL;
+    PFG_MONITOR_CHANNEL channel = NULL;
+    PFG_RECORDS_MESSAGE_BODY messageBody = NULL;
+    ULONG64 dropped = 0ULL;
+    ULONG sendTimeouts = 0UL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NULL != Context);
+    FLT_ASSERT(NULL != Subscriber);
+
+    //
+    // The monitor thread is done with the subscriber once the lock is acquired.
+    //
+    FltAcquirePushLockExclusive(Context->SubscribersLock);
+
+    clientPort = Subscriber->ClientPort;
+    if (NULL != clientPort) {
+
+        channel = Subscriber->Channel;
+        messageBody = Subscriber->MessageBody;
+        dropped = Subscriber->Dropped;
+        sendTimeouts = Subscriber->SendTimeouts;
+        RtlZeroMemory(Subscriber, sizeof(FG_MONITOR_SUBSCRIBER));
+
+        if (0UL == --Context->SubscribersAmount) {
+            KeClearEvent(&Context->EventPortConnected);
+        }
+    }
+
+    FltReleasePushLock(Context->SubscribersLock);
+
+    if (NULL == clientPort) {
+        return;
+    }
+
+    if (NULL != channel) {
+        FgcFreeMonitorChannel(channel);
+    }
+
+    if (NULL != messageBody) {
+        FgcFreeBuffer(messageBody);
+    }
+
+    FltCloseClientPort(Context->Filter, &clientPort);
+
+    LOG_INFO("Monitor communication port disconnected, dropped: %llu, send timeouts: %lu", dropped, sendTimeouts);
+}
+
+_Check_return_
+NTSTATUS
+FgcMapMonitorSubscriberChannel(
+    _In_ PFG_MONITOR_CONTEXT Context,
+    _In_ PFG_MONITOR_SUBSCRIBER Subscriber,
+    _Out_ PVOID *Buffer
+    )
+/*++
+
+Routine Description:
+
+    This routine maps the channel buffer of a monitor port connection into the
+    current process, which is the client sending the query.
+
+Arguments:
+
+    Context    - Pointer to the monitor context.
+
+    Subscriber - The subscriber of the connection.
+
+    Buffer     - A pointer to a variable that receives the address of the view.
+
+Return Value:
+
+    STATUS_SUCCESS   - Success.
+    STATUS_NOT_FOUND - Failure. The connection has no channel.
+    Other            - Failure. The view can not be mapped.
+
+--*/
+{
+    NTSTATUS status = STATUS_NOT_FOUND;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NULL != Context);
+    FLT_ASSERT(NULL != Subscriber);
+
+    *Buffer = NULL;
+
+    //
+    // The channel is not freed while the lock is held.
+    //
+    FltAcquirePushLockShared(Context->SubscribersLock);
+
+    if (NULL != Subscriber->ClientPort && NULL != Subscriber->Channel) {
+        status = FgcMapMonitorChannel(Subscriber->Channel, Buffer);
+    }
+
+    FltReleasePushLock(Context->SubscribersLock);
+
+    return status;
+}
+
+VOID
+FgcDisconnectMonitorSubscribers(
+    _In_ PFG_MONITOR_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    This routine disconnects all subscribers of the monitor port.
+
+Arguments:
+
+    Context - Pointer to the monitor context.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG idx = 0UL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NULL != Context);
+
+    for (idx = 0UL; idx < FG_MONITOR_SUBSCRIBERS_MAX; idx++) {
+        FgcDisconnectMonitorSubscriber(Context, &Context->Subscribers[idx]);
+    }
+}
+
 _IRQL_requires_max_(APC_LEVEL)
 VOID
 FgcMonitorThreadRoutine(
@@ -248,161 +1314,419 @@ Return Value:
 {
     NTSTATUS status = STATUS_SUCCESS;
     PFG_MONITOR_CONTEXT context = NULL;
-    PFG_RECORDS_MESSAGE_BODY messageBody = NULL;
+    PFG_MONITOR_SUBSCRIBER subscriber = NULL;
+    LARGE_INTEGER batchTimeout = { 0 };
+    LARGE_INTEGER sendTimeout = { 0 };
+    LARGE_INTEGER coalesceTimeout = { 0 };
+    ULONG batchDelay = 0UL;
+    ULONG recordsAmount = 0UL;
+    ULONG bucket = 0UL;
+    ULONG idx = 0UL;
+    BOOLEAN stalled = FALSE;
+    BOOLEAN coalescing = FALSE;
 
     PAGED_CODE();
 
     FLT_ASSERT(NULL != MonitorStartContext);
 
     context = (PFG_MONITOR_CONTEXT)MonitorStartContext;
-    messageBody = (PFG_RECORDS_MESSAGE_BODY)context->MessageBody;
 
     while (!context->EndMonitorFlag) {
 
-        if (STATUS_SUCCESS == status || STATUS_BUFFER_TOO_SMALL == status) {
-            RtlZeroMemory(messageBody, sizeof(FG_RECORDS_MESSAGE_BODY));
+        //
+        // Files with coalesced events have them recorded once their window expired, the
+        // monitor comes back for them even if no record wakes it. A file linked after
+        // the check finds the wake pending flag reset and wakes the monitor.
+        //
+        coalescing = FgcIsCoalescedListLinked(context);
+        coalesceTimeout.QuadPart = -10000LL * ReadNoFence((volatile LONG*)&Globals.MonitorCoalesceWindow);
+
+        KeWaitForSingleObject(&context->EventWakeMonitor,
+                              Executive,
+                              KernelMode,
+                              FALSE,
+                              coalescing ? &coalesceTimeout : NULL);
+
+        //
+        // Let the records accumulate until a ring holds a batch or the delay expires,
+        // a record of light traffic waits for the delay at most. The records that
+        // could not be drained last time are retried after the delay too.
+        //
+        batchDelay = FgcGetMonitorBatchDelay(ReadNoFence((volatile LONG*)&Globals.MonitorBatchDelay), stalled);
+
+        if (0UL != batchDelay) {
+            batchTimeout.QuadPart = -10000LL * batchDelay;
+            KeWaitForSingleObject(&context->EventBatchReady, Executive, KernelMode, FALSE, &batchTimeout);
         }
 
-        KeWaitForSingleObject(&context->EventWakeMonitor, Executive, KernelMode, FALSE, NULL);
+        KeClearEvent(&context->EventBatchReady);
+
+        (VOID)FgcFlushCoalescedEvents(context, FALSE);
 
         KeWaitForSingleObject(&context->EventPortConnected, Executive, KernelMode, FALSE, NULL);
 
-        if (NULL == context->ClientPort) {
+        status = STATUS_SUCCESS;
+        recordsAmount = 0UL;
+
+        FltAcquirePushLockShared(context->SubscribersLock);
+
+        if (0UL == context->SubscribersAmount) {
+            FltReleasePushLock(context->SubscribersLock);
             status = STATUS_PORT_DISCONNECTED;
             goto WaitForNextWake;
         }
 
         //
-        // Get monitor record from record queue.
+        // Drain monitor records from the rings once for all subscribers, each record is
+        // only copied into the channels or the records messages it matches.
         //
-        status = FgcGetRecords(context->RecordsQueue, 
-                               context->RecordsQueueLock, 
-                               messageBody->DataBuffer, 
-                               FG_MONITOR_SEND_RECORD_BUFFER_SIZE, 
-                               &messageBody->DataSize);
-        if (STATUS_BUFFER_TOO_SMALL == status) {
-            goto WaitForNextWake;
+        (VOID)FgcGetRecords(context->Rings, context->Subscribers, FG_MONITOR_SUBSCRIBERS_MAX);
+
+        sendTimeout.QuadPart = -10000LL * ReadNoFence((volatile LONG*)&Globals.MonitorSendTimeout);
+
+        for (idx = 0UL; idx < FG_MONITOR_SUBSCRIBERS_MAX; idx++) {
+
+            subscriber = &context->Subscribers[idx];
+            if (NULL == subscriber->ClientPort) {
+                continue;
+            }
+
+            if (NULL != subscriber->Channel) {
+
+                if (0UL != subscriber->RecordsAmount) {
+                    WriteRelease64(&subscriber->Channel->Header->Head, subscriber->Channel->Head);
+                    KeSetEvent(subscriber->Channel->Event, 0, FALSE);
+                    recordsAmount += subscriber->RecordsAmount;
+                    subscriber->RecordsAmount = 0UL;
+                    FgResetMonitorCompactState(&subscriber->CompactState);
+                }
+
+                continue;
+            }
+
+            if (0UL == subscriber->MessageBody->DataSize) {
+                continue;
+            }
+
+            //
+            // Send records message, it is completed to a receive the client posted. A
+            // client without one in the timeout gets the records, and the ones drained
+            // meanwhile, with a later message. The records message is kept until then.
+            //
+            status = FltSendMessage(context->Filter,
+                                    &subscriber->ClientPort,
+                                    subscriber->MessageBody,
+                                    sizeof(FG_RECORDS_MESSAGE_BODY),
+                                    NULL,
+                                    NULL,
+                                    &sendTimeout);
+            switch (FgcGetMonitorSendResult(status)) {
+            case MonitorSendKept:
+                subscriber->Congested = TRUE;
+                subscriber->SendTimeouts++;
+                continue;
+            case MonitorSendDelivered:
+                recordsAmount += subscriber->RecordsAmount;
+                subscriber->Congested = FALSE;
+                break;
+            default:
+                // TODO Handle error.
+                subscriber->Dropped += subscriber->RecordsAmount;
+                break;
+            }
+
+            subscriber->MessageBody->DataSize = 0UL;
+            subscriber->RecordsAmount = 0UL;
+            FgResetMonitorCompactState(&subscriber->CompactState);
         }
 
         //
-        // Send records message.
+        // A subscriber not receiving its records keeps the monitor retrying.
         //
-        status = FltSendMessage(context->Filter,
-                                &context->ClientPort,
-                                messageBody,
-                                sizeof(FG_RECORDS_MESSAGE_BODY),
-                                NULL,
-                                NULL,
-                                NULL);
-        if (STATUS_PORT_DISCONNECTED == status) {
-            // TODO Handle error.
-        } else if (!NT_SUCCESS(status)) {
-            // TODO
+        status = STATUS_SUCCESS;
+        for (idx = 0UL; idx < FG_MONITOR_SUBSCRIBERS_MAX; idx++) {
+            subscriber = &context->Subscribers[idx];
+            if (NULL != subscriber->ClientPort && NULL == subscriber->Channel &&
+                0UL != subscriber->MessageBody->DataSize) {
+                status = STATUS_TIMEOUT;
+                break;
+            }
+        }
+
+        FltReleasePushLock(context->SubscribersLock);
+
+        if (0UL != recordsAmount) {
+            context->BatchHistogram[FgcGetMonitorBatchBucket(recordsAmount)]++;
         }
 
     WaitForNextWake:
 
-        if (IsListEmpty(context->RecordsQueue) && STATUS_SUCCESS == status) {
+        //
+        // A record published between the clearing and the check sets the event again.
+        // The records left behind a full output are a batch already.
+        //
+        stalled = (STATUS_TIMEOUT == status);
+
+        if (STATUS_SUCCESS == status) {
+            InterlockedExchange(&context->WakePending, 0);
             KeClearEvent(&context->EventWakeMonitor);
+            if (!FgcIsMonitorRingsEmpty(context->Rings)) {
+                if (0UL != recordsAmount) {
+                    KeSetEvent(&context->EventBatchReady, 0, FALSE);
+                } else {
+                    stalled = TRUE;
+                }
+
+                InterlockedExchange(&context->WakePending, 1);
+                KeSetEvent(&context->EventWakeMonitor, 0, FALSE);
+            }
+        }
+    }
+
+    for (bucket = 0UL; bucket < FG_MONITOR_BATCH_HISTOGRAM_BUCKETS; bucket++) {
+        if (0UL == context->BatchHistogram[bucket]) {
+            continue;
+        }
+
+        if (FG_MONITOR_BATCH_HISTOGRAM_BUCKETS - 1 == bucket) {
+            LOG_INFO("Monitor records batches of %lu or more records: %lu",
+                     1UL << bucket, context->BatchHistogram[bucket]);
+        } else {
+            LOG_INFO("Monitor records batches of %lu to %lu records: %lu",
+                     1UL << bucket, (2UL << bucket) - 1, context->BatchHistogram[bucket]);
         }
     }
 
     PsTerminateSystemThread(STATUS_SUCCESS);
 }
 
-#pragma warning(push)
-#pragma warning(disable: 6386)
+static
+ULONG
+FgcGetMonitorRecordCodedSize(
+    _In_ PFG_MONITOR_SUBSCRIBER Subscriber,
+    _In_ CONST FG_MONITOR_RECORD *Record,
+    _In_ ULONG RecordSize
+    )
+{
+    if (FG_MONITOR_ENCODING_COMPACT_V1 == Subscriber->Encoding) {
+        return FgEncodeMonitorRecord(&Subscriber->CompactState, Record, NULL);
+    }
 
-_Check_return_
-NTSTATUS
-FgcGetRecords(
-    _In_ PLIST_ENTRY List,
-    _In_ PKSPIN_LOCK Lock,
-    _Out_writes_bytes_to_(OutputBufferSize, *ReturnOutputBufferSize) PUCHAR OutputBuffer,
-    _In_ ULONG OutputBufferSize,
-    _Out_ PULONG ReturnOutputBufferSize
+    return RecordSize;
+}
+
+static
+BOOLEAN
+FgcIsMonitorRecordFitting(
+    _In_ CONST FG_MONITOR_SUBSCRIBER *Subscriber,
+    _In_ ULONG CodedSize
     )
 {
-    BOOLEAN recordsAvailable = FALSE;
-    PLIST_ENTRY entry = NULL;
-    PFG_MONITOR_RECORD_ENTRY recordEntry = NULL;
-    ULONG bytesWritten = 0UL;
-    KIRQL oldIrql;
-    ULONG writeSize = 0UL;
+    CONST FG_MONITOR_CHANNEL *channel = Subscriber->Channel;
 
-    KeAcquireSpinLock(Lock, &oldIrql);
-    while (!IsListEmpty(List) && (OutputBufferSize > 0)) {
+    if (NULL == channel) {
+        return FgcIsMonitorMessageFitting(Subscriber->MessageBody->DataSize, CodedSize);
+    }
 
-        recordsAvailable = TRUE;
+    return FgIsMonitorChannelFitting(channel->Head,
+                                     ReadAcquire64(&channel->Header->Tail),
+                                     channel->DataSize,
+                                     CodedSize);
+}
 
-        entry = RemoveHeadList(List);
-        recordEntry = CONTAINING_RECORD(entry, FG_MONITOR_RECORD_ENTRY, List);
-        writeSize = sizeof(FG_MONITOR_RECORD) +
-                    recordEntry->Record.RulePathExpressionSize + 
-                    recordEntry->Record.FilePathSize + 
-                    recordEntry->Record.RenameFilePathSize;
+static
+VOID
+FgcWriteMonitorRecord(
+    _Inout_ PFG_MONITOR_SUBSCRIBER Subscriber,
+    _In_ CONST FG_MONITOR_RECORD *Record,
+    _In_ ULONG RecordSize,
+    _In_ ULONG CodedSize
+    )
+{
+    FG_MONITOR_CHANNEL *channel = Subscriber->Channel;
+    FG_RECORDS_MESSAGE_BODY *messageBody = Subscriber->MessageBody;
+    FG_MONITOR_CHANNEL_ENTRY *entry = NULL;
+    BOOLEAN compact = (FG_MONITOR_ENCODING_COMPACT_V1 == Subscriber->Encoding);
+    PUCHAR output = NULL;
+
+    if (NULL == channel) {
+
+        output = messageBody->DataBuffer + messageBody->DataSize;
+        messageBody->DataSize += CodedSize;
+
+    } else {
+
+        entry = FgPutMonitorChannelEntry(channel->Data,
+                                         channel->DataSize,
+                                         &channel->Head,
+                                         &channel->Sequence,
+                                         CodedSize,
+                                         compact ? FG_MONITOR_CHANNEL_ENTRY_COMPACT : FG_MONITOR_CHANNEL_ENTRY_RECORD);
+        output = (PUCHAR)&entry->Record;
+    }
 
-        if (OutputBufferSize < writeSize) {
-            InsertHeadList(List, entry);
-            break;
-        }
+    if (compact) {
+        FgEncodeMonitorRecord(&Subscriber->CompactState, Record, output);
+    } else {
+        RtlCopyMemory(output, Record, RecordSize);
+    }
 
-        KeReleaseSpinLock(Lock, oldIrql);
+    Subscriber->Congested = FALSE;
+    Subscriber->RecordsAmount++;
+}
 
-        try {
-            RtlCopyMemory(OutputBuffer, &recordEntry->Record, writeSize);
-        } except (AsMessageException(GetExceptionInformation(), TRUE)) {
-            ExInterlockedInsertHeadList(List, entry, Lock);
-            return GetExceptionCode();
-        }
+static
+VOID
+FgcDrainMonitorRing(
+    _Inout_ PFG_MONITOR_RING Ring,
+    _Inout_updates_(SubscribersAmount) FG_MONITOR_SUBSCRIBER Subscribers[],
+    _In_ ULONG SubscribersAmount
+    )
+{
+    LONG64 head = ReadAcquire64(&Ring->Head);
+    LONG64 tail = Ring->Tail;
+    LONG64 newTail = tail;
+    FG_MONITOR_RING_ENTRY *entry = NULL;
+    ULONG recordSize = 0UL;
+    ULONG codedSizes[FG_MONITOR_SUBSCRIBERS_MAX] = { 0 };
+    ULONG subscribed = 0UL;
+    ULONG fitting = 0UL;
+    ULONG idx = 0UL;
+    BOOLEAN held = FALSE;
+
+    FLT_ASSERT(SubscribersAmount <= FG_MONITOR_SUBSCRIBERS_MAX);
 
-        bytesWritten += writeSize;
-        OutputBufferSize -= writeSize;
-        OutputBuffer += writeSize;
-        FgcFreeMonitorRecordEntry(recordEntry);
-        
-        KeAcquireSpinLock(Lock, &oldIrql);
-    }
-    KeReleaseSpinLock(Lock, oldIrql);
+    //
+    // Take the published prefix that fits in the outputs in one pass, then hand its
+    // space back to the producers at once.
+    //
+    while (newTail != head) {
+
+        entry = FgcPeekMonitorRingEntry(Ring, newTail);
+        if (NULL == entry) {
+            break;
+        }
 
-    *ReturnOutputBufferSize = bytesWritten;
+        if (FG_MONITOR_RING_ENTRY_RECORD == entry->State) {
+
+            recordSize = sizeof(FG_MONITOR_RECORD) +
+                         entry->Record.RulePathExpressionSize +
+                         entry->Record.FilePathSize +
+                         entry->Record.RenameFilePathSize;
+
+            subscribed = 0UL;
+            fitting = 0UL;
+            held = FALSE;
+
+            for (idx = 0UL; idx < SubscribersAmount; idx++) {
+
+                if (NULL == Subscribers[idx].ClientPort ||
+                    !FgcIsMonitorRecordSubscribed(&Subscribers[idx].Filter, &entry->Record)) {
+                    continue;
+                }
+
+                SetFlag(subscribed, 1UL << idx);
+
+                codedSizes[idx] = FgcGetMonitorRecordCodedSize(&Subscribers[idx], &entry->Record, recordSize);
+                switch (FgcGetMonitorDelivery(FgcIsMonitorRecordFitting(&Subscribers[idx], codedSizes[idx]),
+                                              Subscribers[idx].Congested)) {
+                case MonitorDeliveryWrite:
+                    SetFlag(fitting, 1UL << idx);
+                    break;
+                case MonitorDeliveryHold:
+                    if (NULL != Subscribers[idx].Channel) {
+                        Subscribers[idx].Congested = TRUE;
+                    }
+                    held = TRUE;
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            if (held) {
+                break;
+            }
+
+            for (idx = 0UL; idx < SubscribersAmount; idx++) {
+                if (FlagOn(fitting, 1UL << idx)) {
+                    FgcWriteMonitorRecord(&Subscribers[idx], &entry->Record, recordSize, codedSizes[idx]);
+                } else if (FlagOn(subscribed, 1UL << idx)) {
+                    Subscribers[idx].Dropped++;
+                }
+            }
+        }
 
-    if ((0 == bytesWritten) && recordsAvailable) {
-        return STATUS_BUFFER_TOO_SMALL;
-    } else if (bytesWritten > 0) {
-        return STATUS_SUCCESS;
+        newTail += entry->Size;
     }
 
-    return STATUS_UNSUCCESSFUL;
+    FgcReleaseMonitorRingSpan(Ring, tail, newTail);
 }
 
-VOID
-FgcCleanupMonitorRecords(
-    VOID
+_Check_return_
+NTSTATUS
+FgcGetRecords(
+    _In_ PFG_MONITOR_RINGS Rings,
+    _Inout_updates_(SubscribersAmount) FG_MONITOR_SUBSCRIBER Subscribers[],
+    _In_ ULONG SubscribersAmount
     )
-{
-    PLIST_ENTRY pListEntry = NULL;
-    FG_MONITOR_RECORD_ENTRY *monitorRecordEntry;
-    INT count = 0;
-    KIRQL oldIrql;
+/*++
 
-    KeAcquireSpinLock(&Globals.MonitorRecordsQueueLock, &oldIrql);
+Routine Description:
+
+    This routine drains the monitor record rings into the subscribers whose filters
+    match the records, starting from the ring after the one the previous drain
+    started from. Records of different processors are not ordered by time. The
+    drops of each ring since the previous drain are reported as an overflow.
+
+Arguments:
+
+    Rings             - Pointer to the rings.
+    Subscribers       - The subscribers receiving the records through their channel
+                        or records message, the records amount of each is increased
+                        by the records written. Free slots are skipped.
+    SubscribersAmount - Amount of the subscriber slots.
+
+Return Value:
+
+    STATUS_SUCCESS         - Records written.
+    STATUS_NO_MORE_ENTRIES - No record is available or the outputs are full.
 
-    while (!IsListEmpty(&Globals.MonitorRecordsQueue)) {
+--*/
+{
+    FG_MONITOR_RING *ring = NULL;
+    ULONG recordsAmount = 0UL;
+    ULONG idx = 0UL;
+    ULONG ringIdx = 0UL;
+    LONG64 dropped = 0LL;
+
+    for (idx = 0UL; idx < SubscribersAmount; idx++) {
+        recordsAmount += Subscribers[idx].RecordsAmount;
+    }
+
+    for (idx = 0UL; idx < Rings->RingsAmount; idx++) {
 
-        pListEntry = RemoveHeadList(&Globals.MonitorRecordsQueue);
-        KeReleaseSpinLock(&Globals.MonitorRecordsQueueLock, oldIrql);
+        ringIdx = (Rings->NextRing + idx) % Rings->RingsAmount;
+        ring = &Rings->Rings[ringIdx];
 
-        monitorRecordEntry = CONTAINING_RECORD(pListEntry, FG_MONITOR_RECORD_ENTRY, List);
-        FgcFreeMonitorRecordEntry(monitorRecordEntry);
-        count++;
+        FgcDrainMonitorRing(ring, Subscribers, SubscribersAmount);
 
-        KeAcquireSpinLock(&Globals.MonitorRecordsQueueLock, &oldIrql);
+        dropped = ReadNoFence64(&ring->Dropped);
+        if (dropped != ring->DroppedReported) {
+            ring->Overflows++;
+            LOG_WARNING("Monitor ring of processor %lu overflowed, dropped: %lld, overflows: %lu",
+                        ringIdx, dropped - ring->DroppedReported, ring->Overflows);
+            ring->DroppedReported = dropped;
+        }
     }
 
-    KeReleaseSpinLock(&Globals.MonitorRecordsQueueLock, oldIrql);
+    Rings->NextRing = (Rings->NextRing + 1) % Rings->RingsAmount;
+
+    for (idx = 0UL; idx < SubscribersAmount; idx++) {
+        recordsAmount -= Subscribers[idx].RecordsAmount;
+    }
 
-    DBG_TRACE("Clean monitor record count: %d", count);
+    return 0UL != recordsAmount ? STATUS_SUCCESS : STATUS_NO_MORE_ENTRIES;
 }
 
-#pragma warning(pop)
\ No newline at end of file
+#pragma warning(pop)
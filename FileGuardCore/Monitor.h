@@ -41,19 +41,24 @@ Environment:
 #ifndef __MONITOR_H__
 #define __MONITOR_H__
 
-typedef struct _FG_MONITOR_RECORD_ENTRY {
+#include "MonitorFilter.h"
+#include "MonitorRing.h"
 
-    //
-    // This field is used to link to list.
-    //
-    LIST_ENTRY List;
-    
-    //
-    // The monitor record.
-    //
-    FG_MONITOR_RECORD Record;
+_Check_return_
+NTSTATUS
+FgcInitializeMonitorRings(
+    _Out_ PFG_MONITOR_RINGS Rings
+    );
 
-} FG_MONITOR_RECORD_ENTRY, *PFG_MONITOR_RECORD_ENTRY;
+VOID
+FgcFreeMonitorRings(
+    _Inout_ PFG_MONITOR_RINGS Rings
+    );
+
+BOOLEAN
+FgcIsMonitorRingsEmpty(
+    _In_ PFG_MONITOR_RINGS Rings
+    );
 
 _Check_return_
 NTSTATUS
@@ -66,32 +71,132 @@ FgcRecordRuleMatched(
     _In_ CONST FGC_RULE* Rule
     );
 
-#define FG_MONITOR_SEND_RECORD_BUFFER_SIZE (32 * 1024)
+BOOLEAN
+FgcCoalesceRuleMatched(
+    _In_ PFG_FILE_CONTEXT FileContext,
+    _In_ UCHAR MajorFunction,
+    _In_ UCHAR MinorFunction,
+    _In_ FGC_RULE *Rule
+    );
+
+VOID
+FgcRecordHandleSummary(
+    _In_ CONST UNICODE_STRING *FilePath,
+    _In_ CONST FGC_RULE *Rule,
+    _In_ CONST FG_MONITOR_HANDLE_SUMMARY *Summary
+    );
+
+typedef struct _FG_MONITOR_CHANNEL {
+
+    // Section of the channel buffer. It is never locked, the views mapped into the
+    // client keep it alive until they are unmapped, whatever happens to the port.
+    PVOID Section;
+
+    // System view of the channel buffer, the client can write it at any time, only
+    // `Tail` is read from it.
+    PFG_MONITOR_CHANNEL_HEADER Header;
+    PUCHAR Data;
+    ULONG DataSize;
+
+    // Client event set when records were written.
+    PKEVENT Event;
+
+    // Bytes written, published to the header after each drain.
+    LONG64 Head;
+
+    // Sequence number of the next record.
+    ULONGLONG Sequence;
+
+} FG_MONITOR_CHANNEL, *PFG_MONITOR_CHANNEL;
+
+_Check_return_
+NTSTATUS
+FgcCreateMonitorChannel(
+    _In_ CONST FG_MONITOR_CHANNEL_SETUP *Setup,
+    _Outptr_ PFG_MONITOR_CHANNEL *Channel
+    );
+
+VOID
+FgcFreeMonitorChannel(
+    _In_ PFG_MONITOR_CHANNEL Channel
+    );
+
+_Check_return_
+NTSTATUS
+FgcMapMonitorChannel(
+    _In_ PFG_MONITOR_CHANNEL Channel,
+    _Out_ PVOID *Buffer
+    );
+
+//
+// A monitor port connection, the records it subscribed to are written into its
+// channel if the client set one up or else into its records message.
+//
+typedef struct _FG_MONITOR_SUBSCRIBER {
+
+    // Client port, NULL if the subscriber slot is free.
+    PFLT_PORT ClientPort;
+
+    // Records the subscriber receives, the path prefix is upcased.
+    FG_MONITOR_FILTER Filter;
+
+    PFG_MONITOR_CHANNEL Channel;
+    PFG_RECORDS_MESSAGE_BODY MessageBody;
+
+    // FG_MONITOR_ENCODING_* of the records, the compact state is reset at each delivery.
+    ULONG Encoding;
+    FG_MONITOR_COMPACT_STATE CompactState;
+
+    // Records written since the last delivery.
+    ULONG RecordsAmount;
+
+    // Set when the last delivery failed for lack of room in the client, the records
+    // of a congested subscriber are dropped rather than held in the rings.
+    BOOLEAN Congested;
+
+    ULONG64 Dropped;
+    ULONG SendTimeouts;
+
+} FG_MONITOR_SUBSCRIBER, *PFG_MONITOR_SUBSCRIBER;
 
 typedef struct _FG_MONITOR_CONTEXT {
 
     // Filter object.
     PFLT_FILTER Filter;
 
-    // User application client port.
-    PFLT_PORT   ClientPort;
+    // Per processor monitor record rings.
+    PFG_MONITOR_RINGS Rings;
+
+    // The event to notify monitor daemon to send records, set by the first record
+    // published after a drain.
+    KEVENT EventWakeMonitor;
 
-    // Monitor record queue.
-    PLIST_ENTRY RecordsQueue;
+    // Non-zero while the wake event is set or about to be set.
+    __volatile LONG WakePending;
 
-    // Monitor reocrd queue lock.
-    KSPIN_LOCK *RecordsQueueLock;
+    // The event to end the batching delay early, set when a ring fills past the
+    // batch size.
+    KEVENT EventBatchReady;
 
-    // The event to notify monitor daemon to send records.
-    KEVENT EventWakeMonitor;
+    // Amount of records batches delivered by the power of 2 of their records amount.
+    ULONG BatchHistogram[FG_MONITOR_BATCH_HISTOGRAM_BUCKETS];
 
-    // This event will be set when user application connected to
-    // monitor port. When the monitor user port closed, the event 
-    // will be clear.
+    // This event is set while at least one subscriber is connected to the
+    // monitor port.
     KEVENT EventPortConnected;
 
-    // Monitor records message body.
-    PFG_RECORDS_MESSAGE_BODY MessageBody;
+    // Subscribers of the monitor port. The lock is held shared while the monitor
+    // thread delivers the records and exclusive to connect or disconnect one.
+    FG_MONITOR_SUBSCRIBER Subscribers[FG_MONITOR_SUBSCRIBERS_MAX];
+    ULONG SubscribersAmount;
+    PEX_PUSH_LOCK SubscribersLock;
+
+    // File contexts with coalesced events, the monitor thread records the events of
+    // a file once its window expired. No file context is linked after the list is
+    // closed.
+    LIST_ENTRY CoalescedList;
+    KSPIN_LOCK CoalescedListLock;
+    BOOLEAN CoalescedListClosed;
 
     // Monitor daemon thread ending flag.
     __volatile BOOLEAN EndMonitorFlag;
@@ -102,11 +207,49 @@ _Check_return_
 NTSTATUS
 FgcCreateMonitorStartContext(
     _In_ PFLT_FILTER Filter,
-    _In_ LIST_ENTRY *RecordsQueue,
-    _In_ KSPIN_LOCK *RecordsQueueLock,
+    _In_ PFG_MONITOR_RINGS Rings,
     _In_ PFG_MONITOR_CONTEXT *Context
     );
 
+_Check_return_
+NTSTATUS
+FgcConnectMonitorSubscriber(
+    _In_ PFG_MONITOR_CONTEXT Context,
+    _In_ PFLT_PORT ClientPort,
+    _In_opt_ CONST FG_MONITOR_CONNECTION_CONTEXT *Connection,
+    _Outptr_ PFG_MONITOR_SUBSCRIBER *Subscriber
+    );
+
+VOID
+FgcDisconnectMonitorSubscriber(
+    _In_ PFG_MONITOR_CONTEXT Context,
+    _In_ PFG_MONITOR_SUBSCRIBER Subscriber
+    );
+
+_Check_return_
+NTSTATUS
+FgcMapMonitorSubscriberChannel(
+    _In_ PFG_MONITOR_CONTEXT Context,
+    _In_ PFG_MONITOR_SUBSCRIBER Subscriber,
+    _Out_ PVOID *Buffer
+    );
+
+VOID
+FgcDisconnectMonitorSubscribers(
+    _In_ PFG_MONITOR_CONTEXT Context
+    );
+
+BOOLEAN
+FgcFlushCoalescedEvents(
+    _In_ PFG_MONITOR_CONTEXT Context,
+    _In_ BOOLEAN Force
+    );
+
+VOID
+FgcCloseCoalescedEvents(
+    _In_ PFG_MONITOR_CONTEXT Context
+    );
+
 FORCEINLINE
 VOID
 FgcFreeMonitorStartContext(
@@ -114,8 +257,9 @@ FgcFreeMonitorStartContext(
     )
 {
     if (NULL != Context) {
-        if (NULL != Context->MessageBody) {
-            FgcFreeBuffer(Context->MessageBody);
+        if (NULL != Context->SubscribersLock) {
+            FgcDisconnectMonitorSubscribers(Context);
+            FgcFreePushLock(Context->SubscribersLock);
         }
 
         FgcFreeBuffer(Context);
@@ -131,20 +275,22 @@ FgcMonitorThreadRoutine(
 _Check_return_
 NTSTATUS
 FgcGetRecords(
-    _In_ PLIST_ENTRY List,
-    _In_ PKSPIN_LOCK ListMutex,
-    _Out_writes_bytes_to_(OutputBufferSize, *ReturnOutputBufferSize) PUCHAR OutputBuffer,
-    _In_ ULONG OutputBufferSize,
-    _Out_ PULONG ReturnOutputBufferSize
-    );
-
-VOID
-FgcCleanupMonitorRecords(
-    VOID
+    _In_ PFG_MONITOR_RINGS Rings,
+    _Inout_updates_(SubscribersAmount) FG_MONITOR_SUBSCRIBER Subscribers[],
+    _In_ ULONG SubscribersAmount
     );
 
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, FgcInitializeMonitorRings)
+#pragma alloc_text(PAGE, FgcFreeMonitorRings)
+#pragma alloc_text(PAGE, FgcCreateMonitorChannel)
+#pragma alloc_text(PAGE, FgcFreeMonitorChannel)
+#pragma alloc_text(PAGE, FgcMapMonitorChannel)
 #pragma alloc_text(PAGE, FgcCreateMonitorStartContext)
+#pragma alloc_text(PAGE, FgcConnectMonitorSubscriber)
+#pragma alloc_text(PAGE, FgcDisconnectMonitorSubscriber)
+#pragma alloc_text(PAGE, FgcMapMonitorSubscriberChannel)
+#pragma alloc_text(PAGE, FgcDisconnectMonitorSubscribers)
 #pragma alloc_text(PAGE, FgcMonitorThreadRoutine)
 #endif
 
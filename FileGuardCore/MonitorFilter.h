@@ -0,0 +1,124 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    MonitorFilter.h
+
+Abstract:
+
+    The subscription filters the monitor subscribers select records with. They
+    only compare the fields of a record, so they are also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __MONITOR_FILTER_H__
+#define __MONITOR_FILTER_H__
+
+FORCEINLINE
+BOOLEAN
+FgcIsMonitorRecordSubscribed(
+    _In_ CONST FG_MONITOR_FILTER *Filter,
+    _In_ CONST FG_MONITOR_RECORD *Record
+    )
+/*++
+
+Routine Description:
+
+    This routine checks a monitor record against the filter of a subscriber. A zero
+    field of the filter selects any record, the fields set must all match. The path
+    prefix of the filter is upcased when the subscriber connects.
+
+Arguments:
+
+    Filter - The filter of the subscriber.
+    Record - The record drained from a monitor ring.
+
+Return Value:
+
+    TRUE if the subscriber selects the record.
+
+--*/
+{
+    CONST WCHAR *filePath = NULL;
+    ULONG idx = 0UL;
+
+    if (0UL != Filter->RuleMajors) {
+        if (Record->RuleCode.Major >= 32 ||
+            !FlagOn(Filter->RuleMajors, FG_MONITOR_FILTER_RULE_MAJOR(Record->RuleCode.Major))) {
+            return FALSE;
+        }
+    }
+
+    if (0UL != Filter->MajorFunctions) {
+        if (Record->MajorFunction >= 32 ||
+            !FlagOn(Filter->MajorFunctions, FG_MONITOR_FILTER_MAJOR_FUNCTION(Record->MajorFunction))) {
+            return FALSE;
+        }
+    }
+
+    if (0UL != Filter->ProcessIdsAmount) {
+        for (idx = 0UL; idx < Filter->ProcessIdsAmount; idx++) {
+            if ((ULONG_PTR)Filter->ProcessIds[idx] == Record->RequestorPid) break;
+        }
+
+        if (idx == Filter->ProcessIdsAmount) {
+            return FALSE;
+        }
+    }
+
+    if (0UL != Filter->RuleIdsAmount) {
+        for (idx = 0UL; idx < Filter->RuleIdsAmount; idx++) {
+            if (Filter->RuleIds[idx] == Record->RuleId) break;
+        }
+
+        if (idx == Filter->RuleIdsAmount) {
+            return FALSE;
+        }
+    }
+
+    if (0 != Filter->PathPrefixSize) {
+
+        if (Record->FilePathSize < Filter->PathPrefixSize) {
+            return FALSE;
+        }
+
+        filePath = Record->Buffer + Record->RulePathExpressionSize / sizeof(WCHAR);
+        for (idx = 0UL; idx < Filter->PathPrefixSize / sizeof(WCHAR); idx++) {
+            if (RtlUpcaseUnicodeChar(filePath[idx]) != Filter->PathPrefix[idx]) {
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+#endif
@@ -0,0 +1,463 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    MonitorRing.h
+
+Abstract:
+
+    The per processor rings buffering the monitor records, and the batching and
+    delivery decisions of the monitor thread draining them. They only move bytes
+    and counters, so they are also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __MONITOR_RING_H__
+#define __MONITOR_RING_H__
+
+//
+// Monitor records are written into a ring of preallocated non-paged memory of the
+// processor the requestor runs on, and drained by the monitor thread.
+//
+#define FG_MONITOR_RING_SIZE (64 * 1024) // Must be a power of 2.
+
+#define FG_MONITOR_RING_ENTRY_FREE    0
+#define FG_MONITOR_RING_ENTRY_RECORD  1
+#define FG_MONITOR_RING_ENTRY_PADDING 2
+
+typedef struct _FG_MONITOR_RING_ENTRY {
+
+    //
+    // Bytes size of the entry, including this header and the alignment padding.
+    //
+    ULONG Size;
+
+    //
+    // FG_MONITOR_RING_ENTRY_*, written last by the producer to publish the entry.
+    //
+    __volatile LONG State;
+
+    //
+    // The monitor record, absent from a padding entry.
+    //
+    FG_MONITOR_RECORD Record;
+
+} FG_MONITOR_RING_ENTRY, *PFG_MONITOR_RING_ENTRY;
+
+#define FG_MONITOR_RING_ENTRY_SIZE(_record_size_) \
+    ALIGN_UP_BY(FIELD_OFFSET(FG_MONITOR_RING_ENTRY, Record) + (_record_size_), sizeof(LONGLONG))
+
+typedef struct DECLSPEC_CACHEALIGN _FG_MONITOR_RING {
+
+    //
+    // Bytes reserved by the producers and consumed by the monitor thread since the ring
+    // was created, the entry offsets are these counters modulo the ring size. They live
+    // on their own cache lines so that the producers and the consumer do not share one.
+    //
+    DECLSPEC_CACHEALIGN __volatile LONG64 Head;
+    DECLSPEC_CACHEALIGN __volatile LONG64 Tail;
+
+    //
+    // Records dropped because the ring was full.
+    //
+    __volatile LONG64 Dropped;
+
+    //
+    // Drops already reported, and the drains that found new drops. Monitor thread only.
+    //
+    LONG64 DroppedReported;
+    ULONG Overflows;
+
+    PUCHAR Buffer;
+
+} FG_MONITOR_RING, *PFG_MONITOR_RING;
+
+typedef struct _FG_MONITOR_RINGS {
+
+    //
+    // One ring per processor.
+    //
+    PFG_MONITOR_RING Rings;
+    ULONG RingsAmount;
+
+    //
+    // Ring the next drain starts from, so that a busy processor can not starve the
+    // others. Monitor thread only.
+    //
+    ULONG NextRing;
+
+} FG_MONITOR_RINGS, *PFG_MONITOR_RINGS;
+
+#define FG_MONITOR_BATCH_HISTOGRAM_BUCKETS 10
+
+#define FG_MONITOR_SEND_RECORD_BUFFER_SIZE (32 * 1024)
+
+//
+// What the monitor thread does with a drained record for a subscriber it matches.
+//
+typedef enum _FGC_MONITOR_DELIVERY {
+    MonitorDeliveryWrite = 0,   // Written into the channel or the records message of the subscriber.
+    MonitorDeliveryHold,        // Left in the ring with the records behind it until the next drain.
+    MonitorDeliveryDrop         // Dropped for the subscriber alone.
+} FGC_MONITOR_DELIVERY;
+
+//
+// What becomes of a records message sent to a subscriber.
+//
+typedef enum _FGC_MONITOR_SEND {
+    MonitorSendDelivered = 0,   // A receive the client posted took it.
+    MonitorSendKept,            // No receive was posted in time, it is sent again with the records drained meanwhile.
+    MonitorSendFailed           // Its records are dropped.
+} FGC_MONITOR_SEND;
+
+FORCEINLINE
+BOOLEAN
+FgcReserveMonitorRingEntry(
+    _Inout_ PFG_MONITOR_RING Ring,
+    _In_ ULONG EntrySize,
+    _Outptr_ PFG_MONITOR_RING_ENTRY *Entry,
+    _Out_ PULONG Reserved,
+    _Out_ PULONG Fill
+    )
+/*++
+
+Routine Description:
+
+    This routine reserves an entry in a monitor record ring. The producers of a ring
+    are the requestors running on its processor, they may be preempted by one another
+    between the reservation and the publication, so the head is advanced with an
+    interlocked compare exchange. An entry never wraps around the end of the buffer,
+    the rest of the buffer is reserved as a padding entry instead.
+
+Arguments:
+
+    Ring      - The ring of the processor.
+    EntrySize - Bytes size of the entry, FG_MONITOR_RING_ENTRY_SIZE of the record.
+    Entry     - Receives the entry, its state is published by the caller.
+    Reserved  - Receives the bytes reserved, the padding included.
+    Fill      - Receives the bytes of the ring in use once the entry is reserved.
+
+Return Value:
+
+    TRUE if the entry is reserved, FALSE if the ring is full.
+
+--*/
+{
+    LONG64 head = 0LL;
+    LONG64 newHead = 0LL;
+    LONG64 tail = 0LL;
+    ULONG offset = 0UL;
+    ULONG padding = 0UL;
+    FG_MONITOR_RING_ENTRY *paddingEntry = NULL;
+
+    do {
+        head = ReadAcquire64(&Ring->Head);
+        offset = (ULONG)(head & (FG_MONITOR_RING_SIZE - 1));
+        padding = (FG_MONITOR_RING_SIZE - offset < EntrySize) ? FG_MONITOR_RING_SIZE - offset : 0UL;
+        newHead = head + padding + EntrySize;
+
+        tail = ReadAcquire64(&Ring->Tail);
+        if (newHead - tail > FG_MONITOR_RING_SIZE) {
+            return FALSE;
+        }
+
+    } while (head != InterlockedCompareExchange64(&Ring->Head, newHead, head));
+
+    if (0UL != padding) {
+        paddingEntry = (FG_MONITOR_RING_ENTRY*)(Ring->Buffer + offset);
+        paddingEntry->Size = padding;
+        WriteRelease(&paddingEntry->State, FG_MONITOR_RING_ENTRY_PADDING);
+        offset = 0UL;
+    }
+
+    *Entry = (FG_MONITOR_RING_ENTRY*)(Ring->Buffer + offset);
+    (*Entry)->Size = EntrySize;
+    *Reserved = padding + EntrySize;
+    *Fill = (ULONG)(newHead - tail);
+
+    return TRUE;
+}
+
+FORCEINLINE
+PFG_MONITOR_RING_ENTRY
+FgcPeekMonitorRingEntry(
+    _In_ PFG_MONITOR_RING Ring,
+    _In_ LONG64 Position
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the entry at a position of a monitor record ring, below the
+    head the monitor thread read.
+
+Arguments:
+
+    Ring     - The ring being drained.
+    Position - Bytes consumed from the ring so far, the tail of the drain.
+
+Return Value:
+
+    The published entry, NULL if it is reserved but not published yet. The entries
+    behind it wait for the next drain.
+
+--*/
+{
+    FG_MONITOR_RING_ENTRY *entry = (FG_MONITOR_RING_ENTRY*)(Ring->Buffer + (Position & (FG_MONITOR_RING_SIZE - 1)));
+
+    if (FG_MONITOR_RING_ENTRY_FREE == ReadAcquire(&entry->State)) {
+        return NULL;
+    }
+
+    return entry;
+}
+
+#pragma warning(push)
+#pragma warning(disable: 6386)
+
+FORCEINLINE
+VOID
+FgcReleaseMonitorRingSpan(
+    _Inout_ PFG_MONITOR_RING Ring,
+    _In_ LONG64 Tail,
+    _In_ LONG64 NewTail
+    )
+/*++
+
+Routine Description:
+
+    This routine hands the space of the drained entries back to the producers at once.
+    Entries of the next lap may start anywhere in the span, it is zeroed so that no
+    stale state is taken as published. The span wraps around at most once.
+
+Arguments:
+
+    Ring    - The ring being drained.
+    Tail    - The tail of the ring before the drain.
+    NewTail - The position past the last drained entry.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG offset = (ULONG)(Tail & (FG_MONITOR_RING_SIZE - 1));
+    ULONG length = (ULONG)(NewTail - Tail);
+    ULONG firstLength = 0UL;
+
+    if (0UL == length) return;
+
+    firstLength = min(length, FG_MONITOR_RING_SIZE - offset);
+    RtlZeroMemory(Ring->Buffer + offset, firstLength);
+    if (length > firstLength) {
+        RtlZeroMemory(Ring->Buffer, length - firstLength);
+    }
+
+    WriteRelease64(&Ring->Tail, NewTail);
+}
+
+#pragma warning(pop)
+
+FORCEINLINE
+BOOLEAN
+FgcIsMonitorBatchReady(
+    _In_ ULONG Fill,
+    _In_ ULONG Reserved,
+    _In_ ULONG BatchSize
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether a reservation filled a ring past the batch size, the
+    monitor thread then ends its batching delay early. Only the reservation crossing
+    the batch size ends it, the ones behind it find the event set already.
+
+Arguments:
+
+    Fill      - The bytes of the ring in use once the entry is reserved.
+    Reserved  - The bytes reserved for the entry, the padding included.
+    BatchSize - The batch size in bytes, zero to wake the monitor thread at once.
+
+Return Value:
+
+    TRUE if the batching delay ends.
+
+--*/
+{
+    return 0UL == BatchSize || (Fill >= BatchSize && Fill - Reserved < BatchSize);
+}
+
+FORCEINLINE
+ULONG
+FgcGetMonitorBatchDelay(
+    _In_ ULONG BatchDelay,
+    _In_ BOOLEAN Stalled
+    )
+/*++
+
+Routine Description:
+
+    This routine returns how long the monitor thread lets the records accumulate
+    before it drains the rings. A record of light traffic waits for the delay at
+    most. The records that could not be delivered last time are retried after a
+    delay, even without batching, so that the thread does not spin on them.
+
+Arguments:
+
+    BatchDelay - The batch delay in milliseconds, zero for no batching.
+    Stalled    - TRUE if the records of the last drain could not all be delivered.
+
+Return Value:
+
+    The delay in milliseconds, zero to drain at once.
+
+--*/
+{
+    return (Stalled && 0UL == BatchDelay) ? 1UL : BatchDelay;
+}
+
+FORCEINLINE
+ULONG
+FgcGetMonitorBatchBucket(
+    _In_ ULONG RecordsAmount
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the histogram bucket of a delivered batch, the power of 2
+    of its records amount.
+
+Arguments:
+
+    RecordsAmount - The records delivered by a drain, not zero.
+
+Return Value:
+
+    The bucket, the last one counts the batches at least as large as it.
+
+--*/
+{
+    ULONG bucket = 0UL;
+
+    BitScanReverse(&bucket, RecordsAmount);
+
+    return min(bucket, FG_MONITOR_BATCH_HISTOGRAM_BUCKETS - 1);
+}
+
+FORCEINLINE
+BOOLEAN
+FgcIsMonitorMessageFitting(
+    _In_ ULONG DataSize,
+    _In_ ULONG CodedSize
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether a records message has room for a coded record.
+
+Arguments:
+
+    DataSize  - Bytes of the records message in use.
+    CodedSize - Bytes size of the record, coded as it is written.
+
+Return Value:
+
+    TRUE if the record fits.
+
+--*/
+{
+    return FG_MONITOR_SEND_RECORD_BUFFER_SIZE - DataSize >= CodedSize;
+}
+
+FORCEINLINE
+FGC_MONITOR_DELIVERY
+FgcGetMonitorDelivery(
+    _In_ BOOLEAN Fitting,
+    _In_ BOOLEAN Congested
+    )
+/*++
+
+Routine Description:
+
+    This routine decides what the monitor thread does with a drained record for a
+    subscriber it matches. A record stays in the ring while a subscriber has no room
+    for it, unless the subscriber is congested: its last delivery failed for lack of
+    room, then the record is dropped for that subscriber alone so that a slow client
+    does not stall the others.
+
+Arguments:
+
+    Fitting   - TRUE if the output of the subscriber has room for the coded record.
+    Congested - TRUE if the subscriber is congested.
+
+Return Value:
+
+    What is done with the record for the subscriber.
+
+--*/
+{
+    if (Fitting) return MonitorDeliveryWrite;
+
+    return Congested ? MonitorDeliveryDrop : MonitorDeliveryHold;
+}
+
+FORCEINLINE
+FGC_MONITOR_SEND
+FgcGetMonitorSendResult(
+    _In_ NTSTATUS Status
+    )
+/*++
+
+Routine Description:
+
+    This routine returns what becomes of a records message FltSendMessage returned
+    for. A send timing out returns STATUS_TIMEOUT, which passes NT_SUCCESS.
+
+Arguments:
+
+    Status - The status FltSendMessage returned.
+
+Return Value:
+
+    What becomes of the records message.
+
+--*/
+{
+    if (STATUS_TIMEOUT == Status) return MonitorSendKept;
+
+    return NT_SUCCESS(Status) ? MonitorSendDelivered : MonitorSendFailed;
+}
+
+#endif
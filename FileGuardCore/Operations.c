@@ -41,6 +41,294 @@ Environment:
 
 #pragma warning(disable: 4057)
 
+//
+// A maximum allowed open only knows its access after the file system granted it.
+//
+#define FgcGetGrantedAccess(_data_) \
+    ((_data_)->Iopb->Parameters.Create.SecurityContext->AccessState->PreviouslyGrantedAccess)
+
+#define FgcGetDeniedCreateStatus(_rule_) \
+    (RuleMajorAccessDenied == (_rule_)->Code.Major ? STATUS_ACCESS_DENIED : STATUS_MEDIA_WRITE_PROTECTED)
+
+static
+BOOLEAN
+FgcIsCreateDenied(
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ FGC_RULE *Rule
+    )
+{
+    //
+    // These dispositions always write the file, as if the open desired write access.
+    // An open-if only writes when it creates the file, which is only known after the
+    // open, it is rolled back in post-create.
+    //
+    switch (Data->Iopb->Parameters.Create.Options >> 24) {
+    case FILE_SUPERSEDE:
+    case FILE_CREATE:
+    case FILE_OVERWRITE:
+    case FILE_OVERWRITE_IF:
+        return FG_RULE_OPEN_DENIED(Rule->Code, Rule->Operations, FG_WRITE_ACCESS_MASK);
+    }
+
+    return FG_RULE_OPEN_DENIED(Rule->Code, Rule->Operations, Data->Iopb->Parameters.Create.SecurityContext->DesiredAccess);
+}
+
+static
+BOOLEAN
+FgcIsCreateDeferrable(
+    _In_ PFLT_CALLBACK_DATA Data
+    )
+{
+    PUNICODE_STRING fileName = &Data->Iopb->TargetFileObject->FileName;
+    ULONG options = Data->Iopb->Parameters.Create.Options;
+    USHORT idx = 0;
+
+    //
+    // The verdict of a process scoped rule depends on the requestor, it is not cached.
+    //
+    if (0 != ReadNoFence(&Globals.ProcessScopedRulesAmount)) return FALSE;
+
+    if (FILE_OPEN != (options >> 24)) return FALSE;
+    if (FlagOn(options, FILE_DELETE_ON_CLOSE)) return FALSE;
+
+    //
+    // The file context is shared by all streams of a file, named streams are matched
+    // by their own names.
+    //
+    for (idx = fileName->Length / sizeof(WCHAR); idx > 0; idx--) {
+        if (L'\\' == fileName->Buffer[idx - 1]) break;
+        if (L':' == fileName->Buffer[idx - 1]) return FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+FgcIsShortNameOpen(
+    _In_ PFLT_CALLBACK_DATA Data
+    )
+{
+    PUNICODE_STRING fileName = &Data->Iopb->TargetFileObject->FileName;
+    USHORT idx = 0;
+
+    //
+    // The path of a relative open is not known here, the related directory may have
+    // been opened by its short name as well.
+    //
+    if (NULL != Data->Iopb->TargetFileObject->RelatedFileObject) return TRUE;
+
+    for (; idx < fileName->Length / sizeof(WCHAR); idx++) {
+        if (L'~' == fileName->Buffer[idx]) return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// The rules are written with long names, an open which may hold a short name in
+// its path is matched by its normalized name.
+//
+#define FgcGetCreateNameOptions(_data_) \
+    ((FgcIsShortNameOpen(_data_) ? FLT_FILE_NAME_NORMALIZED : FLT_FILE_NAME_OPENED) | FLT_FILE_NAME_QUERY_DEFAULT)
+
+static
+BOOLEAN
+FgcIsCreateParentRuled(
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PFG_INSTANCE_CONTEXT InstanceContext,
+    _In_opt_ PFGC_RULE_SUBSET VolumeRules
+    )
+{
+    PUNICODE_STRING fileName = &Data->Iopb->TargetFileObject->FileName;
+    UNICODE_STRING parentPath = { 0 };
+    USHORT idx = 0;
+
+    //
+    // The parent directory is only known without a name query for a full path of
+    // long names, any other open is always treated as ruled.
+    //
+    if (FgcIsShortNameOpen(Data)) return TRUE;
+    if (fileName->Length < sizeof(WCHAR) || L'\\' != fileName->Buffer[0]) return TRUE;
+
+    for (idx = fileName->Length / sizeof(WCHAR); idx > 0; idx--) {
+        if (L'\\' == fileName->Buffer[idx - 1]) break;
+    }
+
+    parentPath.Buffer = fileName->Buffer;
+    parentPath.Length = idx * sizeof(WCHAR);
+    parentPath.MaximumLength = parentPath.Length;
+
+    return FgcIsDirectoryRuled(InstanceContext, VolumeRules, &parentPath);
+}
+
+static
+_Check_return_
+NTSTATUS
+FgcMatchOpenByFileIdRule(
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PFG_INSTANCE_CONTEXT InstanceContext,
+    _Out_ PFG_FILE_ID_DESCRIPTOR FileIdDescriptor,
+    _Outptr_result_maybenull_ FGC_RULE **MatchedRule
+    )
+{
+    PUNICODE_STRING fileName = &Data->Iopb->TargetFileObject->FileName;
+
+    *MatchedRule = NULL;
+
+    if (!FlagOn(Data->Iopb->Parameters.Create.Options, FILE_OPEN_BY_FILE_ID)) return STATUS_SUCCESS;
+    if (0 == ReadNoFence(&InstanceContext->FileIdRulesAmount)) return STATUS_SUCCESS;
+
+    //
+    // The file name of an open by file id relative to the volume is the binary file id.
+    //
+    if (sizeof(LARGE_INTEGER) != fileName->Length && sizeof(FILE_ID_128) != fileName->Length) return STATUS_SUCCESS;
+
+    RtlZeroMemory(FileIdDescriptor, sizeof(FG_FILE_ID_DESCRIPTOR));
+    FileIdDescriptor->VolumeSerialNumber = InstanceContext->VolumeSerialNumber;
+    RtlCopyMemory(&FileIdDescriptor->FileId, fileName->Buffer, fileName->Length);
+
+    return FgcMatchFileIdRule(&Globals.FileIdRules, FileIdDescriptor, MatchedRule);
+}
+
+static
+_Check_return_
+NTSTATUS
+FgcMatchOpenedFileIdRule(
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
+    _Out_ PFG_FILE_ID_DESCRIPTOR FileIdDescriptor,
+    _Outptr_result_maybenull_ FGC_RULE **MatchedRule
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    FILE_ID_INFORMATION fileIdInformation = { 0 };
+
+    *MatchedRule = NULL;
+
+    status = FltQueryInformationFile(Instance,
+                                     FileObject,
+                                     &fileIdInformation,
+                                     sizeof(FILE_ID_INFORMATION),
+                                     FileIdInformation,
+                                     NULL);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, query file id information failed", status);
+        return status;
+    }
+
+    RtlZeroMemory(FileIdDescriptor, sizeof(FG_FILE_ID_DESCRIPTOR));
+    FileIdDescriptor->VolumeSerialNumber = fileIdInformation.VolumeSerialNumber;
+    RtlCopyMemory(&FileIdDescriptor->FileId.FileId128, &fileIdInformation.FileId, sizeof(FILE_ID_128));
+
+    return FgcMatchFileIdRule(&Globals.FileIdRules, FileIdDescriptor, MatchedRule);
+}
+
+static
+BOOLEAN
+FgcIsCreateDestructive(
+    _In_ PFLT_CALLBACK_DATA Data
+    )
+{
+    //
+    // These change the existing file before the post-operation could cancel the open.
+    //
+    switch (Data->Iopb->Parameters.Create.Options >> 24) {
+    case FILE_SUPERSEDE:
+    case FILE_OVERWRITE:
+    case FILE_OVERWRITE_IF:
+        return TRUE;
+    }
+
+    return BooleanFlagOn(Data->Iopb->Parameters.Create.Options, FILE_DELETE_ON_CLOSE);
+}
+
+static
+_Check_return_
+NTSTATUS
+FgcMatchCreateTargetFileIdRule(
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Out_ PFG_FILE_ID_DESCRIPTOR FileIdDescriptor,
+    _Outptr_result_maybenull_ FGC_RULE **MatchedRule
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFLT_FILE_NAME_INFORMATION nameInfo = NULL;
+    OBJECT_ATTRIBUTES attributes = { 0 };
+    IO_STATUS_BLOCK ioStatus = { 0 };
+    HANDLE fileHandle = NULL;
+    PFILE_OBJECT fileObject = NULL;
+
+    *MatchedRule = NULL;
+
+    status = FltGetFileNameInformation(Data, FLT_FILE_NAME_OPENED | FLT_FILE_NAME_QUERY_DEFAULT, &nameInfo);
+    if (!NT_SUCCESS(status)) {
+        DBG_ERROR("NTSTATUS: '0x%08x', get file name information failed", status);
+        goto Cleanup;
+    }
+
+    //
+    // The target is opened below this filter without any access which could change
+    // it, only to read its file id before the open proper reaches the file system.
+    //
+    InitializeObjectAttributes(&attributes,
+                               &nameInfo->Name,
+                               OBJ_KERNEL_HANDLE | 
+                               (FlagOn(Data->Iopb->OperationFlags, SL_CASE_SENSITIVE) ? 0 : OBJ_CASE_INSENSITIVE),
+                               NULL,
+                               NULL);
+
+    status = FltCreateFileEx2(Globals.Filter,
+                              FltObjects->Instance,
+                              &fileHandle,
+                              &fileObject,
+                              FILE_READ_ATTRIBUTES | SYNCHRONIZE,
+                              &attributes,
+                              &ioStatus,
+                              NULL,
+                              FILE_ATTRIBUTE_NORMAL,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              FILE_OPEN,
+                              FILE_OPEN_REPARSE_POINT | FILE_SYNCHRONOUS_IO_NONALERT,
+                              NULL,
+                              0UL,
+                              IO_IGNORE_SHARE_ACCESS_CHECK,
+                              NULL);
+    if (STATUS_OBJECT_NAME_NOT_FOUND == status || STATUS_OBJECT_PATH_NOT_FOUND == status) {
+
+        //
+        // A file created by the open has a new file id, no file id rule matches it.
+        //
+        fileHandle = NULL;
+        status = STATUS_SUCCESS;
+        goto Cleanup;
+
+    } else if (!NT_SUCCESS(status)) {
+        fileHandle = NULL;
+        LOG_ERROR("NTSTATUS: 0x%08x, open create target '%wZ' failed", status, &nameInfo->Name);
+        goto Cleanup;
+    }
+
+    status = FgcMatchOpenedFileIdRule(FltObjects->Instance, fileObject, FileIdDescriptor, MatchedRule);
+
+Cleanup:
+
+    if (NULL != fileObject) {
+        ObDereferenceObject(fileObject);
+    }
+
+    if (NULL != fileHandle) {
+        FltClose(fileHandle);
+    }
+
+    if (NULL != nameInfo) {
+        FltReleaseFileNameInformation(nameInfo);
+    }
+
+    return status;
+}
+
 FLT_PREOP_CALLBACK_STATUS
 FgcPreCreateCallback(
     _Inout_ PFLT_CALLBACK_DATA Data,
@@ -72,13 +360,14 @@ Return Value:
 {
     NTSTATUS status = STATUS_SUCCESS;
     FLT_PREOP_CALLBACK_STATUS callbackStatus = FLT_PREOP_SUCCESS_WITH_CALLBACK;
-    ULONG createDisposition = 0ul;
     PFLT_FILE_NAME_INFORMATION nameInfo = NULL;
     PFG_COMPLETION_CONTEXT completionContext = NULL;
+    PFG_INSTANCE_CONTEXT instanceContext = NULL;
+    PFGC_RULE_SUBSET volumeRules = NULL;
     FGC_RULE *rule = NULL;
-    BOOLEAN exist = FALSE;
-
-    UNREFERENCED_PARAMETER(FltObjects);
+    FG_FILE_ID_DESCRIPTOR fileIdDescriptor = { 0 };
+    LONG generation = 0l;
+    BOOLEAN deferrable = FALSE;
 
     PAGED_CODE();
 
@@ -86,14 +375,111 @@ Return Value:
     FLT_ASSERT(NULL != Data->Iopb);
     FLT_ASSERT(IRP_MJ_CREATE == Data->Iopb->MajorFunction);
 
-    createDisposition = Data->Iopb->Parameters.Create.Options >> 24;
-
     if (FlagOn(Data->Iopb->TargetFileObject->Flags, FO_VOLUME_OPEN)) {
         callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
         goto Cleanup;
     }
 
-    status = FltGetFileNameInformation(Data, FLT_FILE_NAME_OPENED | FLT_FILE_NAME_QUERY_DEFAULT, &nameInfo);
+    //
+    // No rule could match files on the volume, skip it before any name query.
+    //
+    status = FltGetInstanceContext(FltObjects->Instance, &instanceContext);
+    if (NT_SUCCESS(status)) {
+        if (0 == ReadNoFence(&instanceContext->RulesAmount) && 
+            0 == ReadNoFence(&instanceContext->FileIdRulesAmount)) {
+            callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+            goto Cleanup;
+        }
+    }
+
+    status = STATUS_SUCCESS;
+
+    //
+    // Trusted processes are exempted from all rules, skip them before any name query.
+    //
+    if (FgcIsTrustedProcess(&Globals.TrustedProcesses, FltGetRequestorProcess(Data))) {
+        callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+        goto Cleanup;
+    }
+
+    //
+    // An open by file id is denied by the file id rule before it reaches the file system,
+    // so is an open for write access of a readonly file. An open by name which changes
+    // the existing file is never left to the post-operation on a volume with file id
+    // rules, the file id of its target is resolved before the open.
+    //
+    if (NULL != instanceContext) {
+        status = FgcMatchOpenByFileIdRule(Data, instanceContext, &fileIdDescriptor, &rule);
+        if (NT_SUCCESS(status) &&
+            NULL == rule &&
+            !FlagOn(Data->Iopb->Parameters.Create.Options, FILE_OPEN_BY_FILE_ID) &&
+            0 != ReadNoFence(&instanceContext->FileIdRulesAmount) &&
+            FgcIsCreateDestructive(Data)) {
+            status = FgcMatchCreateTargetFileIdRule(Data, FltObjects, &fileIdDescriptor, &rule);
+        }
+
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, match open by file id rule failed", status);
+            goto Cleanup;
+
+        } else if (NULL != rule && FgcIsCreateDenied(Data, rule)) {
+            status = FgcRecordRuleMatched(Data->Iopb->MajorFunction,
+                                          Data->Iopb->MinorFunction,
+                                          &fileIdDescriptor,
+                                          rule->PathExpression,
+                                          NULL,
+                                          rule);
+            if (!NT_SUCCESS(status)) {
+                LOG_ERROR("NTSTATUS: 0x%08x, record rule matched failed", status);
+                goto Cleanup;
+            }
+
+            SET_CALLBACK_DATA_STATUS(Data, FgcGetDeniedCreateStatus(rule));
+            callbackStatus = FLT_PREOP_COMPLETE;
+            goto Cleanup;
+        }
+
+        if (NULL != rule) {
+            FgcReleaseRule(rule);
+            rule = NULL;
+        }
+    }
+
+    //
+    // A plain open changes nothing, it is matched after the open so the verdict
+    // cached in the file context of an opened stream is found before any name query.
+    // So is every other open on a volume which only has file id rules, an open
+    // changing the file was matched above. Any other open is matched by its name
+    // before the open, so a denied file is never created nor changed.
+    //
+    deferrable = FgcIsCreateDeferrable(Data);
+    if (NULL != instanceContext && (deferrable || 0 == ReadNoFence(&instanceContext->RulesAmount))) {
+
+        if (0 == ReadNoFence(&instanceContext->RulesAmount) && 
+            0 == ReadNoFence(&instanceContext->FileIdRulesAmount)) {
+            callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+            goto Cleanup;
+        }
+
+        status = FgcAllocateCompletionContext(Data->Iopb->MajorFunction, &completionContext);
+        if (!NT_SUCCESS(status)) {
+            DBG_ERROR("Error(0x%08x), allocate create callback context failed", status);
+            goto Cleanup;
+        }
+
+        completionContext->Create.Deferred = TRUE;
+        completionContext->Create.Cacheable = deferrable;
+        *CompletionContext = completionContext;
+        goto Cleanup;
+    }
+
+    if (NULL != instanceContext) {
+        volumeRules = FgcGetInstanceRules(instanceContext);
+    }
+
+    generation = ReadAcquire(&Globals.RulesGeneration);
+
+    status = FltGetFileNameInformation(Data, FgcGetCreateNameOptions(Data), &nameInfo);
     if (!NT_SUCCESS(status)) {
         DBG_ERROR("NTSTATUS: '0x%08x', get file name information failed", status);
         goto Cleanup;
@@ -106,12 +492,12 @@ Return Value:
     }
     
     try {
-        status = FgcMatchRules(&Globals.RulesList, Globals.RulesListLock, &nameInfo->Name, &rule);
+        status = FgcMatchProcessRules(FltGetRequestorProcess(Data), volumeRules, &nameInfo->Name, &rule);
         if (!NT_SUCCESS(status)) {
             LOG_ERROR("NTSTATUS: 0x%08x try match file '%wZ' rule failed", status, &nameInfo->Name);
             goto Cleanup;
 
-        } else if (NULL != rule) {
+        } else if (NULL != rule && FgcIsRuleOperationApplied(rule, FG_RULE_OPERATION_CREATE)) {
             status = FgcRecordRuleMatched(Data->Iopb->MajorFunction,
                                           Data->Iopb->MinorFunction,
                                           NULL,
@@ -123,34 +509,12 @@ Return Value:
                 goto Cleanup;
             }
 
-            if (RuleMajorAccessDenied == rule->Code.Major) {
-                SET_CALLBACK_DATA_STATUS(Data, STATUS_ACCESS_DENIED);
+            if (FgcIsCreateDenied(Data, rule)) {
+                SET_CALLBACK_DATA_STATUS(Data, FgcGetDeniedCreateStatus(rule));
                 callbackStatus = FLT_PREOP_COMPLETE;
                 goto Cleanup;
-
-            } else if (RuleMajorReadonly == rule->Code.Major) {
-                if (FILE_CREATE == createDisposition || 
-                    FILE_OVERWRITE == createDisposition || 
-                    FILE_OVERWRITE_IF == createDisposition) {
-                    SET_CALLBACK_DATA_STATUS(Data, STATUS_MEDIA_WRITE_PROTECTED);
-                    callbackStatus = FLT_PREOP_COMPLETE;
-                    goto Cleanup;
-
-                } else if (FILE_OPEN_IF == createDisposition) {
-                    status = FgcCheckFileExists(FltObjects->Instance, &nameInfo->Name, &exist);
-                    if (!NT_SUCCESS(status)) {
-                        LOG_ERROR("NTSTATUS: 0x%08x, check file existence failed", status);
-                        goto Cleanup;
-                    }
-
-                    if (!exist) {
-                        SET_CALLBACK_DATA_STATUS(Data, STATUS_MEDIA_WRITE_PROTECTED);
-                        callbackStatus = FLT_PREOP_COMPLETE;
-                        goto Cleanup;
-                    }
-                }
             }
-        } else {
+        } else if (NULL == rule && (NULL == instanceContext || 0 == ReadNoFence(&instanceContext->FileIdRulesAmount))) {
             callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
             goto Cleanup;
         }
@@ -171,8 +535,9 @@ Return Value:
     } else {
         FltReferenceFileNameInformation(nameInfo);
         completionContext->Create.FileNameInfo = nameInfo;
-        FgcReferenceRule(rule);
+        if (NULL != rule) FgcReferenceRule(rule);
         completionContext->Create.MatchedRule = rule;
+        completionContext->Create.Generation = generation;
         *CompletionContext = completionContext;
     }
     
@@ -187,6 +552,14 @@ Cleanup:
         FgcReleaseRule(rule);
     }
 
+    if (NULL != volumeRules) {
+        FgcReleaseRuleSubset(volumeRules);
+    }
+
+    if (NULL != instanceContext) {
+        FltReleaseContext(instanceContext);
+    }
+
     if (NULL != nameInfo) {
         FltReleaseFileNameInformation(nameInfo);
     }
@@ -194,6 +567,102 @@ Cleanup:
     return callbackStatus;
 }
 
+static
+NTSTATUS
+FgcEnforceDeferredCreate(
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_opt_ CONST FG_FILE_ID_DESCRIPTOR *FileIdDescriptor,
+    _In_ PUNICODE_STRING FileName,
+    _In_ FGC_RULE *Rule
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (!FgcIsRuleOperationApplied(Rule, FG_RULE_OPERATION_CREATE)) return STATUS_SUCCESS;
+
+    status = FgcRecordRuleMatched(Data->Iopb->MajorFunction,
+                                  Data->Iopb->MinorFunction,
+                                  FileIdDescriptor,
+                                  FileName,
+                                  NULL,
+                                  Rule);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, record rule matched failed", status);
+        return status;
+    }
+
+    //
+    // A plain open changes nothing, the readonly rule only denies the write access.
+    //
+    return FG_RULE_OPEN_DENIED(Rule->Code, Rule->Operations, FgcGetGrantedAccess(Data)) ? 
+           FgcGetDeniedCreateStatus(Rule) : 
+           STATUS_SUCCESS;
+}
+
+static
+VOID
+FgcSetupHandleSummary(
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ FGC_RULE *Rule
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFG_HANDLE_CONTEXT handleContext = NULL;
+
+    if (!FlagOn(Globals.FilteredOperations, FG_FILTER_CLEANUP) ||
+        RuleMinorMonitored != Rule->Code.Minor ||
+        FgcIsTrustedProcess(&Globals.TrustedProcesses, FltGetRequestorProcess(Data)) ||
+        !FgcIsRuleAppliedToProcess(Rule, FltGetRequestorProcess(Data))) {
+        return;
+    }
+
+    status = FltAllocateContext(Globals.Filter,
+                                FLT_STREAMHANDLE_CONTEXT,
+                                sizeof(FG_HANDLE_CONTEXT),
+                                NonPagedPool,
+                                &handleContext);
+    if (!NT_SUCCESS(status)) {
+        DBG_WARNING("NTSTATUS: '0x%08x', allocate handle context failed", status);
+        return;
+    }
+
+    RtlZeroMemory(handleContext, sizeof(FG_HANDLE_CONTEXT));
+    FgcReferenceRule(Rule);
+    handleContext->Rule = Rule;
+
+    //
+    // The requests of a handle without a context are recorded one by one as usual.
+    //
+    status = FltSetStreamHandleContext(FltObjects->Instance,
+                                       FltObjects->FileObject,
+                                       FLT_SET_CONTEXT_KEEP_IF_EXISTS,
+                                       handleContext,
+                                       NULL);
+    if (!NT_SUCCESS(status)) {
+        DBG_WARNING("NTSTATUS: '0x%08x', set handle context failed", status);
+    }
+
+    FltReleaseContext(handleContext);
+}
+
+static
+PFG_HANDLE_CONTEXT
+FgcGetHandleSummary(
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    )
+{
+    PFG_HANDLE_CONTEXT handleContext = NULL;
+
+    if (!FlagOn(Globals.FilteredOperations, FG_FILTER_CLEANUP)) return NULL;
+
+    if (!NT_SUCCESS(FltGetStreamHandleContext(FltObjects->Instance, FltObjects->FileObject, &handleContext))) {
+        return NULL;
+    }
+
+    return handleContext;
+}
+
 FLT_POSTOP_CALLBACK_STATUS
 FgcPostCreateCallback(
     _Inout_ PFLT_CALLBACK_DATA Data,
@@ -232,10 +701,13 @@ Return Value:
     PFG_COMPLETION_CONTEXT completionContext = CompletionContext;
     PFLT_FILE_NAME_INFORMATION nameInfo = NULL;
     FGC_RULE *matchedRule = NULL;
-    FGC_RULE *oldRule = NULL;
     PFG_FILE_CONTEXT fileContext = NULL, oldFileContext = NULL;
-
-    UNREFERENCED_PARAMETER(FltObjects);
+    PFG_INSTANCE_CONTEXT instanceContext = NULL;
+    PFGC_RULE_SUBSET volumeRules = NULL;
+    FG_FILE_ID_DESCRIPTOR fileIdDescriptor = { 0 };
+    FGC_DEFERRED_CREATE_MATCH match = DeferredCreateMatchFileId;
+    LONG generation = 0l;
+    BOOLEAN deferred = FALSE, matchedByFileId = FALSE;
 
     PAGED_CODE();
 
@@ -244,108 +716,595 @@ Return Value:
     FLT_ASSERT(IRP_MJ_CREATE == Data->Iopb->MajorFunction);
     FLT_ASSERT(NULL != completionContext);
     FLT_ASSERT(IRP_MJ_CREATE == completionContext->MajorFunction);
-    FLT_ASSERT(NULL != completionContext->Create.FileNameInfo);
 
     nameInfo = completionContext->Create.FileNameInfo;
     matchedRule = completionContext->Create.MatchedRule;
+    generation = completionContext->Create.Generation;
+    deferred = completionContext->Create.Deferred;
+
+    FLT_ASSERT(deferred || NULL != nameInfo);
 
     if (FlagOn(Flags, FLTFL_POST_OPERATION_DRAINING)) {
         status = STATUS_DEVICE_REMOVED;
         goto Cleanup;
     }
     
-    if (!NT_SUCCESS(Data->IoStatus.Status)) {
-        DBG_WARNING("File '%wZ' operation result status: 0x%08x", &nameInfo->Name, Data->IoStatus.Status);
+    if (!NT_SUCCESS(Data->IoStatus.Status) || STATUS_REPARSE == Data->IoStatus.Status) {
+        DBG_WARNING("File '%wZ' operation result status: 0x%08x", 
+                    deferred ? &Data->Iopb->TargetFileObject->FileName : &nameInfo->Name, 
+                    Data->IoStatus.Status);
         goto Cleanup;
     }
 
     //
-    // Get or setup file context for file.
+    // A readonly file must not be created, delete the file created by an open-if.
     //
+    if (!deferred && 
+        NULL != matchedRule && 
+        FgcIsCreateRolledBack(Data->Iopb->Parameters.Create.Options >> 24,
+                              Data->IoStatus.Information,
+                              matchedRule->Code,
+                              matchedRule->Operations)) {
+        FgcDeleteCreatedFile(FltObjects->Instance, FltObjects->FileObject);
+        status = STATUS_MEDIA_WRITE_PROTECTED;
+        goto Cleanup;
+    }
+
     status = FltGetFileContext(Data->Iopb->TargetInstance, Data->Iopb->TargetFileObject, &fileContext);
     if (!NT_SUCCESS(status) && STATUS_NOT_FOUND != status) {
         DBG_ERROR("NTSTATUS: '0x%08x', get file context failed", status);
         goto Cleanup;
+    }
 
-    } else if (STATUS_NOT_FOUND == status) {
-
-        status = FltAllocateContext(Globals.Filter, 
-                                    FLT_FILE_CONTEXT, 
-                                    sizeof(FG_FILE_CONTEXT), 
-                                    NonPagedPool,
-                                    &fileContext);
-        if (!NT_SUCCESS(status)) {
-            DBG_ERROR("NTSTATUS: '0x%08x', allocate file context failed", status);
+    status = STATUS_SUCCESS;
+
+    if (deferred) {
+
+        if (!NT_SUCCESS(FltGetInstanceContext(FltObjects->Instance, &instanceContext))) goto Cleanup;
+
+        //
+        // The verdict cached by an earlier open of the stream is enforced if the rules
+        // did not change since. The file context is shared by all the links of the
+        // file, a rule matched by the name of another link is enforced on this one as
+        // well, which is only ever stricter than its own verdict.
+        //
+        match = FgcGetDeferredCreateMatch(completionContext->Create.Cacheable && NULL != fileContext,
+                                          NULL != fileContext ? ReadAcquire(&fileContext->Generation) : 0l,
+                                          NULL != fileContext && NULL != fileContext->Rule,
+                                          ReadAcquire(&Globals.RulesGeneration),
+                                          ReadNoFence(&instanceContext->RulesAmount));
+        if (DeferredCreateMatchCached == match) {
+            matchedRule = fileContext->Rule;
+            if (NULL != matchedRule) {
+                FgcReferenceRule(matchedRule);
+                status = FgcEnforceDeferredCreate(Data, NULL, FgcGetFileContextName(fileContext), matchedRule);
+                if (NT_SUCCESS(status)) FgcSetupHandleSummary(Data, FltObjects, matchedRule);
+            }
             goto Cleanup;
-        } else {
-            RtlZeroMemory(fileContext, sizeof(FG_FILE_CONTEXT));
         }
-        
-        status = FltSetFileContext(Data->Iopb->TargetInstance,
-                                   Data->Iopb->TargetFileObject,
-                                   FLT_SET_CONTEXT_KEEP_IF_EXISTS,
-                                   fileContext,
-                                   &oldFileContext);
-        if (!NT_SUCCESS(status) && STATUS_FLT_CONTEXT_ALREADY_DEFINED != status) {
-            DBG_ERROR("NTSTATUS: '0x%08x', set file context failed", status);
-            goto Cleanup;
 
-        } else if (STATUS_FLT_CONTEXT_ALREADY_DEFINED == status) {
+        generation = ReadAcquire(&Globals.RulesGeneration);
 
-            if (!FgcCompareRule(oldFileContext->Rule, matchedRule)) {
-                DBG_WARNING("File context %p rule updated from 0x%08x to 0x%08x",
-                            oldFileContext,
-                            oldFileContext->Rule->Code.Value,
-                            matchedRule->Code.Value);
+        //
+        // The name is only queried if a path rule could match the open, a stale
+        // context holding a rule is always matched by name again so it is never
+        // replaced by a verdict of the file id rules alone.
+        //
+        if (DeferredCreateMatchFileId != match) {
+            volumeRules = FgcGetInstanceRules(instanceContext);
 
-                FgcReferenceRule(matchedRule);
-                oldRule = InterlockedExchangePointer(&oldFileContext->Rule, matchedRule);
-                FgcReleaseRule(oldRule);
-            }
-        } else {
+            if (DeferredCreateMatchName == match || FgcIsCreateParentRuled(Data, instanceContext, volumeRules)) {
+                status = FltGetFileNameInformation(Data, FgcGetCreateNameOptions(Data), &nameInfo);
+                if (!NT_SUCCESS(status)) {
+                    DBG_ERROR("NTSTATUS: '0x%08x', get file name information failed", status);
+                    goto Cleanup;
+                }
 
-            DBG_TRACE("File context '%p' setup for file '%wZ'", fileContext, &nameInfo->Name);
+                try {
+                    status = FgcMatchProcessRules(FltGetRequestorProcess(Data), volumeRules, &nameInfo->Name, &matchedRule);
+                    if (!NT_SUCCESS(status)) {
+                        LOG_ERROR("NTSTATUS: 0x%08x try match file '%wZ' rule failed", status, &nameInfo->Name);
+                        goto Cleanup;
+                    }
+                } except(EXCEPTION_EXECUTE_HANDLER) {
+                    status = GetExceptionCode();
+                    LOG_ERROR("NTSTATUS: 0x%08x, an exception occurred while matching the rules", status);
+                    goto Cleanup;
+                }
+            }
+        }
+    }
 
-            FltReferenceFileNameInformation(nameInfo);
-            InterlockedExchangePointer(&fileContext->FileNameInfo, nameInfo);
+    //
+    // A file not matched by a path rule is matched against the file id rules, the
+    // file name is not queried for a file matched by its id.
+    //
+    if (NULL == matchedRule && 
+        (NULL != instanceContext || NT_SUCCESS(FltGetInstanceContext(FltObjects->Instance, &instanceContext)))) {
+        if (0 != ReadNoFence(&instanceContext->FileIdRulesAmount)) {
+            status = FgcMatchOpenedFileIdRule(FltObjects->Instance, FltObjects->FileObject, &fileIdDescriptor, &matchedRule);
+            if (!NT_SUCCESS(status)) goto Cleanup;
 
-            FgcReferenceRule(matchedRule);
-            InterlockedExchangePointer(&fileContext->Rule, matchedRule);
+            matchedByFileId = NULL != matchedRule;
         }
     }
 
-Cleanup:
+    //
+    // Setup the file context or update the verdict cached in it. The rule of a file
+    // context is never swapped under the callbacks using it, a context with another
+    // rule is replaced as a whole and the callbacks holding the old one keep using
+    // it until they release it.
+    //
+    if (NULL == fileContext || matchedRule != fileContext->Rule) {
+
+        oldFileContext = fileContext;
+        fileContext = NULL;
+
+        status = FgcSetupFileContext(Data->Iopb->TargetInstance,
+                                     Data->Iopb->TargetFileObject,
+                                     matchedRule,
+                                     generation,
+                                     NULL != oldFileContext,
+                                     &fileContext);
+        if (!NT_SUCCESS(status)) goto Cleanup;
+    }
 
-    if (!NT_SUCCESS(status)) {
-        FltCancelFileOpen(Data->Iopb->TargetInstance, Data->Iopb->TargetFileObject);
-        SET_CALLBACK_DATA_STATUS(Data, status);
+    //
+    // Only a file with a rule needs its name for the records. A file matched by a
+    // file id rule has no name queried, the path kept in the rule is used instead.
+    //
+    if (NULL != nameInfo && NULL != matchedRule) {
+        status = FgcSetFileContextName(fileContext, &nameInfo->Name);
+        if (!NT_SUCCESS(status)) {
+            DBG_WARNING("NTSTATUS: '0x%08x', set file context name failed", status);
+            status = STATUS_SUCCESS;
+        }
     }
 
-    if (NULL != oldFileContext) {
+    //
+    // The context may have been set by a concurrent open of the stream, the verdict
+    // of this open is still the one enforced below.
+    //
+    if (matchedRule == fileContext->Rule) {
+        InterlockedExchange(&fileContext->Generation, generation);
+    }
+
+    if ((deferred || matchedByFileId) && NULL != matchedRule) {
+        status = FgcEnforceDeferredCreate(Data, 
+                                          matchedByFileId ? &fileIdDescriptor : NULL,
+                                          NULL != nameInfo ? &nameInfo->Name : matchedRule->PathExpression,
+                                          matchedRule);
+
+    } else if (NULL != matchedRule && 
+               RuleMajorReadonly == matchedRule->Code.Major && 
+               FG_RULE_OPEN_DENIED(matchedRule->Code, matchedRule->Operations, FgcGetGrantedAccess(Data))) {
+        status = STATUS_MEDIA_WRITE_PROTECTED;
+    }
+
+    if (NT_SUCCESS(status) && NULL != matchedRule) {
+        FgcSetupHandleSummary(Data, FltObjects, matchedRule);
+    }
+
+Cleanup:
+
+    if (!NT_SUCCESS(status)) {
+        FltCancelFileOpen(Data->Iopb->TargetInstance, Data->Iopb->TargetFileObject);
+        SET_CALLBACK_DATA_STATUS(Data, status);
+    }
+
+    if (NULL != oldFileContext) {
         FltReleaseContext(oldFileContext);
     }
 
-    if (NULL != fileContext) {
-        FltReleaseContext(fileContext);
+    if (NULL != fileContext) {
+        FltReleaseContext(fileContext);
+    }
+
+    if (NULL != volumeRules) {
+        FgcReleaseRuleSubset(volumeRules);
+    }
+
+    if (NULL != instanceContext) {
+        FltReleaseContext(instanceContext);
+    }
+
+    if (NULL != matchedRule) {
+        FgcReleaseRule(matchedRule);
+    }
+
+    if (NULL != nameInfo) {
+        FltReleaseFileNameInformation(nameInfo);
+    }
+
+    if (NULL != completionContext) {
+        FgFreeCompletionContext(completionContext);
+    }
+
+    return callbackStatus;
+}
+
+FLT_PREOP_CALLBACK_STATUS
+FgcPreWriteCallback(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID* CompletionContext
+    )
+/*++
+
+Routine Description:
+
+    This routine is a pre-operation dispatch routine for 'IRP_MJ_WRITE'.
+
+    This is non-pageable because it could be called on the paging path
+
+Arguments:
+
+    Data              - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects        - Pointer to the FLT_RELATED_OBJECTS data structure containing
+                        opaque handles to this filter, instance, its associated volume and
+                        file object.
+
+    CompletionContext - The context for the completion routine for this
+                        operation.
+
+Return Value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    FLT_PREOP_CALLBACK_STATUS callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+    PFG_FILE_CONTEXT fileContext = NULL;
+    PFG_INSTANCE_CONTEXT instanceContext = NULL;
+    PFG_HANDLE_CONTEXT handleContext = NULL;
+
+    UNREFERENCED_PARAMETER(CompletionContext);
+
+    FLT_ASSERT(NULL != Data);
+    FLT_ASSERT(NULL != Data->Iopb);
+    FLT_ASSERT(IRP_MJ_WRITE == Data->Iopb->MajorFunction);
+
+    //
+    // The registration already skips the paging writes.
+    //
+    if (WriteDecisionSkip == FgcGetWriteDecision(IRP_MJ_WRITE, Data->Iopb->IrpFlags, 0ul, 0ul)) {
+        goto Cleanup;
+    }
+
+    //
+    // A readonly or denied file is never opened for write, the write check is only a
+    // backstop for handles opened before a rule of the volume was added. A volume
+    // without rules has nothing to enforce, skip it before the file context lookup.
+    //
+    status = FltGetInstanceContext(FltObjects->Instance, &instanceContext);
+    if (NT_SUCCESS(status) && 
+        0 == ReadNoFence(&instanceContext->RulesAmount) && 
+        0 == ReadNoFence(&instanceContext->FileIdRulesAmount)) {
+        status = STATUS_SUCCESS;
+        goto Cleanup;
+    }
+
+    status = STATUS_SUCCESS;
+
+    //
+    // Get file context.
+    //
+    status = FltGetFileContext(Data->Iopb->TargetInstance, Data->Iopb->TargetFileObject, &fileContext);
+    if (!NT_SUCCESS(status) && STATUS_NOT_FOUND != status) {
+        LOG_ERROR("NTSTATUS: '0x%08x', get file context", status);
+        goto Cleanup;
+
+    } else if (STATUS_NOT_FOUND == status || NULL == fileContext->Rule) {
+        status = STATUS_SUCCESS;
+        goto Cleanup;
+    }
+
+    //
+    // The writes of a summarized handle are counted whether the rule applies to
+    // them or not, and are not recorded one by one.
+    //
+    handleContext = FgcGetHandleSummary(FltObjects);
+    if (NULL != handleContext) {
+        FgcCountHandleWrite(&handleContext->Summary, Data->Iopb->Parameters.Write.Length);
+    }
+
+    if (!FgcIsFileContextOperationApplied(fileContext, FG_RULE_OPERATION_WRITE)) {
+        goto Cleanup;
+    }
+
+    if (FgcIsTrustedProcess(&Globals.TrustedProcesses, FltGetRequestorProcess(Data)) ||
+        !FgcIsRuleAppliedToProcess(fileContext->Rule, FltGetRequestorProcess(Data))) {
+        goto Cleanup;
+    }
+
+    //
+    // Appending writes come in bursts, the identical ones of a burst are coalesced
+    // into a single record if a coalescing window is set.
+    //
+    if (RuleMinorMonitored == fileContext->Rule->Code.Minor &&
+        NULL == handleContext &&
+        !FgcCoalesceRuleMatched(fileContext,
+                                Data->Iopb->MajorFunction,
+                                Data->Iopb->MinorFunction,
+                                fileContext->Rule)) {
+        status = FgcRecordRuleMatched(Data->Iopb->MajorFunction,
+                                      Data->Iopb->MinorFunction,
+                                      NULL,
+                                      FgcGetFileContextName(fileContext),
+                                      NULL,
+                                      fileContext->Rule);
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, record rule matched failed", status);
+            goto Cleanup;
+        }
+    }
+
+    switch (fileContext->Rule->Code.Major) {
+    case RuleMajorAccessDenied:
+        SET_CALLBACK_DATA_STATUS(Data, STATUS_ACCESS_DENIED);
+        callbackStatus = FLT_PREOP_COMPLETE;
+        break;
+
+    case RuleMajorReadonly:
+        SET_CALLBACK_DATA_STATUS(Data, STATUS_MEDIA_WRITE_PROTECTED);
+        callbackStatus = FLT_PREOP_COMPLETE;
+        break;
+    }
+
+    if (NULL != handleContext && FLT_PREOP_COMPLETE == callbackStatus) {
+        FgcCountHandleDenied(&handleContext->Summary);
+    }
+
+Cleanup:
+
+    if (!NT_SUCCESS(status)) {
+
+        //
+        // A cached write through fast I/O is retried as an IRP rather than failed for
+        // an error of the filter.
+        //
+        if (FLT_IS_FASTIO_OPERATION(Data)) {
+            callbackStatus = FLT_PREOP_DISALLOW_FASTIO;
+        } else {
+            SET_CALLBACK_DATA_STATUS(Data, status);
+            callbackStatus = FLT_PREOP_COMPLETE;
+        }
+    }
+
+    if (NULL != handleContext) {
+        FltReleaseContext(handleContext);
+    }
+
+    if (NULL != fileContext) {
+        FltReleaseContext(fileContext);
+    }
+
+    if (NULL != instanceContext) {
+        FltReleaseContext(instanceContext);
+    }
+
+    return callbackStatus;
+}
+
+FLT_PREOP_CALLBACK_STATUS
+FgcPreAcquireForSectionSynchronizationCallback(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID* CompletionContext
+    )
+/*++
+
+Routine Description:
+
+    This routine is a pre-operation dispatch routine for 'IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION'.
+
+    The writes through a mapped view reach the file as paging writes which are not
+    filtered, so a writable section of a file whose rule applies to writes is checked
+    when it is created, in the context of the process mapping the file.
+
+Arguments:
+
+    Data              - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects        - Pointer to the FLT_RELATED_OBJECTS data structure containing
+                        opaque handles to this filter, instance, its associated volume and
+                        file object.
+
+    CompletionContext - The context for the completion routine for this
+                        operation.
+
+Return Value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    FLT_PREOP_CALLBACK_STATUS callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+    PFG_FILE_CONTEXT fileContext = NULL;
+
+    UNREFERENCED_PARAMETER(CompletionContext);
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NULL != Data);
+    FLT_ASSERT(NULL != Data->Iopb);
+    FLT_ASSERT(IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION == Data->Iopb->MajorFunction);
+
+    //
+    // Only a section which can write the file is checked, an image or a copy on write
+    // section never changes it.
+    //
+    if (WriteDecisionSkip == FgcGetWriteDecision(IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION,
+                                                 Data->Iopb->IrpFlags,
+                                                 (ULONG)Data->Iopb->Parameters.AcquireForSectionSynchronization.SyncType,
+                                                 Data->Iopb->Parameters.AcquireForSectionSynchronization.PageProtection)) {
+        goto Cleanup;
+    }
+
+    status = FltGetFileContext(FltObjects->Instance, FltObjects->FileObject, &fileContext);
+    if (!NT_SUCCESS(status) && STATUS_NOT_FOUND != status) {
+        LOG_ERROR("NTSTATUS: 0x%08x, get file context failed", status);
+        goto Cleanup;
+
+    } else if (STATUS_NOT_FOUND == status || 
+               !FgcIsFileContextOperationApplied(fileContext, FG_RULE_OPERATION_WRITE) ||
+               NULL == fileContext->Rule) {
+        status = STATUS_SUCCESS;
+        goto Cleanup;
+    }
+
+    if (FgcIsTrustedProcess(&Globals.TrustedProcesses, FltGetRequestorProcess(Data)) ||
+        !FgcIsRuleAppliedToProcess(fileContext->Rule, FltGetRequestorProcess(Data))) {
+        goto Cleanup;
+    }
+
+    switch (fileContext->Rule->Code.Major) {
+    case RuleMajorAccessDenied:
+        SET_CALLBACK_DATA_STATUS(Data, STATUS_ACCESS_DENIED);
+        callbackStatus = FLT_PREOP_COMPLETE;
+        break;
+
+    case RuleMajorReadonly:
+        SET_CALLBACK_DATA_STATUS(Data, STATUS_MEDIA_WRITE_PROTECTED);
+        callbackStatus = FLT_PREOP_COMPLETE;
+        break;
+    }
+
+    if (RuleMinorMonitored == fileContext->Rule->Code.Minor) {
+        status = FgcRecordRuleMatched(FG_MONITOR_MAJOR_CREATE_SECTION,
+                                      Data->Iopb->MinorFunction,
+                                      NULL,
+                                      FgcGetFileContextName(fileContext),
+                                      NULL,
+                                      fileContext->Rule);
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, record rule matched failed", status);
+            goto Cleanup;
+        }
+    }
+
+Cleanup:
+
+    if (!NT_SUCCESS(status)) {
+        SET_CALLBACK_DATA_STATUS(Data, status);
+        callbackStatus = FLT_PREOP_COMPLETE;
+    }
+
+    if (NULL != fileContext) {
+        FltReleaseContext(fileContext);
+    }
+
+    return callbackStatus;
+}
+
+static
+_Check_return_
+NTSTATUS
+FgcMatchRenameDestination(
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ BOOLEAN NameRequired,
+    _Outptr_result_maybenull_ PFLT_FILE_NAME_INFORMATION *DestinationNameInfo,
+    _Outptr_result_maybenull_ FGC_RULE **MatchedRule
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFILE_RENAME_INFORMATION renameInfo = Data->Iopb->Parameters.SetFileInformation.InfoBuffer;
+    PFG_INSTANCE_CONTEXT instanceContext = NULL;
+    PFGC_RULE_SUBSET volumeRules = NULL;
+    PFLT_FILE_NAME_INFORMATION nameInfo = NULL;
+    FGC_RENAME_DESTINATION_MATCH match = RenameDestinationRules;
+    BOOLEAN ruled = TRUE;
+
+    *DestinationNameInfo = NULL;
+    *MatchedRule = NULL;
+
+    if (!NT_SUCCESS(FltGetInstanceContext(Data->Iopb->TargetInstance, &instanceContext))) {
+        instanceContext = NULL;
+    }
+
+    match = FgcGetRenameDestinationMatch(NULL != instanceContext,
+                                         NULL != instanceContext ? ReadNoFence(&instanceContext->RulesAmount) : 0l,
+                                         NameRequired);
+    if (RenameDestinationSkip == match) goto Cleanup;
+
+    if (RenameDestinationParent == match) {
+        volumeRules = FgcGetInstanceRules(instanceContext);
+    }
+
+    ruled = RenameDestinationRecord != match;
+
+    //
+    // The destination is matched by its normalized name, a short name in the path
+    // given by the caller must not let it slip past the rules.
+    //
+    status = FltGetDestinationFileNameInformation(Data->Iopb->TargetInstance,
+                                                  Data->Iopb->TargetFileObject,
+                                                  renameInfo->RootDirectory,
+                                                  renameInfo->FileName,
+                                                  renameInfo->FileNameLength,
+                                                  FLT_FILE_NAME_NORMALIZED | FLT_FILE_NAME_QUERY_DEFAULT,
+                                                  &nameInfo);
+    if (!NT_SUCCESS(status)) {
+        DBG_ERROR("NTSTATUS: '0x%08x', get destination file name information failed", status);
+        goto Cleanup;
+    }
+
+    //
+    // Renames mostly go into a few directories, the rules are only matched if any
+    // could apply under the normalized destination parent directory, whose verdict
+    // is cached.
+    //
+    if (RenameDestinationParent == match) {
+        status = FltParseFileNameInformation(nameInfo);
+        if (!NT_SUCCESS(status)) {
+            DBG_ERROR("NTSTATUS: '0x%08x', parse destination file name information failed", status);
+            goto Cleanup;
+        }
+
+        if (0 != nameInfo->FinalComponent.Length && 0 != nameInfo->ParentDir.Length) {
+            ruled = FgcIsDirectoryRuled(instanceContext, volumeRules, &nameInfo->ParentDir);
+        }
+    }
+
+    if (ruled) {
+        try {
+            status = FgcMatchProcessRules(FltGetRequestorProcess(Data), volumeRules, &nameInfo->Name, MatchedRule);
+            if (!NT_SUCCESS(status)) {
+                LOG_ERROR("NTSTATUS: 0x%08x try match file '%wZ' rule failed", status, &nameInfo->Name);
+                goto Cleanup;
+            }
+        } except(EXCEPTION_EXECUTE_HANDLER) {
+            status = GetExceptionCode();
+            LOG_ERROR("NTSTATUS: 0x%08x, an exception occurred while matching the rules", status);
+            goto Cleanup;
+        }
     }
 
-    if (NULL != matchedRule) {
-        FgcReleaseRule(matchedRule);
-    }
+    *DestinationNameInfo = nameInfo;
+    nameInfo = NULL;
+
+Cleanup:
 
     if (NULL != nameInfo) {
         FltReleaseFileNameInformation(nameInfo);
     }
 
-    if (NULL != completionContext) {
-        FgFreeCompletionContext(completionContext);
+    if (NULL != volumeRules) {
+        FgcReleaseRuleSubset(volumeRules);
     }
 
-    return callbackStatus;
+    if (NULL != instanceContext) {
+        FltReleaseContext(instanceContext);
+    }
+
+    return status;
 }
 
 FLT_PREOP_CALLBACK_STATUS
-FgcPreWriteCallback(
+FgcPreSetInformationCallback(
     _Inout_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _Flt_CompletionContext_Outptr_ PVOID* CompletionContext
@@ -354,7 +1313,7 @@ FgcPreWriteCallback(
 
 Routine Description:
 
-    This routine is a pre-operation dispatch routine for 'IRP_MJ_WRITE'.
+    This routine is a pre-operation dispatch routine for 'IRP_MJ_SET_INFORMATION'.
 
     This is non-pageable because it could be called on the paging path
 
@@ -378,52 +1337,133 @@ Return Value:
     NTSTATUS status = STATUS_SUCCESS;
     FLT_PREOP_CALLBACK_STATUS callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
     PFG_FILE_CONTEXT fileContext = NULL;
+    PFG_HANDLE_CONTEXT handleContext = NULL;
+    PFLT_FILE_NAME_INFORMATION nameInfo = NULL, destinationNameInfo = NULL;
+    FGC_RULE *rule = NULL, *destinationRule = NULL;
+    PUNICODE_STRING fileName = NULL;
+    ULONG operation = 0ul;
 
     UNREFERENCED_PARAMETER(CompletionContext);
-    UNREFERENCED_PARAMETER(FltObjects);
+
+    PAGED_CODE();
 
     FLT_ASSERT(NULL != Data);
     FLT_ASSERT(NULL != Data->Iopb);
-    FLT_ASSERT(IRP_MJ_WRITE == Data->Iopb->MajorFunction);
+    FLT_ASSERT(IRP_MJ_SET_INFORMATION == Data->Iopb->MajorFunction);
+
+    switch (Data->Iopb->Parameters.SetFileInformation.FileInformationClass) {
+    case FileRenameInformation:
+    case FileRenameInformationEx:
+        operation = FG_RULE_OPERATION_RENAME;
+        break;
+
+    case FileDispositionInformation:
+    case FileDispositionInformationEx:
+        operation = FG_RULE_OPERATION_DELETE;
+        break;
+
+    case FileEndOfFileInformation:
+    case FileAllocationInformation:
+        operation = FG_RULE_OPERATION_TRUNCATE;
+        break;
+
+    default:
+        goto Cleanup;
+    }
 
     //
-    // Get file context.
+    // Get stream context.
     //
-    status = FltGetFileContext(Data->Iopb->TargetInstance, Data->Iopb->TargetFileObject, &fileContext);
+    status = FltGetFileContext(FltObjects->Instance, FltObjects->FileObject, &fileContext);
     if (!NT_SUCCESS(status) && STATUS_NOT_FOUND != status) {
-        LOG_ERROR("NTSTATUS: '0x%08x', get file context", status);
+        LOG_ERROR("NTSTATUS: 0x%08x, get file context failed", status);
         goto Cleanup;
+    }
 
-    } else if (STATUS_NOT_FOUND == status || NULL == fileContext->Rule) {
-        status = STATUS_SUCCESS;
+    status = STATUS_SUCCESS;
+
+    //
+    // The renames and truncates of a summarized handle are counted whether the rule
+    // applies to them or not.
+    //
+    if (NULL != fileContext && NULL != fileContext->Rule) {
+        handleContext = FgcGetHandleSummary(FltObjects);
+        if (NULL != handleContext) {
+            FgcCountHandleOperation(&handleContext->Summary, operation);
+        }
+    }
+
+    //
+    // A file without a rule on the operation may still be renamed to a path with one.
+    //
+    if (NULL != fileContext && FgcIsFileContextOperationApplied(fileContext, operation)) {
+        rule = fileContext->Rule;
+    }
+
+    if ((NULL == rule && FG_RULE_OPERATION_RENAME != operation) ||
+        FgcIsTrustedProcess(&Globals.TrustedProcesses, FltGetRequestorProcess(Data))) {
         goto Cleanup;
     }
 
-    if (RuleMinorMonitored == fileContext->Rule->Code.Minor) {
+    if (NULL != rule && !FgcIsRuleAppliedToProcess(rule, FltGetRequestorProcess(Data))) {
+        if (FG_RULE_OPERATION_RENAME != operation) goto Cleanup;
+        rule = NULL;
+    }
+
+    //
+    // A rename of a file with a rule is denied whatever the destination is, the
+    // destination is only looked up to be recorded along with the source.
+    //
+    if (FG_RULE_OPERATION_RENAME == operation && 
+        (NULL == rule || (RuleMinorMonitored == rule->Code.Minor && NULL == handleContext))) {
+        status = FgcMatchRenameDestination(Data, NULL != rule, &destinationNameInfo, &destinationRule);
+        if (!NT_SUCCESS(status)) {
+            goto Cleanup;
+        }
+
+        if (NULL == rule && NULL != destinationRule && FgcIsRuleOperationApplied(destinationRule, operation)) {
+            rule = destinationRule;
+        }
+    }
+
+    if (NULL == rule) goto Cleanup;
+
+    //
+    // Only a rename to a path with a rule is recorded for a summarized handle, the
+    // summary does not tell the destination.
+    //
+    if (RuleMinorMonitored == rule->Code.Minor && (NULL == handleContext || rule == destinationRule)) {
+        if (NULL != fileContext && NULL != fileContext->Rule) {
+            fileName = FgcGetFileContextName(fileContext);
+        } else {
+            status = FltGetFileNameInformation(Data, FLT_FILE_NAME_OPENED | FLT_FILE_NAME_QUERY_DEFAULT, &nameInfo);
+            if (!NT_SUCCESS(status)) {
+                DBG_ERROR("NTSTATUS: '0x%08x', get file name information failed", status);
+                goto Cleanup;
+            }
+
+            fileName = &nameInfo->Name;
+        }
+
         status = FgcRecordRuleMatched(Data->Iopb->MajorFunction,
                                       Data->Iopb->MinorFunction,
                                       NULL,
-                                      &fileContext->FileNameInfo->Name,
-                                      NULL,
-                                      fileContext->Rule);
+                                      fileName,
+                                      NULL != destinationNameInfo ? &destinationNameInfo->Name : NULL,
+                                      rule);
         if (!NT_SUCCESS(status)) {
             LOG_ERROR("NTSTATUS: 0x%08x, record rule matched failed", status);
             goto Cleanup;
         }
     }
 
-    switch (fileContext->Rule->Code.Major) {
-    case RuleMajorAccessDenied:
-        SET_CALLBACK_DATA_STATUS(Data, STATUS_ACCESS_DENIED);
-        callbackStatus = FLT_PREOP_COMPLETE;
-        break;
-
-    case RuleMajorReadonly:
-        SET_CALLBACK_DATA_STATUS(Data, STATUS_MEDIA_WRITE_PROTECTED);
-        callbackStatus = FLT_PREOP_COMPLETE;
-        break;
+    if (NULL != handleContext) {
+        FgcCountHandleDenied(&handleContext->Summary);
     }
 
+    SET_CALLBACK_DATA_STATUS(Data, RuleMajorAccessDenied == rule->Code.Major ? 
+                                   STATUS_ACCESS_DENIED : STATUS_MEDIA_WRITE_PROTECTED);
+    callbackStatus = FLT_PREOP_COMPLETE;
 
 Cleanup:
 
@@ -432,6 +1472,22 @@ Cleanup:
         callbackStatus = FLT_PREOP_COMPLETE;
     }
 
+    if (NULL != destinationRule) {
+        FgcReleaseRule(destinationRule);
+    }
+
+    if (NULL != destinationNameInfo) {
+        FltReleaseFileNameInformation(destinationNameInfo);
+    }
+
+    if (NULL != nameInfo) {
+        FltReleaseFileNameInformation(nameInfo);
+    }
+
+    if (NULL != handleContext) {
+        FltReleaseContext(handleContext);
+    }
+
     if (NULL != fileContext) {
         FltReleaseContext(fileContext);
     }
@@ -440,7 +1496,7 @@ Cleanup:
 }
 
 FLT_PREOP_CALLBACK_STATUS
-FgcPreSetInformationCallback(
+FgcPreFileSystemControlCallback(
     _Inout_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _Flt_CompletionContext_Outptr_ PVOID* CompletionContext
@@ -449,7 +1505,7 @@ FgcPreSetInformationCallback(
 
 Routine Description:
 
-    This routine is a pre-operation dispatch routine for 'IRP_MJ_SET_INFORMATION'.
+    This routine is a pre-operation dispatch routine for 'IRP_MJ_FILE_SYSTEM_CONTROL'.
 
     This is non-pageable because it could be called on the paging path
 
@@ -473,9 +1529,7 @@ Return Value:
     NTSTATUS status = STATUS_SUCCESS;
     FLT_PREOP_CALLBACK_STATUS callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
     PFG_FILE_CONTEXT fileContext = NULL;
-    PFLT_FILE_NAME_INFORMATION renameNameInfo = NULL;
-    PFILE_RENAME_INFORMATION renameInfo = NULL;
-    FGC_RULE *matchedRule = NULL;
+    ULONG fsctlCode = 0ul;
 
     UNREFERENCED_PARAMETER(CompletionContext);
 
@@ -483,7 +1537,23 @@ Return Value:
 
     FLT_ASSERT(NULL != Data);
     FLT_ASSERT(NULL != Data->Iopb);
-    FLT_ASSERT(IRP_MJ_SET_INFORMATION == Data->Iopb->MajorFunction);
+    FLT_ASSERT(IRP_MJ_FILE_SYSTEM_CONTROL == Data->Iopb->MajorFunction);
+
+    //
+    // Only the controls changing the file layout are enforced, other controls
+    // do not need the file context.
+    //
+    fsctlCode = Data->Iopb->Parameters.FileSystemControl.Common.FsControlCode;
+    switch (fsctlCode) {
+    case FSCTL_SET_SPARSE:
+    case FSCTL_SET_REPARSE_POINT:
+    case FSCTL_SET_REPARSE_POINT_EX:
+    case FSCTL_DELETE_REPARSE_POINT:
+        break;
+
+    default:
+        goto Cleanup;
+    }
 
     //
     // Get stream context.
@@ -493,120 +1563,41 @@ Return Value:
         LOG_ERROR("NTSTATUS: 0x%08x, get file context failed", status);
         goto Cleanup;
 
-    } else if (STATUS_NOT_FOUND == status || NULL == fileContext->Rule) {
+    } else if (STATUS_NOT_FOUND == status || 
+               !FgcIsFileContextOperationApplied(fileContext, FG_RULE_OPERATION_FSCTL) ||
+               NULL == fileContext->Rule) {
         status = STATUS_SUCCESS;
         goto Cleanup;
     }
 
-    switch (Data->Iopb->Parameters.SetFileInformation.FileInformationClass) {
-    case FileRenameInformation:
-    case FileRenameInformationEx:
-        if (RuleMinorMonitored == fileContext->Rule->Code.Minor) {
-            status = FgcRecordRuleMatched(Data->Iopb->MajorFunction,
-                                          Data->Iopb->MinorFunction,
-                                          NULL,
-                                          &fileContext->FileNameInfo->Name,
-                                          NULL,
-                                          fileContext->Rule);
-            if (!NT_SUCCESS(status)) {
-                LOG_ERROR("NTSTATUS: 0x%08x, record rule matched failed", status);
-                goto Cleanup;
-            }
-        }
+    if (FgcIsTrustedProcess(&Globals.TrustedProcesses, FltGetRequestorProcess(Data)) ||
+        !FgcIsRuleAppliedToProcess(fileContext->Rule, FltGetRequestorProcess(Data))) {
+        goto Cleanup;
+    }
 
-        switch (fileContext->Rule->Code.Major) {
-        case RuleMajorAccessDenied:
-            SET_CALLBACK_DATA_STATUS(Data, STATUS_ACCESS_DENIED);
-            callbackStatus = FLT_PREOP_COMPLETE;
-            break;
+    switch (fileContext->Rule->Code.Major) {
+    case RuleMajorAccessDenied:
+        SET_CALLBACK_DATA_STATUS(Data, STATUS_ACCESS_DENIED);
+        callbackStatus = FLT_PREOP_COMPLETE;
+        break;
 
-        case RuleMajorReadonly:
-            SET_CALLBACK_DATA_STATUS(Data, STATUS_MEDIA_WRITE_PROTECTED);
-            callbackStatus = FLT_PREOP_COMPLETE;
-            break;
-        }
+    case RuleMajorReadonly:
+        SET_CALLBACK_DATA_STATUS(Data, STATUS_MEDIA_WRITE_PROTECTED);
+        callbackStatus = FLT_PREOP_COMPLETE;
+        break;
+    }
 
-        renameInfo = Data->Iopb->Parameters.SetFileInformation.InfoBuffer;
-        status = FltGetDestinationFileNameInformation(Data->Iopb->TargetInstance,
-                                                      Data->Iopb->TargetFileObject,
-                                                      renameInfo->RootDirectory,
-                                                      renameInfo->FileName,
-                                                      renameInfo->FileNameLength,
-                                                      FLT_FILE_NAME_NORMALIZED | FLT_FILE_NAME_QUERY_DEFAULT,
-                                                      &renameNameInfo);
+    if (RuleMinorMonitored == fileContext->Rule->Code.Minor) {
+        status = FgcRecordRuleMatched(Data->Iopb->MajorFunction,
+                                      Data->Iopb->MinorFunction,
+                                      NULL,
+                                      FgcGetFileContextName(fileContext),
+                                      NULL,
+                                      fileContext->Rule);
         if (!NT_SUCCESS(status)) {
-            DBG_ERROR("NTSTATUS: '0x%08x', get destination file name information failed", status);
-            goto Cleanup;
-        }
-
-        try {
-            status = FgcMatchRules(&Globals.RulesList, Globals.RulesListLock, &renameNameInfo->Name, &matchedRule);
-            if (!NT_SUCCESS(status)) {
-                LOG_ERROR("NTSTATUS: 0x%08x try match file '%wZ' rule failed", status, &renameNameInfo->Name);
-                goto Cleanup;
-            } else if (NULL != matchedRule) {
-                if (RuleMinorMonitored == fileContext->Rule->Code.Minor) {
-                    status = FgcRecordRuleMatched(Data->Iopb->MajorFunction,
-                                                  Data->Iopb->MinorFunction,
-                                                  NULL,
-                                                  &fileContext->FileNameInfo->Name,
-                                                  NULL,
-                                                  fileContext->Rule);
-                    if (!NT_SUCCESS(status)) {
-                        LOG_ERROR("NTSTATUS: 0x%08x, record rule matched failed", status);
-                        goto Cleanup;
-                    }
-                }
-
-                switch (matchedRule->Code.Major) {
-                case RuleMajorAccessDenied:
-                    SET_CALLBACK_DATA_STATUS(Data, STATUS_ACCESS_DENIED);
-                    callbackStatus = FLT_PREOP_COMPLETE;
-                    break;
-
-                case RuleMajorReadonly:
-                    SET_CALLBACK_DATA_STATUS(Data, STATUS_MEDIA_WRITE_PROTECTED);
-                    callbackStatus = FLT_PREOP_COMPLETE;
-                    break;
-                }
-            }
-        } except(EXCEPTION_EXECUTE_HANDLER) {
-            status = GetExceptionCode();
-            LOG_ERROR("NTSTATUS: 0x%08x, an exception occurred while matching the rules", status);
+            LOG_ERROR("NTSTATUS: 0x%08x, record rule matched failed", status);
             goto Cleanup;
         }
-        break;
-
-    case FileDispositionInformation:
-    case FileDispositionInformationEx:
-    case FileEndOfFileInformation:
-    case FileAllocationInformation:
-
-        if (RuleMinorMonitored == fileContext->Rule->Code.Minor) {
-            status = FgcRecordRuleMatched(Data->Iopb->MajorFunction,
-                                          Data->Iopb->MinorFunction,
-                                          NULL,
-                                          &fileContext->FileNameInfo->Name,
-                                          NULL,
-                                          fileContext->Rule);
-            if (!NT_SUCCESS(status)) {
-                LOG_ERROR("NTSTATUS: 0x%08x, record rule matched failed", status);
-                goto Cleanup;
-            }
-        }
-
-        switch (fileContext->Rule->Code.Major) {
-        case RuleMajorAccessDenied:
-            SET_CALLBACK_DATA_STATUS(Data, STATUS_ACCESS_DENIED);
-            callbackStatus = FLT_PREOP_COMPLETE;
-            break;
-
-        case RuleMajorReadonly:
-            SET_CALLBACK_DATA_STATUS(Data, STATUS_MEDIA_WRITE_PROTECTED);
-            callbackStatus = FLT_PREOP_COMPLETE;
-            break;
-        }
-        break;
     }
 
 Cleanup:
@@ -616,14 +1607,6 @@ Cleanup:
         callbackStatus = FLT_PREOP_COMPLETE;
     }
 
-    if (NULL != matchedRule) {
-        FgcReleaseRule(matchedRule);
-    }
-
-    if (NULL != renameNameInfo) {
-        FltReleaseContext(renameNameInfo);
-    }
-
     if (NULL != fileContext) {
         FltReleaseContext(fileContext);
     }
@@ -632,7 +1615,7 @@ Cleanup:
 }
 
 FLT_PREOP_CALLBACK_STATUS
-FgcPreFileSystemControlCallback(
+FgcPreCleanupCallback(
     _Inout_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _Flt_CompletionContext_Outptr_ PVOID* CompletionContext
@@ -641,9 +1624,9 @@ FgcPreFileSystemControlCallback(
 
 Routine Description:
 
-    This routine is a pre-operation dispatch routine for 'IRP_MJ_FILE_SYSTEM_CONTROL'.
-
-    This is non-pageable because it could be called on the paging path
+    This routine is a pre-operation dispatch routine for 'IRP_MJ_CLEANUP', it records
+    the summary of a summarized handle that had any request counted. The cleanup
+    itself is never failed.
 
 Arguments:
 
@@ -662,10 +1645,9 @@ Return Value:
 
 --*/
 {
-    NTSTATUS status = STATUS_SUCCESS;
-    FLT_PREOP_CALLBACK_STATUS callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+    PFG_HANDLE_CONTEXT handleContext = NULL;
     PFG_FILE_CONTEXT fileContext = NULL;
-    ULONG fsctlCode = 0ul;
+    FG_MONITOR_HANDLE_SUMMARY summary = { 0 };
 
     UNREFERENCED_PARAMETER(CompletionContext);
 
@@ -673,64 +1655,35 @@ Return Value:
 
     FLT_ASSERT(NULL != Data);
     FLT_ASSERT(NULL != Data->Iopb);
-    FLT_ASSERT(IRP_MJ_FILE_SYSTEM_CONTROL == Data->Iopb->MajorFunction);
+    FLT_ASSERT(IRP_MJ_CLEANUP == Data->Iopb->MajorFunction);
+
+    handleContext = FgcGetHandleSummary(FltObjects);
+    if (NULL == handleContext) goto Cleanup;
 
     //
-    // Get stream context.
+    // A handle without any request counted only has its open recorded.
     //
-    status = FltGetFileContext(FltObjects->Instance, FltObjects->FileObject, &fileContext);
-    if (!NT_SUCCESS(status) && STATUS_NOT_FOUND != status) {
-        LOG_ERROR("NTSTATUS: 0x%08x, get file context failed", status);
-        goto Cleanup;
+    RtlCopyMemory(&summary, &handleContext->Summary, sizeof(FG_MONITOR_HANDLE_SUMMARY));
+    if (FgcIsHandleSummaryEmpty(&summary)) goto Cleanup;
 
-    } else if (STATUS_NOT_FOUND == status || NULL == fileContext->Rule) {
-        status = STATUS_SUCCESS;
-        goto Cleanup;
+    if (!NT_SUCCESS(FltGetFileContext(FltObjects->Instance, FltObjects->FileObject, &fileContext))) {
+        fileContext = NULL;
     }
 
-    fsctlCode = Data->Iopb->Parameters.FileSystemControl.Common.FsControlCode;
-    switch (fsctlCode) {
-    case FSCTL_SET_SPARSE:
-    case FSCTL_SET_REPARSE_POINT:
-    case FSCTL_SET_REPARSE_POINT_EX:
-    case FSCTL_DELETE_REPARSE_POINT:
-
-        switch (fileContext->Rule->Code.Major) {
-        case RuleMajorAccessDenied:
-            SET_CALLBACK_DATA_STATUS(Data, STATUS_ACCESS_DENIED);
-            callbackStatus = FLT_PREOP_COMPLETE;
-            break;
-
-        case RuleMajorReadonly:
-            SET_CALLBACK_DATA_STATUS(Data, STATUS_MEDIA_WRITE_PROTECTED);
-            callbackStatus = FLT_PREOP_COMPLETE;
-            break;
-        }
-
-        if (RuleMinorMonitored == fileContext->Rule->Code.Minor) {
-            status = FgcRecordRuleMatched(Data->Iopb->MajorFunction,
-                                          Data->Iopb->MinorFunction,
-                                          NULL,
-                                          &fileContext->FileNameInfo->Name,
-                                          NULL,
-                                          fileContext->Rule);
-            if (!NT_SUCCESS(status)) {
-                LOG_ERROR("NTSTATUS: 0x%08x, record rule matched failed", status);
-                goto Cleanup;
-            }
-        }
-    }
+    FgcRecordHandleSummary(NULL != fileContext && NULL != fileContext->FileName ? 
+                           fileContext->FileName : handleContext->Rule->PathExpression,
+                           handleContext->Rule,
+                           &summary);
 
 Cleanup:
 
-    if (!NT_SUCCESS(status)) {
-        SET_CALLBACK_DATA_STATUS(Data, status);
-        callbackStatus = FLT_PREOP_COMPLETE;
-    }
-
     if (NULL != fileContext) {
         FltReleaseContext(fileContext);
     }
 
-    return callbackStatus;
+    if (NULL != handleContext) {
+        FltReleaseContext(handleContext);
+    }
+
+    return FLT_PREOP_SUCCESS_NO_CALLBACK;
 }
\ No newline at end of file
@@ -41,6 +41,10 @@ Environment:
 #ifndef __OPERATIONS_H__
 #define __OPERATIONS_H__
 
+#include "CreateDecision.h"
+#include "RenameDecision.h"
+#include "WriteDecision.h"
+
 FLT_PREOP_CALLBACK_STATUS
 FgcPreCreateCallback(
     _Inout_ PFLT_CALLBACK_DATA Data,
@@ -63,6 +67,13 @@ FgcPreWriteCallback(
     _Flt_CompletionContext_Outptr_ PVOID* CompletionContext
     );
 
+FLT_PREOP_CALLBACK_STATUS
+FgcPreAcquireForSectionSynchronizationCallback(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID* CompletionContext
+    );
+
 FLT_PREOP_CALLBACK_STATUS
 FgcPreSetInformationCallback(
     _Inout_ PFLT_CALLBACK_DATA Data,
@@ -77,11 +88,20 @@ FgcPreFileSystemControlCallback(
     _Flt_CompletionContext_Outptr_ PVOID* CompletionContext
     );
 
+FLT_PREOP_CALLBACK_STATUS
+FgcPreCleanupCallback(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID* CompletionContext
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FgcPreCreateCallback)
 #pragma alloc_text(PAGE, FgcPostCreateCallback)
+#pragma alloc_text(PAGE, FgcPreAcquireForSectionSynchronizationCallback)
 #pragma alloc_text(PAGE, FgcPreSetInformationCallback)
 #pragma alloc_text(PAGE, FgcPreFileSystemControlCallback)
+#pragma alloc_text(PAGE, FgcPreCleanupCallback)
 #endif
 
 #endif
\ No newline at end of file
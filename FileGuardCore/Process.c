@@ -0,0 +1,818 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    Process.c
+
+Abstract:
+
+    Definitions of requestor process routines.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#include "FileGuardCore.h"
+#include "Process.h"
+
+/*-------------------------------------------------------------
+    Trusted process table structures and routines.
+-------------------------------------------------------------*/
+
+_Check_return_
+NTSTATUS
+FgcInitializeTrustedProcessTable(
+    _Inout_ PFGC_TRUSTED_PROCESS_TABLE Table
+    )
+/*++
+
+Routine Description:
+
+    This routine initializes an empty trusted process table.
+
+Arguments:
+
+    Table - Trusted process table to be initialized.
+
+Return Value:
+
+    STATUS_SUCCESS                - Success.
+    STATUS_INSUFFICIENT_RESOURCES - Failure. Unable to allocate the table lock.
+    STATUS_INVALID_PARAMETER_1    - Failure. The 'Table' parameter is NULL.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (NULL == Table) return STATUS_INVALID_PARAMETER_1;
+
+    RtlZeroMemory(Table, sizeof(FGC_TRUSTED_PROCESS_TABLE));
+
+    return FgcCreatePushLock(&Table->Lock);
+}
+
+_Check_return_
+NTSTATUS
+FgcAddTrustedProcess(
+    _In_ PFGC_TRUSTED_PROCESS_TABLE Table,
+    _In_ HANDLE ProcessId
+    )
+/*++
+
+Routine Description:
+
+    This routine adds a running process to the trusted process table. The process
+    is keyed on its id and creation time, so the entry never applies to another
+    process which reuses the id later.
+
+Arguments:
+
+    Table     - Trusted process table.
+    ProcessId - Id of the process to be trusted.
+
+Return Value:
+
+    STATUS_SUCCESS             - Success, the process is trusted.
+    STATUS_NO_MORE_ENTRIES     - Failure. The table is full.
+    STATUS_INVALID_PARAMETER_1 - Failure. The 'Table' parameter is NULL.
+    STATUS_INVALID_PARAMETER_2 - Failure. The 'ProcessId' parameter is invalid.
+    Other                      - The process lookup failed.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PEPROCESS process = NULL;
+    LONG64 createTime = 0ll;
+    BOOLEAN exist = FALSE;
+
+    PAGED_CODE();
+
+    if (NULL == Table) return STATUS_INVALID_PARAMETER_1;
+    if (NULL == ProcessId || FG_TRUSTED_PROCESS_TOMBSTONE == ProcessId) return STATUS_INVALID_PARAMETER_2;
+
+    status = PsLookupProcessByProcessId(ProcessId, &process);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, lookup process %p failed", status, ProcessId);
+        return status;
+    }
+
+    createTime = PsGetProcessCreateTimeQuadPart(process);
+    ObDereferenceObject(process);
+
+    FltAcquirePushLockExclusive(Table->Lock);
+
+    if (!FgcStoreTrustedProcessSlot(Table, ProcessId, createTime, &exist)) {
+        status = STATUS_NO_MORE_ENTRIES;
+    } else if (!exist) {
+        InterlockedIncrement(&Table->ProcessesAmount);
+    }
+
+    FltReleasePushLock(Table->Lock);
+
+    if (NT_SUCCESS(status)) {
+        LOG_INFO("Process %p trusted, creation time: %I64d", ProcessId, createTime);
+    } else {
+        LOG_WARNING("NTSTATUS: 0x%08x, trust process %p failed", status, ProcessId);
+    }
+
+    return status;
+}
+
+_Check_return_
+NTSTATUS
+FgcRemoveTrustedProcess(
+    _In_ PFGC_TRUSTED_PROCESS_TABLE Table,
+    _In_ HANDLE ProcessId
+    )
+/*++
+
+Routine Description:
+
+    This routine removes a process from the trusted process table.
+
+Arguments:
+
+    Table     - Trusted process table.
+    ProcessId - Id of the process to be removed.
+
+Return Value:
+
+    STATUS_SUCCESS             - Success.
+    STATUS_NOT_FOUND           - Failure. The process is not trusted.
+    STATUS_INVALID_PARAMETER_1 - Failure. The 'Table' parameter is NULL.
+    STATUS_INVALID_PARAMETER_2 - Failure. The 'ProcessId' parameter is invalid.
+
+--*/
+{
+    NTSTATUS status = STATUS_NOT_FOUND;
+
+    PAGED_CODE();
+
+    if (NULL == Table) return STATUS_INVALID_PARAMETER_1;
+    if (NULL == ProcessId || FG_TRUSTED_PROCESS_TOMBSTONE == ProcessId) return STATUS_INVALID_PARAMETER_2;
+
+    FltAcquirePushLockExclusive(Table->Lock);
+
+    if (FgcClearTrustedProcessSlot(Table, ProcessId)) {
+        InterlockedDecrement(&Table->ProcessesAmount);
+        status = STATUS_SUCCESS;
+    }
+
+    FltReleasePushLock(Table->Lock);
+
+    if (NT_SUCCESS(status)) {
+        LOG_INFO("Process %p untrusted", ProcessId);
+    }
+
+    return status;
+}
+
+BOOLEAN
+FgcIsTrustedProcess(
+    _In_ PFGC_TRUSTED_PROCESS_TABLE Table,
+    _In_opt_ PEPROCESS Process
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether a process is trusted. It never acquires a lock
+    and returns immediately while the table is empty, so it is cheap enough to
+    be called before any name query of an operation.
+
+Arguments:
+
+    Table   - Trusted process table.
+    Process - The process to be checked.
+
+Return Value:
+
+    TRUE if the process is trusted, otherwise FALSE.
+
+--*/
+{
+    LONG64 createTime = 0ll;
+
+    if (0 == ReadNoFence(&Table->ProcessesAmount) || NULL == Process) return FALSE;
+
+    return FgcFindTrustedProcessSlot(Table, PsGetProcessId(Process), &createTime) &&
+           createTime == PsGetProcessCreateTimeQuadPart(Process);
+}
+
+/*-------------------------------------------------------------
+    Process cache structures and routines.
+-------------------------------------------------------------*/
+
+static
+VOID
+FgcFreeProcessEntry(
+    _In_ PFGC_PROCESS_ENTRY Entry
+    )
+{
+    if (NULL != Entry->RuleSubset) {
+        FgcReleaseRuleSubset(Entry->RuleSubset);
+    }
+
+    if (NULL != Entry->ImageName) {
+        FgcFreeUnicodeString(Entry->ImageName);
+    }
+
+    FgcFreeBuffer(Entry);
+}
+
+static
+_Check_return_
+NTSTATUS
+FgcCreateProcessEntry(
+    _In_ PEPROCESS Process,
+    _Outptr_ PFGC_PROCESS_ENTRY *Entry
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PUNICODE_STRING imageName = NULL;
+    PFGC_PROCESS_ENTRY entry = NULL;
+
+    *Entry = NULL;
+
+    status = SeLocateProcessImageName(Process, &imageName);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, locate process %p image name failed", status, PsGetProcessId(Process));
+        goto Cleanup;
+    }
+
+    status = FgcAllocateBufferEx(&entry, POOL_FLAG_PAGED, sizeof(FGC_PROCESS_ENTRY), FG_PROCESS_ENTRY_PAGED_TAG);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate process entry failed", status);
+        goto Cleanup;
+    }
+
+    //
+    // The image name of some system processes is empty.
+    //
+    status = FgcAllocateUnicodeString(max(imageName->Length, sizeof(WCHAR)), &entry->ImageName);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate process image name failed", status);
+        goto Cleanup;
+    }
+
+    RtlCopyUnicodeString(entry->ImageName, imageName);
+    RtlHashUnicodeString(entry->ImageName, TRUE, HASH_STRING_ALGORITHM_DEFAULT, &entry->ImageHash);
+
+    entry->ProcessId = PsGetProcessId(Process);
+    entry->CreateTime = PsGetProcessCreateTimeQuadPart(Process);
+
+    DBG_TRACE("Process %p entry created, image: '%wZ'", entry->ProcessId, entry->ImageName);
+
+    *Entry = entry;
+
+Cleanup:
+
+    if (!NT_SUCCESS(status) && NULL != entry) {
+        FgcFreeProcessEntry(entry);
+    }
+
+    if (NULL != imageName) {
+        ExFreePool(imageName);
+    }
+
+    return status;
+}
+
+_Check_return_
+NTSTATUS
+FgcInitializeProcessCache(
+    _Inout_ PFGC_PROCESS_CACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    This routine initializes an empty process cache.
+
+Arguments:
+
+    Cache - Process cache to be initialized.
+
+Return Value:
+
+    STATUS_SUCCESS                - Success.
+    STATUS_INSUFFICIENT_RESOURCES - Failure. Unable to allocate the cache lock.
+    STATUS_INVALID_PARAMETER_1    - Failure. The 'Cache' parameter is NULL.
+
+--*/
+{
+    ULONG idx = 0ul;
+
+    PAGED_CODE();
+
+    if (NULL == Cache) return STATUS_INVALID_PARAMETER_1;
+
+    for (; idx < FG_PROCESS_CACHE_BUCKETS; idx++) {
+        InitializeListHead(&Cache->Buckets[idx]);
+        InitializeListHead(&Cache->ImageBuckets[idx]);
+    }
+
+    Cache->EntriesAmount = 0l;
+
+    return FgcCreatePushLock(&Cache->Lock);
+}
+
+VOID
+FgcFreeProcessCache(
+    _Inout_ PFGC_PROCESS_CACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    This routine frees all entries of the process cache and the cache lock.
+
+Arguments:
+
+    Cache - Process cache to be freed.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PLIST_ENTRY listEntry = NULL;
+    ULONG idx = 0ul;
+
+    PAGED_CODE();
+
+    if (NULL == Cache->Lock) return;
+
+    for (; idx < FG_PROCESS_CACHE_BUCKETS; idx++) {
+        while (!IsListEmpty(&Cache->Buckets[idx])) {
+            listEntry = RemoveHeadList(&Cache->Buckets[idx]);
+            FgcFreeProcessEntry(CONTAINING_RECORD(listEntry, FGC_PROCESS_ENTRY, List));
+        }
+
+        InitializeListHead(&Cache->ImageBuckets[idx]);
+    }
+
+    Cache->EntriesAmount = 0l;
+
+    FgcFreePushLock(Cache->Lock);
+    Cache->Lock = NULL;
+}
+
+_Check_return_
+NTSTATUS
+FgcGetProcessRuleSubset(
+    _In_ PFGC_PROCESS_CACHE Cache,
+    _In_ PEPROCESS Process,
+    _Outptr_ PFGC_RULE_SUBSET *Subset
+    )
+/*++
+
+Routine Description:
+
+    This routine gets the rules which apply to a process. The image path of a
+    process is resolved only once, the subset is rebuilt only if the rules
+    generation changed, and processes of the same image share one subset.
+
+Arguments:
+
+    Cache   - Process cache.
+    Process - The requestor process.
+    Subset  - A pointer to a variable that receives the referenced rule subset,
+              the caller releases it by FgcReleaseRuleSubset.
+
+Return Value:
+
+    STATUS_SUCCESS - Success.
+    Other          - Failure.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    HANDLE processId = NULL;
+    LONG64 createTime = 0ll;
+    LONG generation = 0l;
+    PFGC_PROCESS_ENTRY entry = NULL, newEntry = NULL, staleEntry = NULL;
+    PFGC_RULE_SUBSET subset = NULL, oldSubset = NULL;
+
+    PAGED_CODE();
+
+    if (NULL == Cache) return STATUS_INVALID_PARAMETER_1;
+    if (NULL == Process) return STATUS_INVALID_PARAMETER_2;
+    if (NULL == Subset) return STATUS_INVALID_PARAMETER_3;
+
+    *Subset = NULL;
+
+    processId = PsGetProcessId(Process);
+    createTime = PsGetProcessCreateTimeQuadPart(Process);
+    generation = ReadAcquire(&Globals.RulesGeneration);
+
+    FltAcquirePushLockShared(Cache->Lock);
+
+    entry = FgcLookupProcessEntry(Cache, processId);
+    if (NULL != entry && 
+        createTime == entry->CreateTime && 
+        NULL != entry->RuleSubset && 
+        generation == entry->RuleSubset->Generation) {
+        subset = entry->RuleSubset;
+        FgcReferenceRuleSubset(subset);
+    }
+
+    FltReleasePushLock(Cache->Lock);
+
+    if (NULL != subset) {
+        *Subset = subset;
+        return STATUS_SUCCESS;
+    }
+
+    for (;;) {
+
+        FltAcquirePushLockExclusive(Cache->Lock);
+
+        entry = FgcLookupProcessEntry(Cache, processId);
+        if (NULL != entry && createTime != entry->CreateTime) {
+
+            //
+            // The process id has been reused by a new process.
+            //
+            FgcUnlinkProcessEntry(Cache, entry);
+            staleEntry = entry;
+            entry = NULL;
+        }
+
+        if (NULL != entry || NULL != newEntry) break;
+
+        //
+        // Resolve the image name out of the lock. The entry is normally added by
+        // the process notify routine, only processes created before the first
+        // image rule was added get here, once.
+        //
+        FltReleasePushLock(Cache->Lock);
+
+        status = FgcCreateProcessEntry(Process, &newEntry);
+        if (!NT_SUCCESS(status)) goto Cleanup;
+    }
+
+    if (NULL == entry) {
+        entry = newEntry;
+
+        //
+        // The exit of a process may have been notified already, its entry would
+        // never be removed. The exit status is set before the exit is notified and
+        // the notify routine removes the entry under the cache lock, so an exiting
+        // process gets its rules without caching them.
+        //
+        if (STATUS_PENDING == PsGetProcessExitStatus(Process)) {
+            FgcInsertProcessEntry(Cache, entry);
+            newEntry = NULL;
+        }
+    }
+
+    generation = ReadAcquire(&Globals.RulesGeneration);
+    if (NULL == entry->RuleSubset || generation != entry->RuleSubset->Generation) {
+
+        subset = FgcLookupSharedRuleSubset(Cache, entry, generation);
+        if (NULL != subset) {
+            FgcReferenceRuleSubset(subset);
+        } else {
+            status = FgcCreateRuleSubset(&Globals.RulesList,
+                                         Globals.RulesListLock,
+                                         generation,
+                                         entry->ImageName,
+                                         &subset);
+        }
+
+        if (NT_SUCCESS(status)) {
+            oldSubset = entry->RuleSubset;
+            entry->RuleSubset = subset;
+        }
+    }
+
+    if (NT_SUCCESS(status)) {
+        subset = entry->RuleSubset;
+        FgcReferenceRuleSubset(subset);
+        *Subset = subset;
+    }
+
+    FltReleasePushLock(Cache->Lock);
+
+Cleanup:
+
+    if (NULL != oldSubset) {
+        FgcReleaseRuleSubset(oldSubset);
+    }
+
+    if (NULL != staleEntry) {
+        FgcFreeProcessEntry(staleEntry);
+    }
+
+    if (NULL != newEntry) {
+        FgcFreeProcessEntry(newEntry);
+    }
+
+    return status;
+}
+
+_Check_return_
+NTSTATUS
+FgcAddProcessEntry(
+    _In_ PFGC_PROCESS_CACHE Cache,
+    _In_ PEPROCESS Process
+    )
+/*++
+
+Routine Description:
+
+    This routine resolves the image path of a created process and adds its entry
+    to the process cache, so the operation callbacks find it without locating the
+    image name themselves. The rule subset is still built on the first match.
+
+Arguments:
+
+    Cache   - Process cache.
+    Process - The created process.
+
+Return Value:
+
+    STATUS_SUCCESS - Success, or the process is cached already.
+    Other          - Failure.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFGC_PROCESS_ENTRY entry = NULL, newEntry = NULL, staleEntry = NULL;
+
+    PAGED_CODE();
+
+    if (NULL == Cache) return STATUS_INVALID_PARAMETER_1;
+    if (NULL == Process) return STATUS_INVALID_PARAMETER_2;
+
+    status = FgcCreateProcessEntry(Process, &newEntry);
+    if (!NT_SUCCESS(status)) return status;
+
+    FltAcquirePushLockExclusive(Cache->Lock);
+
+    entry = FgcLookupProcessEntry(Cache, newEntry->ProcessId);
+    if (NULL != entry && newEntry->CreateTime != entry->CreateTime) {
+
+        //
+        // The exit of the former process has not been notified yet.
+        //
+        FgcUnlinkProcessEntry(Cache, entry);
+        staleEntry = entry;
+        entry = NULL;
+    }
+
+    if (NULL == entry) {
+        FgcInsertProcessEntry(Cache, newEntry);
+        newEntry = NULL;
+    }
+
+    FltReleasePushLock(Cache->Lock);
+
+    if (NULL != staleEntry) {
+        FgcFreeProcessEntry(staleEntry);
+    }
+
+    if (NULL != newEntry) {
+        FgcFreeProcessEntry(newEntry);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FgcRemoveProcessEntry(
+    _In_ PFGC_PROCESS_CACHE Cache,
+    _In_ HANDLE ProcessId
+    )
+/*++
+
+Routine Description:
+
+    This routine removes the entry of an exited process from the process cache.
+
+Arguments:
+
+    Cache     - Process cache.
+    ProcessId - Id of the exited process.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PFGC_PROCESS_ENTRY entry = NULL;
+
+    PAGED_CODE();
+
+    if (0 == ReadNoFence(&Cache->EntriesAmount)) return;
+
+    FltAcquirePushLockExclusive(Cache->Lock);
+
+    entry = FgcLookupProcessEntry(Cache, ProcessId);
+    if (NULL != entry) {
+        FgcUnlinkProcessEntry(Cache, entry);
+    }
+
+    FltReleasePushLock(Cache->Lock);
+
+    if (NULL != entry) {
+        FgcFreeProcessEntry(entry);
+    }
+}
+
+_Check_return_
+NTSTATUS
+FgcMatchProcessRules(
+    _In_opt_ PEPROCESS Process,
+    _In_opt_ PFGC_RULE_SUBSET VolumeRules,
+    _In_ UNICODE_STRING *FileDevicePathName,
+    _Outptr_result_maybenull_ FGC_RULE **MatchedRule
+    )
+/*++
+
+Routine Description:
+
+    This routine matches a file path against the rules which apply to the requestor
+    process. While no rule has an image expression only the rules partition of the
+    file volume is matched and the requestor process is never looked up.
+
+Arguments:
+
+    Process            - The requestor process, NULL for the current process.
+    VolumeRules        - The rules partition of the file volume, NULL to match the
+                         whole rules list.
+    FileDevicePathName - The file path to be matched.
+    MatchedRule        - A pointer to a variable that receives the referenced first
+                         matched rule, NULL if no rule matched.
+
+Return Value:
+
+    STATUS_SUCCESS - Success.
+    Other          - Failure.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFGC_RULE_SUBSET subset = NULL;
+
+    PAGED_CODE();
+
+    if (0 == ReadNoFence(&Globals.ProcessScopedRulesAmount)) {
+        if (NULL != VolumeRules) {
+            return FgcMatchRuleSubset(VolumeRules, FileDevicePathName, MatchedRule);
+        }
+
+        return FgcMatchRules(&Globals.RulesList, Globals.RulesListLock, FileDevicePathName, MatchedRule);
+    }
+
+    if (NULL == Process) Process = PsGetCurrentProcess();
+
+    status = FgcGetProcessRuleSubset(&Globals.ProcessCache, Process, &subset);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, get process %p rule subset failed", status, PsGetProcessId(Process));
+        return status;
+    }
+
+    status = FgcMatchRuleSubset(subset, FileDevicePathName, MatchedRule);
+
+    FgcReleaseRuleSubset(subset);
+
+    return status;
+}
+
+BOOLEAN
+FgcIsRuleAppliedToProcess(
+    _In_ CONST FGC_RULE *Rule,
+    _In_opt_ PEPROCESS Process
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether a rule cached in a file context applies to the
+    requestor process of a later operation on the file. The image of the process
+    is resolved through its cached rule subset, it is located once when the
+    process is created, or here for a process created before the first image
+    rule was added.
+
+Arguments:
+
+    Rule    - The rule to be checked.
+    Process - The requestor process, NULL for the current process.
+
+Return Value:
+
+    TRUE if the rule applies to the process, otherwise FALSE. If the process
+    rule subset can not be resolved the rule is treated as applied.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFGC_RULE_SUBSET subset = NULL;
+    BOOLEAN applied = FALSE;
+    ULONG idx = 0ul;
+
+    PAGED_CODE();
+
+    if (NULL == Rule->ImageExpression) return TRUE;
+
+    if (NULL == Process) Process = PsGetCurrentProcess();
+
+    status = FgcGetProcessRuleSubset(&Globals.ProcessCache, Process, &subset);
+    if (!NT_SUCCESS(status)) return TRUE;
+
+    for (; idx < subset->RulesAmount; idx++) {
+        if (Rule == subset->Rules[idx]) {
+            applied = TRUE;
+            break;
+        }
+    }
+
+    FgcReleaseRuleSubset(subset);
+
+    return applied;
+}
+
+VOID
+FgcProcessNotifyRoutine(
+    _In_ HANDLE ParentId,
+    _In_ HANDLE ProcessId,
+    _In_ BOOLEAN Create
+    )
+/*++
+
+Routine Description:
+
+    This routine is the process creation and deletion notify routine. While any
+    rule has an image expression it caches the image of a created process, and it
+    drops the cached identity and the trust of an exited process.
+
+Arguments:
+
+    ParentId  - Id of the parent process.
+    ProcessId - Id of the process.
+    Create    - TRUE if the process is created, FALSE if it is deleted.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PEPROCESS process = NULL;
+
+    UNREFERENCED_PARAMETER(ParentId);
+
+    PAGED_CODE();
+
+    if (Create) {
+        if (0 == ReadNoFence(&Globals.ProcessScopedRulesAmount)) return;
+
+        status = PsLookupProcessByProcessId(ProcessId, &process);
+        if (!NT_SUCCESS(status)) return;
+
+        status = FgcAddProcessEntry(&Globals.ProcessCache, process);
+        if (!NT_SUCCESS(status)) {
+            DBG_WARNING("NTSTATUS: 0x%08x, cache process %p failed", status, ProcessId);
+        }
+
+        ObDereferenceObject(process);
+        return;
+    }
+
+    FgcRemoveProcessEntry(&Globals.ProcessCache, ProcessId);
+
+    if (0 != ReadNoFence(&Globals.TrustedProcesses.ProcessesAmount)) {
+        status = FgcRemoveTrustedProcess(&Globals.TrustedProcesses, ProcessId);
+        UNREFERENCED_PARAMETER(status);
+    }
+}
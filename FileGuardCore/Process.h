@@ -0,0 +1,163 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    Process.h
+
+Abstract:
+
+    Declarations of requestor process routines.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __PROCESS_H__
+#define __PROCESS_H__
+
+/*-------------------------------------------------------------
+    Trusted process table structures and routines.
+-------------------------------------------------------------*/
+
+#include "TrustedProcessTable.h"
+
+_Check_return_
+NTSTATUS
+FgcInitializeTrustedProcessTable(
+    _Inout_ PFGC_TRUSTED_PROCESS_TABLE Table
+    );
+
+FORCEINLINE
+VOID
+FgcFreeTrustedProcessTable(
+    _Inout_ PFGC_TRUSTED_PROCESS_TABLE Table
+    )
+{
+    if (NULL != Table->Lock) {
+        FgcFreePushLock(Table->Lock);
+        Table->Lock = NULL;
+    }
+}
+
+_Check_return_
+NTSTATUS
+FgcAddTrustedProcess(
+    _In_ PFGC_TRUSTED_PROCESS_TABLE Table,
+    _In_ HANDLE ProcessId
+    );
+
+_Check_return_
+NTSTATUS
+FgcRemoveTrustedProcess(
+    _In_ PFGC_TRUSTED_PROCESS_TABLE Table,
+    _In_ HANDLE ProcessId
+    );
+
+BOOLEAN
+FgcIsTrustedProcess(
+    _In_ PFGC_TRUSTED_PROCESS_TABLE Table,
+    _In_opt_ PEPROCESS Process
+    );
+
+/*-------------------------------------------------------------
+    Process cache structures and routines.
+-------------------------------------------------------------*/
+
+#include "ProcessCache.h"
+
+_Check_return_
+NTSTATUS
+FgcInitializeProcessCache(
+    _Inout_ PFGC_PROCESS_CACHE Cache
+    );
+
+VOID
+FgcFreeProcessCache(
+    _Inout_ PFGC_PROCESS_CACHE Cache
+    );
+
+_Check_return_
+NTSTATUS
+FgcGetProcessRuleSubset(
+    _In_ PFGC_PROCESS_CACHE Cache,
+    _In_ PEPROCESS Process,
+    _Outptr_ PFGC_RULE_SUBSET *Subset
+    );
+
+_Check_return_
+NTSTATUS
+FgcAddProcessEntry(
+    _In_ PFGC_PROCESS_CACHE Cache,
+    _In_ PEPROCESS Process
+    );
+
+VOID
+FgcRemoveProcessEntry(
+    _In_ PFGC_PROCESS_CACHE Cache,
+    _In_ HANDLE ProcessId
+    );
+
+_Check_return_
+NTSTATUS
+FgcMatchProcessRules(
+    _In_opt_ PEPROCESS Process,
+    _In_opt_ PFGC_RULE_SUBSET VolumeRules,
+    _In_ UNICODE_STRING *FileDevicePathName,
+    _Outptr_result_maybenull_ FGC_RULE **MatchedRule
+    );
+
+BOOLEAN
+FgcIsRuleAppliedToProcess(
+    _In_ CONST FGC_RULE *Rule,
+    _In_opt_ PEPROCESS Process
+    );
+
+VOID
+FgcProcessNotifyRoutine(
+    _In_ HANDLE ParentId,
+    _In_ HANDLE ProcessId,
+    _In_ BOOLEAN Create
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, FgcInitializeProcessCache)
+#pragma alloc_text(PAGE, FgcFreeProcessCache)
+#pragma alloc_text(PAGE, FgcGetProcessRuleSubset)
+#pragma alloc_text(PAGE, FgcAddProcessEntry)
+#pragma alloc_text(PAGE, FgcRemoveProcessEntry)
+#pragma alloc_text(PAGE, FgcMatchProcessRules)
+#pragma alloc_text(PAGE, FgcIsRuleAppliedToProcess)
+#pragma alloc_text(PAGE, FgcProcessNotifyRoutine)
+#pragma alloc_text(PAGE, FgcInitializeTrustedProcessTable)
+#pragma alloc_text(PAGE, FgcAddTrustedProcess)
+#pragma alloc_text(PAGE, FgcRemoveTrustedProcess)
+#endif
+
+#endif
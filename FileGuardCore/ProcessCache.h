@@ -0,0 +1,174 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    ProcessCache.h
+
+Abstract:
+
+    Process cache entries and their buckets. The bucket routines only link, unlink
+    and compare entries, so they are also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __PROCESS_CACHE_H__
+#define __PROCESS_CACHE_H__
+
+//
+// Amount of process cache buckets, it must be a power of two.
+//
+#define FG_PROCESS_CACHE_BUCKETS 64
+
+typedef struct _FGC_PROCESS_ENTRY {
+
+    //
+    // This field is used to link to cache bucket.
+    //
+    LIST_ENTRY List;
+
+    //
+    // This field is used to link to image bucket, keyed by the image hash.
+    //
+    LIST_ENTRY ImageList;
+
+    HANDLE ProcessId;
+
+    LONG64 CreateTime;
+
+    //
+    // Case insensitive hash of the image path, processes running the same image
+    // share their rule subset.
+    //
+    ULONG ImageHash;
+
+    //
+    // Image path of the process.
+    //
+    PUNICODE_STRING ImageName;
+
+    //
+    // Rules which apply to the process, NULL until the first match.
+    //
+    PFGC_RULE_SUBSET RuleSubset;
+
+} FGC_PROCESS_ENTRY, *PFGC_PROCESS_ENTRY;
+
+typedef struct _FGC_PROCESS_CACHE {
+
+    PEX_PUSH_LOCK Lock;
+
+    __volatile LONG EntriesAmount;
+
+    LIST_ENTRY Buckets[FG_PROCESS_CACHE_BUCKETS];
+
+    //
+    // The same entries bucketed by image hash, processes of an image find the
+    // rule subset they share without walking the whole cache.
+    //
+    LIST_ENTRY ImageBuckets[FG_PROCESS_CACHE_BUCKETS];
+
+} FGC_PROCESS_CACHE, *PFGC_PROCESS_CACHE;
+
+#define FgcProcessIdIndex(_pid_) ((ULONG)(((ULONG_PTR)(_pid_) >> 2) & (FG_PROCESS_CACHE_BUCKETS - 1)))
+#define FgcImageHashIndex(_hash_) ((ULONG)((_hash_) & (FG_PROCESS_CACHE_BUCKETS - 1)))
+
+FORCEINLINE
+PFGC_PROCESS_ENTRY
+FgcLookupProcessEntry(
+    _In_ PFGC_PROCESS_CACHE Cache,
+    _In_ HANDLE ProcessId
+    )
+{
+    PLIST_ENTRY bucket = NULL, listEntry = NULL;
+    PFGC_PROCESS_ENTRY entry = NULL;
+
+    bucket = &Cache->Buckets[FgcProcessIdIndex(ProcessId)];
+    for (listEntry = bucket->Flink; listEntry != bucket; listEntry = listEntry->Flink) {
+        entry = CONTAINING_RECORD(listEntry, FGC_PROCESS_ENTRY, List);
+        if (ProcessId == entry->ProcessId) return entry;
+    }
+
+    return NULL;
+}
+
+FORCEINLINE
+VOID
+FgcInsertProcessEntry(
+    _In_ PFGC_PROCESS_CACHE Cache,
+    _In_ PFGC_PROCESS_ENTRY Entry
+    )
+{
+    InsertHeadList(&Cache->Buckets[FgcProcessIdIndex(Entry->ProcessId)], &Entry->List);
+    InsertHeadList(&Cache->ImageBuckets[FgcImageHashIndex(Entry->ImageHash)], &Entry->ImageList);
+    InterlockedIncrement(&Cache->EntriesAmount);
+}
+
+FORCEINLINE
+VOID
+FgcUnlinkProcessEntry(
+    _In_ PFGC_PROCESS_CACHE Cache,
+    _In_ PFGC_PROCESS_ENTRY Entry
+    )
+{
+    RemoveEntryList(&Entry->List);
+    RemoveEntryList(&Entry->ImageList);
+    InterlockedDecrement(&Cache->EntriesAmount);
+}
+
+FORCEINLINE
+PFGC_RULE_SUBSET
+FgcLookupSharedRuleSubset(
+    _In_ PFGC_PROCESS_CACHE Cache,
+    _In_ PFGC_PROCESS_ENTRY Entry,
+    _In_ LONG Generation
+    )
+{
+    PLIST_ENTRY bucket = NULL, listEntry = NULL;
+    PFGC_PROCESS_ENTRY entry = NULL;
+
+    bucket = &Cache->ImageBuckets[FgcImageHashIndex(Entry->ImageHash)];
+    for (listEntry = bucket->Flink; listEntry != bucket; listEntry = listEntry->Flink) {
+
+        entry = CONTAINING_RECORD(listEntry, FGC_PROCESS_ENTRY, ImageList);
+        if (entry != Entry && 
+            entry->ImageHash == Entry->ImageHash &&
+            NULL != entry->RuleSubset &&
+            Generation == entry->RuleSubset->Generation &&
+            RtlEqualUnicodeString(entry->ImageName, Entry->ImageName, TRUE)) {
+            return entry->RuleSubset;
+        }
+    }
+
+    return NULL;
+}
+
+#endif
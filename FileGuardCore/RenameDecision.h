@@ -0,0 +1,88 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    RenameDecision.h
+
+Abstract:
+
+    Decisions of the rename callback which only depend on the state cached by the
+    filter. They touch no kernel object, so they are also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __RENAME_DECISION_H__
+#define __RENAME_DECISION_H__
+
+//
+// How the destination of a rename is matched.
+//
+typedef enum _FGC_RENAME_DESTINATION_MATCH {
+    RenameDestinationSkip = 0,  // Nothing to match nor to record, the destination is not looked up.
+    RenameDestinationRecord,    // The destination is only looked up to be recorded along with the source.
+    RenameDestinationParent,    // The rules are matched if any could apply under the destination parent.
+    RenameDestinationRules      // The rules are always matched.
+} FGC_RENAME_DESTINATION_MATCH;
+
+FORCEINLINE
+FGC_RENAME_DESTINATION_MATCH
+FgcGetRenameDestinationMatch(
+    _In_ BOOLEAN InstanceKnown,
+    _In_ LONG VolumeRulesAmount,
+    _In_ BOOLEAN NameRequired
+    )
+/*++
+
+Routine Description:
+
+    This routine decides how the destination of a rename is matched. A volume no
+    rule could match a file on is never matched, the verdict of the destination
+    parent is only cached for a volume whose instance context is known.
+
+Arguments:
+
+    InstanceKnown     - TRUE if the instance context of the volume is known.
+    VolumeRulesAmount - Amount of rules which could match files on the volume.
+    NameRequired      - TRUE if the destination name is recorded whatever it matches.
+
+Return Value:
+
+    How the destination is matched.
+
+--*/
+{
+    if (!InstanceKnown) return RenameDestinationRules;
+    if (0 != VolumeRulesAmount) return RenameDestinationParent;
+
+    return NameRequired ? RenameDestinationRecord : RenameDestinationSkip;
+}
+
+#endif
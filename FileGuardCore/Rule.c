@@ -51,8 +51,8 @@ FgcCreateRule(
     _Inout_ FGC_RULE** Rule
 ) {
     NTSTATUS status = STATUS_SUCCESS;
-    UNICODE_STRING originalPathExpression = { 0 };
-    PUNICODE_STRING pathExpression = NULL;
+    UNICODE_STRING originalPathExpression = { 0 }, originalImageExpression = { 0 };
+    PUNICODE_STRING pathExpression = NULL, imageExpression = NULL;
     FGC_RULE* rule = NULL;
 
     status = FgcAllocateUnicodeString(UserRule->PathExpressionSize, &pathExpression);
@@ -71,7 +71,25 @@ FgcCreateRule(
         goto Cleanup;
     }
 
-    status = FgcAllocateBufferEx(&rule, POOL_FLAG_PAGED, sizeof(FGC_RULE_ENTRY), FG_RULE_ENTRY_PAGED_TAG);
+    if (0 != UserRule->ImageExpressionSize) {
+        status = FgcAllocateUnicodeString(UserRule->ImageExpressionSize, &imageExpression);
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, allocate image expression string failed", status);
+            goto Cleanup;
+        }
+
+        originalImageExpression.Buffer = FG_RULE_IMAGE_EXPRESSION(UserRule);
+        originalImageExpression.Length = UserRule->ImageExpressionSize;
+        originalImageExpression.MaximumLength = UserRule->ImageExpressionSize;
+
+        status = RtlUpcaseUnicodeString(imageExpression, &originalImageExpression, FALSE);
+        if (!NT_SUCCESS(status)) {
+            LOG_ERROR("NTSTATUS: 0x%08x, upcase image expression string failed", status);
+            goto Cleanup;
+        }
+    }
+
+    status = FgcAllocateBufferEx(&rule, POOL_FLAG_PAGED, sizeof(FGC_RULE), FG_RULE_ENTRY_PAGED_TAG);
     if (!NT_SUCCESS(status)) {
         LOG_ERROR("NTSTATUS: 0x%08x, allocate new rule entry failed", status);
         goto Cleanup;
@@ -81,7 +99,10 @@ FgcCreateRule(
     FLT_ASSERT(NULL != rule);
 
     rule->Code.Value = UserRule->Code.Value;
+    rule->Id = FgcAllocateRuleId();
+    rule->Operations = FG_RULE_COMPILE_OPERATIONS(UserRule->Code, UserRule->Operations);
     rule->PathExpression = pathExpression;
+    rule->ImageExpression = imageExpression;
     InterlockedExchange64(&rule->References, 1);
 
     *Rule = rule;
@@ -98,6 +119,10 @@ Cleanup:
             FgcFreeUnicodeString(pathExpression);
         }
 
+        if (NULL != imageExpression) {
+            FgcFreeUnicodeString(imageExpression);
+        }
+
         *Rule = NULL;
     }
 
@@ -124,6 +149,10 @@ FgcReleaseRule(
                 FgcFreeUnicodeString(InterlockedExchangePointer(&Rule->PathExpression, NULL));
             }
 
+            if (NULL != Rule->ImageExpression) {
+                FgcFreeUnicodeString(InterlockedExchangePointer(&Rule->ImageExpression, NULL));
+            }
+
             FgcFreeBuffer(Rule);
         }
 
@@ -140,6 +169,121 @@ FgcReleaseRule(
     }
 }
 
+BOOLEAN
+FgcIsRuleImageMatched(
+    _In_ CONST FGC_RULE *Rule,
+    _In_ PCUNICODE_STRING ImageName
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether a rule applies to a process image.
+
+Arguments:
+
+    Rule      - The rule to be checked.
+    ImageName - The image path of the process.
+
+Return Value:
+
+    TRUE if the rule has no image expression or the image expression accepts the image,
+    otherwise FALSE.
+
+--*/
+{
+    UNICODE_STRING imageExpression = { 0 };
+    BOOLEAN inverted = FALSE, matched = FALSE;
+
+    if (NULL == Rule->ImageExpression) return TRUE;
+
+    imageExpression = *Rule->ImageExpression;
+    if (imageExpression.Length >= sizeof(WCHAR) && L'!' == imageExpression.Buffer[0]) {
+        inverted = TRUE;
+        imageExpression.Buffer++;
+        imageExpression.Length -= sizeof(WCHAR);
+        imageExpression.MaximumLength -= sizeof(WCHAR);
+    }
+
+    matched = FsRtlIsNameInExpression(&imageExpression, (PUNICODE_STRING)ImageName, TRUE, NULL);
+
+    return inverted ? !matched : matched;
+}
+
+BOOLEAN
+FgcIsRuleAppliedToVolume(
+    _In_ CONST FGC_RULE *Rule,
+    _In_ PCUNICODE_STRING VolumeName
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether a rule could match any file on a volume. Only the
+    literal prefix of the path expression, up to the first wildcard, is compared
+    with the volume name, so the result may be a false positive but never a false
+    negative.
+
+Arguments:
+
+    Rule       - The rule to be checked.
+    VolumeName - The upcased device name of the volume, e.g. '\DEVICE\HARDDISKVOLUME1'.
+
+Return Value:
+
+    TRUE if the rule could match files on the volume, otherwise FALSE.
+
+--*/
+{
+    return FgcIsExpressionAppliedToVolume(Rule->PathExpression, VolumeName);
+}
+
+static
+BOOLEAN
+FgcIsSameRule(
+    _In_ CONST FGC_RULE *Rule,
+    _In_ FG_RULE *UserRule
+    )
+{
+    UNICODE_STRING expression = { 0 };
+
+    if (Rule->Code.Value != UserRule->Code.Value) return FALSE;
+    if (Rule->Operations != FG_RULE_COMPILE_OPERATIONS(UserRule->Code, UserRule->Operations)) return FALSE;
+
+    expression.Buffer = UserRule->PathExpression;
+    expression.Length = UserRule->PathExpressionSize;
+    expression.MaximumLength = UserRule->PathExpressionSize;
+    if (0 != RtlCompareUnicodeString(&expression, Rule->PathExpression, TRUE)) return FALSE;
+
+    if (0 == UserRule->ImageExpressionSize) return NULL == Rule->ImageExpression;
+    if (NULL == Rule->ImageExpression) return FALSE;
+
+    expression.Buffer = FG_RULE_IMAGE_EXPRESSION(UserRule);
+    expression.Length = UserRule->ImageExpressionSize;
+    expression.MaximumLength = UserRule->ImageExpressionSize;
+    return 0 == RtlCompareUnicodeString(&expression, Rule->ImageExpression, TRUE);
+}
+
+static
+VOID
+FgcCopyRule(
+    _Out_ FG_RULE *Buffer,
+    _In_ CONST FGC_RULE *Rule
+    )
+{
+    RtlCopyMemory(Buffer->PathExpression, Rule->PathExpression->Buffer, Rule->PathExpression->Length);
+    Buffer->Code.Value = Rule->Code.Value;
+    Buffer->Id = Rule->Id;
+    Buffer->Operations = Rule->Operations;
+    Buffer->PathExpressionSize = Rule->PathExpression->Length;
+    Buffer->ImageExpressionSize = 0;
+
+    if (NULL != Rule->ImageExpression) {
+        RtlCopyMemory(FG_RULE_IMAGE_EXPRESSION(Buffer), Rule->ImageExpression->Buffer, Rule->ImageExpression->Length);
+        Buffer->ImageExpressionSize = Rule->ImageExpression->Length;
+    }
+}
+
 /*-------------------------------------------------------------
     Rule entry basic structures and routines
 -------------------------------------------------------------*/
@@ -227,6 +371,7 @@ FgcAddRules(
     PFGC_RULE_ENTRY ruleEntry = NULL;
     PLIST_ENTRY listEntry = NULL, next = NULL;
     UNICODE_STRING pathExpression = { 0 };
+    USHORT addedAmount = 0;
 
     if (NULL == RuleList) return STATUS_INVALID_PARAMETER_1;
     if (NULL == ListLock) return STATUS_INVALID_PARAMETER_2;
@@ -239,13 +384,14 @@ FgcAddRules(
     FltAcquirePushLockExclusive(ListLock);
     for (; ruleIdx < RulesAmount; ruleIdx++) {
 
-        if (!VALID_RULE_CODE(rulePtr->Code)) {
+        if (!VALID_RULE_CODE(rulePtr->Code) || !VALID_RULE_OPERATIONS(rulePtr->Operations)) {
             pathExpression.Buffer = rulePtr->PathExpression;
             pathExpression.Length = rulePtr->PathExpressionSize;
             pathExpression.MaximumLength = rulePtr->PathExpressionSize;
-            LOG_WARNING("Invalid rule, major code: 0x%08x, minor code: 0x%08x, path expression: '%wZ'", 
+            LOG_WARNING("Invalid rule, major code: 0x%08x, minor code: 0x%08x, operations: 0x%08x, path expression: '%wZ'", 
                         rulePtr->Code.Major,
                         rulePtr->Code.Minor,
+                        rulePtr->Operations,
                         &pathExpression);
 
             goto NextNewRule;
@@ -254,14 +400,7 @@ FgcAddRules(
         LIST_FOR_EACH_SAFE(listEntry, next, RuleList) {
 
             ruleEntry = CONTAINING_RECORD(listEntry, FGC_RULE_ENTRY, List);
-            if (rulePtr->Code.Value == ruleEntry->Rule->Code.Value) {
-                pathExpression.Buffer = rulePtr->PathExpression;
-                pathExpression.Length = rulePtr->PathExpressionSize;
-                pathExpression.MaximumLength = rulePtr->PathExpressionSize;
-
-                if (0 == RtlCompareUnicodeString(&pathExpression, ruleEntry->Rule->PathExpression, TRUE)) 
-                    goto NextNewRule;
-            }
+            if (FgcIsSameRule(ruleEntry->Rule, rulePtr)) goto NextNewRule;
         }
 
         status = FgcCreateRuleEntry(rulePtr, &ruleEntry);
@@ -271,7 +410,11 @@ FgcAddRules(
         }
 
         InsertHeadList(RuleList, &ruleEntry->List);
-        if (NULL != AddedAmount) (*AddedAmount)++;
+        if (NULL != ruleEntry->Rule->ImageExpression) {
+            InterlockedIncrement(&Globals.ProcessScopedRulesAmount);
+        }
+
+        addedAmount++;
 
         DBG_INFO("Rule %p added, major code: 0x%08x, minor code: 0x%08x, path expression: '%wZ'", 
                  ruleEntry, 
@@ -281,10 +424,21 @@ FgcAddRules(
 
     NextNewRule:
 
-        rulePtr = Add2Ptr(rulePtr, rulePtr->PathExpressionSize + sizeof(FG_RULE));
+        rulePtr = Add2Ptr(rulePtr, FG_RULE_SIZE(rulePtr));
+    }
+
+    //
+    // The partitions of the instances are rebuilt before the new generation is
+    // published, a create which sees it sees the new rules amount of its volume.
+    //
+    if (addedAmount > 0) {
+        FgcRebuildInstanceContexts(ReadNoFence(&Globals.RulesGeneration) + 1);
+        InterlockedIncrement(&Globals.RulesGeneration);
     }
     FltReleasePushLock(ListLock);
 
+    if (NULL != AddedAmount) (*AddedAmount) = addedAmount;
+
     return status;
 }
 
@@ -303,7 +457,7 @@ FgcFindAndRemoveRule(
     FG_RULE *rulePtr = NULL;
     FGC_RULE_ENTRY *ruleEntry = NULL;
     LIST_ENTRY *listEntry = NULL, *next = NULL;
-    UNICODE_STRING pathExpression = { 0 };
+    USHORT removedAmount = 0;
 
     if (NULL == RuleList) return STATUS_INVALID_PARAMETER_1;
     if (NULL == ListLock) return STATUS_INVALID_PARAMETER_2;
@@ -319,28 +473,34 @@ FgcFindAndRemoveRule(
         LIST_FOR_EACH_SAFE(listEntry, next, RuleList) {
 
             ruleEntry = CONTAINING_RECORD(listEntry, FGC_RULE_ENTRY, List);
-            if (rulePtr->Code.Value == ruleEntry->Rule->Code.Value) {
-                pathExpression.Buffer = rulePtr->PathExpression;
-                pathExpression.Length = rulePtr->PathExpressionSize;
-                pathExpression.MaximumLength = rulePtr->PathExpressionSize;
-                if (0 == RtlCompareUnicodeString(&pathExpression, ruleEntry->Rule->PathExpression, TRUE)) {
-                    LOG_INFO("Rule %p removed, major code: 0x%08x, minor code: 0x%08x, path expression: '%wZ'",
-                             ruleEntry,
-                             ruleEntry->Rule->Code.Major,
-                             ruleEntry->Rule->Code.Minor,
-                             ruleEntry->Rule->PathExpression);
-
-                    RemoveEntryList(listEntry);
-                    FgcFreeRuleEntry(ruleEntry);
-                    if (NULL != RemovedAmount) (*RemovedAmount)++;
+            if (FgcIsSameRule(ruleEntry->Rule, rulePtr)) {
+                LOG_INFO("Rule %p removed, major code: 0x%08x, minor code: 0x%08x, path expression: '%wZ'",
+                         ruleEntry,
+                         ruleEntry->Rule->Code.Major,
+                         ruleEntry->Rule->Code.Minor,
+                         ruleEntry->Rule->PathExpression);
+
+                RemoveEntryList(listEntry);
+                if (NULL != ruleEntry->Rule->ImageExpression) {
+                    InterlockedDecrement(&Globals.ProcessScopedRulesAmount);
                 }
+
+                FgcFreeRuleEntry(ruleEntry);
+                removedAmount++;
             }
         }
 
-        rulePtr = Add2Ptr(rulePtr, rulePtr->PathExpressionSize + sizeof(FG_RULE));
+        rulePtr = Add2Ptr(rulePtr, FG_RULE_SIZE(rulePtr));
+    }
+
+    if (removedAmount > 0) {
+        FgcRebuildInstanceContexts(ReadNoFence(&Globals.RulesGeneration) + 1);
+        InterlockedIncrement(&Globals.RulesGeneration);
     }
     FltReleasePushLock(ListLock);
 
+    if (NULL != RemovedAmount) (*RemovedAmount) = removedAmount;
+
     return status;
 }
 
@@ -434,7 +594,7 @@ FgcMatchRulesEx(
                       ruleEntry->Rule->Code.Minor,
                       ruleEntry->Rule->PathExpression);
 
-            thisRuleSize = sizeof(FG_RULE) + ruleEntry->Rule->PathExpression->Length;
+            thisRuleSize = FgcGetRuleSize(ruleEntry->Rule);
             *RulesSize += thisRuleSize;
             rulesAmount++;
 
@@ -442,11 +602,7 @@ FgcMatchRulesEx(
 
             if (NULL != RulesBuffer && 0 != RulesBufferSize && bufferRemainSize >= thisRuleSize) {
                 try {
-                    RtlCopyMemory(rulePtr->PathExpression,
-                                  ruleEntry->Rule->PathExpression->Buffer,
-                                  ruleEntry->Rule->PathExpression->Length);
-                    rulePtr->Code.Value = ruleEntry->Rule->Code.Value;
-                    rulePtr->PathExpressionSize = ruleEntry->Rule->PathExpression->Length;
+                    FgcCopyRule(rulePtr, ruleEntry->Rule);
                 } except(EXCEPTION_EXECUTE_HANDLER) {
                     status = GetExceptionCode();
                     LOG_ERROR("NTSTATUS: 0x%08x, get rule failed", status);
@@ -501,7 +657,7 @@ FgcGetRules(
     FltAcquirePushLockExclusive(Lock);
     LIST_FOR_EACH_SAFE(listEntry, next, RuleList) {
         ruleEntry = CONTAINING_RECORD(listEntry, FGC_RULE_ENTRY, List);
-        *RulesSize += sizeof(FG_RULE) + ruleEntry->Rule->PathExpression->Length;
+        *RulesSize += FgcGetRuleSize(ruleEntry->Rule);
         rulesAmount++;
     }
 
@@ -522,18 +678,14 @@ FgcGetRules(
         
         ruleEntry = CONTAINING_RECORD(listEntry, FGC_RULE_ENTRY, List);
         try {
-            RtlCopyMemory(rulePtr->PathExpression,
-                          ruleEntry->Rule->PathExpression->Buffer,
-                          ruleEntry->Rule->PathExpression->Length);
-            rulePtr->Code.Value = ruleEntry->Rule->Code.Value;
-            rulePtr->PathExpressionSize = ruleEntry->Rule->PathExpression->Length;
+            FgcCopyRule(rulePtr, ruleEntry->Rule);
         } except(EXCEPTION_EXECUTE_HANDLER) {
             status = GetExceptionCode();
             LOG_ERROR("NTSTATUS: 0x%08x, get rule failed", status);
             break;
         }
 
-        thisRuleSize = sizeof(FG_RULE) + rulePtr->PathExpressionSize;
+        thisRuleSize = FG_RULE_SIZE(rulePtr);
         RulesBufferSize -= thisRuleSize;
         if ((LONG)RulesBufferSize > 0) {
             rulePtr = Add2Ptr(rulePtr, thisRuleSize);
@@ -579,9 +731,798 @@ FgcCleanupRuleEntriesList(
         clean++;
     }
 
+    if (clean > 0) {
+        InterlockedExchange(&Globals.ProcessScopedRulesAmount, 0);
+        FgcRebuildInstanceContexts(ReadNoFence(&Globals.RulesGeneration) + 1);
+        InterlockedIncrement(&Globals.RulesGeneration);
+    }
+
     FltReleasePushLock(Lock);
 
     DBG_INFO("Cleanup %lu rules", clean);
 
     return clean;
 }
+
+/*-------------------------------------------------------------
+    Rule subset structures and routines
+-------------------------------------------------------------*/
+
+static
+_Check_return_
+NTSTATUS
+FgcBuildRuleSubset(
+    _In_ LIST_ENTRY *RuleList,
+    _In_ LONG Generation,
+    _In_opt_ PCUNICODE_STRING ImageName,
+    _In_opt_ PCUNICODE_STRING VolumeName,
+    _Outptr_ PFGC_RULE_SUBSET *Subset
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    LIST_ENTRY *entry = NULL, *next = NULL;
+    FGC_RULE_ENTRY *ruleEntry = NULL;
+    PFGC_RULE_SUBSET subset = NULL;
+    ULONG rulesAmount = 0ul;
+
+#define FgcIsRuleInSubset(_rule_) ((NULL == ImageName || FgcIsRuleImageMatched((_rule_), ImageName)) && \
+                                   (NULL == VolumeName || FgcIsRuleAppliedToVolume((_rule_), VolumeName)))
+
+    LIST_FOR_EACH_SAFE(entry, next, RuleList) {
+        ruleEntry = CONTAINING_RECORD(entry, FGC_RULE_ENTRY, List);
+        if (FgcIsRuleInSubset(ruleEntry->Rule)) rulesAmount++;
+    }
+
+    status = FgcAllocateBufferEx(&subset,
+                                 POOL_FLAG_PAGED,
+                                 FIELD_OFFSET(FGC_RULE_SUBSET, Rules[rulesAmount]),
+                                 FG_RULE_SUBSET_PAGED_TAG);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate rule subset failed", status);
+        return status;
+    }
+
+    subset->References = 1;
+    subset->Generation = Generation;
+    subset->RulesAmount = 0ul;
+
+    LIST_FOR_EACH_SAFE(entry, next, RuleList) {
+        ruleEntry = CONTAINING_RECORD(entry, FGC_RULE_ENTRY, List);
+        if (FgcIsRuleInSubset(ruleEntry->Rule)) {
+            FgcReferenceRule(ruleEntry->Rule);
+            subset->Rules[subset->RulesAmount++] = ruleEntry->Rule;
+        }
+    }
+
+#undef FgcIsRuleInSubset
+
+    *Subset = subset;
+
+    return status;
+}
+
+_Check_return_
+NTSTATUS
+FgcCreateRuleSubset(
+    _In_ LIST_ENTRY *RuleList,
+    _In_ EX_PUSH_LOCK *ListLock,
+    _In_ LONG Generation,
+    _In_ PCUNICODE_STRING ImageName,
+    _Outptr_ PFGC_RULE_SUBSET *Subset
+    )
+/*++
+
+Routine Description:
+
+    This routine builds a snapshot of the rules which apply to a process image.
+
+Arguments:
+
+    RuleList   - The rule list.
+    ListLock   - Lock of the rule list.
+    Generation - The rules generation read before the rule list is walked.
+    ImageName  - The image path of the process.
+    Subset     - A pointer to a variable that receives the referenced subset.
+
+Return Value:
+
+    STATUS_SUCCESS                - Success.
+    STATUS_INSUFFICIENT_RESOURCES - Failure. Unable to allocate memory.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    if (NULL == RuleList) return STATUS_INVALID_PARAMETER_1;
+    if (NULL == ListLock) return STATUS_INVALID_PARAMETER_2;
+    if (NULL == ImageName) return STATUS_INVALID_PARAMETER_4;
+    if (NULL == Subset) return STATUS_INVALID_PARAMETER_5;
+
+    *Subset = NULL;
+
+    FltAcquirePushLockShared(ListLock);
+
+    status = FgcBuildRuleSubset(RuleList, Generation, ImageName, NULL, Subset);
+    if (NT_SUCCESS(status)) {
+        DBG_TRACE("Rule subset %p built for image '%wZ', rules amount: %lu", *Subset, ImageName, (*Subset)->RulesAmount);
+    }
+
+    FltReleasePushLock(ListLock);
+
+    return status;
+}
+
+_Check_return_
+NTSTATUS
+FgcCreateVolumeRuleSubset(
+    _In_ LIST_ENTRY *RuleList,
+    _In_ LONG Generation,
+    _In_ PCUNICODE_STRING VolumeName,
+    _Outptr_ PFGC_RULE_SUBSET *Subset
+    )
+/*++
+
+Routine Description:
+
+    This routine builds the partition of the rules which could match files on a
+    volume. Rules whose expression has a wildcard in the volume part are shared
+    by the partitions of all volumes. The caller must hold the rule list lock.
+
+Arguments:
+
+    RuleList   - The rule list.
+    Generation - The rules generation of the rule list.
+    VolumeName - The upcased device name of the volume.
+    Subset     - A pointer to a variable that receives the referenced subset.
+
+Return Value:
+
+    STATUS_SUCCESS                - Success.
+    STATUS_INSUFFICIENT_RESOURCES - Failure. Unable to allocate memory.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    if (NULL == RuleList) return STATUS_INVALID_PARAMETER_1;
+    if (NULL == VolumeName) return STATUS_INVALID_PARAMETER_3;
+    if (NULL == Subset) return STATUS_INVALID_PARAMETER_4;
+
+    *Subset = NULL;
+
+    status = FgcBuildRuleSubset(RuleList, Generation, NULL, VolumeName, Subset);
+    if (NT_SUCCESS(status)) {
+        DBG_TRACE("Rule subset %p built for volume '%wZ', rules amount: %lu", *Subset, VolumeName, (*Subset)->RulesAmount);
+    }
+
+    return status;
+}
+
+VOID
+FgcReleaseRuleSubset(
+    _Inout_ PFGC_RULE_SUBSET Subset
+    )
+{
+    ULONG idx = 0ul;
+
+    FLT_ASSERT(NULL != Subset);
+
+    if (0 == InterlockedDecrement64(&Subset->References)) {
+        for (; idx < Subset->RulesAmount; idx++) {
+            FgcReleaseRule(Subset->Rules[idx]);
+        }
+
+        FgcFreeBuffer(Subset);
+    }
+}
+
+_Check_return_
+NTSTATUS
+FgcMatchRuleSubset(
+    _In_ PFGC_RULE_SUBSET Subset,
+    _In_ UNICODE_STRING *FileDevicePathName,
+    _Outptr_result_maybenull_ FGC_RULE **MatchedRule
+    )
+/*++
+
+Routine Description:
+
+    This routine matches a file path against a rule subset, the subset is immutable
+    so no lock is required.
+
+Arguments:
+
+    Subset             - The rule subset of the requestor process.
+    FileDevicePathName - The file path to be matched.
+    MatchedRule        - A pointer to a variable that receives the referenced first
+                         matched rule, NULL if no rule matched.
+
+Return Value:
+
+    STATUS_SUCCESS - Success.
+
+--*/
+{
+    ULONG idx = 0ul;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NULL != Subset);
+    FLT_ASSERT(NULL != FileDevicePathName);
+    if (NULL == MatchedRule) return STATUS_INVALID_PARAMETER_3;
+
+    *MatchedRule = NULL;
+
+    for (; idx < Subset->RulesAmount; idx++) {
+        if (FsRtlIsNameInExpression(Subset->Rules[idx]->PathExpression, FileDevicePathName, TRUE, NULL)) {
+            FgcReferenceRule(Subset->Rules[idx]);
+            *MatchedRule = Subset->Rules[idx];
+            break;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+FgcIsRuleSubsetAppliedToDirectory(
+    _In_ PFGC_RULE_SUBSET Subset,
+    _In_ PCUNICODE_STRING VolumeName,
+    _In_ PCUNICODE_STRING DirectoryPath
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether any rule of a subset could match a file under a
+    directory. As in FgcIsRuleAppliedToVolume only the literal prefix of each path
+    expression is compared, so the result may be a false positive but never a false
+    negative.
+
+Arguments:
+
+    Subset        - The rules partition of the directory volume.
+    VolumeName    - The upcased device name of the volume.
+    DirectoryPath - The directory path on the volume ending with a separator, in
+                    any case.
+
+Return Value:
+
+    TRUE if any rule could match files under the directory, otherwise FALSE.
+
+--*/
+{
+    ULONG idx = 0ul;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NULL != Subset);
+    FLT_ASSERT(NULL != VolumeName);
+    FLT_ASSERT(NULL != DirectoryPath);
+
+    for (; idx < Subset->RulesAmount; idx++) {
+        if (FgcIsExpressionAppliedToDirectory(Subset->Rules[idx]->PathExpression, VolumeName, DirectoryPath)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*-------------------------------------------------------------
+    File id rule table structures and routines
+-------------------------------------------------------------*/
+
+static
+VOID
+FgcFreeFileIdRuleEntry(
+    _In_ PFGC_FILE_ID_RULE_ENTRY Entry
+    )
+{
+    if (NULL != Entry->Rule) {
+        FgcReleaseRule(Entry->Rule);
+    }
+
+    FgcFreeBuffer(Entry);
+}
+
+_Check_return_
+NTSTATUS
+FgcInitializeFileIdRuleTable(
+    _Inout_ PFGC_FILE_ID_RULE_TABLE Table
+    )
+/*++
+
+Routine Description:
+
+    This routine initializes an empty file id rule table.
+
+Arguments:
+
+    Table - File id rule table to be initialized.
+
+Return Value:
+
+    STATUS_SUCCESS                - Success.
+    STATUS_INSUFFICIENT_RESOURCES - Failure. Unable to allocate the table lock.
+    STATUS_INVALID_PARAMETER_1    - Failure. The 'Table' parameter is NULL.
+
+--*/
+{
+    ULONG idx = 0ul;
+
+    PAGED_CODE();
+
+    if (NULL == Table) return STATUS_INVALID_PARAMETER_1;
+
+    for (; idx < FG_FILE_ID_RULE_TABLE_BUCKETS; idx++) {
+        InitializeListHead(&Table->Buckets[idx]);
+    }
+
+    Table->RulesAmount = 0l;
+
+    return FgcCreatePushLock(&Table->Lock);
+}
+
+ULONG
+FgcCleanupFileIdRuleTable(
+    _Inout_ PFGC_FILE_ID_RULE_TABLE Table
+    )
+/*++
+
+Routine Description:
+
+    This routine removes all rules of the file id rule table.
+
+Arguments:
+
+    Table - File id rule table.
+
+Return Value:
+
+    Amount of removed rules.
+
+--*/
+{
+    PLIST_ENTRY listEntry = NULL;
+    ULONG idx = 0ul, clean = 0ul;
+
+    PAGED_CODE();
+
+    FltAcquirePushLockExclusive(Table->Lock);
+
+    for (; idx < FG_FILE_ID_RULE_TABLE_BUCKETS; idx++) {
+        while (!IsListEmpty(&Table->Buckets[idx])) {
+            listEntry = RemoveHeadList(&Table->Buckets[idx]);
+            FgcFreeFileIdRuleEntry(CONTAINING_RECORD(listEntry, FGC_FILE_ID_RULE_ENTRY, List));
+            clean++;
+        }
+    }
+
+    if (clean > 0) {
+        InterlockedExchange(&Table->RulesAmount, 0);
+    }
+
+    FltReleasePushLock(Table->Lock);
+
+    //
+    // The instances count the file id rules of their volume before the new
+    // generation is published.
+    //
+    if (clean > 0) {
+        FgcUpdateInstanceFileIdRules();
+        InterlockedIncrement(&Globals.RulesGeneration);
+    }
+
+    DBG_INFO("Cleanup %lu file id rules", clean);
+
+    return clean;
+}
+
+_Check_return_
+NTSTATUS
+FgcAddFileIdRule(
+    _Inout_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ CONST FG_FILE_ID_DESCRIPTOR *FileIdDescriptor,
+    _In_ FG_RULE_CODE Code,
+    _In_ PCUNICODE_STRING FilePath,
+    _Out_ BOOLEAN *Added
+    )
+/*++
+
+Routine Description:
+
+    This routine adds a rule which matches a file by its id. A file has one file id
+    rule at most.
+
+Arguments:
+
+    Table            - File id rule table.
+    FileIdDescriptor - Volume serial number and id of the file.
+    Code             - Code of the rule.
+    FilePath         - Path of the file when the rule is added, it is kept as the rule
+                       expression for display.
+    Added            - A pointer to a variable that receives whether the rule is added.
+
+Return Value:
+
+    STATUS_SUCCESS - Success.
+    Other          - Failure.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PFGC_FILE_ID_RULE_ENTRY entry = NULL;
+    PUNICODE_STRING filePath = NULL;
+    FGC_RULE *rule = NULL;
+
+    PAGED_CODE();
+
+    if (NULL == Table) return STATUS_INVALID_PARAMETER_1;
+    if (NULL == FileIdDescriptor) return STATUS_INVALID_PARAMETER_2;
+    if (!VALID_RULE_CODE(Code)) return STATUS_INVALID_PARAMETER_3;
+    if (NULL == FilePath || 0 == FilePath->Length) return STATUS_INVALID_PARAMETER_4;
+    if (NULL == Added) return STATUS_INVALID_PARAMETER_5;
+
+    *Added = FALSE;
+
+    status = FgcAllocateBufferEx(&entry, POOL_FLAG_PAGED, sizeof(FGC_FILE_ID_RULE_ENTRY), FG_RULE_ENTRY_PAGED_TAG);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate file id rule entry failed", status);
+        goto Cleanup;
+    }
+
+    status = FgcAllocateUnicodeString(FilePath->Length, &filePath);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate file path string failed", status);
+        goto Cleanup;
+    }
+
+    RtlCopyUnicodeString(filePath, FilePath);
+
+    status = FgcAllocateBufferEx(&rule, POOL_FLAG_PAGED, sizeof(FGC_RULE), FG_RULE_ENTRY_PAGED_TAG);
+    if (!NT_SUCCESS(status)) {
+        LOG_ERROR("NTSTATUS: 0x%08x, allocate file id rule failed", status);
+        goto Cleanup;
+    }
+
+    rule->Code.Value = Code.Value;
+    rule->Id = FgcAllocateRuleId();
+    rule->Operations = FG_RULE_COMPILE_OPERATIONS(Code, 0ul);
+    rule->PathExpression = filePath;
+    filePath = NULL;
+    InterlockedExchange64(&rule->References, 1);
+
+    entry->VolumeSerialNumber = FileIdDescriptor->VolumeSerialNumber;
+    RtlCopyMemory(&entry->FileId, &FileIdDescriptor->FileId.FileId128, sizeof(FILE_ID_128));
+    entry->Rule = rule;
+    rule = NULL;
+
+    FltAcquirePushLockExclusive(Table->Lock);
+
+    if (FgcInsertFileIdRuleEntry(Table, entry)) {
+        DBG_INFO("File id rule %p added, major code: 0x%08x, minor code: 0x%08x, file: '%wZ'",
+                 entry,
+                 entry->Rule->Code.Major,
+                 entry->Rule->Code.Minor,
+                 entry->Rule->PathExpression);
+
+        entry = NULL;
+        *Added = TRUE;
+    }
+
+    FltReleasePushLock(Table->Lock);
+
+    if (*Added) {
+        FgcUpdateInstanceFileIdRules();
+        InterlockedIncrement(&Globals.RulesGeneration);
+    }
+
+Cleanup:
+
+    if (NULL != filePath) {
+        FgcFreeUnicodeString(filePath);
+    }
+
+    if (NULL != rule) {
+        FgcFreeBuffer(rule);
+    }
+
+    if (NULL != entry) {
+        FgcFreeFileIdRuleEntry(entry);
+    }
+
+    return status;
+}
+
+_Check_return_
+NTSTATUS
+FgcRemoveFileIdRule(
+    _Inout_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ CONST FG_FILE_ID_DESCRIPTOR *FileIdDescriptor,
+    _In_ FG_RULE_CODE Code,
+    _Out_ BOOLEAN *Removed
+    )
+/*++
+
+Routine Description:
+
+    This routine removes the rule of a file id.
+
+Arguments:
+
+    Table            - File id rule table.
+    FileIdDescriptor - Volume serial number and id of the file.
+    Code             - Code of the rule.
+    Removed          - A pointer to a variable that receives whether the rule is removed.
+
+Return Value:
+
+    STATUS_SUCCESS - Success.
+    Other          - Failure.
+
+--*/
+{
+    PFGC_FILE_ID_RULE_ENTRY entry = NULL;
+
+    PAGED_CODE();
+
+    if (NULL == Table) return STATUS_INVALID_PARAMETER_1;
+    if (NULL == FileIdDescriptor) return STATUS_INVALID_PARAMETER_2;
+    if (NULL == Removed) return STATUS_INVALID_PARAMETER_4;
+
+    *Removed = FALSE;
+
+    FltAcquirePushLockExclusive(Table->Lock);
+
+    entry = FgcLookupFileIdRuleEntry(Table,
+                                     FileIdDescriptor->VolumeSerialNumber,
+                                     &FileIdDescriptor->FileId.FileId128);
+    if (NULL != entry && Code.Value == entry->Rule->Code.Value) {
+        RemoveEntryList(&entry->List);
+        InterlockedDecrement(&Table->RulesAmount);
+        *Removed = TRUE;
+    } else {
+        entry = NULL;
+    }
+
+    FltReleasePushLock(Table->Lock);
+
+    if (NULL != entry) {
+        FgcUpdateInstanceFileIdRules();
+        InterlockedIncrement(&Globals.RulesGeneration);
+
+        LOG_INFO("File id rule %p removed, file: '%wZ'", entry, entry->Rule->PathExpression);
+        FgcFreeFileIdRuleEntry(entry);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Check_return_
+NTSTATUS
+FgcMatchFileIdRule(
+    _In_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ CONST FG_FILE_ID_DESCRIPTOR *FileIdDescriptor,
+    _Outptr_result_maybenull_ FGC_RULE **MatchedRule
+    )
+/*++
+
+Routine Description:
+
+    This routine looks up the rule of a file id.
+
+Arguments:
+
+    Table            - File id rule table.
+    FileIdDescriptor - Volume serial number and id of the file.
+    MatchedRule      - A pointer to a variable that receives the referenced rule,
+                       NULL if the file has no rule.
+
+Return Value:
+
+    STATUS_SUCCESS - Success.
+
+--*/
+{
+    PFGC_FILE_ID_RULE_ENTRY entry = NULL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NULL != Table);
+    FLT_ASSERT(NULL != FileIdDescriptor);
+    if (NULL == MatchedRule) return STATUS_INVALID_PARAMETER_3;
+
+    *MatchedRule = NULL;
+
+    if (0 == ReadNoFence(&Table->RulesAmount)) return STATUS_SUCCESS;
+
+    FltAcquirePushLockShared(Table->Lock);
+
+    entry = FgcLookupFileIdRuleEntry(Table,
+                                     FileIdDescriptor->VolumeSerialNumber,
+                                     &FileIdDescriptor->FileId.FileId128);
+    if (NULL != entry) {
+        FgcReferenceRule(entry->Rule);
+        *MatchedRule = entry->Rule;
+    }
+
+    FltReleasePushLock(Table->Lock);
+
+    return STATUS_SUCCESS;
+}
+
+LONG
+FgcCountVolumeFileIdRules(
+    _In_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ ULONGLONG VolumeSerialNumber
+    )
+/*++
+
+Routine Description:
+
+    This routine counts the file id rules of a volume.
+
+Arguments:
+
+    Table              - File id rule table.
+    VolumeSerialNumber - Serial number of the volume.
+
+Return Value:
+
+    Amount of the file id rules of the volume.
+
+--*/
+{
+    LONG rulesAmount = 0l;
+
+    PAGED_CODE();
+
+    if (0 == ReadNoFence(&Table->RulesAmount)) return 0l;
+
+    FltAcquirePushLockShared(Table->Lock);
+    rulesAmount = FgcCountFileIdRuleEntries(Table, VolumeSerialNumber);
+    FltReleasePushLock(Table->Lock);
+
+    return rulesAmount;
+}
+
+/*-------------------------------------------------------------
+    Rule dictionary routines
+-------------------------------------------------------------*/
+
+static
+NTSTATUS
+FgcAppendDictionaryRule(
+    _In_ CONST FGC_RULE *Rule,
+    _In_ ULONG FirstRuleId,
+    _Inout_ FG_RULE *RulesBuffer,
+    _In_ ULONG RulesBufferSize,
+    _Inout_ USHORT *RulesAmount,
+    _Inout_ ULONG *RulesSize
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG ruleSize = 0ul;
+
+    if (Rule->Id < FirstRuleId) return STATUS_SUCCESS;
+
+    ruleSize = (ULONG)FgcGetRuleSize(Rule);
+
+    //
+    // The size of all rules is counted even if they do not fit, so the client knows
+    // the buffer size to query again with.
+    //
+    if (NULL != RulesBuffer && *RulesSize + ruleSize <= RulesBufferSize) {
+        try {
+            FgcCopyRule(Add2Ptr(RulesBuffer, *RulesSize), Rule);
+        } except(EXCEPTION_EXECUTE_HANDLER) {
+            status = GetExceptionCode();
+            LOG_ERROR("NTSTATUS: 0x%08x, copy dictionary rule failed", status);
+            return status;
+        }
+    }
+
+    *RulesSize += ruleSize;
+    (*RulesAmount)++;
+
+    return status;
+}
+
+NTSTATUS
+FgcGetRuleDictionary(
+    _In_ LIST_ENTRY *RuleList,
+    _In_ EX_PUSH_LOCK *Lock,
+    _In_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ ULONG FirstRuleId,
+    _Out_writes_bytes_opt_(RulesBufferSize) FG_RULE *RulesBuffer,
+    _In_ ULONG RulesBufferSize,
+    _Out_ USHORT *RulesAmount,
+    _Out_ ULONG *RulesSize
+    )
+/*++
+
+Routine Description:
+
+    This routine copies the rules and the file id rules with an id not below the
+    first rule id, the monitor records refer to them by their ids.
+
+Arguments:
+
+    RuleList        - Rule list.
+    Lock            - Lock of the rule list.
+    Table           - File id rule table.
+    FirstRuleId     - The least id of the rules copied.
+    RulesBuffer     - A buffer that receives the rules.
+    RulesBufferSize - Bytes size of the buffer.
+    RulesAmount     - A pointer to a variable that receives the amount of the rules.
+    RulesSize       - A pointer to a variable that receives the bytes size of the rules.
+
+Return Value:
+
+    STATUS_SUCCESS          - Success.
+    STATUS_BUFFER_TOO_SMALL - The rules do not fit in the buffer, the rules size is the
+                              buffer size needed.
+    Other                   - Failure.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PLIST_ENTRY listEntry = NULL, next = NULL;
+    ULONG idx = 0ul;
+
+    PAGED_CODE();
+
+    if (NULL == RuleList) return STATUS_INVALID_PARAMETER_1;
+    if (NULL == Lock) return STATUS_INVALID_PARAMETER_2;
+    if (NULL == Table) return STATUS_INVALID_PARAMETER_3;
+    if (NULL == RulesAmount) return STATUS_INVALID_PARAMETER_7;
+    if (NULL == RulesSize) return STATUS_INVALID_PARAMETER_8;
+
+    *RulesAmount = 0;
+    *RulesSize = 0ul;
+
+    FltAcquirePushLockShared(Lock);
+
+    LIST_FOR_EACH_SAFE(listEntry, next, RuleList) {
+        status = FgcAppendDictionaryRule(CONTAINING_RECORD(listEntry, FGC_RULE_ENTRY, List)->Rule,
+                                         FirstRuleId,
+                                         RulesBuffer,
+                                         RulesBufferSize,
+                                         RulesAmount,
+                                         RulesSize);
+        if (!NT_SUCCESS(status)) break;
+    }
+
+    FltReleasePushLock(Lock);
+
+    if (!NT_SUCCESS(status)) return status;
+
+    FltAcquirePushLockShared(Table->Lock);
+
+    for (; idx < FG_FILE_ID_RULE_TABLE_BUCKETS && NT_SUCCESS(status); idx++) {
+        LIST_FOR_EACH_SAFE(listEntry, next, &Table->Buckets[idx]) {
+            status = FgcAppendDictionaryRule(CONTAINING_RECORD(listEntry, FGC_FILE_ID_RULE_ENTRY, List)->Rule,
+                                             FirstRuleId,
+                                             RulesBuffer,
+                                             RulesBufferSize,
+                                             RulesAmount,
+                                             RulesSize);
+            if (!NT_SUCCESS(status)) break;
+        }
+    }
+
+    FltReleasePushLock(Table->Lock);
+
+    if (NT_SUCCESS(status) && *RulesSize > RulesBufferSize) {
+        status = STATUS_BUFFER_TOO_SMALL;
+    }
+
+    DBG_INFO("Query rule dictionary from id: %lu, amount: %hu, size: %lu", FirstRuleId, *RulesAmount, *RulesSize);
+
+    return status;
+}
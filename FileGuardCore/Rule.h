@@ -41,13 +41,18 @@ Environment:
 #ifndef __RULE_H__
 #define __RULE_H__
 
+#include "RuleExpression.h"
+
 /*-------------------------------------------------------------
     Core rule basic structures and routines
 -------------------------------------------------------------*/
 
 typedef struct _FGC_RULE {
     FG_RULE_CODE Code;
+    ULONG Id;                        // Unique for the driver lifetime, monitor records refer to the rule by it.
+    ULONG Operations;                // Compiled FG_RULE_OPERATION_* classes the rule is enforced on.
     PUNICODE_STRING PathExpression;
+    PUNICODE_STRING ImageExpression; // NULL if the rule applies to all processes.
     volatile LONG64 References;
 } FGC_RULE, * PFGC_RULE;
 
@@ -60,13 +65,27 @@ FgcCreateRule(
 
 #define FgcReferenceRule(_rule_) InterlockedIncrement64(&(_rule_)->References)
 
+#define FgcIsRuleOperationApplied(_rule_, _operation_) FlagOn((_rule_)->Operations, (_operation_))
+
 VOID
 FgcReleaseRule(
     _Inout_ FGC_RULE* Rule
 );
 
-#define FgcCompareRule(_rule1_, _rule2_) (_rule1_)->Code.Value == (_rule2_)->Code.Value && \
-                                          RtlCompareUnicodeString((_rule1_)->PathExpression, (_rule2_)->PathExpression, FALSE)
+BOOLEAN
+FgcIsRuleImageMatched(
+    _In_ CONST FGC_RULE *Rule,
+    _In_ PCUNICODE_STRING ImageName
+    );
+
+BOOLEAN
+FgcIsRuleAppliedToVolume(
+    _In_ CONST FGC_RULE *Rule,
+    _In_ PCUNICODE_STRING VolumeName
+    );
+
+#define FgcGetRuleSize(_rule_) (sizeof(FG_RULE) + (_rule_)->PathExpression->Length + \
+                                (NULL != (_rule_)->ImageExpression ? (_rule_)->ImageExpression->Length : 0))
 
 /*-------------------------------------------------------------
     Rule entry basic structures and routines
@@ -154,8 +173,164 @@ FgcCleanupRuleEntriesList(
     _In_ LIST_ENTRY *RuleList
     );
 
+/*-------------------------------------------------------------
+    Rule subset structures and routines
+-------------------------------------------------------------*/
+
+//
+// An immutable snapshot of the rules which apply to a process image or to a
+// volume, in the same order as the rule list.
+//
+typedef struct _FGC_RULE_SUBSET {
+
+    volatile LONG64 References;
+
+    //
+    // The rules generation which the subset was built from.
+    //
+    LONG Generation;
+
+    ULONG RulesAmount;
+
+    FGC_RULE *Rules[];
+
+} FGC_RULE_SUBSET, *PFGC_RULE_SUBSET;
+
+_Check_return_
+NTSTATUS
+FgcCreateRuleSubset(
+    _In_ LIST_ENTRY *RuleList,
+    _In_ EX_PUSH_LOCK *ListLock,
+    _In_ LONG Generation,
+    _In_ PCUNICODE_STRING ImageName,
+    _Outptr_ PFGC_RULE_SUBSET *Subset
+    );
+
+_Check_return_
+NTSTATUS
+FgcCreateVolumeRuleSubset(
+    _In_ LIST_ENTRY *RuleList,
+    _In_ LONG Generation,
+    _In_ PCUNICODE_STRING VolumeName,
+    _Outptr_ PFGC_RULE_SUBSET *Subset
+    );
+
+#define FgcReferenceRuleSubset(_subset_) InterlockedIncrement64(&(_subset_)->References)
+
+VOID
+FgcReleaseRuleSubset(
+    _Inout_ PFGC_RULE_SUBSET Subset
+    );
+
+_Check_return_
+NTSTATUS
+FgcMatchRuleSubset(
+    _In_ PFGC_RULE_SUBSET Subset,
+    _In_ UNICODE_STRING *FileDevicePathName,
+    _Outptr_result_maybenull_ FGC_RULE **MatchedRule
+    );
+
+BOOLEAN
+FgcIsRuleSubsetAppliedToDirectory(
+    _In_ PFGC_RULE_SUBSET Subset,
+    _In_ PCUNICODE_STRING VolumeName,
+    _In_ PCUNICODE_STRING DirectoryPath
+    );
+
+/*-------------------------------------------------------------
+    File id rule table structures and routines
+-------------------------------------------------------------*/
+
+#include "FileIdRuleTable.h"
+
+_Check_return_
+NTSTATUS
+FgcInitializeFileIdRuleTable(
+    _Inout_ PFGC_FILE_ID_RULE_TABLE Table
+    );
+
+ULONG
+FgcCleanupFileIdRuleTable(
+    _Inout_ PFGC_FILE_ID_RULE_TABLE Table
+    );
+
+FORCEINLINE
+VOID
+FgcFreeFileIdRuleTable(
+    _Inout_ PFGC_FILE_ID_RULE_TABLE Table
+    )
+{
+    if (NULL != Table->Lock) {
+        FgcCleanupFileIdRuleTable(Table);
+        FgcFreePushLock(Table->Lock);
+        Table->Lock = NULL;
+    }
+}
+
+_Check_return_
+NTSTATUS
+FgcAddFileIdRule(
+    _Inout_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ CONST FG_FILE_ID_DESCRIPTOR *FileIdDescriptor,
+    _In_ FG_RULE_CODE Code,
+    _In_ PCUNICODE_STRING FilePath,
+    _Out_ BOOLEAN *Added
+    );
+
+_Check_return_
+NTSTATUS
+FgcRemoveFileIdRule(
+    _Inout_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ CONST FG_FILE_ID_DESCRIPTOR *FileIdDescriptor,
+    _In_ FG_RULE_CODE Code,
+    _Out_ BOOLEAN *Removed
+    );
+
+_Check_return_
+NTSTATUS
+FgcMatchFileIdRule(
+    _In_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ CONST FG_FILE_ID_DESCRIPTOR *FileIdDescriptor,
+    _Outptr_result_maybenull_ FGC_RULE **MatchedRule
+    );
+
+LONG
+FgcCountVolumeFileIdRules(
+    _In_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ ULONGLONG VolumeSerialNumber
+    );
+
+/*-------------------------------------------------------------
+    Rule dictionary routines
+-------------------------------------------------------------*/
+
+#define FgcAllocateRuleId() ((ULONG)InterlockedIncrement(&Globals.LastRuleId))
+
+NTSTATUS
+FgcGetRuleDictionary(
+    _In_ LIST_ENTRY *RuleList,
+    _In_ EX_PUSH_LOCK *Lock,
+    _In_ PFGC_FILE_ID_RULE_TABLE Table,
+    _In_ ULONG FirstRuleId,
+    _Out_writes_bytes_opt_(RulesBufferSize) FG_RULE *RulesBuffer,
+    _In_ ULONG RulesBufferSize,
+    _Out_ USHORT *RulesAmount,
+    _Out_ ULONG *RulesSize
+    );
+
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, FgcInitializeFileIdRuleTable)
+#pragma alloc_text(PAGE, FgcCleanupFileIdRuleTable)
+#pragma alloc_text(PAGE, FgcAddFileIdRule)
+#pragma alloc_text(PAGE, FgcRemoveFileIdRule)
+#pragma alloc_text(PAGE, FgcMatchFileIdRule)
+#pragma alloc_text(PAGE, FgcCountVolumeFileIdRules)
+#pragma alloc_text(PAGE, FgcGetRuleDictionary)
 #pragma alloc_text(PAGE, FgcMatchRules)
+#pragma alloc_text(PAGE, FgcCreateRuleSubset)
+#pragma alloc_text(PAGE, FgcCreateVolumeRuleSubset)
+#pragma alloc_text(PAGE, FgcMatchRuleSubset)
+#pragma alloc_text(PAGE, FgcIsRuleSubsetAppliedToDirectory)
 #endif
 
 #endif
@@ -0,0 +1,142 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    RuleExpression.h
+
+Abstract:
+
+    Literal prefix checks of rule path expressions, they decide which rules a
+    volume partition holds and under which directories no rule applies. They
+    only compare characters, so they are also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __RULE_EXPRESSION_H__
+#define __RULE_EXPRESSION_H__
+
+FORCEINLINE
+BOOLEAN
+FgcIsExpressionAppliedToVolume(
+    _In_ PCUNICODE_STRING Expression,
+    _In_ PCUNICODE_STRING VolumeName
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether an upcased path expression could match any file on
+    a volume. Only the literal prefix of the expression, up to the first wildcard,
+    is compared with the volume name, so the result may be a false positive but
+    never a false negative. A literal prefix running past the volume name must go
+    on with a separator, '\DEVICE\HARDDISKVOLUME10\*' is not on the volume
+    '\DEVICE\HARDDISKVOLUME1'.
+
+Arguments:
+
+    Expression - The upcased path expression.
+    VolumeName - The upcased device name of the volume.
+
+Return Value:
+
+    TRUE if the expression could match files on the volume, otherwise FALSE.
+
+--*/
+{
+    USHORT idx = 0, length = 0;
+    WCHAR ch = 0;
+
+    length = min(Expression->Length, VolumeName->Length) / sizeof(WCHAR);
+    for (; idx < length; idx++) {
+        ch = Expression->Buffer[idx];
+        if (FsRtlIsUnicodeCharacterWild(ch)) return TRUE;
+        if (ch != VolumeName->Buffer[idx]) return FALSE;
+    }
+
+    if (Expression->Length < VolumeName->Length) return FALSE;
+    if (Expression->Length == VolumeName->Length) return TRUE;
+
+    ch = Expression->Buffer[idx];
+    return L'\\' == ch || FsRtlIsUnicodeCharacterWild(ch);
+}
+
+FORCEINLINE
+BOOLEAN
+FgcIsExpressionAppliedToDirectory(
+    _In_ PCUNICODE_STRING Expression,
+    _In_ PCUNICODE_STRING VolumeName,
+    _In_ PCUNICODE_STRING DirectoryPath
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether an upcased path expression could match any file
+    under a directory of a volume. The directory path is compared as if it followed
+    the volume name, so it is never copied. As in FgcIsExpressionAppliedToVolume
+    only the literal prefix of the expression is compared.
+
+Arguments:
+
+    Expression    - The upcased path expression.
+    VolumeName    - The upcased device name of the volume.
+    DirectoryPath - The directory path on the volume ending with a separator, in
+                    any case.
+
+Return Value:
+
+    TRUE if the expression could match files under the directory, otherwise FALSE.
+
+--*/
+{
+    ULONG directoryLength = (ULONG)VolumeName->Length + DirectoryPath->Length;
+    USHORT idx = 0, length = 0, volumeLength = VolumeName->Length / sizeof(WCHAR);
+    WCHAR ch = 0;
+
+    length = (USHORT)(min((ULONG)Expression->Length, directoryLength) / sizeof(WCHAR));
+    for (; idx < length; idx++) {
+        ch = Expression->Buffer[idx];
+        if (FsRtlIsUnicodeCharacterWild(ch)) return TRUE;
+        if (idx < volumeLength) {
+            if (ch != VolumeName->Buffer[idx]) return FALSE;
+        } else if (ch != RtlUpcaseUnicodeChar(DirectoryPath->Buffer[idx - volumeLength])) {
+            return FALSE;
+        }
+    }
+
+    //
+    // The path of a file under the directory is longer than the directory path.
+    //
+    return Expression->Length > directoryLength;
+}
+
+#endif
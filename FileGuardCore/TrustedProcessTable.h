@@ -0,0 +1,319 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    TrustedProcessTable.h
+
+Abstract:
+
+    Lock free trusted process table slots. The table has no dependency but the
+    interlocked primitives, so the probing is also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __TRUSTED_PROCESS_TABLE_H__
+#define __TRUSTED_PROCESS_TABLE_H__
+
+//
+// Capacity of trusted process table, it must be a power of two.
+//
+#define FG_TRUSTED_PROCESS_TABLE_SIZE 64
+
+//
+// Process id of the slot which trusted process has been removed. A real
+// process id is always a multiple of four, so it never collides with this.
+//
+#define FG_TRUSTED_PROCESS_TOMBSTONE ((HANDLE)(ULONG_PTR)1)
+
+#define FgcTrustedProcessSlotIndex(_pid_, _probe_) \
+    ((ULONG)((((ULONG_PTR)(_pid_) >> 2) + (_probe_)) & (FG_TRUSTED_PROCESS_TABLE_SIZE - 1)))
+
+#define FgcTrustedProcessSlotStep(_index_, _step_) \
+    ((ULONG)(((_index_) + (_step_)) & (FG_TRUSTED_PROCESS_TABLE_SIZE - 1)))
+
+typedef struct _FGC_TRUSTED_PROCESS_SLOT {
+
+    //
+    // Slot sequence, it is odd while a writer is updating the slot.
+    //
+    __volatile LONG Sequence;
+
+    //
+    // Trusted process id, NULL if the slot has never been used.
+    //
+    __volatile HANDLE ProcessId;
+
+    //
+    // Trusted process creation time, it keeps a reused process id untrusted.
+    //
+    __volatile LONG64 CreateTime;
+
+} FGC_TRUSTED_PROCESS_SLOT, *PFGC_TRUSTED_PROCESS_SLOT;
+
+typedef struct _FGC_TRUSTED_PROCESS_TABLE {
+
+    //
+    // Amount of trusted processes, readers skip the table when it is zero.
+    //
+    __volatile LONG ProcessesAmount;
+
+    //
+    // This lock serializes writers only, readers never acquire it.
+    //
+    PEX_PUSH_LOCK Lock;
+
+    //
+    // Open addressing slots, indexed by process id.
+    //
+    FGC_TRUSTED_PROCESS_SLOT Slots[FG_TRUSTED_PROCESS_TABLE_SIZE];
+
+} FGC_TRUSTED_PROCESS_TABLE, *PFGC_TRUSTED_PROCESS_TABLE;
+
+FORCEINLINE
+VOID
+FgcWriteTrustedProcessSlot(
+    _Inout_ PFGC_TRUSTED_PROCESS_SLOT Slot,
+    _In_ HANDLE ProcessId,
+    _In_ LONG64 CreateTime
+    )
+{
+    InterlockedIncrement(&Slot->Sequence);
+    InterlockedExchange64(&Slot->CreateTime, CreateTime);
+    InterlockedExchangePointer(&Slot->ProcessId, ProcessId);
+    InterlockedIncrement(&Slot->Sequence);
+}
+
+FORCEINLINE
+VOID
+FgcReadTrustedProcessSlot(
+    _In_ PFGC_TRUSTED_PROCESS_SLOT Slot,
+    _Out_ HANDLE *ProcessId,
+    _Out_ LONG64 *CreateTime
+    )
+{
+    LONG sequence = 0;
+
+    for (;;) {
+        sequence = ReadAcquire(&Slot->Sequence);
+        if (FlagOn(sequence, 1)) {
+            YieldProcessor();
+            continue;
+        }
+
+        *ProcessId = ReadPointerNoFence(&Slot->ProcessId);
+        *CreateTime = ReadNoFence64(&Slot->CreateTime);
+
+        KeMemoryBarrier();
+        if (sequence == ReadNoFence(&Slot->Sequence)) break;
+    }
+}
+
+FORCEINLINE
+BOOLEAN
+FgcFindTrustedProcessSlot(
+    _In_ PFGC_TRUSTED_PROCESS_TABLE Table,
+    _In_ HANDLE ProcessId,
+    _Out_ LONG64 *CreateTime
+    )
+/*++
+
+Routine Description:
+
+    This routine looks up the creation time a process id is trusted with, it
+    never acquires a lock.
+
+Arguments:
+
+    Table      - Trusted process table.
+    ProcessId  - Id of the process.
+    CreateTime - A pointer to a variable that receives the trusted creation time.
+
+Return Value:
+
+    TRUE if the process id is in the table, otherwise FALSE.
+
+--*/
+{
+    HANDLE slotProcessId = NULL;
+    LONG64 slotCreateTime = 0ll;
+    ULONG probe = 0ul;
+
+    for (; probe < FG_TRUSTED_PROCESS_TABLE_SIZE; probe++) {
+
+        FgcReadTrustedProcessSlot(&Table->Slots[FgcTrustedProcessSlotIndex(ProcessId, probe)],
+                                  &slotProcessId,
+                                  &slotCreateTime);
+        if (NULL == slotProcessId) break;
+
+        if (ProcessId == slotProcessId) {
+            *CreateTime = slotCreateTime;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+FORCEINLINE
+BOOLEAN
+FgcStoreTrustedProcessSlot(
+    _Inout_ PFGC_TRUSTED_PROCESS_TABLE Table,
+    _In_ HANDLE ProcessId,
+    _In_ LONG64 CreateTime,
+    _Out_ BOOLEAN *Exist
+    )
+/*++
+
+Routine Description:
+
+    This routine stores a process id with its creation time, the first tombstone
+    of the probe sequence is reused unless the process id is already stored. The
+    caller serializes writers.
+
+Arguments:
+
+    Table      - Trusted process table.
+    ProcessId  - Id of the process, neither NULL nor the tombstone.
+    CreateTime - Creation time of the process.
+    Exist      - A pointer to a variable that receives whether the process id was
+                 stored already, its creation time is refreshed then.
+
+Return Value:
+
+    TRUE if the process id is stored, FALSE if the table is full.
+
+--*/
+{
+    PFGC_TRUSTED_PROCESS_SLOT slot = NULL, targetSlot = NULL;
+    ULONG probe = 0ul;
+
+    *Exist = FALSE;
+
+    for (; probe < FG_TRUSTED_PROCESS_TABLE_SIZE; probe++) {
+
+        slot = &Table->Slots[FgcTrustedProcessSlotIndex(ProcessId, probe)];
+        if (NULL == slot->ProcessId) {
+            if (NULL == targetSlot) targetSlot = slot;
+            break;
+
+        } else if (FG_TRUSTED_PROCESS_TOMBSTONE == slot->ProcessId) {
+            if (NULL == targetSlot) targetSlot = slot;
+
+        } else if (ProcessId == slot->ProcessId) {
+
+            //
+            // Refresh the creation time, the former process may have exited.
+            //
+            targetSlot = slot;
+            *Exist = TRUE;
+            break;
+        }
+    }
+
+    if (NULL == targetSlot) return FALSE;
+
+    FgcWriteTrustedProcessSlot(targetSlot, ProcessId, CreateTime);
+
+    return TRUE;
+}
+
+FORCEINLINE
+BOOLEAN
+FgcClearTrustedProcessSlot(
+    _Inout_ PFGC_TRUSTED_PROCESS_TABLE Table,
+    _In_ HANDLE ProcessId
+    )
+/*++
+
+Routine Description:
+
+    This routine removes a process id from the table. The slot becomes a tombstone
+    so the probe sequences running through it stay intact, unless only tombstones
+    follow it up to an empty slot: no probe sequence runs past an empty slot, so
+    that run of tombstones is emptied and lookups of untrusted processes stay
+    short. The caller serializes writers.
+
+Arguments:
+
+    Table     - Trusted process table.
+    ProcessId - Id of the process, neither NULL nor the tombstone.
+
+Return Value:
+
+    TRUE if the process id is removed, FALSE if it is not in the table.
+
+--*/
+{
+    PFGC_TRUSTED_PROCESS_SLOT slot = NULL;
+    HANDLE processId = NULL;
+    ULONG index = 0ul, probe = 0ul, step = 0ul;
+
+    for (; probe < FG_TRUSTED_PROCESS_TABLE_SIZE; probe++) {
+
+        index = FgcTrustedProcessSlotIndex(ProcessId, probe);
+        slot = &Table->Slots[index];
+        if (NULL == slot->ProcessId) return FALSE;
+        if (ProcessId == slot->ProcessId) break;
+    }
+
+    if (probe == FG_TRUSTED_PROCESS_TABLE_SIZE) return FALSE;
+
+    for (step = 1ul; step < FG_TRUSTED_PROCESS_TABLE_SIZE; step++) {
+        processId = Table->Slots[FgcTrustedProcessSlotStep(index, step)].ProcessId;
+        if (FG_TRUSTED_PROCESS_TOMBSTONE != processId) break;
+    }
+
+    if (step < FG_TRUSTED_PROCESS_TABLE_SIZE && NULL != processId) {
+        FgcWriteTrustedProcessSlot(slot, FG_TRUSTED_PROCESS_TOMBSTONE, 0ll);
+        return TRUE;
+    }
+
+    //
+    // The slot, the tombstones after it up to the empty slot and the ones before
+    // it are in no probe sequence of a stored process.
+    //
+    for (probe = 0ul; probe < step; probe++) {
+        FgcWriteTrustedProcessSlot(&Table->Slots[FgcTrustedProcessSlotStep(index, probe)], NULL, 0ll);
+    }
+
+    for (probe = 1ul; probe < FG_TRUSTED_PROCESS_TABLE_SIZE - step; probe++) {
+
+        slot = &Table->Slots[FgcTrustedProcessSlotStep(index, FG_TRUSTED_PROCESS_TABLE_SIZE - probe)];
+        if (FG_TRUSTED_PROCESS_TOMBSTONE != slot->ProcessId) break;
+
+        FgcWriteTrustedProcessSlot(slot, NULL, 0ll);
+    }
+
+    return TRUE;
+}
+
+#endif
@@ -0,0 +1,133 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    UnruledDirectories.h
+
+Abstract:
+
+    The cache of directories no rule could match any file under. Creates and
+    renames into a cached directory are allowed without matching the rules until
+    the rules partition of the volume is rebuilt. The entries only hold names and
+    generations, so they are also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __UNRULED_DIRECTORIES_H__
+#define __UNRULED_DIRECTORIES_H__
+
+#define FG_UNRULED_DIRECTORIES_AMOUNT 32
+
+typedef struct _FG_UNRULED_DIRECTORY_ENTRY {
+
+    //
+    // Path on the volume of a directory no rule could match any file under,
+    // NULL if the entry is free.
+    //
+    PUNICODE_STRING DirectoryName;
+
+    //
+    // The generation of the rules partition the verdict was made from.
+    //
+    LONG Generation;
+
+} FG_UNRULED_DIRECTORY_ENTRY, *PFG_UNRULED_DIRECTORY_ENTRY;
+
+#define FgcGetUnruledDirectoryEntry(_entries_, _hash_) (&(_entries_)[(_hash_) % FG_UNRULED_DIRECTORIES_AMOUNT])
+
+FORCEINLINE
+BOOLEAN
+FgcIsUnruledDirectoryCached(
+    _In_ CONST FG_UNRULED_DIRECTORY_ENTRY *Entry,
+    _In_ LONG Generation,
+    _In_ PCUNICODE_STRING DirectoryPath
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether an entry holds the verdict of a directory. A verdict
+    made from another generation of the rules partition is stale, a rule added
+    since may apply under the directory.
+
+Arguments:
+
+    Entry         - The entry the directory path hashes to.
+    Generation    - The generation of the current rules partition of the volume.
+    DirectoryPath - The directory path on the volume ending with a separator, in
+                    any case.
+
+Return Value:
+
+    TRUE if no rule of the partition could match files under the directory.
+
+--*/
+{
+    return NULL != Entry->DirectoryName &&
+           Generation == Entry->Generation &&
+           RtlEqualUnicodeString(Entry->DirectoryName, DirectoryPath, TRUE);
+}
+
+FORCEINLINE
+PUNICODE_STRING
+FgcCacheUnruledDirectory(
+    _Inout_ FG_UNRULED_DIRECTORY_ENTRY *Entry,
+    _In_ PUNICODE_STRING DirectoryName,
+    _In_ LONG Generation
+    )
+/*++
+
+Routine Description:
+
+    This routine replaces whatever an entry held by the verdict of a directory.
+
+Arguments:
+
+    Entry         - The entry the directory path hashes to.
+    DirectoryName - The copy of the directory path the entry takes over.
+    Generation    - The generation of the rules partition the verdict was made from.
+
+Return Value:
+
+    The directory name the entry held, the caller frees it. NULL if the entry was
+    free.
+
+--*/
+{
+    PUNICODE_STRING oldDirectoryName = Entry->DirectoryName;
+
+    Entry->DirectoryName = DirectoryName;
+    Entry->Generation = Generation;
+
+    return oldDirectoryName;
+}
+
+#endif
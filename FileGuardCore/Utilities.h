@@ -155,12 +155,10 @@ FgcFreePushLock(
                                                   (_cbd_)->IoStatus.Information = 0; \
                                                   FltSetCallbackDataDirty(Data);
 
-_Check_return_
 NTSTATUS
-FgcCheckFileExists(
+FgcDeleteCreatedFile(
     _In_ PFLT_INSTANCE Instance,
-    _In_ UNICODE_STRING* FileDevicePath,
-    _Out_ BOOLEAN* Exist
+    _In_ PFILE_OBJECT FileObject
 );
 
 /*-------------------------------------------------------------
@@ -0,0 +1,106 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    WriteDecision.h
+
+Abstract:
+
+    Decision table of the write callbacks, which writes and sections are checked
+    against the rule of the file by their IRP flags and section parameters. It
+    touches no kernel object, so it is also built by the host tests.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+
+#ifndef __WRITE_DECISION_H__
+#define __WRITE_DECISION_H__
+
+typedef enum _FGC_WRITE_DECISION {
+    WriteDecisionSkip = 0,  // Nothing the rule of the file could be enforced on.
+    WriteDecisionCheck      // The rule of the file is checked against the requestor.
+} FGC_WRITE_DECISION;
+
+FORCEINLINE
+FGC_WRITE_DECISION
+FgcGetWriteDecision(
+    _In_ UCHAR MajorFunction,
+    _In_ ULONG IrpFlags,
+    _In_ ULONG SyncType,
+    _In_ ULONG PageProtection
+    )
+/*++
+
+Routine Description:
+
+    This routine decides whether a write or the creation of a section is checked.
+
+    A paging write is issued by the thread flushing the pages rather than the writer,
+    it is skipped, the write callback is also registered to skip paging I/O. Cached,
+    non cached and fast I/O writes through a handle are checked.
+
+    The writes through a mapped view reach the file as paging writes, so a section
+    which can write the file is checked when it is created. An image or a copy on
+    write section never changes the file.
+
+Arguments:
+
+    MajorFunction  - IRP_MJ_WRITE or IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION.
+    IrpFlags       - The IRP flags of the request.
+    SyncType       - The section synchronization type, only for a section.
+    PageProtection - The page protection of the section, only for a section.
+
+Return Value:
+
+    Whether the request is checked.
+
+--*/
+{
+    switch (MajorFunction) {
+    case IRP_MJ_WRITE:
+        if (FlagOn(IrpFlags, IRP_PAGING_IO | IRP_SYNCHRONOUS_PAGING_IO)) return WriteDecisionSkip;
+        return WriteDecisionCheck;
+
+    case IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION:
+        if (SyncTypeCreateSection != SyncType) return WriteDecisionSkip;
+
+        switch (PageProtection) {
+        case PAGE_READWRITE:
+        case PAGE_EXECUTE_READWRITE:
+            return WriteDecisionCheck;
+        }
+
+        return WriteDecisionSkip;
+    }
+
+    return WriteDecisionSkip;
+}
+
+#endif
@@ -44,6 +44,8 @@ Environment:
 #include <stdio.h>
 
 #include "FileGuard.h"
+#include "FileGuardCodec.h"
+#include "FileGuardChannel.h"
 #include "FileGuardLib.h"
 
 HRESULT FglConnectCore(
@@ -135,7 +137,297 @@ Arguments:
     return S_OK;
 }
 
-HRESULT FglReceiveMonitorRecords(
+//
+// Data size of the shared memory channel the records are received through.
+//
+#define FGL_MONITOR_CHANNEL_DATA_SIZE (1024 * 1024)
+
+//
+// Milliseconds a monitor receiver waits for records before checking the end flag.
+//
+#define FGL_MONITOR_WAIT_INTERVAL 200
+
+//
+// Rules of a monitor connection by id. The records refer to their rule by id, the
+// rule expression is put back into a record before it is passed to the callback.
+//
+#define FGL_RULE_DICTIONARY_QUERY_SIZE (16 * 1024)
+
+typedef struct _FGL_RULE_DICTIONARY_ENTRY {
+    ULONG Id;
+    USHORT ExpressionSize;
+    PWCHAR Expression;       // NULL for a rule removed before it was fetched.
+} FGL_RULE_DICTIONARY_ENTRY, *PFGL_RULE_DICTIONARY_ENTRY;
+
+typedef struct _FGL_RULE_DICTIONARY {
+    HANDLE Port;
+    FGL_RULE_DICTIONARY_ENTRY *Entries; // Sorted by id.
+    ULONG EntriesAmount;
+    ULONG EntriesCapacity;
+    ULONG NextRuleId;                   // The rules from this id were not fetched yet.
+    FG_MONITOR_RECORD *Record;          // The record with the rule expression put back.
+    ULONG RecordSize;
+} FGL_RULE_DICTIONARY, *PFGL_RULE_DICTIONARY;
+
+static ULONG FglSearchRuleDictionary(
+    _In_ CONST FGL_RULE_DICTIONARY *Dictionary,
+    _In_ ULONG Id
+    )
+{
+    ULONG low = 0, high = Dictionary->EntriesAmount, middle = 0;
+
+    //
+    // The index of the entry of the id, or where it would be inserted.
+    //
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (Dictionary->Entries[middle].Id < Id) low = middle + 1;
+        else high = middle;
+    }
+
+    return low;
+}
+
+static HRESULT FglInsertRuleDictionary(
+    _Inout_ FGL_RULE_DICTIONARY *Dictionary,
+    _In_ ULONG Id,
+    _In_reads_bytes_opt_(ExpressionSize) CONST WCHAR *Expression,
+    _In_ USHORT ExpressionSize
+    )
+{
+    FGL_RULE_DICTIONARY_ENTRY *entries = NULL, *entry = NULL;
+    PWCHAR expression = NULL;
+    ULONG idx = FglSearchRuleDictionary(Dictionary, Id);
+
+    if (idx < Dictionary->EntriesAmount && Id == Dictionary->Entries[idx].Id) return S_OK;
+
+    if (Dictionary->EntriesAmount == Dictionary->EntriesCapacity) {
+        entries = realloc(Dictionary->Entries,
+                          (Dictionary->EntriesCapacity + 64) * sizeof(FGL_RULE_DICTIONARY_ENTRY));
+        if (NULL == entries) return E_OUTOFMEMORY;
+
+        Dictionary->Entries = entries;
+        Dictionary->EntriesCapacity += 64;
+    }
+
+    if (NULL != Expression && 0 != ExpressionSize) {
+        expression = malloc(ExpressionSize);
+        if (NULL == expression) return E_OUTOFMEMORY;
+        RtlCopyMemory(expression, Expression, ExpressionSize);
+    }
+
+    entry = &Dictionary->Entries[idx];
+    MoveMemory(entry + 1, entry, (Dictionary->EntriesAmount - idx) * sizeof(FGL_RULE_DICTIONARY_ENTRY));
+    entry->Id = Id;
+    entry->Expression = expression;
+    entry->ExpressionSize = NULL != expression ? ExpressionSize : 0;
+    Dictionary->EntriesAmount++;
+
+    return S_OK;
+}
+
+static HRESULT FglFetchRuleDictionary(
+    _Inout_ FGL_RULE_DICTIONARY *Dictionary,
+    _In_ ULONG FirstRuleId
+    )
+/*++
+
+Routine Description:
+
+    This routine queries the rules with an id not below the first rule id from the
+    FileGuardCore driver and adds them to the rule dictionary.
+
+Arguments:
+
+    Dictionary  - The rule dictionary of the monitor connection.
+    FirstRuleId - The least id of the rules queried.
+
+--*/
+{
+    HRESULT hr = S_OK;
+    FG_MESSAGE message = { 0 };
+    PFG_MESSAGE_RESULT result = NULL;
+    ULONG resultSize = sizeof(FG_MESSAGE_RESULT) + FGL_RULE_DICTIONARY_QUERY_SIZE;
+    DWORD returned = 0ul;
+    FG_RULE *rule = NULL;
+    ULONG offset = 0ul;
+    USHORT i = 0;
+
+    message.Type = QueryRuleDictionary;
+    message.FirstRuleId = FirstRuleId;
+
+    while (TRUE) {
+        result = malloc(resultSize);
+        if (NULL == result) return E_OUTOFMEMORY;
+
+        hr = FilterSendMessage(Dictionary->Port,
+                               &message,
+                               sizeof(FG_MESSAGE),
+                               result,
+                               resultSize,
+                               &returned);
+        if (FAILED(hr)) break;
+
+        hr = HRESULT_FROM_WIN32(result->ResultCode);
+        if (HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER) != hr) break;
+
+        //
+        // Rules were added meanwhile, query again with the size reported.
+        //
+        resultSize = sizeof(FG_MESSAGE_RESULT) + result->Rules.RulesSize;
+        free(result);
+    }
+
+    if (FAILED(hr)) goto Cleanup;
+
+    for (i = 0; i < result->Rules.RulesAmount && offset < result->Rules.RulesSize; i++) {
+        rule = (FG_RULE*)(result->Rules.RulesBuffer + offset);
+
+        hr = FglInsertRuleDictionary(Dictionary, rule->Id, rule->PathExpression, rule->PathExpressionSize);
+        if (FAILED(hr)) goto Cleanup;
+
+        if (rule->Id >= Dictionary->NextRuleId) Dictionary->NextRuleId = rule->Id + 1;
+        offset += FG_RULE_SIZE(rule);
+    }
+
+Cleanup:
+
+    free(result);
+
+    return hr;
+}
+
+static FG_MONITOR_RECORD* FglResolveMonitorRecord(
+    _Inout_ FGL_RULE_DICTIONARY *Dictionary,
+    _In_ FG_MONITOR_RECORD *Record
+    )
+/*++
+
+Routine Description:
+
+    This routine puts the rule expression back into a monitor record. An unknown rule
+    id is fetched from the driver, a rule removed before that is remembered without
+    expression, so it is fetched once.
+
+Arguments:
+
+    Dictionary - The rule dictionary of the monitor connection.
+    Record     - The record received.
+
+Return Value:
+
+    The record with the rule expression, valid until the next record is resolved, or
+    the record received if the rule expression is not available.
+
+--*/
+{
+    FGL_RULE_DICTIONARY_ENTRY *entry = NULL;
+    FG_MONITOR_RECORD *record = NULL;
+    ULONG idx = 0ul;
+    ULONG recordSize = 0ul;
+
+    if (0 == Record->RuleId || 0 != Record->RulePathExpressionSize) return Record;
+
+    idx = FglSearchRuleDictionary(Dictionary, Record->RuleId);
+    if (idx == Dictionary->EntriesAmount || Record->RuleId != Dictionary->Entries[idx].Id) {
+        FglFetchRuleDictionary(Dictionary, min(Record->RuleId, Dictionary->NextRuleId));
+        if (FAILED(FglInsertRuleDictionary(Dictionary, Record->RuleId, NULL, 0))) return Record;
+        idx = FglSearchRuleDictionary(Dictionary, Record->RuleId);
+    }
+
+    entry = &Dictionary->Entries[idx];
+    if (NULL == entry->Expression) return Record;
+
+    recordSize = sizeof(FG_MONITOR_RECORD) + entry->ExpressionSize + Record->FilePathSize + Record->RenameFilePathSize;
+    if (recordSize > Dictionary->RecordSize) {
+        record = realloc(Dictionary->Record, recordSize);
+        if (NULL == record) return Record;
+
+        Dictionary->Record = record;
+        Dictionary->RecordSize = recordSize;
+    }
+
+    record = Dictionary->Record;
+    RtlCopyMemory(record, Record, sizeof(FG_MONITOR_RECORD));
+    record->RulePathExpressionSize = entry->ExpressionSize;
+    RtlCopyMemory(record->Buffer, entry->Expression, entry->ExpressionSize);
+    RtlCopyMemory((PUCHAR)record->Buffer + entry->ExpressionSize,
+                  Record->Buffer,
+                  Record->FilePathSize + Record->RenameFilePathSize);
+
+    return record;
+}
+
+static VOID FglFreeRuleDictionary(
+    _Inout_ FGL_RULE_DICTIONARY *Dictionary
+    )
+{
+    ULONG i = 0;
+
+    for (i = 0; i < Dictionary->EntriesAmount; i++) free(Dictionary->Entries[i].Expression);
+
+    free(Dictionary->Entries);
+    free(Dictionary->Record);
+}
+
+//
+// Decoding state of the compact records of a monitor connection.
+//
+#define FGL_MONITOR_DECODED_RECORD_SIZE (sizeof(FG_MONITOR_RECORD) + 2 * MAXUSHORT)
+
+typedef struct _FGL_MONITOR_DECODER {
+    FG_MONITOR_COMPACT_STATE State;
+    FG_MONITOR_RECORD *Record;          // The record decoded last, its paths follow it.
+} FGL_MONITOR_DECODER, *PFGL_MONITOR_DECODER;
+
+static HRESULT FglDecodeMonitorRecords(
+    _Inout_ FGL_MONITOR_DECODER *Decoder,
+    _Inout_ FGL_RULE_DICTIONARY *Dictionary,
+    _In_reads_bytes_(DataSize) CONST UCHAR *Data,
+    _In_ ULONG DataSize,
+    _In_ FGL_MONITOR_RECORD_CALLBACK MonitorRecordCallback
+    )
+/*++
+
+Routine Description:
+
+    This routine decodes the compact records coded back to back in the data and invokes
+    the callback for each of them.
+
+Arguments:
+
+    Decoder               - The decoding state of the monitor connection.
+    Dictionary            - The rule dictionary the rule ids of the records are resolved by.
+    Data                  - The coded records.
+    DataSize              - Bytes size of the coded records.
+    MonitorRecordCallback - A callback function that will be invoked for each record.
+
+--*/
+{
+    ULONG offset = 0ul, consumed = 0ul;
+
+    while (offset < DataSize) {
+        if (!FgDecodeMonitorRecord(&Decoder->State,
+                                   Data + offset,
+                                   DataSize - offset,
+                                   &consumed,
+                                   Decoder->Record,
+                                   FGL_MONITOR_DECODED_RECORD_SIZE)) {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        MonitorRecordCallback(FglResolveMonitorRecord(Dictionary, Decoder->Record));
+        offset += consumed;
+    }
+
+    return S_OK;
+}
+
+static HRESULT FglReceiveChannelRecords(
+    _In_ FG_MONITOR_CHANNEL_HEADER *Header,
+    _In_ HANDLE Event,
+    _Inout_ FGL_RULE_DICTIONARY *Dictionary,
+    _Inout_ FGL_MONITOR_DECODER *Decoder,
     _In_ volatile BOOLEAN *End,
     _In_ FGL_MONITOR_RECORD_CALLBACK MonitorRecordCallback
     )
@@ -143,12 +435,125 @@ HRESULT FglReceiveMonitorRecords(
 
 Routine Description:
 
-    This routine continuously receives monitor records from the FileGuardCore driver until the specified
-    end condition is met. It connects to the monitor port, retrieves messages containing monitor records,
-    parses the records, and invokes the provided callback function for each parsed record.
+    This routine consumes the records written by the FileGuardCore driver into the
+    shared memory channel, the space of the records is handed back once the callback
+    returned for all of them.
 
 Arguments:
 
+    Header                - The channel buffer mapped by the driver.
+    Event                 - The event set by the driver when records were written.
+    Dictionary            - The rule dictionary the rule ids of the records are resolved by.
+    Decoder               - The decoding state of the compact records.
+    End                   - A pointer to a volatile BOOLEAN that, when set to TRUE,
+                            indicates that the routine should stop receiving records.
+    MonitorRecordCallback - A callback function that will be invoked for each record.
+
+--*/
+{
+    PUCHAR data = FG_MONITOR_CHANNEL_DATA(Header);
+    ULONG dataSize = Header->DataSize;
+    LONGLONG head = 0, tail = ReadAcquire64(&Header->Tail);
+    ULONGLONG sequence = 0;
+    FG_MONITOR_CHANNEL_ENTRY *entry = NULL;
+    ULONG consumed = 0ul;
+
+    while (!(*End)) {
+
+        if (WAIT_FAILED == WaitForSingleObject(Event, FGL_MONITOR_WAIT_INTERVAL)) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        head = ReadAcquire64(&Header->Head);
+
+        while (tail != head) {
+
+            entry = (FG_MONITOR_CHANNEL_ENTRY*)(data + (tail & (dataSize - 1)));
+
+            if (!FgCheckMonitorChannelEntry(entry, tail, head, dataSize, &sequence)) {
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+
+            if (FG_MONITOR_CHANNEL_ENTRY_RECORD == entry->Type) {
+                MonitorRecordCallback(FglResolveMonitorRecord(Dictionary, &entry->Record));
+            } else if (FG_MONITOR_CHANNEL_ENTRY_COMPACT == entry->Type) {
+
+                //
+                // An entry holds one record, the bytes behind it pad the entry size.
+                //
+                if (!FgDecodeMonitorRecord(&Decoder->State,
+                                           (CONST UCHAR*)&entry->Record,
+                                           entry->Size - FIELD_OFFSET(FG_MONITOR_CHANNEL_ENTRY, Record),
+                                           &consumed,
+                                           Decoder->Record,
+                                           FGL_MONITOR_DECODED_RECORD_SIZE)) {
+                    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                }
+
+                MonitorRecordCallback(FglResolveMonitorRecord(Dictionary, Decoder->Record));
+            }
+
+            tail += entry->Size;
+        }
+
+        WriteRelease64(&Header->Tail, tail);
+    }
+
+    return S_OK;
+}
+
+//
+// Records message receives kept posted to the monitor port, the driver completes
+// whichever is posted when it sends records.
+//
+#define FGL_MONITOR_RECEIVES_AMOUNT 4
+
+typedef struct _FGL_RECORDS_RECEIVE {
+    FG_MONITOR_RECORDS_MESSAGE Message;
+    OVERLAPPED Overlapped;
+    BOOLEAN Posted;
+} FGL_RECORDS_RECEIVE, *PFGL_RECORDS_RECEIVE;
+
+static HRESULT FglPostRecordsReceive(
+    _In_ HANDLE Port,
+    _Inout_ FGL_RECORDS_RECEIVE *Receive
+    )
+{
+    HRESULT hr = S_OK;
+
+    ZeroMemory(&Receive->Overlapped, sizeof(OVERLAPPED));
+
+    hr = FilterGetMessage(Port,
+                          &Receive->Message.Header,
+                          sizeof(FG_MONITOR_RECORDS_MESSAGE),
+                          &Receive->Overlapped);
+    if (HRESULT_FROM_WIN32(ERROR_IO_PENDING) == hr) hr = S_OK;
+
+    Receive->Posted = SUCCEEDED(hr);
+
+    return hr;
+}
+
+static HRESULT FglReceiveMessageRecords(
+    _In_ HANDLE Port,
+    _Inout_ FGL_RULE_DICTIONARY *Dictionary,
+    _Inout_ FGL_MONITOR_DECODER *Decoder,
+    _In_ volatile BOOLEAN *End,
+    _In_ FGL_MONITOR_RECORD_CALLBACK MonitorRecordCallback
+    )
+/*++
+
+Routine Description:
+
+    This routine receives the records messages sent by the FileGuardCore driver to a
+    client without a shared memory channel. Several receives are kept posted, so the
+    driver does not wait on the callbacks of the previous message.
+
+Arguments:
+
+    Port                  - The connected monitor port.
+    Dictionary            - The rule dictionary the rule ids of the records are resolved by.
+    Decoder               - The decoding state of the compact records.
     End                   - A pointer to a volatile BOOLEAN that, when set to TRUE,
                             indicates that the routine should stop receiving records.
     MonitorRecordCallback - A callback function that will be invoked for each parsed monitor record.
@@ -156,35 +561,71 @@ Arguments:
 --*/
 {
     HRESULT hr = S_OK;
-    HANDLE port = INVALID_HANDLE_VALUE;
-    FG_MONITOR_RECORDS_MESSAGE *recordsMessage = NULL;
+    HANDLE completion = NULL;
+    FGL_RECORDS_RECEIVE *receives = NULL, *receive = NULL;
+    OVERLAPPED *overlapped = NULL;
+    ULONG_PTR completionKey = 0;
+    DWORD transferred = 0ul;
     USHORT parsedRecordsArrayLength = 32, parsedRecordsCount = 0;
     PFG_MONITOR_RECORD *parsedRecords = NULL, *temp = NULL;
     ULONG i = 0;
 
-    hr = FilterConnectCommunicationPort(FG_MONITOR_PORT_NAME,
-                                        0,
-                                        NULL,
-                                        0,
-                                        NULL,
-                                        &port);
-    if (FAILED(hr)) return hr;
-
-    recordsMessage = malloc(sizeof(FG_MONITOR_RECORDS_MESSAGE));
-    if (NULL == recordsMessage) return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    receives = calloc(FGL_MONITOR_RECEIVES_AMOUNT, sizeof(FGL_RECORDS_RECEIVE));
+    if (NULL == receives) return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
 
     parsedRecords = (PFG_MONITOR_RECORD*)malloc(parsedRecordsArrayLength * sizeof(PFG_MONITOR_RECORD));
-    if (NULL == parsedRecords) return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    if (NULL == parsedRecords) {
+        hr = HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+        goto Cleanup;
+    }
 
-    while (!(*End)) {
-        hr = FilterGetMessage(port,
-                              &recordsMessage->Header, 
-                              sizeof(FG_MONITOR_RECORDS_MESSAGE), 
-                              NULL);
+    completion = CreateIoCompletionPort(Port, NULL, 0, 1);
+    if (NULL == completion) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto Cleanup;
+    }
+
+    for (i = 0; i < FGL_MONITOR_RECEIVES_AMOUNT; i++) {
+        hr = FglPostRecordsReceive(Port, &receives[i]);
         if (FAILED(hr)) goto Cleanup;
+    }
+
+    while (!(*End)) {
+
+        if (!GetQueuedCompletionStatus(completion,
+                                       &transferred,
+                                       &completionKey,
+                                       &overlapped,
+                                       FGL_MONITOR_WAIT_INTERVAL)) {
+            if (NULL == overlapped && WAIT_TIMEOUT == GetLastError()) continue;
+
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            goto Cleanup;
+        }
+
+        receive = CONTAINING_RECORD(overlapped, FGL_RECORDS_RECEIVE, Overlapped);
+        receive->Posted = FALSE;
+
+        if (receive->Message.Body.DataSize > MONITOR_RECORDS_MESSAGE_BODY_BUFFER_SIZE) {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            goto Cleanup;
+        }
+
+        if (FG_MONITOR_ENCODING_COMPACT_V1 == receive->Message.Body.Encoding) {
+            hr = FglDecodeMonitorRecords(Decoder,
+                                         Dictionary,
+                                         receive->Message.Body.DataBuffer,
+                                         receive->Message.Body.DataSize,
+                                         MonitorRecordCallback);
+            if (FAILED(hr)) goto Cleanup;
+
+            hr = FglPostRecordsReceive(Port, receive);
+            if (FAILED(hr)) goto Cleanup;
+            continue;
+        }
 
         while (TRUE) {
-            hr = FglParseMonitorRecords(&recordsMessage->Body,
+            hr = FglParseMonitorRecords(&receive->Message.Body,
                                         parsedRecords,
                                         parsedRecordsArrayLength,
                                         &parsedRecordsCount);
@@ -204,17 +645,169 @@ Arguments:
 
         if (FAILED(hr)) goto Cleanup;
         
-        for (i = 0; i < parsedRecordsCount; i++) MonitorRecordCallback(parsedRecords[i]);
-       
+        for (i = 0; i < parsedRecordsCount; i++) {
+            MonitorRecordCallback(FglResolveMonitorRecord(Dictionary, parsedRecords[i]));
+        }
+
+        hr = FglPostRecordsReceive(Port, receive);
+        if (FAILED(hr)) goto Cleanup;
     }
 
 Cleanup:
 
+    //
+    // The posted receives must be completed before their buffers are freed.
+    //
+    CancelIoEx(Port, NULL);
+    for (i = 0; i < FGL_MONITOR_RECEIVES_AMOUNT; i++) {
+        if (receives[i].Posted) {
+            GetOverlappedResult(Port, &receives[i].Overlapped, &transferred, TRUE);
+        }
+    }
+
+    if (NULL != completion) CloseHandle(completion);
     if (NULL != parsedRecords) free(parsedRecords);
+    free(receives);
 
     return hr;
 }
 
+HRESULT FglReceiveFilteredMonitorRecords(
+    _In_ volatile BOOLEAN *End,
+    _In_opt_ CONST FG_MONITOR_FILTER *Filter,
+    _In_ FGL_MONITOR_RECORD_CALLBACK MonitorRecordCallback
+    )
+/*++
+
+Routine Description:
+
+    This routine continuously receives the monitor records matching a filter from the FileGuardCore driver
+    until the specified end condition is met. It connects to the monitor port with a shared memory channel
+    the driver writes the records into, or receives records messages if the channel can not be set up, and
+    invokes the provided callback function for each record. Other clients may be connected to the monitor
+    port at the same time with their own filters.
+
+Arguments:
+
+    End                   - A pointer to a volatile BOOLEAN that, when set to TRUE,
+                            indicates that the routine should stop receiving records.
+    Filter                - Optional, the records to receive, all records are received if NULL.
+    MonitorRecordCallback - A callback function that will be invoked for each parsed monitor record.
+
+--*/
+{
+    HRESULT hr = S_OK;
+    HANDLE port = INVALID_HANDLE_VALUE;
+    HANDLE event = NULL;
+    FG_MONITOR_CHANNEL_HEADER *header = NULL;
+    FG_MONITOR_CONNECTION_CONTEXT connection = { 0 };
+    FG_MESSAGE message = { 0 };
+    FG_MESSAGE_RESULT result = { 0 };
+    DWORD returned = 0ul;
+    FGL_RULE_DICTIONARY dictionary = { .NextRuleId = 1 };
+    FGL_MONITOR_DECODER decoder = { 0 };
+
+    if (NULL != Filter) connection.Filter = *Filter;
+
+    //
+    // The records are asked for in the compact encoding, the driver tells the encoding
+    // of each channel entry and records message.
+    //
+    connection.Encoding = FG_MONITOR_ENCODING_COMPACT_V1;
+    decoder.Record = malloc(FGL_MONITOR_DECODED_RECORD_SIZE);
+    if (NULL == decoder.Record) return E_OUTOFMEMORY;
+
+    //
+    // The driver creates the channel buffer for the connection, its view is mapped
+    // into this process on query and is unmapped by this process.
+    //
+    connection.Channel.BufferSize = sizeof(FG_MONITOR_CHANNEL_HEADER) + FGL_MONITOR_CHANNEL_DATA_SIZE;
+    event = CreateEventW(NULL, FALSE, FALSE, NULL);
+
+    if (NULL != event) {
+        connection.Channel.Event = (ULONGLONG)(ULONG_PTR)event;
+        hr = FilterConnectCommunicationPort(FG_MONITOR_PORT_NAME,
+                                            0,
+                                            &connection,
+                                            sizeof(FG_MONITOR_CONNECTION_CONTEXT),
+                                            NULL,
+                                            &port);
+        if (SUCCEEDED(hr)) {
+            message.Type = QueryMonitorChannel;
+            hr = FilterSendMessage(port,
+                                   &message,
+                                   sizeof(FG_MESSAGE),
+                                   &result,
+                                   sizeof(FG_MESSAGE_RESULT),
+                                   &returned);
+            if (SUCCEEDED(hr)) hr = HRESULT_FROM_WIN32(result.ResultCode);
+            if (SUCCEEDED(hr)) header = (FG_MONITOR_CHANNEL_HEADER*)(ULONG_PTR)result.MonitorChannelBuffer;
+        }
+
+        if (NULL != header) {
+            dictionary.Port = port;
+            FglFetchRuleDictionary(&dictionary, dictionary.NextRuleId);
+            hr = FglReceiveChannelRecords(header, event, &dictionary, &decoder, End, MonitorRecordCallback);
+            goto Cleanup;
+        }
+
+        if (INVALID_HANDLE_VALUE != port) CloseHandle(port);
+    }
+
+    //
+    // Fall back to the records messages.
+    //
+    RtlZeroMemory(&connection.Channel, sizeof(FG_MONITOR_CHANNEL_SETUP));
+    port = INVALID_HANDLE_VALUE;
+    hr = FilterConnectCommunicationPort(FG_MONITOR_PORT_NAME,
+                                        0,
+                                        &connection,
+                                        sizeof(FG_MONITOR_CONNECTION_CONTEXT),
+                                        NULL,
+                                        &port);
+    if (FAILED(hr)) goto Cleanup;
+
+    dictionary.Port = port;
+    FglFetchRuleDictionary(&dictionary, dictionary.NextRuleId);
+    hr = FglReceiveMessageRecords(port, &dictionary, &decoder, End, MonitorRecordCallback);
+
+Cleanup:
+
+    //
+    // The view keeps the channel buffer alive after the port is closed, it is
+    // released with the view.
+    //
+    if (INVALID_HANDLE_VALUE != port) CloseHandle(port);
+    if (NULL != event) CloseHandle(event);
+    if (NULL != header) UnmapViewOfFile(header);
+    FglFreeRuleDictionary(&dictionary);
+    free(decoder.Record);
+
+    return hr;
+}
+
+HRESULT FglReceiveMonitorRecords(
+    _In_ volatile BOOLEAN *End,
+    _In_ FGL_MONITOR_RECORD_CALLBACK MonitorRecordCallback
+    )
+/*++
+
+Routine Description:
+
+    This routine continuously receives all monitor records from the FileGuardCore driver until the
+    specified end condition is met, see FglReceiveFilteredMonitorRecords.
+
+Arguments:
+
+    End                   - A pointer to a volatile BOOLEAN that, when set to TRUE,
+                            indicates that the routine should stop receiving records.
+    MonitorRecordCallback - A callback function that will be invoked for each parsed monitor record.
+
+--*/
+{
+    return FglReceiveFilteredMonitorRecords(End, NULL, MonitorRecordCallback);
+}
+
 HRESULT FglGetCoreVersion(
     _In_ CONST HANDLE Port,
     _Inout_ FG_CORE_VERSION *Version
@@ -325,6 +918,118 @@ Arguments:
     return hr;
 }
 
+HRESULT FglSetMonitorBatching(
+    _In_ HANDLE Port,
+    _In_ ULONG BatchSize,
+    _In_ ULONG BatchDelay
+    )
+/*++
+
+Routine Description:
+
+    This routine sets how the FileGuardCore driver batches the monitor records.
+    The records are sent once a processor has `BatchSize` bytes of them pending,
+    or `BatchDelay` milliseconds after the first of them was recorded.
+
+Arguments:
+
+    Port       - A handle to the FileGuardCore port used to send the message.
+    BatchSize  - Bytes of pending records, up to FG_MONITOR_BATCH_SIZE_MAX. Zero sends
+                 every record at once.
+    BatchDelay - Milliseconds of the delay, up to FG_MONITOR_BATCH_DELAY_MAX.
+
+--*/
+{
+    HRESULT hr = S_OK;
+    FG_MESSAGE msg = { .Type = SetMonitorBatching, .MonitorBatchSize = BatchSize, .MonitorBatchDelay = BatchDelay };
+    FG_MESSAGE_RESULT result = { 0 };
+    DWORD returned = 0ul;
+
+    if (BatchSize > FG_MONITOR_BATCH_SIZE_MAX) return E_INVALIDARG;
+    if (BatchDelay > FG_MONITOR_BATCH_DELAY_MAX) return E_INVALIDARG;
+
+    hr = FilterSendMessage(Port,
+                           &msg,
+                           sizeof(FG_MESSAGE),
+                           &result,
+                           sizeof(FG_MESSAGE_RESULT),
+                           &returned);
+    if (SUCCEEDED(hr)) hr = result.ResultCode;
+    return hr;
+}
+
+HRESULT FglSetMonitorSendTimeout(
+    _In_ HANDLE Port,
+    _In_ ULONG SendTimeout
+    )
+/*++
+
+Routine Description:
+
+    This routine sets how long the FileGuardCore driver waits for a posted receive
+    when it sends a records message, the records are sent again later if none is.
+
+Arguments:
+
+    Port        - A handle to the FileGuardCore port used to send the message.
+    SendTimeout - Milliseconds of the timeout, up to FG_MONITOR_SEND_TIMEOUT_MAX.
+
+--*/
+{
+    HRESULT hr = S_OK;
+    FG_MESSAGE msg = { .Type = SetMonitorSendTimeout, .MonitorSendTimeout = SendTimeout };
+    FG_MESSAGE_RESULT result = { 0 };
+    DWORD returned = 0ul;
+
+    if (SendTimeout > FG_MONITOR_SEND_TIMEOUT_MAX) return E_INVALIDARG;
+
+    hr = FilterSendMessage(Port,
+                           &msg,
+                           sizeof(FG_MESSAGE),
+                           &result,
+                           sizeof(FG_MESSAGE_RESULT),
+                           &returned);
+    if (SUCCEEDED(hr)) hr = result.ResultCode;
+    return hr;
+}
+
+HRESULT FglSetMonitorCoalescing(
+    _In_ HANDLE Port,
+    _In_ ULONG CoalesceWindow
+    )
+/*++
+
+Routine Description:
+
+    This routine sets the window the FileGuardCore driver coalesces identical monitor
+    events of a file in. The events of a window after the first one are received as
+    a single record, its `RepeatCount` is the amount of the events.
+
+Arguments:
+
+    Port           - A handle to the FileGuardCore port used to send the message.
+    CoalesceWindow - Milliseconds of the window, up to FG_MONITOR_COALESCE_WINDOW_MAX,
+                     zero records every event.
+
+--*/
+{
+    HRESULT hr = S_OK;
+    FG_MESSAGE msg = { .Type = SetMonitorCoalescing, .MonitorCoalesceWindow = CoalesceWindow };
+    FG_MESSAGE_RESULT result = { 0 };
+    DWORD returned = 0ul;
+
+    if (CoalesceWindow > FG_MONITOR_COALESCE_WINDOW_MAX) return E_INVALIDARG;
+
+    hr = FilterSendMessage(Port,
+                           &msg,
+                           sizeof(FG_MESSAGE),
+                           &result,
+                           sizeof(FG_MESSAGE_RESULT),
+                           &returned);
+    if (SUCCEEDED(hr)) hr = result.ResultCode;
+    return hr;
+}
+
 HRESULT FglCreateRulesMessage(
     _In_ CONST FGL_RULE Rules[],
     _In_ USHORT RulesAmount,
@@ -351,12 +1056,14 @@ Arguments:
     SIZE_T rulesSize = 0, messageSize = 0;
     FG_MESSAGE* message = NULL;
     FG_RULE* rulePtr = NULL;
-    USHORT pathExpressionSize = 0;
+    USHORT pathExpressionSize = 0, imageExpressionSize = 0;
 
     if (0 == RulesAmount || NULL == Rules || NULL == Message) return E_INVALIDARG;
 
     for (; i < RulesAmount; i ++) {
         rulesSize += (wcslen(Rules[i].RulePathExpression) * sizeof(WCHAR) + sizeof(FG_RULE));
+        if (NULL != Rules[i].RuleImageExpression)
+            rulesSize += wcslen(Rules[i].RuleImageExpression) * sizeof(WCHAR);
     }
 
     messageSize = rulesSize + sizeof(FG_MESSAGE);
@@ -370,17 +1077,24 @@ Arguments:
     message->RulesAmount = RulesAmount;
     message->RulesSize = (ULONG)rulesSize;
     for (i = 0; i < RulesAmount; i++) {
-        if (!VALID_RULE_CODE(Rules[i].Code)) {
+        if (!VALID_RULE_CODE(Rules[i].Code) || !VALID_RULE_OPERATIONS(Rules[i].Operations)) {
             free(message);
             return E_INVALIDARG;
         }
         rulePtr->Code = Rules[i].Code;
+        rulePtr->Operations = Rules[i].Operations;
 
         pathExpressionSize = (USHORT)wcslen(Rules[i].RulePathExpression) * sizeof(WCHAR);
         rulePtr->PathExpressionSize = pathExpressionSize;
         RtlCopyMemory(rulePtr->PathExpression, Rules[i].RulePathExpression, pathExpressionSize);
 
-        (UCHAR*)rulePtr += (sizeof(FG_RULE) + pathExpressionSize);
+        imageExpressionSize = NULL == Rules[i].RuleImageExpression ? 0 : 
+                              (USHORT)wcslen(Rules[i].RuleImageExpression) * sizeof(WCHAR);
+        rulePtr->ImageExpressionSize = imageExpressionSize;
+        if (0 != imageExpressionSize)
+            RtlCopyMemory(FG_RULE_IMAGE_EXPRESSION(rulePtr), Rules[i].RuleImageExpression, imageExpressionSize);
+
+        (UCHAR*)rulePtr += FG_RULE_SIZE(rulePtr);
     }
 
     *Message = message;
@@ -716,3 +1430,263 @@ Arguments:
 
     return hr;
 }
+
+HRESULT FglRefreshRulesMirror(
+    _In_ CONST HANDLE Port,
+    _Inout_ FGL_RULES_MIRROR *Mirror
+    )
+/*++
+
+Routine Description:
+
+    This routine brings a local copy of the rules list up to date via the specified
+    FileGuardCore port. A synchronized mirror sends a conditional query, the rules are
+    only transferred if the rules generation changed since the last refresh.
+
+Arguments:
+
+    Port   - A handle to the FileGuardCore port used to send the query message.
+    Mirror - The mirror to be refreshed, zero initialized before the first refresh.
+
+Return Value:
+
+    S_OK    - The mirror was refreshed with the current rules.
+    S_FALSE - The rules did not change, the mirror is kept as it is.
+    Other   - Failure, the mirror is kept as it is.
+
+--*/
+{
+    return FglSynchronizeRulesMirror(FilterSendMessage, Port, Mirror);
+}
+
+VOID FglFreeRulesMirror(
+    _Inout_ FGL_RULES_MIRROR *Mirror
+    )
+/*++
+
+Routine Description:
+
+    This routine frees the rules kept by a mirror, the mirror is synchronized again
+    by its next refresh.
+
+Arguments:
+
+    Mirror - The mirror to be freed.
+
+--*/
+{
+    if (NULL == Mirror) return;
+
+    free(Mirror->Buffer);
+    RtlZeroMemory(Mirror, sizeof(FGL_RULES_MIRROR));
+}
+
+HRESULT FglSendFileIdRuleMessage(
+    _In_ CONST HANDLE Port,
+    _In_ FG_MESSAGE_TYPE Type,
+    _In_ FG_RULE_CODE Code,
+    _In_ PCWSTR FilePath,
+    _Inout_ BOOLEAN *Affected
+    )
+/*++
+
+Routine Description:
+
+    This routine opens the file to resolve its volume serial number and file id, then
+    sends a file id rule message of the specified type via the FileGuardCore port.
+
+Arguments:
+
+    Port     - A handle to the FileGuardCore port used to send message.
+    Type     - AddFileIdRule or RemoveFileIdRule.
+    Code     - The rule code.
+    FilePath - A pointer to a wide character string that specifies the path of the file.
+    Affected - A pointer to a BOOLEAN variable that receives TRUE if the rule was added 
+               or removed, or FALSE otherwise.
+
+--*/
+{
+    HRESULT hr = S_OK;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    FILE_ID_INFO fileIdInfo = { 0 };
+    SIZE_T filePathSize = 0;
+    FG_MESSAGE *message = NULL;
+    ULONG messageSize = 0ul;
+    FG_MESSAGE_RESULT result = { 0 };
+    DWORD returned = 0ul;
+
+    if (NULL == FilePath || NULL == Affected) return E_INVALIDARG;
+
+    *Affected = FALSE;
+
+    filePathSize = wcslen(FilePath) * sizeof(WCHAR);
+    if (0 == filePathSize || MAXUSHORT < filePathSize) return E_INVALIDARG;
+
+    //
+    // The file is opened without any access, only to query its id.
+    //
+    file = CreateFileW(FilePath,
+                       0,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                       NULL,
+                       OPEN_EXISTING,
+                       FILE_FLAG_BACKUP_SEMANTICS,
+                       NULL);
+    if (INVALID_HANDLE_VALUE == file) return HRESULT_FROM_WIN32(GetLastError());
+
+    if (!GetFileInformationByHandleEx(file, FileIdInfo, &fileIdInfo, sizeof(FILE_ID_INFO))) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        CloseHandle(file);
+        return hr;
+    }
+
+    CloseHandle(file);
+
+    messageSize = (ULONG)(FIELD_OFFSET(FG_MESSAGE, FilePath) + filePathSize);
+    message = malloc(messageSize);
+    if (NULL == message) return E_OUTOFMEMORY;
+    else memset(message, 0, messageSize);
+
+    message->Type = Type;
+    message->MessageSize = messageSize;
+    message->FileIdDescriptor.VolumeSerialNumber = fileIdInfo.VolumeSerialNumber;
+    RtlCopyMemory(&message->FileIdDescriptor.FileId.FileId128, &fileIdInfo.FileId, sizeof(FILE_ID_128));
+    message->FileIdRuleCode = Code;
+    message->FilePathSize = (USHORT)filePathSize;
+    RtlCopyMemory(message->FilePath, FilePath, filePathSize);
+
+    hr = FilterSendMessage(Port,
+                           message,
+                           messageSize,
+                           &result,
+                           sizeof(FG_MESSAGE_RESULT),
+                           &returned);
+    if (SUCCEEDED(hr)) hr = HRESULT_FROM_WIN32(result.ResultCode);
+    if (SUCCEEDED(hr)) *Affected = 0 != result.AffectedRulesAmount;
+
+    free(message);
+
+    return hr;
+}
+
+HRESULT FglAddFileIdRule(
+    _In_ CONST HANDLE Port,
+    _In_ FG_RULE_CODE Code,
+    _In_ PCWSTR FilePath,
+    _Inout_ BOOLEAN *Added
+    )
+/*++
+
+Routine Description:
+
+    This routine adds a rule matching an existing file by its id via the specified 
+    FileGuardCore port. The rule follows the file across renames and hard links, and 
+    the core matches it without resolving the file name.
+
+Arguments:
+
+    Port     - A handle to the FileGuardCore port used to send message.
+    Code     - The rule code.
+    FilePath - A pointer to a wide character string that specifies the path of the file.
+    Added    - A pointer to a BOOLEAN variable that receives TRUE if the rule was added, 
+               or FALSE otherwise. This parameter is required.
+
+--*/
+{
+    return FglSendFileIdRuleMessage(Port, AddFileIdRule, Code, FilePath, Added);
+}
+
+HRESULT FglRemoveFileIdRule(
+    _In_ CONST HANDLE Port,
+    _In_ FG_RULE_CODE Code,
+    _In_ PCWSTR FilePath,
+    _Inout_ BOOLEAN *Removed
+    )
+/*++
+
+Routine Description:
+
+    This routine removes the rule of a file added by FglAddFileIdRule via the specified 
+    FileGuardCore port.
+
+Arguments:
+
+    Port     - A handle to the FileGuardCore port used to send message.
+    Code     - The rule code.
+    FilePath - A pointer to a wide character string that specifies the path of the file.
+    Removed  - A pointer to a BOOLEAN variable that receives TRUE if the rule was removed, 
+               or FALSE otherwise. This parameter is required.
+
+--*/
+{
+    return FglSendFileIdRuleMessage(Port, RemoveFileIdRule, Code, FilePath, Removed);
+}
+
+HRESULT FglAddTrustedProcess(
+    _In_ CONST HANDLE Port,
+    _In_ ULONG ProcessId
+    )
+/*++
+
+Routine Description:
+
+    This routine sends a message to exempt a running process from all rules via the
+    specified FileGuardCore port. The core keys the process on its id and creation time,
+    so the exemption ends with the process.
+
+Arguments:
+
+    Port      - A handle to the FileGuardCore port used to send message.
+    ProcessId - The id of the process to be trusted.
+
+--*/
+{
+    HRESULT hr = S_OK;
+    FG_MESSAGE message = { .Type = AddTrustedProcess, .ProcessId = ProcessId };
+    FG_MESSAGE_RESULT result = { 0 };
+    DWORD returned = 0ul;
+
+    hr = FilterSendMessage(Port,
+                           &message,
+                           sizeof(FG_MESSAGE),
+                           &result,
+                           sizeof(FG_MESSAGE_RESULT),
+                           &returned);
+    if (SUCCEEDED(hr)) hr = HRESULT_FROM_WIN32(result.ResultCode);
+
+    return hr;
+}
+
+HRESULT FglRemoveTrustedProcess(
+    _In_ CONST HANDLE Port,
+    _In_ ULONG ProcessId
+    )
+/*++
+
+Routine Description:
+
+    This routine sends a message to revoke the exemption of a trusted process via the
+    specified FileGuardCore port.
+
+Arguments:
+
+    Port      - A handle to the FileGuardCore port used to send message.
+    ProcessId - The id of the trusted process.
+
+--*/
+{
+    HRESULT hr = S_OK;
+    FG_MESSAGE message = { .Type = RemoveTrustedProcess, .ProcessId = ProcessId };
+    FG_MESSAGE_RESULT result = { 0 };
+    DWORD returned = 0ul;
+
+    hr = FilterSendMessage(Port,
+                           &message,
+                           sizeof(FG_MESSAGE),
+                           &result,
+                           sizeof(FG_MESSAGE_RESULT),
+                           &returned);
+    if (SUCCEEDED(hr)) hr = HRESULT_FROM_WIN32(result.ResultCode);
+
+    return hr;
+}
@@ -43,6 +43,8 @@ Environment:
 
 #include <windows.h>
 
+#include "RulesMirror.h"
+
 /*-------------------------------------------------------------
     FileGuardCore driver control routines
 -------------------------------------------------------------*/
@@ -70,6 +72,22 @@ extern HRESULT FglSetDetachAcceptable(
     _In_ BOOLEAN acceptable
 );
 
+extern HRESULT FglSetMonitorBatching(
+    _In_ HANDLE Port,
+    _In_ ULONG BatchSize,
+    _In_ ULONG BatchDelay
+);
+
+extern HRESULT FglSetMonitorSendTimeout(
+    _In_ HANDLE Port,
+    _In_ ULONG SendTimeout
+);
+
+extern HRESULT FglSetMonitorCoalescing(
+    _In_ HANDLE Port,
+    _In_ ULONG CoalesceWindow
+);
+
 /*-------------------------------------------------------------
     Monitor record handling routine
 -------------------------------------------------------------*/
@@ -81,6 +99,12 @@ extern HRESULT FglReceiveMonitorRecords(
     _In_ FGL_MONITOR_RECORD_CALLBACK MonitorRecordCallback
 );
 
+extern HRESULT FglReceiveFilteredMonitorRecords(
+    _In_ volatile BOOLEAN* End,
+    _In_opt_ CONST FG_MONITOR_FILTER* Filter,
+    _In_ FGL_MONITOR_RECORD_CALLBACK MonitorRecordCallback
+);
+
 /*-------------------------------------------------------------
     Rule management routines
 -------------------------------------------------------------*/
@@ -88,6 +112,8 @@ extern HRESULT FglReceiveMonitorRecords(
 typedef struct _FGL_RULE {
     FG_RULE_CODE Code;
     PCWSTR RulePathExpression;
+    PCWSTR RuleImageExpression; // Optional, NULL applies the rule to all processes.
+    ULONG Operations;           // Optional, FG_RULE_OPERATION_* classes, zero applies the rule to all classes.
 } FGL_RULE, * PFGL_RULE;
 
 
@@ -139,4 +165,45 @@ extern HRESULT FglCleanupRules(
     _Inout_opt_ ULONG *CleanedRulesAmount
 );
 
+extern HRESULT FglRefreshRulesMirror(
+    _In_ CONST HANDLE Port,
+    _Inout_ FGL_RULES_MIRROR *Mirror
+);
+
+extern VOID FglFreeRulesMirror(
+    _Inout_ FGL_RULES_MIRROR *Mirror
+);
+
+/*-------------------------------------------------------------
+    File id rule management routines
+-------------------------------------------------------------*/
+
+extern HRESULT FglAddFileIdRule(
+    _In_ CONST HANDLE Port,
+    _In_ FG_RULE_CODE Code,
+    _In_ PCWSTR FilePath,
+    _Inout_ BOOLEAN *Added
+);
+
+extern HRESULT FglRemoveFileIdRule(
+    _In_ CONST HANDLE Port,
+    _In_ FG_RULE_CODE Code,
+    _In_ PCWSTR FilePath,
+    _Inout_ BOOLEAN *Removed
+);
+
+/*-------------------------------------------------------------
+    Trusted process management routines
+-------------------------------------------------------------*/
+
+extern HRESULT FglAddTrustedProcess(
+    _In_ CONST HANDLE Port,
+    _In_ ULONG ProcessId
+);
+
+extern HRESULT FglRemoveTrustedProcess(
+    _In_ CONST HANDLE Port,
+    _In_ ULONG ProcessId
+);
+
 #endif
\ No newline at end of file
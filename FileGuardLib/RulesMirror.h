@@ -0,0 +1,161 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    RulesMirror.h
+
+Abstract:
+
+    The local copy of the rules list kept by a client of FileGuardCore. Its refresh
+    only depends on the replies of the core, the message is sent by the routine
+    given, so it is also built by the host tests.
+
+Environment:
+
+    User mode.
+
+--*/
+
+#pragma once
+
+#ifndef _FG_RULES_MIRROR_H_
+#define _FG_RULES_MIRROR_H_
+
+#include <stdlib.h>
+
+//
+// A local copy of the rules list, refreshed only when the core reports the rules
+// generation changed. Zero initialize it before the first refresh.
+//
+typedef struct _FGL_RULES_MIRROR {
+    BOOLEAN Synchronized;
+    LONG RulesGeneration;
+    USHORT RulesAmount;
+    ULONG RulesSize;
+    FG_RULE *Rules;         // Points into `Buffer`, NULL if there is no rule.
+    PVOID Buffer;
+} FGL_RULES_MIRROR, * PFGL_RULES_MIRROR;
+
+//
+// Sends a message to the core and receives its reply, as FilterSendMessage does.
+//
+typedef HRESULT (WINAPI *FGL_SEND_MESSAGE_ROUTINE)(
+    _In_ HANDLE Port,
+    _In_reads_bytes_(InputSize) LPVOID Input,
+    _In_ DWORD InputSize,
+    _Out_writes_bytes_to_opt_(OutputSize, *Returned) LPVOID Output,
+    _In_ DWORD OutputSize,
+    _Out_ LPDWORD Returned
+);
+
+FORCEINLINE HRESULT FglSynchronizeRulesMirror(
+    _In_ FGL_SEND_MESSAGE_ROUTINE SendRoutine,
+    _In_ CONST HANDLE Port,
+    _Inout_ FGL_RULES_MIRROR *Mirror
+    )
+/*++
+
+Routine Description:
+
+    This routine brings a local copy of the rules list up to date. A synchronized
+    mirror sends a conditional query, the rules are only transferred if the rules
+    generation changed since the last refresh.
+
+Arguments:
+
+    SendRoutine - The routine sending the query message.
+    Port        - A handle to the FileGuardCore port used to send the query message.
+    Mirror      - The mirror to be refreshed, zero initialized before the first refresh.
+
+Return Value:
+
+    S_OK    - The mirror was refreshed with the current rules.
+    S_FALSE - The rules did not change, the mirror is kept as it is.
+    Other   - Failure, the mirror is kept as it is.
+
+--*/
+{
+    HRESULT hr = S_OK;
+    FG_MESSAGE message;
+    ULONG resultSize = 0ul, rulesBufferSize = 0ul;
+    PFG_MESSAGE_RESULT result = NULL;
+    DWORD returned = 0ul;
+
+    if (NULL == Mirror) return E_INVALIDARG;
+
+    RtlZeroMemory(&message, sizeof(FG_MESSAGE));
+
+    //
+    // The rules size of the last refresh is a good guess, the query is repeated
+    // with the reported size while the rules grow meanwhile.
+    //
+    rulesBufferSize = Mirror->RulesSize;
+
+    for (;;) {
+        resultSize = sizeof(FG_MESSAGE_RESULT) + rulesBufferSize;
+        result = (PFG_MESSAGE_RESULT)malloc(resultSize);
+        if (NULL == result) return E_OUTOFMEMORY;
+        else RtlZeroMemory(result, resultSize);
+
+        message.Type = QueryRules;
+        message.QueryIfChanged = Mirror->Synchronized;
+        message.RulesGeneration = Mirror->RulesGeneration;
+        hr = SendRoutine(Port,
+                         &message,
+                         sizeof(FG_MESSAGE),
+                         result,
+                         resultSize,
+                         &returned);
+        if (!SUCCEEDED(hr)) break;
+
+        if (Mirror->Synchronized && Mirror->RulesGeneration == result->RulesGeneration) {
+            hr = S_FALSE;
+            break;
+        }
+
+        hr = HRESULT_FROM_WIN32(result->ResultCode);
+        if (HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER) != hr) break;
+
+        rulesBufferSize = result->Rules.RulesSize;
+        free(result);
+    }
+
+    if (S_OK != hr) {
+        free(result);
+        return hr;
+    }
+
+    free(Mirror->Buffer);
+    Mirror->Buffer = result;
+    Mirror->Rules = 0 != result->Rules.RulesAmount ? (FG_RULE*)result->Rules.RulesBuffer : NULL;
+    Mirror->RulesAmount = result->Rules.RulesAmount;
+    Mirror->RulesSize = result->Rules.RulesSize;
+    Mirror->RulesGeneration = result->RulesGeneration;
+    Mirror->Synchronized = TRUE;
+
+    return S_OK;
+}
+
+#endif
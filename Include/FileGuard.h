@@ -60,7 +60,16 @@ typedef enum _FG_MESSAGE_TYPE {
     RemoveRules,
     QueryRules,
     CheckMatchedRule,
-    CleanupRules
+    CleanupRules,
+    AddTrustedProcess,
+    RemoveTrustedProcess,
+    AddFileIdRule,
+    RemoveFileIdRule,
+    SetMonitorBatching,
+    SetMonitorSendTimeout,
+    QueryRuleDictionary,    // Sent to the monitor port.
+    SetMonitorCoalescing,
+    QueryMonitorChannel     // Sent to the monitor port.
 } FG_MESSAGE_TYPE;
 
 typedef struct _FG_CORE_VERSION {
@@ -95,12 +104,104 @@ typedef enum _FG_RULE_MINOR_CODE {
 #define VALID_MINOR_RULE_CODE(_code_) ((_code_).Minor > RuleMinorNone && (_code_).Minor < RuleMinorMaximum)
 #define VALID_RULE_CODE(_code_) (VALID_MAJOR_RULE_CODE(_code_) && VALID_MINOR_RULE_CODE(_code_))
 
+//
+// Operation classes a rule applies to. A rule without any class set applies to all
+// the classes its major code enforces.
+//
+#define FG_RULE_OPERATION_CREATE    0x00000001  // Opens and creates.
+#define FG_RULE_OPERATION_WRITE     0x00000002  // Data writes.
+#define FG_RULE_OPERATION_RENAME    0x00000004  // Renames, of the file or onto its path.
+#define FG_RULE_OPERATION_DELETE    0x00000008  // Deletes on close.
+#define FG_RULE_OPERATION_TRUNCATE  0x00000010  // End of file and allocation size changes.
+#define FG_RULE_OPERATION_FSCTL     0x00000020  // Sparse and reparse point controls.
+#define FG_RULE_OPERATIONS_ALL      0x0000003F
+
+#define VALID_RULE_OPERATIONS(_operations_) (0 == ((_operations_) & ~FG_RULE_OPERATIONS_ALL))
+
+#define FG_RULE_MAJOR_OPERATIONS(_code_) (RuleMajorAccessDenied == (_code_).Major || \
+                                          RuleMajorReadonly == (_code_).Major ? FG_RULE_OPERATIONS_ALL : 0)
+
+//
+// Compiles a rule code and the operation classes it is narrowed to into the mask of
+// the operation classes the rule is enforced on.
+//
+#define FG_RULE_COMPILE_OPERATIONS(_code_, _operations_) \
+    ((0 == (_operations_) ? FG_RULE_OPERATIONS_ALL : (_operations_)) & FG_RULE_MAJOR_OPERATIONS(_code_))
+
+//
+// Access rights of an open which could modify the data of a file, delete or rename
+// it. The generic rights are checked as well, in case they are not mapped yet.
+//
+#define FG_WRITE_ACCESS_MASK (FILE_WRITE_DATA | FILE_APPEND_DATA | DELETE | GENERIC_WRITE | GENERIC_ALL)
+
+//
+// Decides an open of a file by the compiled operation classes of its rule and the
+// access the open desires, or was granted for a maximum allowed open. An access
+// denied rule denies every open, a readonly rule the opens with write access only,
+// so no handle of a readonly file can write, truncate, rename or delete it.
+//
+#define FG_RULE_OPEN_DENIED(_code_, _operations_, _access_)                     \
+    (0 != ((_operations_) & FG_RULE_OPERATION_CREATE) &&                        \
+     (RuleMajorAccessDenied == (_code_).Major ||                                \
+      (RuleMajorReadonly == (_code_).Major && 0 != ((_access_) & FG_WRITE_ACCESS_MASK))))
+
+//
+// A rule applies to all processes when `ImageExpressionSize` is zero. Otherwise the
+// image expression follows the path expression in the buffer and is matched against
+// the requestor process image path, an expression led by '!' applies the rule to all
+// processes except the matched ones.
+//
 typedef struct _FG_RULE {
     FG_RULE_CODE Code;
-    USHORT PathExpressionSize; // The bytes size of `FilePathName`, contain null wide char.
-    WCHAR PathExpression[];    // End of null.
+    ULONG Id;                   // Assigned by the core, ignored when rules are added or removed.
+    ULONG Operations;           // FG_RULE_OPERATION_* classes, zero for all classes.
+    USHORT PathExpressionSize;  // The bytes size of `FilePathName`, contain null wide char.
+    USHORT ImageExpressionSize; // The bytes size of image expression, zero if no image expression.
+    WCHAR PathExpression[];     // End of null.
 } FG_RULE, *PFG_RULE;
 
+#define FG_RULE_IMAGE_EXPRESSION(_rule_) ((PWCHAR)((PUCHAR)(_rule_)->PathExpression + (_rule_)->PathExpressionSize))
+#define FG_RULE_SIZE(_rule_) (sizeof(FG_RULE) + (_rule_)->PathExpressionSize + (_rule_)->ImageExpressionSize)
+
+typedef struct _FG_FILE_ID_DESCRIPTOR {
+    
+    ULONGLONG VolumeSerialNumber;
+    
+    union {
+        LARGE_INTEGER FileId64;
+        FILE_ID_128 FileId128;  
+    } FileId;
+
+} FG_FILE_ID_DESCRIPTOR, *PFG_FILE_ID_DESCRIPTOR;
+
+//
+// Monitor records batching. The monitor thread is woken when a processor has the
+// batch size of records bytes pending, or when the batch delay in milliseconds
+// expired since the first pending record. A zero batch size sends every record
+// without delay.
+//
+#define FG_MONITOR_BATCH_SIZE_DEFAULT  (16 * 1024)
+#define FG_MONITOR_BATCH_SIZE_MAX      (64 * 1024)
+#define FG_MONITOR_BATCH_DELAY_DEFAULT 10
+#define FG_MONITOR_BATCH_DELAY_MAX     1000
+
+//
+// Milliseconds a records message waits for a receive posted by the client, the
+// records stay queued in the core and are sent again when it expires. Zero only
+// delivers to receives already posted.
+//
+#define FG_MONITOR_SEND_TIMEOUT_DEFAULT 1000
+#define FG_MONITOR_SEND_TIMEOUT_MAX     60000
+
+//
+// Milliseconds identical monitor events are coalesced in, zero records every event.
+// Events of a file are identical if they are of the same process, IRP major function
+// and rule. The first event of a window is recorded as it is, the later ones are sent
+// as a single record with their repeat count once the window expired.
+//
+#define FG_MONITOR_COALESCE_WINDOW_DEFAULT 0
+#define FG_MONITOR_COALESCE_WINDOW_MAX     10000
+
 //
 // Message of user application send to core.
 //
@@ -110,6 +211,29 @@ typedef struct _FG_MESSAGE {
     union {
         BOOLEAN UnloadAcceptable;
         BOOLEAN DetachAcceptable;
+        ULONG ProcessId;
+        struct {
+            ULONG MonitorBatchSize;
+            ULONG MonitorBatchDelay;
+        } DUMMYSTRUCTNAME;
+        ULONG MonitorSendTimeout;
+        ULONG MonitorCoalesceWindow;
+
+        //
+        // The rule dictionary query returns the rules and file id rules with an id not
+        // below `FirstRuleId`, the ids only grow so a client asks for the ones above
+        // the highest id it knows.
+        //
+        ULONG FirstRuleId;
+
+        //
+        // A conditional rules query returns no rule if the rules generation is still
+        // `RulesGeneration`, the client copy of the rules is current.
+        //
+        struct {
+            BOOLEAN QueryIfChanged;
+            LONG RulesGeneration;
+        } DUMMYSTRUCTNAME;
         struct {
             USHORT RulesAmount;
             ULONG RulesSize;
@@ -119,6 +243,17 @@ typedef struct _FG_MESSAGE {
             USHORT PathNameSize;
             WCHAR PathName[];
         } DUMMYSTRUCTNAME;
+
+        //
+        // A file id rule matches the file by its id, a 64-bit id is stored in the low
+        // part of `FileId128`. The file path is kept as the rule expression for display.
+        //
+        struct {
+            FG_FILE_ID_DESCRIPTOR FileIdDescriptor;
+            FG_RULE_CODE FileIdRuleCode;
+            USHORT FilePathSize;
+            WCHAR FilePath[];
+        } DUMMYSTRUCTNAME;
     } DUMMYUNIONNAME;
 } FG_MESSAGE, *PFG_MESSAGE;
 
@@ -128,6 +263,7 @@ typedef struct _FG_MESSAGE {
 typedef struct _FG_MESSAGE_RESULT {
     ULONG ResultCode;
     ULONG ResultSize;
+    LONG RulesGeneration;   // Bumped on every change of the rules, the rules returned are at least this recent.
     union {
         FG_CORE_VERSION CoreVersion;
         ULONG AffectedRulesAmount;
@@ -137,33 +273,40 @@ typedef struct _FG_MESSAGE_RESULT {
             UCHAR RulesBuffer[];
         } Rules;
         FG_RULE MatchedRule;
+        ULONGLONG MonitorChannelBuffer; // Address of the channel buffer mapped into the caller.
     } DUMMYUNIONNAME;
 } FG_MESSAGE_RESULT, *PFG_MESSAGE_RESULT;
 
-typedef struct _FG_FILE_ID_DESCRIPTOR {
-    
-    ULONGLONG VolumeSerialNumber;
-    
-    union {
-        LARGE_INTEGER FileId64;
-        FILE_ID_128 FileId128;  
-    } FileId;
-
-} FG_FILE_ID_DESCRIPTOR, *PFG_FILE_ID_DESCRIPTOR;
-
 /*-------------------------------------------------------------
     Monitor structures
 -------------------------------------------------------------*/
 
+//
+// Activity of a handle of a file with a monitored rule, recorded in a record of
+// IRP_MJ_CLEANUP when the handle is closed if handle summaries are enabled. The
+// requests are counted whether the rule allowed them or not.
+//
+typedef struct _FG_MONITOR_HANDLE_SUMMARY {
+    ULONG Writes;         // Write requests.
+    ULONG Truncates;      // End of file and allocation size changes.
+    ULONG Renames;        // Rename requests.
+    ULONG Denied;         // Requests failed by the rule.
+    ULONG64 WriteBytes;   // Bytes of the write requests.
+} FG_MONITOR_HANDLE_SUMMARY, *PFG_MONITOR_HANDLE_SUMMARY;
+
 typedef struct _FG_MONITOR_RECORD {
     UCHAR MajorFunction;
     UCHAR MinorFunction;
     ULONG_PTR RequestorPid;
     ULONG_PTR RequestorTid;
-    LARGE_INTEGER RecordTime;
+    LARGE_INTEGER RecordTime;       // Time of the first event the record stands for.
+    LARGE_INTEGER LastRecordTime;   // Time of the last event the record stands for.
+    ULONG RepeatCount;              // Identical events coalesced into the record, one for a single event.
     FG_FILE_ID_DESCRIPTOR FileIdDescriptor;
     FG_RULE_CODE RuleCode;
-    USHORT RulePathExpressionSize;
+    ULONG RuleId;                   // Resolved to the rule expression by the rule dictionary.
+    FG_MONITOR_HANDLE_SUMMARY Summary; // Zero except in the records of IRP_MJ_CLEANUP.
+    USHORT RulePathExpressionSize;  // Zero in the records of the core, the expression is not sent.
     USHORT FilePathSize;
     USHORT RenameFilePathSize;
     WCHAR Buffer[];
@@ -180,6 +323,11 @@ typedef struct _FG_RECORD_MESSAGE_BODY {
     //
     ULONG DataSize;
 
+    //
+    // FG_MONITOR_ENCODING_* of the records in the data buffer.
+    //
+    ULONG Encoding;
+
     //
     // Data buffer.
     //
@@ -201,4 +349,105 @@ typedef struct _FG_MONITOR_RECORDS_MESSAGE {
 
 } FG_MONITOR_RECORDS_MESSAGE, *PFG_MONITOR_RECORDS_MESSAGE;
 
+//
+// Shared memory monitor channel. A client passes FG_MONITOR_CHANNEL_SETUP as the
+// context of its monitor port connection, the core then writes the records into
+// a channel buffer instead of sending records messages. The buffer is a section
+// owned by the core, the client maps it by sending QueryMonitorChannel on the port
+// and unmaps it by UnmapViewOfFile. It starts with FG_MONITOR_CHANNEL_HEADER,
+// followed by a ring of FG_MONITOR_CHANNEL_ENTRY.
+//
+#define FG_MONITOR_CHANNEL_DATA_SIZE_MIN (64 * 1024)
+#define FG_MONITOR_CHANNEL_DATA_SIZE_MAX (64 * 1024 * 1024)
+
+typedef struct _FG_MONITOR_CHANNEL_SETUP {
+    ULONG BufferSize;   // Header included, the data size must be a power of 2. Zero for no channel.
+    ULONGLONG Event;    // Handle of an event set when records were written.
+} FG_MONITOR_CHANNEL_SETUP, *PFG_MONITOR_CHANNEL_SETUP;
+
+//
+// `Head` is only written by the core and `Tail` only by the client, both count the
+// bytes since the channel was set up, the entry offsets are these counters modulo
+// the data size. They live on their own cache lines.
+//
+typedef struct _FG_MONITOR_CHANNEL_HEADER {
+    ULONG DataSize;
+    ULONG Reserved;
+    UCHAR Padding0[56];
+    volatile LONGLONG Head;
+    UCHAR Padding1[56];
+    volatile LONGLONG Tail;
+    UCHAR Padding2[56];
+} FG_MONITOR_CHANNEL_HEADER, *PFG_MONITOR_CHANNEL_HEADER;
+
+#define FG_MONITOR_CHANNEL_DATA(_header_) ((PUCHAR)(_header_) + sizeof(FG_MONITOR_CHANNEL_HEADER))
+
+#define FG_MONITOR_CHANNEL_ENTRY_RECORD 1
+#define FG_MONITOR_CHANNEL_ENTRY_WRAP   2 // The rest of the data is skipped, the next entry is at offset 0.
+                                          // Only its size and type are written, it may be 8 bytes.
+#define FG_MONITOR_CHANNEL_ENTRY_COMPACT 3 // The record is in the compact encoding.
+
+#pragma warning(push)
+#pragma warning(disable: 4200)
+
+typedef struct _FG_MONITOR_CHANNEL_ENTRY {
+    ULONG Size;          // Entry included, 8 bytes aligned.
+    ULONG Type;          // FG_MONITOR_CHANNEL_ENTRY_*.
+    ULONGLONG Sequence;  // Increased by one for each record, absent from a wrap entry.
+    FG_MONITOR_RECORD Record;
+} FG_MONITOR_CHANNEL_ENTRY, *PFG_MONITOR_CHANNEL_ENTRY;
+
+#pragma warning(pop)
+
+#define FG_MONITOR_CHANNEL_ENTRY_SIZE(_record_size_) \
+    (((ULONG)FIELD_OFFSET(FG_MONITOR_CHANNEL_ENTRY, Record) + (_record_size_) + 7) & ~7UL)
+
+//
+// Monitor port subscribers. Up to FG_MONITOR_SUBSCRIBERS_MAX clients can be connected
+// at the same time, each one passes FG_MONITOR_CONNECTION_CONTEXT as the context of
+// its connection, or only FG_MONITOR_CHANNEL_SETUP to receive all records. A record
+// is delivered to the subscribers whose filter matches it, a zero field of the
+// filter matches any record.
+//
+#define FG_MONITOR_SUBSCRIBERS_MAX          4
+#define FG_MONITOR_FILTER_PROCESS_IDS_MAX   8
+#define FG_MONITOR_FILTER_RULE_IDS_MAX      8
+#define FG_MONITOR_FILTER_PATH_PREFIX_MAX   260
+
+#define FG_MONITOR_FILTER_RULE_MAJOR(_major_)         ((ULONG)1 << (_major_))
+#define FG_MONITOR_FILTER_MAJOR_FUNCTION(_function_)  ((ULONG)1 << (_function_))
+
+//
+// Major function of the records of a writable section created on a ruled file. The
+// section is checked in IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION, which is 0xff and
+// out of the range of FG_MONITOR_FILTER_MAJOR_FUNCTION, the records carry this value
+// past IRP_MJ_MAXIMUM_FUNCTION instead, so a subscriber can select them.
+//
+#define FG_MONITOR_MAJOR_CREATE_SECTION 0x1f
+
+typedef struct _FG_MONITOR_FILTER {
+    ULONG RuleMajors;         // FG_MONITOR_FILTER_RULE_MAJOR bits of the matched rules.
+    ULONG MajorFunctions;     // FG_MONITOR_FILTER_MAJOR_FUNCTION bits of the IRP major functions.
+    ULONG ProcessIdsAmount;
+    ULONG ProcessIds[FG_MONITOR_FILTER_PROCESS_IDS_MAX];  // Requestor process ids.
+    ULONG RuleIdsAmount;
+    ULONG RuleIds[FG_MONITOR_FILTER_RULE_IDS_MAX];        // Ids of the matched rules, see QueryRuleDictionary.
+    USHORT PathPrefixSize;    // Bytes, the prefix of the file paths, case insensitive.
+    WCHAR PathPrefix[FG_MONITOR_FILTER_PATH_PREFIX_MAX];
+} FG_MONITOR_FILTER, *PFG_MONITOR_FILTER;
+
+//
+// Record encodings a subscriber asks for. The compact encoding is declared in
+// FileGuardCodec.h, the records of a records message are then coded back to back.
+//
+#define FG_MONITOR_ENCODING_RECORD     0 // FG_MONITOR_RECORD as is.
+#define FG_MONITOR_ENCODING_COMPACT_V1 1
+#define FG_MONITOR_ENCODING_MAXIMUM    FG_MONITOR_ENCODING_COMPACT_V1
+
+typedef struct _FG_MONITOR_CONNECTION_CONTEXT {
+    FG_MONITOR_CHANNEL_SETUP Channel; // Records messages are sent if the buffer size is zero.
+    FG_MONITOR_FILTER Filter;
+    ULONG Encoding;                   // FG_MONITOR_ENCODING_*.
+} FG_MONITOR_CONNECTION_CONTEXT, *PFG_MONITOR_CONNECTION_CONTEXT;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,188 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    FileGuardChannel.h
+
+Abstract:
+
+    Entry placement and checks of the shared memory monitor channel, shared by
+    FileGuardCore writing the channel and FileGuardLib reading it.
+
+Environment:
+
+    Kernel/User mode.
+
+--*/
+
+#ifndef __FILE_GUARD_CHANNEL_H__
+#define __FILE_GUARD_CHANNEL_H__
+
+#include "FileGuard.h"
+
+FORCEINLINE
+BOOLEAN
+FgIsMonitorChannelFitting(
+    _In_ LONGLONG Head,
+    _In_ LONGLONG Tail,
+    _In_ ULONG DataSize,
+    _In_ ULONG RecordSize
+    )
+/*++
+
+Routine Description:
+
+    This routine checks whether the channel has room for the entry of a record, and
+    for the wrap entry placed before it if the record does not fit before the end of
+    the data. The tail is written by the client, a bogus one only makes the channel
+    look full, the entries are placed by the head of the writer.
+
+Arguments:
+
+    Head       - The bytes written into the channel by the core.
+    Tail       - The bytes consumed from the channel by the client.
+    DataSize   - Bytes size of the channel data, a power of 2.
+    RecordSize - Bytes size of the record, coded as it is written.
+
+Return Value:
+
+    TRUE if the record fits.
+
+--*/
+{
+    ULONG entrySize = FG_MONITOR_CHANNEL_ENTRY_SIZE(RecordSize);
+    ULONG offset = (ULONG)(Head & (DataSize - 1));
+    ULONG padding = (DataSize - offset < entrySize) ? DataSize - offset : 0;
+    LONGLONG used = Head - Tail;
+
+    return used >= 0 && used + padding + entrySize <= DataSize;
+}
+
+FORCEINLINE
+FG_MONITOR_CHANNEL_ENTRY*
+FgPutMonitorChannelEntry(
+    _Inout_updates_bytes_(DataSize) UCHAR *Data,
+    _In_ ULONG DataSize,
+    _Inout_ LONGLONG *Head,
+    _Inout_ ULONGLONG *Sequence,
+    _In_ ULONG RecordSize,
+    _In_ ULONG Type
+    )
+/*++
+
+Routine Description:
+
+    This routine places the entry of a record at the head of the channel. An entry
+    never wraps around the end of the data, the rest of the data is skipped by a
+    wrap entry instead. The caller checked the record fits, it writes the record
+    and then publishes the head to the client.
+
+Arguments:
+
+    Data       - The channel data.
+    DataSize   - Bytes size of the channel data, a power of 2.
+    Head       - The bytes written into the channel, advanced past the entry.
+    Sequence   - The sequence number of the record, advanced by one.
+    RecordSize - Bytes size of the record, coded as it is written.
+    Type       - FG_MONITOR_CHANNEL_ENTRY_RECORD or FG_MONITOR_CHANNEL_ENTRY_COMPACT.
+
+Return Value:
+
+    The entry, its record follows the header.
+
+--*/
+{
+    FG_MONITOR_CHANNEL_ENTRY *entry = NULL;
+    ULONG entrySize = FG_MONITOR_CHANNEL_ENTRY_SIZE(RecordSize);
+    ULONG offset = (ULONG)(*Head & (DataSize - 1));
+
+    if (DataSize - offset < entrySize) {
+        entry = (FG_MONITOR_CHANNEL_ENTRY*)(Data + offset);
+        entry->Size = DataSize - offset;
+        entry->Type = FG_MONITOR_CHANNEL_ENTRY_WRAP;
+        *Head += entry->Size;
+        offset = 0;
+    }
+
+    entry = (FG_MONITOR_CHANNEL_ENTRY*)(Data + offset);
+    entry->Size = entrySize;
+    entry->Type = Type;
+    entry->Sequence = (*Sequence)++;
+    *Head += entrySize;
+
+    return entry;
+}
+
+FORCEINLINE
+BOOLEAN
+FgCheckMonitorChannelEntry(
+    _In_ CONST FG_MONITOR_CHANNEL_ENTRY *Entry,
+    _In_ LONGLONG Tail,
+    _In_ LONGLONG Head,
+    _In_ ULONG DataSize,
+    _Inout_ ULONGLONG *Sequence
+    )
+/*++
+
+Routine Description:
+
+    This routine checks the entry at the tail of the channel before the client reads
+    it. The entries are only written by the driver, a broken size or sequence means
+    the channel was overwritten. A wrap entry fills the rest of the data whatever its
+    size, only the record entries have a sequence.
+
+Arguments:
+
+    Entry    - The entry at the tail.
+    Tail     - The bytes consumed from the channel.
+    Head     - The bytes written into the channel, published by the driver.
+    DataSize - Bytes size of the channel data, a power of 2.
+    Sequence - The sequence number of the next record, advanced by one past a record.
+
+Return Value:
+
+    TRUE if the entry can be read, FALSE if the channel is corrupted.
+
+--*/
+{
+    if (Entry->Size < FIELD_OFFSET(FG_MONITOR_CHANNEL_ENTRY, Sequence) ||
+        0 != (Entry->Size & 7) ||
+        Head - Tail < Entry->Size) {
+        return FALSE;
+    }
+
+    if (FG_MONITOR_CHANNEL_ENTRY_WRAP == Entry->Type) {
+        return (Tail & (DataSize - 1)) + Entry->Size == DataSize;
+    }
+
+    if (FG_MONITOR_CHANNEL_ENTRY_RECORD == Entry->Type ||
+        FG_MONITOR_CHANNEL_ENTRY_COMPACT == Entry->Type) {
+        return Entry->Size >= FIELD_OFFSET(FG_MONITOR_CHANNEL_ENTRY, Record) && Entry->Sequence == (*Sequence)++;
+    }
+
+    return TRUE;
+}
+
+#endif
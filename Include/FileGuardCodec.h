@@ -0,0 +1,412 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    FileGuardCodec.h
+
+Abstract:
+
+    Compact monitor record encoding shared by FileGuardCore and FileGuardLib.
+
+Environment:
+
+    Kernel/User mode.
+
+--*/
+
+#ifndef __FILE_GUARD_CODEC_H__
+#define __FILE_GUARD_CODEC_H__
+
+#include "FileGuard.h"
+
+//
+// A record of the compact encoding is coded as:
+//
+//   UCHAR  Flags                FG_MONITOR_COMPACT_* bits.
+//   UCHAR  MajorFunction
+//   UCHAR  MinorFunction        Only with FG_MONITOR_COMPACT_MINOR.
+//   VARINT RequestorPid
+//   VARINT RequestorTid
+//   VARINT RecordTime           Absolute with FG_MONITOR_COMPACT_BASE, the zigzag delta
+//                               to the previous record time otherwise.
+//   VARINT RepeatCount          Only with FG_MONITOR_COMPACT_REPEAT, followed by
+//   VARINT LastRecordTime       the zigzag delta to the record time. Without it the
+//                               record stands for a single event.
+//   VARINT RuleCode
+//   VARINT RuleId
+//   VARINT Summary[5]           Only with FG_MONITOR_COMPACT_SUMMARY, the writes,
+//                               truncates, renames, denied and write bytes counters.
+//   VARINT VolumeSerialNumber   Only with FG_MONITOR_COMPACT_FILE_ID, followed by
+//   UCHAR  FileId[16]           the 128-bit file id.
+//   VARINT SharedChars          Leading characters of the file path shared with the
+//                               previous record, zero with FG_MONITOR_COMPACT_BASE.
+//   VARINT SuffixChars
+//   WCHAR  Suffix[SuffixChars]
+//   VARINT RenameChars          Only with FG_MONITOR_COMPACT_RENAME, followed by
+//   WCHAR  Rename[RenameChars]  the rename file path.
+//
+// A VARINT is an unsigned LEB128 of up to 10 bytes. The rule path expression is not
+// coded, the rule id refers to it. The first record of each records message or channel
+// publish is coded with FG_MONITOR_COMPACT_BASE, so a record never depends on the ones
+// of an earlier delivery.
+//
+#define FG_MONITOR_COMPACT_BASE    0x01
+#define FG_MONITOR_COMPACT_MINOR   0x02
+#define FG_MONITOR_COMPACT_FILE_ID 0x04
+#define FG_MONITOR_COMPACT_RENAME  0x08
+#define FG_MONITOR_COMPACT_REPEAT  0x10
+#define FG_MONITOR_COMPACT_SUMMARY 0x20
+#define FG_MONITOR_COMPACT_FLAGS   0x3F
+
+//
+// Characters of the previous file path kept for the front coding.
+//
+#define FG_MONITOR_COMPACT_PREFIX_MAX 256
+
+//
+// Bytes a compact record takes at most besides its path characters.
+//
+#define FG_MONITOR_COMPACT_HEADER_MAX (3 + 10 * 16 + 16)
+
+typedef struct _FG_MONITOR_COMPACT_STATE {
+    BOOLEAN Based;          // A record was coded since the state was reset.
+    LONGLONG RecordTime;
+    USHORT PathChars;
+    WCHAR Path[FG_MONITOR_COMPACT_PREFIX_MAX];
+} FG_MONITOR_COMPACT_STATE, *PFG_MONITOR_COMPACT_STATE;
+
+#define FgResetMonitorCompactState(_state_) ((_state_)->Based = FALSE)
+
+FORCEINLINE
+ULONG
+FgPutMonitorVarint(
+    _Out_writes_bytes_opt_(10) UCHAR *Buffer,
+    _In_ ULONG64 Value
+    )
+{
+    ULONG size = 0;
+    UCHAR byte = 0;
+
+    do {
+        byte = (UCHAR)(Value & 0x7F);
+        Value >>= 7;
+        if (0 != Value) byte |= 0x80;
+        if (NULL != Buffer) Buffer[size] = byte;
+        size++;
+    } while (0 != Value);
+
+    return size;
+}
+
+FORCEINLINE
+BOOLEAN
+FgGetMonitorVarint(
+    _In_reads_bytes_(DataSize) CONST UCHAR *Data,
+    _In_ ULONG DataSize,
+    _Inout_ ULONG *Offset,
+    _Out_ ULONG64 *Value
+    )
+{
+    ULONG64 value = 0;
+    ULONG shift = 0;
+    UCHAR byte = 0;
+
+    while (*Offset < DataSize && shift < 64) {
+        byte = Data[(*Offset)++];
+        value |= (ULONG64)(byte & 0x7F) << shift;
+        if (0 == (byte & 0x80)) {
+            *Value = value;
+            return TRUE;
+        }
+
+        shift += 7;
+    }
+
+    return FALSE;
+}
+
+FORCEINLINE
+ULONG
+FgEncodeMonitorRecord(
+    _Inout_ FG_MONITOR_COMPACT_STATE *State,
+    _In_ CONST FG_MONITOR_RECORD *Record,
+    _Out_writes_bytes_opt_(return) UCHAR *Buffer
+    )
+/*++
+
+Routine Description:
+
+    This routine codes a monitor record in the compact encoding. Without a buffer only
+    the size is returned and the state is left as it is.
+
+Arguments:
+
+    State  - The coding state of the records before this one.
+    Record - The record to be coded.
+    Buffer - Optional, receives the coded record.
+
+Return Value:
+
+    Bytes size of the coded record.
+
+--*/
+{
+    CONST WCHAR *path = Record->Buffer + Record->RulePathExpressionSize / sizeof(WCHAR);
+    ULONG pathChars = Record->FilePathSize / sizeof(WCHAR);
+    ULONG renameChars = Record->RenameFilePathSize / sizeof(WCHAR);
+    ULONG sharedChars = 0, maxChars = 0;
+    LONGLONG delta = 0;
+    ULONG size = 0, idx = 0;
+    UCHAR flags = 0, fileIdBits = 0;
+
+    if (State->Based) {
+        maxChars = min(min((ULONG)State->PathChars, pathChars), FG_MONITOR_COMPACT_PREFIX_MAX);
+        while (sharedChars < maxChars && path[sharedChars] == State->Path[sharedChars]) sharedChars++;
+    } else {
+        flags |= FG_MONITOR_COMPACT_BASE;
+    }
+
+    for (idx = 0; idx < sizeof(FILE_ID_128); idx++) {
+        fileIdBits |= Record->FileIdDescriptor.FileId.FileId128.Identifier[idx];
+    }
+
+    if (0 != Record->MinorFunction) flags |= FG_MONITOR_COMPACT_MINOR;
+    if (0 != Record->FileIdDescriptor.VolumeSerialNumber || 0 != fileIdBits) flags |= FG_MONITOR_COMPACT_FILE_ID;
+    if (0 != renameChars) flags |= FG_MONITOR_COMPACT_RENAME;
+    if (1 != Record->RepeatCount || Record->LastRecordTime.QuadPart != Record->RecordTime.QuadPart) {
+        flags |= FG_MONITOR_COMPACT_REPEAT;
+    }
+    if (0 != (Record->Summary.Writes | Record->Summary.Truncates | Record->Summary.Renames |
+              Record->Summary.Denied | Record->Summary.WriteBytes)) {
+        flags |= FG_MONITOR_COMPACT_SUMMARY;
+    }
+
+#define FG_PUT_BYTE(_byte_) { if (NULL != Buffer) Buffer[size] = (UCHAR)(_byte_); size++; }
+#define FG_PUT_VARINT(_value_) { size += FgPutMonitorVarint(NULL != Buffer ? Buffer + size : NULL, (ULONG64)(_value_)); }
+#define FG_PUT_BYTES(_data_, _size_) { if (NULL != Buffer) RtlCopyMemory(Buffer + size, (_data_), (_size_)); size += (_size_); }
+
+    FG_PUT_BYTE(flags);
+    FG_PUT_BYTE(Record->MajorFunction);
+    if (flags & FG_MONITOR_COMPACT_MINOR) FG_PUT_BYTE(Record->MinorFunction);
+    FG_PUT_VARINT(Record->RequestorPid);
+    FG_PUT_VARINT(Record->RequestorTid);
+
+    //
+    // The records of different processors are not ordered by time, the delta may be
+    // negative.
+    //
+    if (flags & FG_MONITOR_COMPACT_BASE) {
+        FG_PUT_VARINT(Record->RecordTime.QuadPart);
+    } else {
+        delta = Record->RecordTime.QuadPart - State->RecordTime;
+        FG_PUT_VARINT(((ULONG64)delta << 1) ^ (ULONG64)(delta >> 63));
+    }
+
+    if (flags & FG_MONITOR_COMPACT_REPEAT) {
+        delta = Record->LastRecordTime.QuadPart - Record->RecordTime.QuadPart;
+        FG_PUT_VARINT(Record->RepeatCount);
+        FG_PUT_VARINT(((ULONG64)delta << 1) ^ (ULONG64)(delta >> 63));
+    }
+
+    FG_PUT_VARINT((ULONG)Record->RuleCode.Value);
+    FG_PUT_VARINT(Record->RuleId);
+
+    if (flags & FG_MONITOR_COMPACT_SUMMARY) {
+        FG_PUT_VARINT(Record->Summary.Writes);
+        FG_PUT_VARINT(Record->Summary.Truncates);
+        FG_PUT_VARINT(Record->Summary.Renames);
+        FG_PUT_VARINT(Record->Summary.Denied);
+        FG_PUT_VARINT(Record->Summary.WriteBytes);
+    }
+
+    if (flags & FG_MONITOR_COMPACT_FILE_ID) {
+        FG_PUT_VARINT(Record->FileIdDescriptor.VolumeSerialNumber);
+        FG_PUT_BYTES(&Record->FileIdDescriptor.FileId.FileId128, sizeof(FILE_ID_128));
+    }
+
+    FG_PUT_VARINT(sharedChars);
+    FG_PUT_VARINT(pathChars - sharedChars);
+    FG_PUT_BYTES(path + sharedChars, (pathChars - sharedChars) * sizeof(WCHAR));
+
+    if (flags & FG_MONITOR_COMPACT_RENAME) {
+        FG_PUT_VARINT(renameChars);
+        FG_PUT_BYTES(path + pathChars, renameChars * sizeof(WCHAR));
+    }
+
+#undef FG_PUT_BYTE
+#undef FG_PUT_VARINT
+#undef FG_PUT_BYTES
+
+    if (NULL != Buffer) {
+        State->Based = TRUE;
+        State->RecordTime = Record->RecordTime.QuadPart;
+        State->PathChars = (USHORT)min(pathChars, FG_MONITOR_COMPACT_PREFIX_MAX);
+        RtlCopyMemory(State->Path + sharedChars, path + sharedChars, (State->PathChars - sharedChars) * sizeof(WCHAR));
+    }
+
+    return size;
+}
+
+FORCEINLINE
+BOOLEAN
+FgDecodeMonitorRecord(
+    _Inout_ FG_MONITOR_COMPACT_STATE *State,
+    _In_reads_bytes_(DataSize) CONST UCHAR *Data,
+    _In_ ULONG DataSize,
+    _Out_ ULONG *Consumed,
+    _Out_writes_bytes_(RecordSize) FG_MONITOR_RECORD *Record,
+    _In_ ULONG RecordSize
+    )
+/*++
+
+Routine Description:
+
+    This routine decodes a monitor record of the compact encoding. The data is not
+    trusted, every size is checked against the data and the record buffer.
+
+Arguments:
+
+    State      - The coding state of the records before this one.
+    Data       - The coded records.
+    DataSize   - Bytes size of the coded records.
+    Consumed   - A pointer to a variable that receives the bytes size of the record coded.
+    Record     - A buffer that receives the record, its paths follow it.
+    RecordSize - Bytes size of the record buffer.
+
+Return Value:
+
+    TRUE if a record is decoded, FALSE if the data is malformed or the record does not
+    fit in the buffer.
+
+--*/
+{
+    ULONG offset = 0;
+    ULONG64 value = 0, sharedChars = 0, suffixChars = 0, renameChars = 0;
+    LONGLONG delta = 0;
+    UCHAR flags = 0;
+
+    *Consumed = 0;
+
+    if (RecordSize < sizeof(FG_MONITOR_RECORD) || DataSize < 2) return FALSE;
+
+    RtlZeroMemory(Record, sizeof(FG_MONITOR_RECORD));
+
+    flags = Data[offset++];
+    if (0 != (flags & ~FG_MONITOR_COMPACT_FLAGS)) return FALSE;
+    if (0 == (flags & FG_MONITOR_COMPACT_BASE) && !State->Based) return FALSE;
+
+    Record->MajorFunction = Data[offset++];
+    if (flags & FG_MONITOR_COMPACT_MINOR) {
+        if (offset >= DataSize) return FALSE;
+        Record->MinorFunction = Data[offset++];
+    }
+
+    if (!FgGetMonitorVarint(Data, DataSize, &offset, &value)) return FALSE;
+    Record->RequestorPid = (ULONG_PTR)value;
+    if (!FgGetMonitorVarint(Data, DataSize, &offset, &value)) return FALSE;
+    Record->RequestorTid = (ULONG_PTR)value;
+
+    if (!FgGetMonitorVarint(Data, DataSize, &offset, &value)) return FALSE;
+    if (flags & FG_MONITOR_COMPACT_BASE) {
+        Record->RecordTime.QuadPart = (LONGLONG)value;
+    } else {
+        delta = (LONGLONG)(value >> 1) ^ -(LONGLONG)(value & 1);
+        Record->RecordTime.QuadPart = State->RecordTime + delta;
+    }
+
+    Record->RepeatCount = 1;
+    Record->LastRecordTime = Record->RecordTime;
+    if (flags & FG_MONITOR_COMPACT_REPEAT) {
+        if (!FgGetMonitorVarint(Data, DataSize, &offset, &value) || value > MAXULONG) return FALSE;
+        Record->RepeatCount = (ULONG)value;
+        if (!FgGetMonitorVarint(Data, DataSize, &offset, &value)) return FALSE;
+        delta = (LONGLONG)(value >> 1) ^ -(LONGLONG)(value & 1);
+        Record->LastRecordTime.QuadPart = Record->RecordTime.QuadPart + delta;
+    }
+
+    if (!FgGetMonitorVarint(Data, DataSize, &offset, &value) || value > MAXULONG) return FALSE;
+    Record->RuleCode.Value = (LONG)(ULONG)value;
+    if (!FgGetMonitorVarint(Data, DataSize, &offset, &value) || value > MAXULONG) return FALSE;
+    Record->RuleId = (ULONG)value;
+
+    if (flags & FG_MONITOR_COMPACT_SUMMARY) {
+        if (!FgGetMonitorVarint(Data, DataSize, &offset, &value) || value > MAXULONG) return FALSE;
+        Record->Summary.Writes = (ULONG)value;
+        if (!FgGetMonitorVarint(Data, DataSize, &offset, &value) || value > MAXULONG) return FALSE;
+        Record->Summary.Truncates = (ULONG)value;
+        if (!FgGetMonitorVarint(Data, DataSize, &offset, &value) || value > MAXULONG) return FALSE;
+        Record->Summary.Renames = (ULONG)value;
+        if (!FgGetMonitorVarint(Data, DataSize, &offset, &value) || value > MAXULONG) return FALSE;
+        Record->Summary.Denied = (ULONG)value;
+        if (!FgGetMonitorVarint(Data, DataSize, &offset, &value)) return FALSE;
+        Record->Summary.WriteBytes = value;
+    }
+
+    if (flags & FG_MONITOR_COMPACT_FILE_ID) {
+        if (!FgGetMonitorVarint(Data, DataSize, &offset, &value)) return FALSE;
+        Record->FileIdDescriptor.VolumeSerialNumber = value;
+        if (DataSize - offset < sizeof(FILE_ID_128)) return FALSE;
+        RtlCopyMemory(&Record->FileIdDescriptor.FileId.FileId128, Data + offset, sizeof(FILE_ID_128));
+        offset += sizeof(FILE_ID_128);
+    }
+
+    if (!FgGetMonitorVarint(Data, DataSize, &offset, &sharedChars)) return FALSE;
+    if (!FgGetMonitorVarint(Data, DataSize, &offset, &suffixChars)) return FALSE;
+    if ((flags & FG_MONITOR_COMPACT_BASE) ? 0 != sharedChars : sharedChars > State->PathChars) return FALSE;
+    if (suffixChars > (DataSize - offset) / sizeof(WCHAR)) return FALSE;
+    if (sharedChars + suffixChars > MAXUSHORT / sizeof(WCHAR)) return FALSE;
+    if ((RecordSize - sizeof(FG_MONITOR_RECORD)) / sizeof(WCHAR) < sharedChars + suffixChars) return FALSE;
+
+    RtlCopyMemory(Record->Buffer, State->Path, (SIZE_T)sharedChars * sizeof(WCHAR));
+    RtlCopyMemory(Record->Buffer + sharedChars, Data + offset, (SIZE_T)suffixChars * sizeof(WCHAR));
+    offset += (ULONG)suffixChars * sizeof(WCHAR);
+    Record->FilePathSize = (USHORT)((sharedChars + suffixChars) * sizeof(WCHAR));
+
+    if (flags & FG_MONITOR_COMPACT_RENAME) {
+        if (!FgGetMonitorVarint(Data, DataSize, &offset, &renameChars)) return FALSE;
+        if (renameChars > (DataSize - offset) / sizeof(WCHAR)) return FALSE;
+        if (renameChars > MAXUSHORT / sizeof(WCHAR)) return FALSE;
+        if ((RecordSize - sizeof(FG_MONITOR_RECORD)) / sizeof(WCHAR) - sharedChars - suffixChars < renameChars) return FALSE;
+
+        RtlCopyMemory(Record->Buffer + sharedChars + suffixChars, Data + offset, (SIZE_T)renameChars * sizeof(WCHAR));
+        offset += (ULONG)renameChars * sizeof(WCHAR);
+        Record->RenameFilePathSize = (USHORT)(renameChars * sizeof(WCHAR));
+    }
+
+    State->Based = TRUE;
+    State->RecordTime = Record->RecordTime.QuadPart;
+    State->PathChars = (USHORT)min(sharedChars + suffixChars, FG_MONITOR_COMPACT_PREFIX_MAX);
+    if (State->PathChars > sharedChars) {
+        RtlCopyMemory(State->Path + sharedChars,
+                      Record->Buffer + sharedChars,
+                      (State->PathChars - (SIZE_T)sharedChars) * sizeof(WCHAR));
+    }
+
+    *Consumed = offset;
+
+    return TRUE;
+}
+
+#endif
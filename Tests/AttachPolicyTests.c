@@ -0,0 +1,261 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    AttachPolicyTests.c
+
+Abstract:
+
+    Tests of the volume attach policy. A volume is attached if its file system and
+    device type are selected and its name matches an expression, if there is any.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HostShim.h"
+#include "AttachPolicy.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+#define NAME_CHARS 64
+
+static WCHAR ExpressionBuffers[4][NAME_CHARS];
+static UNICODE_STRING Expressions[4];
+
+static
+VOID
+InitPolicy(
+    _Out_ FG_ATTACH_POLICY *Policy,
+    _In_ ULONG FileSystems,
+    _In_ ULONG DeviceTypes
+    )
+{
+    memset(Policy, 0, sizeof(FG_ATTACH_POLICY));
+    Policy->FileSystems = FileSystems;
+    Policy->DeviceTypes = DeviceTypes;
+    Policy->VolumeExpressions = Expressions;
+}
+
+static
+VOID
+AddExpression(
+    _Inout_ FG_ATTACH_POLICY *Policy,
+    _In_ const char *Expression
+    )
+{
+    HostInitUnicodeString(&Expressions[Policy->VolumeExpressionsAmount],
+                          ExpressionBuffers[Policy->VolumeExpressionsAmount],
+                          Expression);
+    Policy->VolumeExpressionsAmount++;
+}
+
+static
+BOOLEAN
+IsAttachable(
+    _In_ CONST FG_ATTACH_POLICY *Policy,
+    _In_ DEVICE_TYPE DeviceType,
+    _In_ FLT_FILESYSTEM_TYPE FileSystem,
+    _In_ BOOLEAN Removable,
+    _In_ const char *VolumeName
+    )
+{
+    WCHAR buffer[NAME_CHARS] = { 0 };
+    UNICODE_STRING volumeName = { 0 };
+
+    HostInitUnicodeString(&volumeName, buffer, VolumeName);
+
+    return FgcIsVolumeAttachable(Policy, DeviceType, FileSystem, Removable, &volumeName);
+}
+
+static
+VOID
+TestDefaultPolicy(
+    VOID
+    )
+{
+    FG_ATTACH_POLICY policy;
+
+    InitPolicy(&policy, FG_ATTACH_DEFAULT_FILE_SYSTEMS, FG_ATTACH_DEFAULT_DEVICE_TYPES);
+
+    //
+    // Only NTFS is attached by default, on any device type.
+    //
+    CHECK(IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\HARDDISKVOLUME2"));
+    CHECK(IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_NTFS, TRUE, "\\DEVICE\\HARDDISKVOLUME7"));
+    CHECK(IsAttachable(&policy, FILE_DEVICE_CD_ROM_FILE_SYSTEM, FLT_FSTYPE_NTFS, TRUE, "\\DEVICE\\CDROM0"));
+    CHECK(IsAttachable(&policy, FILE_DEVICE_NETWORK_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\MUP"));
+
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_FAT, FALSE, "\\DEVICE\\HARDDISKVOLUME3"));
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_REFS, FALSE, "\\DEVICE\\HARDDISKVOLUME4"));
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_NETWORK_FILE_SYSTEM, FLT_FSTYPE_MUP, FALSE, "\\DEVICE\\MUP"));
+
+    //
+    // A device type the policy has no class for is never attached.
+    //
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_VIRTUAL_DISK, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\HARDDISKVOLUME5"));
+}
+
+static
+VOID
+TestFileSystemRange(
+    VOID
+    )
+{
+    FG_ATTACH_POLICY policy;
+
+    InitPolicy(&policy, MAXULONG, FG_ATTACH_DEFAULT_DEVICE_TYPES);
+
+    //
+    // A file system type past the bits of the mask is rejected rather than shifted
+    // out of range.
+    //
+    CHECK(IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, (FLT_FILESYSTEM_TYPE)31, FALSE, "\\DEVICE\\HARDDISKVOLUME2"));
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, (FLT_FILESYSTEM_TYPE)32, FALSE, "\\DEVICE\\HARDDISKVOLUME2"));
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, (FLT_FILESYSTEM_TYPE)200, FALSE, "\\DEVICE\\HARDDISKVOLUME2"));
+}
+
+static
+VOID
+TestDeviceTypes(
+    VOID
+    )
+{
+    static const DEVICE_TYPE deviceTypes[] = {
+        FILE_DEVICE_DISK_FILE_SYSTEM, FILE_DEVICE_CD_ROM_FILE_SYSTEM,
+        FILE_DEVICE_NETWORK_FILE_SYSTEM, FILE_DEVICE_VIRTUAL_DISK
+    };
+
+    FG_ATTACH_POLICY policy;
+    ULONG classes = 0, idx = 0, fileSystem = 0, deviceClass = 0;
+    BOOLEAN removable = FALSE, expected = FALSE;
+
+    //
+    // Every selection of device classes and file systems against every volume.
+    //
+    for (classes = 0; classes <= FG_ATTACH_DEFAULT_DEVICE_TYPES; classes++) {
+        for (fileSystem = FLT_FSTYPE_UNKNOWN; fileSystem <= FLT_FSTYPE_REFS; fileSystem++) {
+
+            InitPolicy(&policy, FG_ATTACH_FILE_SYSTEM(FLT_FSTYPE_NTFS) | FG_ATTACH_FILE_SYSTEM(FLT_FSTYPE_REFS), classes);
+
+            for (idx = 0; idx < sizeof(deviceTypes) / sizeof(deviceTypes[0]); idx++) {
+                for (removable = FALSE; removable <= TRUE; removable++) {
+
+                    switch (deviceTypes[idx]) {
+                    case FILE_DEVICE_DISK_FILE_SYSTEM:
+                        deviceClass = removable ? FG_ATTACH_REMOVABLE : FG_ATTACH_DISK;
+                        break;
+                    case FILE_DEVICE_CD_ROM_FILE_SYSTEM:
+                        deviceClass = FG_ATTACH_CD_ROM;
+                        break;
+                    case FILE_DEVICE_NETWORK_FILE_SYSTEM:
+                        deviceClass = FG_ATTACH_NETWORK;
+                        break;
+                    default:
+                        deviceClass = 0;
+                        break;
+                    }
+
+                    expected = (FLT_FSTYPE_NTFS == fileSystem || FLT_FSTYPE_REFS == fileSystem) &&
+                               0 != (classes & deviceClass);
+
+                    CHECK(expected == IsAttachable(&policy,
+                                                   deviceTypes[idx],
+                                                   (FLT_FILESYSTEM_TYPE)fileSystem,
+                                                   removable,
+                                                   "\\DEVICE\\HARDDISKVOLUME2"));
+                }
+            }
+        }
+    }
+}
+
+static
+VOID
+TestVolumeExpressions(
+    VOID
+    )
+{
+    FG_ATTACH_POLICY policy;
+
+    InitPolicy(&policy, FG_ATTACH_DEFAULT_FILE_SYSTEMS, FG_ATTACH_DEFAULT_DEVICE_TYPES);
+
+    AddExpression(&policy, "\\DEVICE\\HARDDISKVOLUME?");
+    CHECK(IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\HARDDISKVOLUME2"));
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\HARDDISKVOLUME12"));
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_NETWORK_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\MUP"));
+
+    //
+    // A volume is attached if any expression matches its name, the name is compared
+    // case insensitively.
+    //
+    AddExpression(&policy, "\\DEVICE\\HARDDISKVOLUME1*");
+    AddExpression(&policy, "*MUP");
+    CHECK(IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\HARDDISKVOLUME12"));
+    CHECK(IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\Device\\HarddiskVolume1"));
+    CHECK(IsAttachable(&policy, FILE_DEVICE_NETWORK_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\MUP"));
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\HARDDISKVOLUME23"));
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_CD_ROM_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\CDROM0"));
+
+    //
+    // The expressions only narrow the volumes the types select.
+    //
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_FAT, FALSE, "\\DEVICE\\HARDDISKVOLUME2"));
+    policy.DeviceTypes = FG_ATTACH_DISK;
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_NETWORK_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\MUP"));
+    CHECK(!IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_NTFS, TRUE, "\\DEVICE\\HARDDISKVOLUME2"));
+    CHECK(IsAttachable(&policy, FILE_DEVICE_DISK_FILE_SYSTEM, FLT_FSTYPE_NTFS, FALSE, "\\DEVICE\\HARDDISKVOLUME2"));
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestDefaultPolicy();
+    TestFileSystemRange();
+    TestDeviceTypes();
+    TestVolumeExpressions();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All attach policy checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,447 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    CoalescedEventsTests.c
+
+Abstract:
+
+    Tests of the coalescing window of the monitor events of a file, driven by
+    simulated events the way FgcCoalesceRuleMatched and FgcFlushCoalescedEvents
+    drive it. The identical events of a window are folded into one record with
+    their count and their first and last times, and the reduction of synthetic
+    traces is measured.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HostShim.h"
+#include "FileGuard.h"
+#include "CoalescedEvents.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+//
+// Times are in the 100 nanoseconds units of KeQuerySystemTime.
+//
+#define MILLISECONDS(_ms_) ((LONGLONG)(_ms_) * 10000LL)
+
+#define MAX_RECORDS 4096
+
+//
+// A file coalescing its events, and the records sent for them.
+//
+typedef struct _SIMULATED_FILE {
+    FGC_COALESCED_WINDOW Window;
+    LONGLONG Length;
+    ULONG RecordsAmount;
+    ULONG EventsAmount;
+    FG_MONITOR_RECORD Records[MAX_RECORDS];
+} SIMULATED_FILE;
+
+static SIMULATED_FILE File;
+
+static
+VOID
+ResetFile(
+    _In_ LONGLONG Length
+    )
+{
+    memset(&File, 0, sizeof(File));
+    File.Length = Length;
+}
+
+static
+VOID
+SendRecord(
+    _In_ CONST FG_MONITOR_RECORD *Header
+    )
+{
+    if (File.RecordsAmount < MAX_RECORDS) {
+        File.Records[File.RecordsAmount] = *Header;
+    }
+
+    File.RecordsAmount++;
+}
+
+static
+VOID
+TakeWindow(
+    VOID
+    )
+{
+    FG_MONITOR_RECORD header = { 0 };
+
+    FgcTakeCoalescedWindow(&File.Window, &header);
+    header.RuleId = File.Window.RuleId;
+    SendRecord(&header);
+}
+
+//
+// An event of the file, coalesced or recorded by itself as FgcCoalesceRuleMatched
+// does.
+//
+static
+VOID
+SimulateEvent(
+    _In_ ULONG_PTR RequestorPid,
+    _In_ ULONG_PTR RequestorTid,
+    _In_ UCHAR MajorFunction,
+    _In_ UCHAR MinorFunction,
+    _In_ ULONG RuleId,
+    _In_ LONGLONG Now
+    )
+{
+    FG_MONITOR_RECORD header = { 0 };
+
+    File.EventsAmount++;
+
+    if (FgcIsEventInCoalescedWindow(&File.Window, RequestorPid, MajorFunction, RuleId, Now, File.Length)) {
+        (VOID)FgcCoalesceEvent(&File.Window, RequestorTid, MinorFunction, Now);
+        return;
+    }
+
+    if (0UL != File.Window.Repeats) {
+        TakeWindow();
+    }
+
+    FgcOpenCoalescedWindow(&File.Window, RequestorPid, MajorFunction, RuleId, Now);
+
+    header.MajorFunction = MajorFunction;
+    header.MinorFunction = MinorFunction;
+    header.RequestorPid = RequestorPid;
+    header.RequestorTid = RequestorTid;
+    header.RecordTime.QuadPart = Now;
+    header.LastRecordTime.QuadPart = Now;
+    header.RepeatCount = 1UL;
+    header.RuleId = RuleId;
+    SendRecord(&header);
+}
+
+//
+// A pass of the monitor thread over the file, as FgcFlushCoalescedEvents does.
+//
+static
+VOID
+SimulateFlush(
+    _In_ LONGLONG Now,
+    _In_ BOOLEAN Force
+    )
+{
+    if (0UL != File.Window.Repeats &&
+        (Force || FgcIsCoalescedWindowExpired(&File.Window, Now, File.Length))) {
+        TakeWindow();
+    }
+}
+
+static
+ULONG
+CountRecordedEvents(
+    VOID
+    )
+{
+    ULONG idx = 0, events = 0;
+
+    for (; idx < File.RecordsAmount && idx < MAX_RECORDS; idx++) {
+        events += File.Records[idx].RepeatCount;
+    }
+
+    return events;
+}
+
+static
+VOID
+TestFolding(
+    VOID
+    )
+{
+    ULONG idx = 0;
+
+    ResetFile(MILLISECONDS(10));
+
+    //
+    // An appending burst of ten writes a millisecond apart, the first opens the window
+    // and is recorded, the other nine are folded.
+    //
+    for (idx = 0; idx < 10; idx++) {
+        SimulateEvent(100, 200 + idx, IRP_MJ_WRITE, (UCHAR)idx, 7, MILLISECONDS(idx));
+    }
+
+    CHECK(1 == File.RecordsAmount);
+    CHECK(9 == File.Window.Repeats);
+
+    //
+    // The window is not taken before it expires.
+    //
+    SimulateFlush(MILLISECONDS(9), FALSE);
+    CHECK(1 == File.RecordsAmount);
+
+    SimulateFlush(MILLISECONDS(10), FALSE);
+    CHECK(2 == File.RecordsAmount);
+    CHECK(0 == File.Window.Repeats);
+
+    CHECK(1 == File.Records[0].RepeatCount);
+    CHECK(0 == File.Records[0].RecordTime.QuadPart);
+
+    //
+    // The record of the folded events keeps the thread and minor function of the
+    // first one, and spans the times of the first and the last.
+    //
+    CHECK(9 == File.Records[1].RepeatCount);
+    CHECK(IRP_MJ_WRITE == File.Records[1].MajorFunction);
+    CHECK(1 == File.Records[1].MinorFunction);
+    CHECK(100 == File.Records[1].RequestorPid);
+    CHECK(201 == File.Records[1].RequestorTid);
+    CHECK(7 == File.Records[1].RuleId);
+    CHECK(MILLISECONDS(1) == File.Records[1].RecordTime.QuadPart);
+    CHECK(MILLISECONDS(9) == File.Records[1].LastRecordTime.QuadPart);
+
+    CHECK(File.EventsAmount == CountRecordedEvents());
+
+    //
+    // Nothing is left to take.
+    //
+    SimulateFlush(MILLISECONDS(100), TRUE);
+    CHECK(2 == File.RecordsAmount);
+}
+
+static
+VOID
+TestWindowExpiry(
+    VOID
+    )
+{
+    ResetFile(MILLISECONDS(10));
+
+    SimulateEvent(100, 200, IRP_MJ_WRITE, 0, 7, MILLISECONDS(0));
+    SimulateEvent(100, 200, IRP_MJ_WRITE, 0, 7, MILLISECONDS(5));
+    SimulateEvent(100, 200, IRP_MJ_WRITE, 0, 7, MILLISECONDS(9));
+    CHECK(1 == File.RecordsAmount);
+
+    //
+    // The window is not extended by the events folded into it, an identical event
+    // once it expired takes the events counted and opens a new window.
+    //
+    SimulateEvent(100, 200, IRP_MJ_WRITE, 0, 7, MILLISECONDS(10));
+    CHECK(3 == File.RecordsAmount);
+    CHECK(2 == File.Records[1].RepeatCount);
+    CHECK(MILLISECONDS(5) == File.Records[1].RecordTime.QuadPart);
+    CHECK(MILLISECONDS(9) == File.Records[1].LastRecordTime.QuadPart);
+    CHECK(1 == File.Records[2].RepeatCount);
+    CHECK(MILLISECONDS(10) == File.Records[2].RecordTime.QuadPart);
+    CHECK(MILLISECONDS(10) == File.Window.WindowStart);
+
+    SimulateEvent(100, 200, IRP_MJ_WRITE, 0, 7, MILLISECONDS(19));
+    SimulateFlush(MILLISECONDS(19), FALSE);
+    CHECK(3 == File.RecordsAmount);
+
+    //
+    // The unload forces the window out before it expires.
+    //
+    SimulateFlush(MILLISECONDS(19), TRUE);
+    CHECK(4 == File.RecordsAmount);
+    CHECK(1 == File.Records[3].RepeatCount);
+
+    CHECK(File.EventsAmount == CountRecordedEvents());
+}
+
+static
+VOID
+TestKey(
+    VOID
+    )
+{
+    ResetFile(MILLISECONDS(10));
+
+    SimulateEvent(100, 200, IRP_MJ_WRITE, 0, 7, MILLISECONDS(0));
+    SimulateEvent(100, 200, IRP_MJ_WRITE, 0, 7, MILLISECONDS(1));
+
+    //
+    // An event of another process, major function or rule is not identical, it takes
+    // the events counted and is recorded by itself.
+    //
+    SimulateEvent(101, 200, IRP_MJ_WRITE, 0, 7, MILLISECONDS(2));
+    CHECK(3 == File.RecordsAmount);
+    CHECK(100 == File.Records[1].RequestorPid);
+    CHECK(1 == File.Records[1].RepeatCount);
+    CHECK(101 == File.Records[2].RequestorPid);
+
+    SimulateEvent(101, 200, IRP_MJ_READ, 0, 7, MILLISECONDS(3));
+    CHECK(4 == File.RecordsAmount);
+    CHECK(IRP_MJ_READ == File.Records[3].MajorFunction);
+
+    SimulateEvent(101, 200, IRP_MJ_READ, 0, 8, MILLISECONDS(4));
+    CHECK(5 == File.RecordsAmount);
+    CHECK(8 == File.Records[4].RuleId);
+
+    //
+    // Other threads and minor functions of the process are folded.
+    //
+    SimulateEvent(101, 201, IRP_MJ_READ, 1, 8, MILLISECONDS(5));
+    SimulateEvent(101, 202, IRP_MJ_READ, 2, 8, MILLISECONDS(6));
+    CHECK(5 == File.RecordsAmount);
+    CHECK(2 == File.Window.Repeats);
+
+    SimulateFlush(MILLISECONDS(14), FALSE);
+    CHECK(6 == File.RecordsAmount);
+    CHECK(201 == File.Records[5].RequestorTid);
+    CHECK(1 == File.Records[5].MinorFunction);
+
+    CHECK(File.EventsAmount == CountRecordedEvents());
+}
+
+//
+// Synthetic traces, the events are a tenth of a millisecond apart at most and the
+// monitor thread flushes every millisecond.
+//
+typedef enum _TRACE_KIND {
+    TraceAppendingLog,
+    TraceTwoWriters,
+    TraceRandomMix
+} TRACE_KIND;
+
+static
+double
+ReduceTrace(
+    _In_ TRACE_KIND Kind,
+    _In_ ULONG EventsAmount,
+    _In_ LONGLONG Length
+    )
+{
+    ULONG idx = 0, seed = 12345;
+    ULONG_PTR pid = 100;
+    UCHAR major = IRP_MJ_WRITE;
+    LONGLONG now = 0, nextFlush = MILLISECONDS(1);
+
+    ResetFile(Length);
+
+    for (idx = 0; idx < EventsAmount; idx++) {
+
+        switch (Kind) {
+        case TraceAppendingLog:
+            now += 1000;
+            break;
+        case TraceTwoWriters:
+            now += 1000;
+            pid = 100 + (idx / 4) % 2;
+            break;
+        case TraceRandomMix:
+            seed = seed * 1103515245 + 12345;
+            now += (seed >> 16) % 1000;
+            pid = 100 + (seed >> 8) % 8;
+            major = (seed >> 4) % 2 ? IRP_MJ_WRITE : IRP_MJ_READ;
+            break;
+        }
+
+        while (now >= nextFlush) {
+            SimulateFlush(nextFlush, FALSE);
+            nextFlush += MILLISECONDS(1);
+        }
+
+        SimulateEvent(pid, pid + 1000, major, 0, 7, now);
+    }
+
+    SimulateFlush(now, TRUE);
+
+    CHECK(File.EventsAmount == EventsAmount);
+    CHECK(File.RecordsAmount <= MAX_RECORDS);
+    CHECK(File.EventsAmount == CountRecordedEvents());
+
+    return (double)File.EventsAmount / (double)File.RecordsAmount;
+}
+
+static
+VOID
+TestReduction(
+    VOID
+    )
+{
+    static const char *names[] = { "appending log", "two writers", "random mix" };
+    static const LONGLONG lengths[] = { MILLISECONDS(1), MILLISECONDS(10), MILLISECONDS(100) };
+    double ratios[3][3] = { { 0 } };
+    ULONG kind = 0, length = 0;
+
+    for (kind = TraceAppendingLog; kind <= TraceRandomMix; kind++) {
+        for (length = 0; length < 3; length++) {
+            ratios[kind][length] = ReduceTrace((TRACE_KIND)kind, 4000, lengths[length]);
+            printf("%-14s window %3lld ms: %lu events, %lu records, reduction %.1fx\n",
+                   names[kind],
+                   lengths[length] / 10000LL,
+                   (unsigned long)File.EventsAmount,
+                   (unsigned long)File.RecordsAmount,
+                   ratios[kind][length]);
+        }
+    }
+
+    //
+    // A writer appending every tenth of a millisecond sends two records per window,
+    // the one opening it and the one of the events folded.
+    //
+    CHECK(ratios[TraceAppendingLog][0] >= 4.9);
+    CHECK(ratios[TraceAppendingLog][1] >= 49.0);
+    CHECK(ratios[TraceAppendingLog][2] >= 490.0);
+
+    //
+    // Interleaved writers break each other's windows, the events are still folded
+    // between the switches, and longer windows never send more records.
+    //
+    CHECK(ratios[TraceTwoWriters][1] > 1.5);
+    for (kind = TraceAppendingLog; kind <= TraceRandomMix; kind++) {
+        CHECK(ratios[kind][0] <= ratios[kind][1]);
+        CHECK(ratios[kind][1] <= ratios[kind][2]);
+    }
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestFolding();
+    TestWindowExpiry();
+    TestKey();
+    TestReduction();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All coalesced events checks passed\n");
+    return EXIT_SUCCESS;
+}
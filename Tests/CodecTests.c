@@ -0,0 +1,639 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    CodecTests.c
+
+Abstract:
+
+    Tests of the compact monitor record encoding. The decoder reads records written
+    by the core into memory the client does not control, so besides the round trip
+    every truncated, oversized or malformed input must be rejected without reading
+    or writing out of bounds. The size of the records written with their rule ids
+    rather than their rule expressions, and the throughput and compression ratio
+    of the compact encoding, are measured on a busy workload.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "HostShim.h"
+#include "FileGuard.h"
+#include "FileGuardCodec.h"
+
+#define RECORD_BUFFER_SIZE (sizeof(FG_MONITOR_RECORD) + 2 * 4096 * sizeof(WCHAR))
+#define CODED_BUFFER_SIZE  (64 * 1024)
+#define RECORDS_AMOUNT     24
+
+#define BENCHMARK_RECORD_BUFFER_SIZE (sizeof(FG_MONITOR_RECORD) + 512 * sizeof(WCHAR))
+#define BENCHMARK_RECORDS            4096
+#define BENCHMARK_RULES              16
+#define BENCHMARK_ROUNDS             25
+#define BENCHMARK_BATCH_RECORDS      64
+#define BENCHMARK_CODED_BUFFER_SIZE  (BENCHMARK_RECORDS * BENCHMARK_RECORD_BUFFER_SIZE / 4)
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+typedef union _RECORD_STORAGE {
+    FG_MONITOR_RECORD Record;
+    UCHAR Buffer[RECORD_BUFFER_SIZE];
+} RECORD_STORAGE;
+
+static RECORD_STORAGE Records[RECORDS_AMOUNT];
+static RECORD_STORAGE Decoded;
+static UCHAR Coded[CODED_BUFFER_SIZE];
+
+typedef union _BENCHMARK_STORAGE {
+    FG_MONITOR_RECORD Record;
+    UCHAR Buffer[BENCHMARK_RECORD_BUFFER_SIZE];
+} BENCHMARK_STORAGE;
+
+static BENCHMARK_STORAGE BenchmarkRecords[BENCHMARK_RECORDS];
+static BENCHMARK_STORAGE ExpressedRecords[BENCHMARK_RECORDS];
+static char BenchmarkExpressions[BENCHMARK_RULES][128];
+static UCHAR BenchmarkCoded[BENCHMARK_CODED_BUFFER_SIZE];
+
+static
+ULONG
+NextRandom(
+    _Inout_ ULONG *Seed
+    )
+{
+    *Seed = *Seed * 1103515245UL + 12345UL;
+    return (*Seed >> 16) & 0x7FFF;
+}
+
+static
+double
+GetSeconds(
+    VOID
+    )
+{
+    struct timespec now;
+
+    timespec_get(&now, TIME_UTC);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static
+VOID
+SetRecordPaths(
+    _Inout_ FG_MONITOR_RECORD *Record,
+    _In_ CONST char *FilePath,
+    _In_ CONST char *RenameFilePath
+    )
+{
+    size_t idx = 0, fileChars = strlen(FilePath), renameChars = strlen(RenameFilePath);
+
+    for (idx = 0; idx < fileChars; idx++) Record->Buffer[idx] = (WCHAR)FilePath[idx];
+    for (idx = 0; idx < renameChars; idx++) Record->Buffer[fileChars + idx] = (WCHAR)RenameFilePath[idx];
+
+    Record->FilePathSize = (USHORT)(fileChars * sizeof(WCHAR));
+    Record->RenameFilePathSize = (USHORT)(renameChars * sizeof(WCHAR));
+}
+
+static
+BOOLEAN
+IsRecordEqual(
+    _In_ CONST FG_MONITOR_RECORD *Left,
+    _In_ CONST FG_MONITOR_RECORD *Right
+    )
+{
+    return Left->MajorFunction == Right->MajorFunction &&
+           Left->MinorFunction == Right->MinorFunction &&
+           Left->RequestorPid == Right->RequestorPid &&
+           Left->RequestorTid == Right->RequestorTid &&
+           Left->RecordTime.QuadPart == Right->RecordTime.QuadPart &&
+           Left->LastRecordTime.QuadPart == Right->LastRecordTime.QuadPart &&
+           Left->RepeatCount == Right->RepeatCount &&
+           0 == memcmp(&Left->FileIdDescriptor, &Right->FileIdDescriptor, sizeof(FG_FILE_ID_DESCRIPTOR)) &&
+           Left->RuleCode.Value == Right->RuleCode.Value &&
+           Left->RuleId == Right->RuleId &&
+           0 == memcmp(&Left->Summary, &Right->Summary, sizeof(FG_MONITOR_HANDLE_SUMMARY)) &&
+           Left->FilePathSize == Right->FilePathSize &&
+           Left->RenameFilePathSize == Right->RenameFilePathSize &&
+           0 == memcmp(Left->Buffer, Right->Buffer, Left->FilePathSize + Left->RenameFilePathSize);
+}
+
+static
+VOID
+BuildRecords(
+    VOID
+    )
+{
+    ULONG seed = 1, idx = 0, chars = 0;
+    char filePath[600];
+    FG_MONITOR_RECORD *record = NULL;
+
+    for (idx = 0; idx < RECORDS_AMOUNT; idx++) {
+        record = &Records[idx].Record;
+        memset(record, 0, sizeof(RECORD_STORAGE));
+
+        record->MajorFunction = (UCHAR)(NextRandom(&seed) % 28);
+        record->MinorFunction = (UCHAR)(idx % 3);
+        record->RequestorPid = 4000 + NextRandom(&seed) % 5;
+        record->RequestorTid = NextRandom(&seed);
+
+        //
+        // The records of different processors are not ordered by time.
+        //
+        record->RecordTime.QuadPart = 133000000000000000LL + idx * 1000LL - NextRandom(&seed) % 3000;
+        record->LastRecordTime = record->RecordTime;
+        record->RepeatCount = 1;
+        if (0 == idx % 3) {
+            record->RepeatCount = 2 + NextRandom(&seed);
+            record->LastRecordTime.QuadPart += NextRandom(&seed);
+        }
+
+        record->RuleCode.Major = RuleMajorReadonly;
+        record->RuleCode.Minor = RuleMinorMonitored;
+        record->RuleId = NextRandom(&seed) % 10;
+
+        if (1 == idx % 4) {
+            record->Summary.Writes = NextRandom(&seed);
+            record->Summary.Denied = 3;
+            record->Summary.WriteBytes = 0x123456789ULL;
+        }
+
+        if (0 == idx % 7) {
+            record->FileIdDescriptor.VolumeSerialNumber = 0xC0FFEEULL;
+            record->FileIdDescriptor.FileId.FileId128.Identifier[3] = 9;
+        }
+
+        //
+        // Paths share a prefix with the previous record, and some exceed the prefix
+        // kept by the coding state.
+        //
+        if (0 == idx % 11) {
+            chars = (ULONG)snprintf(filePath, sizeof(filePath), "\\Device\\HarddiskVolume3\\");
+            for (; chars < FG_MONITOR_COMPACT_PREFIX_MAX + 40; chars++) filePath[chars] = (char)('a' + chars % 26);
+            filePath[chars] = '\0';
+        } else {
+            snprintf(filePath, sizeof(filePath), "\\Device\\HarddiskVolume3\\Users\\docs\\file%03u.txt",
+                     (unsigned)(NextRandom(&seed) % 50));
+        }
+
+        SetRecordPaths(record, filePath, 0 == idx % 5 ? "\\Device\\HarddiskVolume3\\renamed.txt" : "");
+    }
+}
+
+static
+ULONG
+EncodeRecords(
+    VOID
+    )
+{
+    FG_MONITOR_COMPACT_STATE state = { 0 };
+    ULONG size = 0, recordSize = 0, idx = 0;
+
+    for (idx = 0; idx < RECORDS_AMOUNT; idx++) {
+        if (0 == idx % 8) FgResetMonitorCompactState(&state);
+
+        recordSize = FgEncodeMonitorRecord(&state, &Records[idx].Record, NULL);
+        CHECK(recordSize <= (ULONG)FG_MONITOR_COMPACT_HEADER_MAX + 
+                            Records[idx].Record.FilePathSize + 
+                            Records[idx].Record.RenameFilePathSize);
+        CHECK(size + recordSize <= CODED_BUFFER_SIZE);
+
+        CHECK(recordSize == FgEncodeMonitorRecord(&state, &Records[idx].Record, Coded + size));
+        size += recordSize;
+    }
+
+    return size;
+}
+
+static
+VOID
+TestRoundTrip(
+    VOID
+    )
+{
+    FG_MONITOR_COMPACT_STATE state = { 0 };
+    ULONG size = 0, offset = 0, consumed = 0, idx = 0;
+
+    size = EncodeRecords();
+
+    for (idx = 0; idx < RECORDS_AMOUNT; idx++) {
+        CHECK(FgDecodeMonitorRecord(&state, Coded + offset, size - offset, &consumed, &Decoded.Record, sizeof(Decoded)));
+        CHECK(IsRecordEqual(&Records[idx].Record, &Decoded.Record));
+        offset += consumed;
+    }
+
+    CHECK(offset == size);
+}
+
+static
+VOID
+TestTruncatedInputs(
+    VOID
+    )
+{
+    FG_MONITOR_COMPACT_STATE state = { 0 };
+    ULONG size = 0, length = 0, consumed = 0, idx = 0;
+    UCHAR *data = NULL;
+
+    for (idx = 0; idx < RECORDS_AMOUNT; idx++) {
+        FgResetMonitorCompactState(&state);
+        size = FgEncodeMonitorRecord(&state, &Records[idx].Record, Coded);
+
+        //
+        // Each prefix is copied to an allocation of its exact size, so a read past
+        // its end is caught by the sanitizers.
+        //
+        for (length = 0; length < size; length++) {
+            data = malloc(length + 1);
+            CHECK(NULL != data);
+            if (NULL == data) return;
+
+            memcpy(data, Coded, length);
+            FgResetMonitorCompactState(&state);
+            CHECK(!FgDecodeMonitorRecord(&state, data, length, &consumed, &Decoded.Record, sizeof(Decoded)));
+            CHECK(0 == consumed);
+            free(data);
+        }
+    }
+}
+
+static
+VOID
+TestOversizedInputs(
+    VOID
+    )
+{
+    FG_MONITOR_COMPACT_STATE state = { 0 };
+    FG_MONITOR_RECORD *record = &Records[0].Record;
+    ULONG size = 0, consumed = 0, offset = 0;
+    UCHAR data[64] = { 0 };
+
+    //
+    // A record buffer too small for the paths, or even for the record itself.
+    //
+    size = FgEncodeMonitorRecord(&state, record, Coded);
+    FgResetMonitorCompactState(&state);
+    CHECK(!FgDecodeMonitorRecord(&state, Coded, size, &consumed, &Decoded.Record,
+                                 (ULONG)sizeof(FG_MONITOR_RECORD) + record->FilePathSize + 
+                                 record->RenameFilePathSize - sizeof(WCHAR)));
+    CHECK(!FgDecodeMonitorRecord(&state, Coded, size, &consumed, &Decoded.Record, sizeof(FG_MONITOR_RECORD) - 1));
+    CHECK(FgDecodeMonitorRecord(&state, Coded, size, &consumed, &Decoded.Record,
+                                (ULONG)sizeof(FG_MONITOR_RECORD) + record->FilePathSize + record->RenameFilePathSize));
+
+    //
+    // A path claiming more characters than the data holds, or than a record can.
+    //
+    data[offset++] = FG_MONITOR_COMPACT_BASE;
+    data[offset++] = 4;             // MajorFunction
+    data[offset++] = 1;             // RequestorPid
+    data[offset++] = 1;             // RequestorTid
+    data[offset++] = 1;             // RecordTime
+    data[offset++] = 1;             // RuleCode
+    data[offset++] = 1;             // RuleId
+    data[offset++] = 0;             // Shared characters
+    offset += FgPutMonitorVarint(data + offset, 8);
+    FgResetMonitorCompactState(&state);
+    CHECK(!FgDecodeMonitorRecord(&state, data, offset + 15, &consumed, &Decoded.Record, sizeof(Decoded)));
+    CHECK(FgDecodeMonitorRecord(&state, data, offset + 16, &consumed, &Decoded.Record, sizeof(Decoded)));
+    CHECK(offset + 16 == consumed);
+
+    offset -= 1;
+    offset += FgPutMonitorVarint(data + offset, 0x7FFFFFFFFFFFFFFFULL);
+    FgResetMonitorCompactState(&state);
+    CHECK(!FgDecodeMonitorRecord(&state, data, sizeof(data), &consumed, &Decoded.Record, sizeof(Decoded)));
+
+    //
+    // Shared characters without a previous record, or more than it kept.
+    //
+    data[7] = 1;
+    data[8] = 0;
+    FgResetMonitorCompactState(&state);
+    CHECK(!FgDecodeMonitorRecord(&state, data, 9, &consumed, &Decoded.Record, sizeof(Decoded)));
+
+    data[0] = 0;
+    data[7] = 5;
+    state.Based = TRUE;
+    state.PathChars = 4;
+    CHECK(!FgDecodeMonitorRecord(&state, data, 9, &consumed, &Decoded.Record, sizeof(Decoded)));
+
+    //
+    // A delta record without a base, unknown flags, counters beyond 32 bits and a
+    // varint which never ends.
+    //
+    FgResetMonitorCompactState(&state);
+    CHECK(!FgDecodeMonitorRecord(&state, data, 9, &consumed, &Decoded.Record, sizeof(Decoded)));
+
+    data[0] = 0x80 | FG_MONITOR_COMPACT_BASE;
+    CHECK(!FgDecodeMonitorRecord(&state, data, 9, &consumed, &Decoded.Record, sizeof(Decoded)));
+
+    offset = 0;
+    data[offset++] = FG_MONITOR_COMPACT_BASE | FG_MONITOR_COMPACT_REPEAT;
+    data[offset++] = 4;
+    data[offset++] = 1;
+    data[offset++] = 1;
+    data[offset++] = 1;
+    offset += FgPutMonitorVarint(data + offset, 0x100000000ULL);
+    data[offset++] = 0;
+    data[offset++] = 1;
+    data[offset++] = 1;
+    data[offset++] = 0;
+    data[offset++] = 0;
+    CHECK(!FgDecodeMonitorRecord(&state, data, offset, &consumed, &Decoded.Record, sizeof(Decoded)));
+
+    memset(data, 0xFF, sizeof(data));
+    data[0] = FG_MONITOR_COMPACT_BASE;
+    CHECK(!FgDecodeMonitorRecord(&state, data, sizeof(data), &consumed, &Decoded.Record, sizeof(Decoded)));
+}
+
+static
+VOID
+TestMutatedInputs(
+    VOID
+    )
+{
+    FG_MONITOR_COMPACT_STATE state = { 0 };
+    ULONG seed = 7, size = 0, length = 0, offset = 0, consumed = 0, round = 0, idx = 0;
+    UCHAR *data = NULL;
+
+    size = EncodeRecords();
+
+    for (round = 0; round < 20000; round++) {
+        length = NextRandom(&seed) % (size + 1);
+        data = malloc(length + 1);
+        CHECK(NULL != data);
+        if (NULL == data) return;
+
+        memcpy(data, Coded, length);
+        for (idx = 0; idx < 4 && 0 != length; idx++) data[NextRandom(&seed) % length] = (UCHAR)NextRandom(&seed);
+
+        FgResetMonitorCompactState(&state);
+        offset = 0;
+        while (offset < length &&
+               FgDecodeMonitorRecord(&state, data + offset, length - offset, &consumed, &Decoded.Record, sizeof(Decoded))) {
+            CHECK(0 != consumed && consumed <= length - offset);
+            CHECK(Decoded.Record.FilePathSize + Decoded.Record.RenameFilePathSize <= 
+                  sizeof(Decoded) - sizeof(FG_MONITOR_RECORD));
+            offset += consumed;
+        }
+
+        free(data);
+    }
+}
+
+//
+// The records of a busy workload: a few processes writing the documents of users
+// under 16 monitored rules, with the creates, renames and handle summaries around
+// the writes, in time order as the monitor thread drains them.
+//
+static
+VOID
+BuildBenchmarkRecords(
+    VOID
+    )
+{
+    static CONST UCHAR majors[] = { IRP_MJ_CREATE, IRP_MJ_WRITE, IRP_MJ_WRITE, IRP_MJ_WRITE,
+                                    IRP_MJ_WRITE, IRP_MJ_SET_INFORMATION, IRP_MJ_CLEANUP, IRP_MJ_WRITE };
+    ULONG seed = 47, idx = 0, rule = 0;
+    LONGLONG time = 133000000000000000LL;
+    char filePath[256];
+    FG_MONITOR_RECORD *record = NULL;
+
+    for (rule = 0; rule < BENCHMARK_RULES; rule++) {
+        snprintf(BenchmarkExpressions[rule], sizeof(BenchmarkExpressions[rule]),
+                 "\\Device\\HarddiskVolume3\\Users\\user%lu\\Documents\\project%lu\\*",
+                 (unsigned long)(rule / 4), (unsigned long)(rule % 4));
+    }
+
+    for (idx = 0; idx < BENCHMARK_RECORDS; idx++) {
+        record = &BenchmarkRecords[idx].Record;
+        memset(record, 0, sizeof(BENCHMARK_STORAGE));
+
+        rule = NextRandom(&seed) % BENCHMARK_RULES;
+        time += NextRandom(&seed) % 20000;
+
+        record->MajorFunction = majors[NextRandom(&seed) % sizeof(majors)];
+        record->RequestorPid = 4000 + NextRandom(&seed) % 6 * 4;
+        record->RequestorTid = record->RequestorPid + 4 + NextRandom(&seed) % 3 * 4;
+        record->RecordTime.QuadPart = time;
+        record->LastRecordTime = record->RecordTime;
+        record->RepeatCount = 1;
+        record->RuleCode.Major = RuleMajorReadonly;
+        record->RuleCode.Minor = RuleMinorMonitored;
+        record->RuleId = rule + 1;
+
+        if (IRP_MJ_CLEANUP == record->MajorFunction) {
+            record->Summary.Writes = 1 + NextRandom(&seed) % 200;
+            record->Summary.WriteBytes = (ULONG64)record->Summary.Writes * 4096;
+        }
+
+        snprintf(filePath, sizeof(filePath),
+                 "\\Device\\HarddiskVolume3\\Users\\user%lu\\Documents\\project%lu\\file%04lu.docx",
+                 (unsigned long)(rule / 4), (unsigned long)(rule % 4), (unsigned long)(NextRandom(&seed) % 300));
+
+        SetRecordPaths(record, filePath, IRP_MJ_SET_INFORMATION == record->MajorFunction ?
+                                         "\\Device\\HarddiskVolume3\\Users\\user0\\Documents\\renamed.docx" : "");
+    }
+}
+
+//
+// Compare the records written with their rule expression, as the core did before
+// the rule dictionary, to the records written with the rule id alone. The records
+// are copied into messages the way FgcWriteMonitorRecord does.
+//
+static
+VOID
+BenchmarkRuleIds(
+    VOID
+    )
+{
+    static UCHAR message[MONITOR_RECORDS_MESSAGE_BODY_BUFFER_SIZE];
+    CONST FG_MONITOR_RECORD *record = NULL;
+    FG_MONITOR_RECORD *expressed = NULL;
+    CONST char *expression = NULL;
+    ULONG idx = 0, chr = 0, round = 0, layout = 0, recordSize = 0, dataSize = 0, messages = 0;
+    unsigned long long bytes[2] = { 0 };
+    double start = 0.0, seconds = 0.0;
+
+    //
+    // The expression is written ahead of the paths, as the library still lays out
+    // the records it resolves.
+    //
+    for (idx = 0; idx < BENCHMARK_RECORDS; idx++) {
+        record = &BenchmarkRecords[idx].Record;
+        expressed = &ExpressedRecords[idx].Record;
+        expression = BenchmarkExpressions[record->RuleId - 1];
+
+        memcpy(expressed, record, sizeof(FG_MONITOR_RECORD));
+        for (chr = 0; '\0' != expression[chr]; chr++) expressed->Buffer[chr] = (WCHAR)expression[chr];
+        memcpy(expressed->Buffer + chr, record->Buffer, record->FilePathSize + record->RenameFilePathSize);
+        expressed->RulePathExpressionSize = (USHORT)(chr * sizeof(WCHAR));
+    }
+
+    printf("layout             bytes/record  records/message  records/s\n");
+
+    for (layout = 0; layout < 2; layout++) {
+
+        dataSize = 0;
+        messages = 1;
+
+        start = GetSeconds();
+
+        for (round = 0; round < BENCHMARK_ROUNDS; round++) {
+            for (idx = 0; idx < BENCHMARK_RECORDS; idx++) {
+                record = 0 == layout ? &ExpressedRecords[idx].Record : &BenchmarkRecords[idx].Record;
+                recordSize = sizeof(FG_MONITOR_RECORD) +
+                             record->RulePathExpressionSize +
+                             record->FilePathSize +
+                             record->RenameFilePathSize;
+
+                if (dataSize + recordSize > sizeof(message)) {
+                    dataSize = 0;
+                    messages++;
+                }
+
+                memcpy(message + dataSize, record, recordSize);
+                dataSize += recordSize;
+                bytes[layout] += recordSize;
+            }
+        }
+
+        seconds = GetSeconds() - start;
+        if (seconds <= 0.0) seconds = 1e-9;
+
+        printf("%-18s %12.1f %16.1f %10.0f\n",
+               0 == layout ? "rule expression" : "rule id",
+               (double)bytes[layout] / ((double)BENCHMARK_ROUNDS * BENCHMARK_RECORDS),
+               (double)BENCHMARK_ROUNDS * BENCHMARK_RECORDS / messages,
+               (double)BENCHMARK_ROUNDS * BENCHMARK_RECORDS / seconds);
+    }
+
+    CHECK(bytes[1] < bytes[0]);
+}
+
+//
+// Encode and decode the workload in batches, the coding state is reset for each
+// batch as the core does for each records message. The compression ratio is the
+// size of the records in the record encoding over their size compacted.
+//
+static
+VOID
+BenchmarkCompactEncoding(
+    VOID
+    )
+{
+    FG_MONITOR_COMPACT_STATE state = { 0 };
+    CONST FG_MONITOR_RECORD *record = NULL;
+    ULONG idx = 0, round = 0, size = 0, offset = 0, consumed = 0, recordsSize = 0, mismatches = 0;
+    double start = 0.0, encodeSeconds = 0.0, decodeSeconds = 0.0, records = 0.0;
+
+    for (idx = 0; idx < BENCHMARK_RECORDS; idx++) {
+        record = &BenchmarkRecords[idx].Record;
+        recordsSize += sizeof(FG_MONITOR_RECORD) + record->FilePathSize + record->RenameFilePathSize;
+    }
+
+    start = GetSeconds();
+
+    for (round = 0; round < BENCHMARK_ROUNDS; round++) {
+        size = 0;
+        for (idx = 0; idx < BENCHMARK_RECORDS; idx++) {
+            if (0 == idx % BENCHMARK_BATCH_RECORDS) FgResetMonitorCompactState(&state);
+            size += FgEncodeMonitorRecord(&state, &BenchmarkRecords[idx].Record, BenchmarkCoded + size);
+        }
+    }
+
+    encodeSeconds = GetSeconds() - start;
+
+    CHECK(size <= BENCHMARK_CODED_BUFFER_SIZE);
+
+    start = GetSeconds();
+
+    for (round = 0; round < BENCHMARK_ROUNDS; round++) {
+        offset = 0;
+        for (idx = 0; idx < BENCHMARK_RECORDS; idx++) {
+            if (0 == idx % BENCHMARK_BATCH_RECORDS) FgResetMonitorCompactState(&state);
+            if (!FgDecodeMonitorRecord(&state, BenchmarkCoded + offset, size - offset, &consumed,
+                                       &Decoded.Record, sizeof(Decoded))) {
+                mismatches++;
+                break;
+            }
+
+            if (0 == round && !IsRecordEqual(&BenchmarkRecords[idx].Record, &Decoded.Record)) mismatches++;
+            offset += consumed;
+        }
+    }
+
+    decodeSeconds = GetSeconds() - start;
+
+    CHECK(0 == mismatches);
+    CHECK(offset == size);
+
+    if (encodeSeconds <= 0.0) encodeSeconds = 1e-9;
+    if (decodeSeconds <= 0.0) decodeSeconds = 1e-9;
+    records = (double)BENCHMARK_ROUNDS * BENCHMARK_RECORDS;
+
+    printf("encoding           bytes/record  encode records/s  decode records/s  ratio\n");
+    printf("%-18s %12.1f %17s %17s %6.2f\n", "record",
+           (double)recordsSize / BENCHMARK_RECORDS, "-", "-", 1.0);
+    printf("%-18s %12.1f %17.0f %17.0f %6.2f\n", "compact v1",
+           (double)size / BENCHMARK_RECORDS, records / encodeSeconds, records / decodeSeconds,
+           (double)recordsSize / size);
+
+    CHECK(size < recordsSize);
+}
+
+int
+main(
+    VOID
+    )
+{
+    BuildRecords();
+    BuildBenchmarkRecords();
+
+    TestRoundTrip();
+    TestTruncatedInputs();
+    TestOversizedInputs();
+    TestMutatedInputs();
+    BenchmarkRuleIds();
+    BenchmarkCompactEncoding();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All codec checks passed\n");
+    return EXIT_SUCCESS;
+}
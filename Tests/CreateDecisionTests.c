@@ -0,0 +1,370 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+Module Name:
+
+    CreateDecisionTests.c
+
+Abstract:
+
+    Tests of the decisions of the create callbacks. A deferred open enforces the
+    verdict cached in the file context of its stream until the rules change, the
+    name is only queried when a path rule could match it, and a cached rule is
+    never replaced by a verdict made without the name. A file created by an open
+    of a readonly file is deleted again.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "HostShim.h"
+#include "FileGuard.h"
+#include "RuleExpression.h"
+#include "CreateDecision.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+//
+// The file context of a stream as the post-create callback sees it.
+//
+typedef struct _MODEL_FILE_CONTEXT {
+    BOOLEAN Exists;
+    const char *Rule;
+    LONG Generation;
+} MODEL_FILE_CONTEXT;
+
+//
+// How a link of the file is opened, what matching its name finds and whether a
+// path rule could match anything under its parent directory.
+//
+typedef struct _MODEL_OPEN {
+    BOOLEAN Cacheable;
+    BOOLEAN ParentRuled;
+    const char *PathRule;
+    const char *FileIdRule;
+} MODEL_OPEN;
+
+static LONG RulesGeneration = 1;
+static LONG PathRulesAmount = 1;
+static int NameQueries = 0;
+
+static
+const char *
+ModelDeferredOpen(
+    _Inout_ MODEL_FILE_CONTEXT *Context,
+    _In_ const MODEL_OPEN *Open
+    )
+{
+    FGC_DEFERRED_CREATE_MATCH match;
+    const char *rule = NULL;
+    LONG generation = 0;
+
+    match = FgcGetDeferredCreateMatch(Open->Cacheable && Context->Exists,
+                                      Context->Exists ? Context->Generation : 0,
+                                      Context->Exists && NULL != Context->Rule,
+                                      RulesGeneration,
+                                      PathRulesAmount);
+    if (DeferredCreateMatchCached == match) return Context->Rule;
+
+    generation = RulesGeneration;
+
+    if (DeferredCreateMatchFileId != match && (DeferredCreateMatchName == match || Open->ParentRuled)) {
+        NameQueries++;
+        rule = Open->PathRule;
+    }
+
+    if (NULL == rule) rule = Open->FileIdRule;
+
+    Context->Exists = TRUE;
+    Context->Rule = rule;
+    Context->Generation = generation;
+
+    return rule;
+}
+
+static
+VOID
+TestCachedVerdict(
+    VOID
+    )
+{
+    MODEL_FILE_CONTEXT context = { FALSE, NULL, 0 };
+    MODEL_OPEN open = { TRUE, TRUE, "SECRET", NULL };
+
+    RulesGeneration = 1;
+    PathRulesAmount = 1;
+    NameQueries = 0;
+
+    //
+    // The first open of the stream matches its name, the later ones reuse the
+    // verdict until the rules change.
+    //
+    CHECK(0 == strcmp("SECRET", ModelDeferredOpen(&context, &open)));
+    CHECK(1 == NameQueries);
+    CHECK(0 == strcmp("SECRET", ModelDeferredOpen(&context, &open)));
+    CHECK(0 == strcmp("SECRET", ModelDeferredOpen(&context, &open)));
+    CHECK(1 == NameQueries);
+
+    RulesGeneration++;
+    open.PathRule = "SECRET2";
+    CHECK(0 == strcmp("SECRET2", ModelDeferredOpen(&context, &open)));
+    CHECK(2 == NameQueries);
+    CHECK(0 == strcmp("SECRET2", ModelDeferredOpen(&context, &open)));
+    CHECK(2 == NameQueries);
+
+    //
+    // A file no rule matches is cached as well, with no name query at all under
+    // an unruled directory.
+    //
+    context.Exists = FALSE;
+    open.ParentRuled = FALSE;
+    open.PathRule = NULL;
+    CHECK(NULL == ModelDeferredOpen(&context, &open));
+    CHECK(NULL == ModelDeferredOpen(&context, &open));
+    CHECK(2 == NameQueries);
+    CHECK(context.Exists && RulesGeneration == context.Generation);
+
+    //
+    // An open whose verdict depends on the requestor never reuses the cache.
+    //
+    context.Exists = FALSE;
+    open.Cacheable = FALSE;
+    open.ParentRuled = TRUE;
+    open.PathRule = "SECRET2";
+    ModelDeferredOpen(&context, &open);
+    ModelDeferredOpen(&context, &open);
+    CHECK(4 == NameQueries);
+}
+
+static
+VOID
+TestNoDowngrade(
+    VOID
+    )
+{
+    MODEL_FILE_CONTEXT context = { FALSE, NULL, 0 };
+    MODEL_OPEN ruledLink = { TRUE, TRUE, "SECRET", NULL };
+    MODEL_OPEN unruledLink = { TRUE, FALSE, "SECRET", "BY-ID" };
+
+    RulesGeneration = 1;
+    PathRulesAmount = 1;
+    NameQueries = 0;
+
+    CHECK(0 == strcmp("SECRET", ModelDeferredOpen(&context, &ruledLink)));
+
+    //
+    // Another link of the file under a directory with no rule reuses the verdict
+    // while it is current.
+    //
+    CHECK(0 == strcmp("SECRET", ModelDeferredOpen(&context, &unruledLink)));
+    CHECK(1 == NameQueries);
+
+    //
+    // Once stale, the cached path rule is matched by name again rather than being
+    // replaced by the file id rule matched without the name.
+    //
+    RulesGeneration++;
+    CHECK(0 == strcmp("SECRET", ModelDeferredOpen(&context, &unruledLink)));
+    CHECK(2 == NameQueries);
+    CHECK(0 == strcmp("SECRET", context.Rule));
+
+    //
+    // Without any path rule on the volume the file id rules are all that is left.
+    //
+    RulesGeneration++;
+    PathRulesAmount = 0;
+    CHECK(0 == strcmp("BY-ID", ModelDeferredOpen(&context, &unruledLink)));
+    CHECK(2 == NameQueries);
+}
+
+static
+VOID
+TestDeferredCreateMatch(
+    VOID
+    )
+{
+    ULONG inputs = 0;
+    BOOLEAN cacheable, current, ruled, pathRules;
+    FGC_DEFERRED_CREATE_MATCH match;
+
+    for (inputs = 0; inputs < 16; inputs++) {
+        cacheable = (inputs & 1) != 0;
+        current = (inputs & 2) != 0;
+        ruled = (inputs & 4) != 0;
+        pathRules = (inputs & 8) != 0;
+
+        match = FgcGetDeferredCreateMatch(cacheable, current ? 7 : 6, ruled, 7, pathRules ? 3 : 0);
+
+        CHECK((DeferredCreateMatchCached == match) == (cacheable && current));
+        if (cacheable && current) continue;
+
+        CHECK((DeferredCreateMatchFileId == match) == !pathRules);
+        if (cacheable && ruled && pathRules) CHECK(DeferredCreateMatchName == match);
+        if (!(cacheable && ruled) && pathRules) CHECK(DeferredCreateMatchParent == match);
+    }
+
+    //
+    // The generation only has to differ, it may have wrapped around.
+    //
+    CHECK(DeferredCreateMatchParent == FgcGetDeferredCreateMatch(TRUE, 0x7FFFFFFF, FALSE, (LONG)0x80000000, 1));
+}
+
+static
+BOOLEAN
+IsAppliedToDirectory(
+    _In_ const char *Expression,
+    _In_ const char *VolumeName,
+    _In_ const char *DirectoryPath
+    )
+{
+    WCHAR expressionBuffer[260], volumeBuffer[260], directoryBuffer[260];
+    UNICODE_STRING expression, volumeName, directoryPath;
+
+    HostInitUnicodeString(&expression, expressionBuffer, Expression);
+    HostInitUnicodeString(&volumeName, volumeBuffer, VolumeName);
+    HostInitUnicodeString(&directoryPath, directoryBuffer, DirectoryPath);
+
+    return FgcIsExpressionAppliedToDirectory(&expression, &volumeName, &directoryPath);
+}
+
+static
+VOID
+TestParentDirectory(
+    VOID
+    )
+{
+    const char *volume = "\\DEVICE\\HARDDISKVOLUME1";
+
+    //
+    // The parent is taken from the opened path as is, it is compared as if it
+    // followed the volume name.
+    //
+    CHECK(IsAppliedToDirectory("\\DEVICE\\HARDDISKVOLUME1\\SECRET\\*", volume, "\\secret\\"));
+    CHECK(IsAppliedToDirectory("\\DEVICE\\HARDDISKVOLUME1\\SECRET\\*", volume, "\\"));
+    CHECK(IsAppliedToDirectory("\\DEVICE\\HARDDISKVOLUME1\\SECRET\\A.TXT", volume, "\\Secret\\"));
+    CHECK(!IsAppliedToDirectory("\\DEVICE\\HARDDISKVOLUME1\\SECRET\\*", volume, "\\public\\"));
+    CHECK(!IsAppliedToDirectory("\\DEVICE\\HARDDISKVOLUME1\\SECRET\\", volume, "\\secret\\"));
+    CHECK(!IsAppliedToDirectory("\\DEVICE\\HARDDISKVOLUME2\\SECRET\\*", volume, "\\secret\\"));
+    CHECK(IsAppliedToDirectory("\\DEVICE\\HARDDISKVOLUME1\\*\\A.TXT", volume, "\\public\\"));
+    CHECK(IsAppliedToDirectory("*\\DESKTOP.INI", volume, "\\public\\"));
+    CHECK(!IsAppliedToDirectory("\\DEVICE\\HARDDISKVOLUME1\\SECRET\\SUB\\*", volume, "\\secret\\other\\"));
+}
+
+static
+VOID
+TestCreateRollback(
+    VOID
+    )
+{
+    static const struct {
+        ULONG Disposition;
+        ULONG_PTR Information;
+        USHORT Major;
+        ULONG Operations;
+        BOOLEAN RolledBack;
+    } table[] = {
+        { FILE_OPEN_IF,      FILE_CREATED,     RuleMajorReadonly,     0,                          TRUE  },
+        { FILE_OPEN_IF,      FILE_OPENED,      RuleMajorReadonly,     0,                          FALSE },
+        { FILE_OPEN_IF,      FILE_CREATED,     RuleMajorReadonly,     FG_RULE_OPERATION_CREATE,   TRUE  },
+        { FILE_OPEN_IF,      FILE_CREATED,     RuleMajorReadonly,     FG_RULE_OPERATION_WRITE,    FALSE },
+        { FILE_OPEN_IF,      FILE_CREATED,     RuleMajorAccessDenied, 0,                          FALSE },
+        { FILE_OPEN_IF,      FILE_CREATED,     RuleMajorNone,         0,                          FALSE },
+        { FILE_CREATE,       FILE_CREATED,     RuleMajorReadonly,     0,                          TRUE  },
+        { FILE_OVERWRITE_IF, FILE_CREATED,     RuleMajorReadonly,     0,                          TRUE  },
+        { FILE_OVERWRITE_IF, FILE_OVERWRITTEN, RuleMajorReadonly,     0,                          FALSE },
+        { FILE_SUPERSEDE,    FILE_CREATED,     RuleMajorReadonly,     0,                          TRUE  },
+        { FILE_SUPERSEDE,    FILE_SUPERSEDED,  RuleMajorReadonly,     0,                          FALSE },
+        { FILE_OPEN,         FILE_OPENED,      RuleMajorReadonly,     0,                          FALSE },
+        { FILE_OVERWRITE,    FILE_OVERWRITTEN, RuleMajorReadonly,     0,                          FALSE },
+    };
+
+    FG_RULE_CODE code = { 0 };
+    ULONG idx = 0, disposition = 0, operations = 0;
+    ULONG_PTR information = 0;
+    USHORT major = 0;
+    BOOLEAN expected = FALSE;
+
+    for (idx = 0; idx < sizeof(table) / sizeof(table[0]); idx++) {
+        code.Major = table[idx].Major;
+        code.Minor = RuleMinorMonitored;
+        CHECK(table[idx].RolledBack == FgcIsCreateRolledBack(table[idx].Disposition,
+                                                             table[idx].Information,
+                                                             code,
+                                                             FG_RULE_COMPILE_OPERATIONS(code, table[idx].Operations)));
+    }
+
+    //
+    // Only a file the open reports as created by a creating disposition is deleted,
+    // and only for a readonly rule enforced on opens.
+    //
+    for (major = 0; major <= RuleMajorMaximum; major++) {
+        code.Major = major;
+        for (operations = 0; operations <= FG_RULE_OPERATIONS_ALL; operations++) {
+            for (disposition = FILE_SUPERSEDE; disposition <= FILE_OVERWRITE_IF; disposition++) {
+                for (information = FILE_SUPERSEDED; information <= FILE_OVERWRITTEN + 2; information++) {
+                    expected = RuleMajorReadonly == major &&
+                               0 != (FG_RULE_COMPILE_OPERATIONS(code, operations) & FG_RULE_OPERATION_CREATE) &&
+                               FILE_CREATED == information &&
+                               FILE_OPEN != disposition && FILE_OVERWRITE != disposition;
+                    CHECK(expected == FgcIsCreateRolledBack(disposition,
+                                                            information,
+                                                            code,
+                                                            FG_RULE_COMPILE_OPERATIONS(code, operations)));
+                }
+            }
+        }
+    }
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestCachedVerdict();
+    TestNoDowngrade();
+    TestDeferredCreateMatch();
+    TestParentDirectory();
+    TestCreateRollback();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All create decision checks passed\n");
+    return EXIT_SUCCESS;
+}
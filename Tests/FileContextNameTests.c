@@ -0,0 +1,271 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    FileContextNameTests.c
+
+Abstract:
+
+    Tests of the names kept by the file contexts. A name is a single allocation
+    independent of the name it was copied from, a stream keeps the name of the
+    first open which sets it, and the memory the contexts take is counted.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "HostShim.h"
+#include "FileContextName.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+#define NAME_CHARS 128
+
+//
+// Sizes given for a file context and its coalesced events, the average adds the
+// names kept and the coalesced events allocated to the contexts.
+//
+#define CONTEXT_SIZE   32
+#define COALESCED_SIZE 96
+
+static
+PUNICODE_STRING
+CopyName(
+    _In_ const char *Text
+    )
+{
+    WCHAR buffer[NAME_CHARS] = { 0 };
+    UNICODE_STRING name = { 0 };
+    PVOID allocation = NULL;
+
+    HostInitUnicodeString(&name, buffer, Text);
+
+    allocation = malloc(FG_FILE_CONTEXT_NAME_SIZE(name.Length));
+    if (NULL == allocation) abort();
+
+    return FgcInitializeFileContextName(allocation, &name);
+}
+
+static
+VOID
+TestLayout(
+    VOID
+    )
+{
+    WCHAR buffer[NAME_CHARS] = { 0 }, expectedBuffer[NAME_CHARS] = { 0 };
+    UNICODE_STRING name = { 0 }, expected = { 0 };
+    PUNICODE_STRING copy = NULL;
+    PUCHAR allocation = NULL;
+
+    HostInitUnicodeString(&name, buffer, "\\Device\\HarddiskVolume2\\Logs\\app.log");
+    HostInitUnicodeString(&expected, expectedBuffer, "\\Device\\HarddiskVolume2\\Logs\\app.log");
+
+    allocation = malloc(FG_FILE_CONTEXT_NAME_SIZE(name.Length));
+    CHECK(NULL != allocation);
+    if (NULL == allocation) return;
+
+    copy = FgcInitializeFileContextName(allocation, &name);
+
+    //
+    // The header and the characters share the allocation, the length is the one
+    // of the name and nothing is left unused.
+    //
+    CHECK((PVOID)copy == (PVOID)allocation);
+    CHECK((PUCHAR)copy->Buffer == allocation + sizeof(UNICODE_STRING));
+    CHECK(copy->Length == name.Length);
+    CHECK(copy->MaximumLength == name.Length);
+    CHECK((PUCHAR)copy->Buffer + copy->MaximumLength == allocation + FG_FILE_CONTEXT_NAME_SIZE(name.Length));
+
+    //
+    // The copy does not refer to the name it was copied from.
+    //
+    memset(buffer, 0, sizeof(buffer));
+    CHECK(RtlEqualUnicodeString(copy, &expected, FALSE));
+
+    free(allocation);
+}
+
+static
+VOID
+TestPublishOnce(
+    VOID
+    )
+{
+    FGC_FILE_CONTEXT_STATISTICS statistics = { 0 };
+    PUNICODE_STRING volatile slot = NULL;
+    PUNICODE_STRING first = CopyName("\\Device\\HarddiskVolume2\\Data\\a.txt");
+    PUNICODE_STRING second = CopyName("\\Device\\HarddiskVolume2\\Data\\A.TXT");
+
+    CHECK(FgcPublishFileContextName(&slot, first, &statistics));
+    CHECK(first == slot);
+
+    //
+    // A later open of the stream keeps the name of the first one, its copy is not
+    // counted.
+    //
+    CHECK(!FgcPublishFileContextName(&slot, second, &statistics));
+    CHECK(first == slot);
+
+    CHECK(1 == statistics.Names);
+    CHECK((LONG64)FG_FILE_CONTEXT_NAME_SIZE(first->Length) == statistics.NameBytes);
+
+    free(second);
+    free(first);
+}
+
+static
+VOID
+TestAverageSize(
+    VOID
+    )
+{
+    FGC_FILE_CONTEXT_STATISTICS statistics = { 0 };
+    PUNICODE_STRING volatile slots[4] = { NULL };
+    PUNICODE_STRING names[2] = { NULL };
+    LONG64 nameBytes = 0;
+
+    CHECK(0 == FgcGetAverageFileContextSize(&statistics, CONTEXT_SIZE, COALESCED_SIZE));
+
+    //
+    // Four contexts, two of them matched by their name.
+    //
+    statistics.Contexts = 4;
+    names[0] = CopyName("\\Device\\HarddiskVolume2\\Data\\a.txt");
+    names[1] = CopyName("\\Device\\HarddiskVolume3\\Very\\Long\\Directory\\Path\\b.txt");
+    CHECK(FgcPublishFileContextName(&slots[0], names[0], &statistics));
+    CHECK(FgcPublishFileContextName(&slots[2], names[1], &statistics));
+
+    nameBytes = (LONG64)(FG_FILE_CONTEXT_NAME_SIZE(names[0]->Length) + FG_FILE_CONTEXT_NAME_SIZE(names[1]->Length));
+    CHECK(2 == statistics.Names);
+    CHECK(nameBytes == statistics.NameBytes);
+    CHECK((4 * CONTEXT_SIZE + nameBytes) / 4 == FgcGetAverageFileContextSize(&statistics, CONTEXT_SIZE, COALESCED_SIZE));
+
+    //
+    // Only the contexts of monitored files carry coalesced events.
+    //
+    statistics.CoalescedEvents = 1;
+    CHECK((4 * CONTEXT_SIZE + nameBytes + COALESCED_SIZE) / 4 ==
+          FgcGetAverageFileContextSize(&statistics, CONTEXT_SIZE, COALESCED_SIZE));
+
+    free(names[1]);
+    free(names[0]);
+}
+
+#ifndef _WIN32
+
+#define PUBLISHERS 8
+
+static PUNICODE_STRING volatile SharedSlot = NULL;
+static FGC_FILE_CONTEXT_STATISTICS SharedStatistics = { 0 };
+
+static
+void *
+PublisherRoutine(
+    void *Parameter
+    )
+{
+    PUNICODE_STRING name = (PUNICODE_STRING)Parameter;
+
+    return FgcPublishFileContextName(&SharedSlot, name, &SharedStatistics) ? name : NULL;
+}
+
+static
+VOID
+TestConcurrentPublish(
+    VOID
+    )
+{
+    pthread_t publishers[PUBLISHERS];
+    PUNICODE_STRING names[PUBLISHERS] = { NULL };
+    void *published = NULL;
+    ULONG idx = 0, winners = 0;
+
+    for (idx = 0; idx < PUBLISHERS; idx++) {
+        names[idx] = CopyName("\\Device\\HarddiskVolume2\\Logs\\app.log");
+    }
+
+    for (idx = 0; idx < PUBLISHERS; idx++) {
+        CHECK(0 == pthread_create(&publishers[idx], NULL, PublisherRoutine, names[idx]));
+    }
+
+    //
+    // The opens of a stream race to set its name, exactly one of them wins and the
+    // stream keeps a single name.
+    //
+    for (idx = 0; idx < PUBLISHERS; idx++) {
+        CHECK(0 == pthread_join(publishers[idx], &published));
+        if (NULL != published) {
+            CHECK(published == SharedSlot);
+            winners++;
+        }
+    }
+
+    CHECK(1 == winners);
+    CHECK(1 == SharedStatistics.Names);
+    CHECK((LONG64)FG_FILE_CONTEXT_NAME_SIZE(names[0]->Length) == SharedStatistics.NameBytes);
+
+    for (idx = 0; idx < PUBLISHERS; idx++) {
+        free(names[idx]);
+    }
+}
+
+#endif
+
+int
+main(
+    VOID
+    )
+{
+    TestLayout();
+    TestPublishOnce();
+    TestAverageSize();
+#ifndef _WIN32
+    TestConcurrentPublish();
+#endif
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All file context name checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,308 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+Module Name:
+
+    FileIdRuleTableTests.c
+
+Abstract:
+
+    Tests of the file id rule table. Volumes are told apart by the full 64-bit
+    serial number, two volumes whose serial numbers only differ in the high bits
+    must not share their rules, and the file id rules of a volume are counted
+    for it alone. The lookups an open by file id pays are measured as the rules
+    grow.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "HostShim.h"
+
+typedef struct _FGC_RULE {
+    ULONG Id;
+} FGC_RULE;
+
+#include "FileIdRuleTable.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+#define TEST_ENTRIES 4096
+#define BENCHMARK_LOOKUPS 1000000UL
+
+static FGC_FILE_ID_RULE_TABLE Table;
+static FGC_FILE_ID_RULE_ENTRY Entries[TEST_ENTRIES];
+static FGC_RULE Rules[TEST_ENTRIES];
+
+static
+VOID
+InitializeTable(
+    VOID
+    )
+{
+    ULONG idx = 0;
+
+    memset(&Table, 0, sizeof(Table));
+    for (; idx < FG_FILE_ID_RULE_TABLE_BUCKETS; idx++) {
+        InitializeListHead(&Table.Buckets[idx]);
+    }
+}
+
+static
+double
+GetSeconds(
+    VOID
+    )
+{
+    struct timespec now;
+
+    timespec_get(&now, TIME_UTC);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+//
+// A 64-bit file id is zero extended, as the core copies it into the descriptor.
+//
+static
+FILE_ID_128
+MakeFileId(
+    _In_ ULONGLONG FileId64
+    )
+{
+    FILE_ID_128 fileId;
+
+    memset(&fileId, 0, sizeof(fileId));
+    memcpy(fileId.Identifier, &FileId64, sizeof(FileId64));
+
+    return fileId;
+}
+
+static
+PFGC_FILE_ID_RULE_ENTRY
+SetupEntry(
+    _In_ ULONG Index,
+    _In_ ULONGLONG VolumeSerialNumber,
+    _In_ ULONGLONG FileId64
+    )
+{
+    PFGC_FILE_ID_RULE_ENTRY entry = &Entries[Index];
+
+    memset(entry, 0, sizeof(*entry));
+    entry->VolumeSerialNumber = VolumeSerialNumber;
+    entry->FileId = MakeFileId(FileId64);
+    entry->Rule = &Rules[Index];
+    Rules[Index].Id = Index + 1;
+
+    return entry;
+}
+
+static
+VOID
+TestHighSerialBits(
+    VOID
+    )
+{
+    const ULONGLONG volume1 = 0x0000000112345678ull, volume2 = 0x0000000212345678ull;
+    FILE_ID_128 fileId = MakeFileId(0x50000000000123ull);
+    PFGC_FILE_ID_RULE_ENTRY entry = NULL;
+
+    InitializeTable();
+
+    //
+    // The same file id on two volumes with the same low serial number bits are
+    // two rules.
+    //
+    CHECK(FgcInsertFileIdRuleEntry(&Table, SetupEntry(0, volume1, 0x50000000000123ull)));
+    CHECK(NULL == FgcLookupFileIdRuleEntry(&Table, volume2, &fileId));
+    CHECK(NULL == FgcLookupFileIdRuleEntry(&Table, (ULONG)volume1, &fileId));
+
+    CHECK(FgcInsertFileIdRuleEntry(&Table, SetupEntry(1, volume2, 0x50000000000123ull)));
+    CHECK(2 == Table.RulesAmount);
+
+    entry = FgcLookupFileIdRuleEntry(&Table, volume1, &fileId);
+    CHECK(NULL != entry && 1 == entry->Rule->Id);
+    entry = FgcLookupFileIdRuleEntry(&Table, volume2, &fileId);
+    CHECK(NULL != entry && 2 == entry->Rule->Id);
+
+    CHECK(1 == FgcCountFileIdRuleEntries(&Table, volume1));
+    CHECK(1 == FgcCountFileIdRuleEntries(&Table, volume2));
+    CHECK(0 == FgcCountFileIdRuleEntries(&Table, (ULONG)volume1));
+
+    //
+    // A file has one rule at most.
+    //
+    CHECK(!FgcInsertFileIdRuleEntry(&Table, SetupEntry(2, volume1, 0x50000000000123ull)));
+    CHECK(2 == Table.RulesAmount);
+
+    //
+    // A removed rule is not found any more, the rule of the other volume is.
+    //
+    entry = FgcLookupFileIdRuleEntry(&Table, volume1, &fileId);
+    RemoveEntryList(&entry->List);
+    InterlockedDecrement(&Table.RulesAmount);
+    CHECK(NULL == FgcLookupFileIdRuleEntry(&Table, volume1, &fileId));
+    CHECK(NULL != FgcLookupFileIdRuleEntry(&Table, volume2, &fileId));
+    CHECK(0 == FgcCountFileIdRuleEntries(&Table, volume1));
+}
+
+static
+VOID
+TestVolumeCounts(
+    VOID
+    )
+{
+    static const ULONGLONG volumes[] = {
+        0x1C2D3E4F12345678ull, 0x2C2D3E4F12345678ull, 0x00000000DEADBEEFull, 0ull
+    };
+    FILE_ID_128 fileId;
+    LONG counts[4] = { 0 };
+    ULONG idx = 0, usedBuckets = 0;
+
+    InitializeTable();
+
+    for (idx = 0; idx < 1024; idx++) {
+        CHECK(FgcInsertFileIdRuleEntry(&Table, SetupEntry(idx, volumes[idx % 4], 0x10000ull + idx / 4)));
+        counts[idx % 4]++;
+    }
+
+    CHECK(1024 == Table.RulesAmount);
+
+    for (idx = 0; idx < 4; idx++) {
+        CHECK(counts[idx] == FgcCountFileIdRuleEntries(&Table, volumes[idx]));
+    }
+
+    CHECK(0 == FgcCountFileIdRuleEntries(&Table, 0x3C2D3E4F12345678ull));
+
+    for (idx = 0; idx < 1024; idx++) {
+        fileId = MakeFileId(0x10000ull + idx / 4);
+        CHECK(&Entries[idx] == FgcLookupFileIdRuleEntry(&Table, volumes[idx % 4], &fileId));
+    }
+
+    //
+    // Consecutive file ids are spread over the buckets.
+    //
+    for (idx = 0; idx < FG_FILE_ID_RULE_TABLE_BUCKETS; idx++) {
+        if (!IsListEmpty(&Table.Buckets[idx])) usedBuckets++;
+    }
+
+    CHECK(usedBuckets >= FG_FILE_ID_RULE_TABLE_BUCKETS * 3 / 4);
+}
+
+//
+// Look up the file ids of opens in tables of growing amounts of rules, half of the
+// opens are of files with a rule. NTFS file ids carry the sequence number in their
+// high 16 bits and the file record number below, the records of the ruled files
+// are scattered over two volumes. The misses are of files past the records of the
+// ruled ones.
+//
+static
+VOID
+BenchmarkLookups(
+    VOID
+    )
+{
+    static const ULONG rulesAmounts[] = { 16, 256, 1024, TEST_ENTRIES };
+    static const ULONGLONG volumes[] = { 0x1C2D3E4F12345678ull, 0x2C2D3E4F12345678ull };
+    FILE_ID_128 fileId;
+    PLIST_ENTRY listEntry = NULL;
+    ULONG seed = 31, amountIdx = 0, rulesAmount = 0, idx = 0, hits = 0, longest = 0, chain = 0;
+    ULONG64 fileId64 = 0;
+    double start = 0.0, seconds = 0.0;
+
+    printf("rules    lookups/s   hits  longest chain\n");
+
+    for (amountIdx = 0; amountIdx < sizeof(rulesAmounts) / sizeof(rulesAmounts[0]); amountIdx++) {
+
+        rulesAmount = rulesAmounts[amountIdx];
+
+        InitializeTable();
+        for (idx = 0; idx < rulesAmount; idx++) {
+            seed = seed * 1103515245UL + 12345UL;
+            fileId64 = ((ULONG64)(1 + idx % 7) << 48) | ((ULONG64)idx * 977 + (seed >> 8) % 977);
+            CHECK(FgcInsertFileIdRuleEntry(&Table, SetupEntry(idx, volumes[idx % 2], fileId64)));
+        }
+
+        longest = 0;
+        for (idx = 0; idx < FG_FILE_ID_RULE_TABLE_BUCKETS; idx++) {
+            chain = 0;
+            for (listEntry = Table.Buckets[idx].Flink; listEntry != &Table.Buckets[idx]; listEntry = listEntry->Flink) {
+                chain++;
+            }
+            if (chain > longest) longest = chain;
+        }
+
+        hits = 0;
+        start = GetSeconds();
+
+        for (idx = 0; idx < BENCHMARK_LOOKUPS; idx++) {
+            if (0 == idx % 2) {
+                fileId = Entries[(idx / 2) % rulesAmount].FileId;
+            } else {
+                fileId = MakeFileId(((ULONG64)8 << 48) | ((ULONG64)TEST_ENTRIES * 977 + idx));
+            }
+
+            if (NULL != FgcLookupFileIdRuleEntry(&Table, volumes[(idx / 2) % rulesAmount % 2], &fileId)) hits++;
+        }
+
+        seconds = GetSeconds() - start;
+        if (seconds <= 0.0) seconds = 1e-9;
+
+        CHECK(BENCHMARK_LOOKUPS / 2 == hits);
+
+        printf("%5lu %12.0f %6.2f %14lu\n",
+               (unsigned long)rulesAmount, BENCHMARK_LOOKUPS / seconds,
+               (double)hits / BENCHMARK_LOOKUPS, (unsigned long)longest);
+    }
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestHighSerialBits();
+    TestVolumeCounts();
+    BenchmarkLookups();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All file id rule table checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,411 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    HandleSummaryTests.c
+
+Abstract:
+
+    Tests of the handle summaries recorded on IRP_MJ_CLEANUP. The requests of a
+    handle are counted the way the write and set information callbacks do, by many
+    threads at once, and the summary record is carried by both record encodings.
+    The records a busy handle saves are measured against recording its requests
+    one by one.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "HostShim.h"
+#include "FileGuard.h"
+#include "FileGuardCodec.h"
+#include "HandleSummary.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+#define RECORD_BUFFER_SIZE (sizeof(FG_MONITOR_RECORD) + 512 * sizeof(WCHAR))
+#define CODED_BUFFER_SIZE  (64 * 1024)
+#define THREADS_AMOUNT     8
+#define THREAD_REQUESTS    20000
+
+typedef union _RECORD_STORAGE {
+    FG_MONITOR_RECORD Record;
+    UCHAR Buffer[RECORD_BUFFER_SIZE];
+} RECORD_STORAGE;
+
+static FG_MONITOR_HANDLE_SUMMARY SharedSummary;
+static RECORD_STORAGE Decoded;
+static UCHAR Coded[CODED_BUFFER_SIZE];
+
+static
+VOID
+SetRecordPath(
+    _Inout_ FG_MONITOR_RECORD *Record,
+    _In_ CONST char *FilePath
+    )
+{
+    size_t idx = 0, chars = strlen(FilePath);
+
+    for (idx = 0; idx < chars; idx++) Record->Buffer[idx] = (WCHAR)FilePath[idx];
+
+    Record->FilePathSize = (USHORT)(chars * sizeof(WCHAR));
+}
+
+//
+// A request of a summarized handle, counted as the callbacks count it: the writes
+// by FgcPreWriteCallback, the renames, truncates and deletes by
+// FgcPreSetInformationCallback, and the requests the rule fails as denied too.
+//
+static
+VOID
+CountRequest(
+    _Inout_ PFG_MONITOR_HANDLE_SUMMARY Summary,
+    _In_ ULONG Thread,
+    _In_ ULONG Request
+    )
+{
+    switch (Request % 8) {
+    case 0:
+    case 1:
+    case 2:
+        FgcCountHandleWrite(Summary, (Thread + 1) * 512 + Request % 4096);
+        break;
+    case 3:
+        FgcCountHandleOperation(Summary, FG_RULE_OPERATION_RENAME);
+        break;
+    case 4:
+        FgcCountHandleOperation(Summary, FG_RULE_OPERATION_TRUNCATE);
+        break;
+    case 5:
+        FgcCountHandleOperation(Summary, FG_RULE_OPERATION_DELETE);
+        break;
+    case 6:
+        FgcCountHandleOperation(Summary, FG_RULE_OPERATION_RENAME);
+        FgcCountHandleDenied(Summary);
+        break;
+    default:
+        FgcCountHandleWrite(Summary, 0);
+        FgcCountHandleDenied(Summary);
+        break;
+    }
+}
+
+static
+VOID
+TestCountedRequests(
+    VOID
+    )
+{
+    FG_MONITOR_HANDLE_SUMMARY summary = { 0 };
+
+    CHECK(FgcIsHandleSummaryEmpty(&summary));
+
+    //
+    // Deletes and the other classes are not summarized, the handle only has its
+    // open recorded.
+    //
+    FgcCountHandleOperation(&summary, FG_RULE_OPERATION_DELETE);
+    FgcCountHandleOperation(&summary, FG_RULE_OPERATION_FSCTL);
+    FgcCountHandleOperation(&summary, FG_RULE_OPERATION_CREATE);
+    CHECK(FgcIsHandleSummaryEmpty(&summary));
+
+    //
+    // A write of no byte is a request of the handle all the same.
+    //
+    FgcCountHandleWrite(&summary, 0);
+    CHECK(!FgcIsHandleSummaryEmpty(&summary));
+    CHECK(1 == summary.Writes);
+    CHECK(0 == summary.WriteBytes);
+
+    //
+    // The bytes written through a handle pass 4GB.
+    //
+    FgcCountHandleWrite(&summary, 0xFFFFFFFFUL);
+    FgcCountHandleWrite(&summary, 0xFFFFFFFFUL);
+    CHECK(3 == summary.Writes);
+    CHECK(0x1FFFFFFFEULL == summary.WriteBytes);
+
+    FgcCountHandleOperation(&summary, FG_RULE_OPERATION_RENAME);
+    FgcCountHandleOperation(&summary, FG_RULE_OPERATION_TRUNCATE);
+    FgcCountHandleOperation(&summary, FG_RULE_OPERATION_TRUNCATE);
+    FgcCountHandleDenied(&summary);
+    CHECK(1 == summary.Renames);
+    CHECK(2 == summary.Truncates);
+    CHECK(1 == summary.Denied);
+    CHECK(3 == summary.Writes);
+
+    //
+    // Each counter alone makes the summary worth a record.
+    //
+    memset(&summary, 0, sizeof(summary));
+    FgcCountHandleOperation(&summary, FG_RULE_OPERATION_TRUNCATE);
+    CHECK(!FgcIsHandleSummaryEmpty(&summary));
+
+    memset(&summary, 0, sizeof(summary));
+    FgcCountHandleOperation(&summary, FG_RULE_OPERATION_RENAME);
+    CHECK(!FgcIsHandleSummaryEmpty(&summary));
+
+    memset(&summary, 0, sizeof(summary));
+    FgcCountHandleDenied(&summary);
+    CHECK(!FgcIsHandleSummaryEmpty(&summary));
+}
+
+#ifndef _WIN32
+
+static
+void*
+RequestorRoutine(
+    void *Parameter
+    )
+{
+    ULONG thread = (ULONG)(ULONG_PTR)Parameter, request = 0;
+
+    for (request = 0; request < THREAD_REQUESTS; request++) {
+        CountRequest(&SharedSummary, thread, request);
+    }
+
+    return NULL;
+}
+
+static
+VOID
+TestConcurrentRequests(
+    VOID
+    )
+{
+    pthread_t threads[THREADS_AMOUNT];
+    FG_MONITOR_HANDLE_SUMMARY expected = { 0 };
+    ULONG thread = 0, request = 0;
+
+    //
+    // The threads of a process share a handle, the counters must not lose any of
+    // their requests.
+    //
+    memset(&SharedSummary, 0, sizeof(SharedSummary));
+
+    for (thread = 0; thread < THREADS_AMOUNT; thread++) {
+        CHECK(0 == pthread_create(&threads[thread], NULL, RequestorRoutine, (void*)(ULONG_PTR)thread));
+    }
+
+    for (thread = 0; thread < THREADS_AMOUNT; thread++) {
+        CHECK(0 == pthread_join(threads[thread], NULL));
+    }
+
+    for (thread = 0; thread < THREADS_AMOUNT; thread++) {
+        for (request = 0; request < THREAD_REQUESTS; request++) {
+            CountRequest(&expected, thread, request);
+        }
+    }
+
+    CHECK(THREADS_AMOUNT * THREAD_REQUESTS / 2 == expected.Writes);
+    CHECK(expected.Writes == SharedSummary.Writes);
+    CHECK(expected.WriteBytes == SharedSummary.WriteBytes);
+    CHECK(expected.Renames == SharedSummary.Renames);
+    CHECK(expected.Truncates == SharedSummary.Truncates);
+    CHECK(expected.Denied == SharedSummary.Denied);
+}
+
+#endif
+
+static
+VOID
+BuildSummaryRecord(
+    _Out_ RECORD_STORAGE *Storage,
+    _In_ CONST FG_MONITOR_HANDLE_SUMMARY *Summary
+    )
+{
+    FG_MONITOR_RECORD *record = &Storage->Record;
+
+    memset(Storage, 0, sizeof(RECORD_STORAGE));
+
+    //
+    // As FgcRecordHandleSummary lays out the record of a closed handle.
+    //
+    record->MajorFunction = IRP_MJ_CLEANUP;
+    record->RequestorPid = 4000;
+    record->RequestorTid = 4004;
+    record->RecordTime.QuadPart = 133000000000000000LL;
+    record->LastRecordTime = record->RecordTime;
+    record->RepeatCount = 1;
+    record->RuleCode.Major = RuleMajorReadonly;
+    record->RuleCode.Minor = RuleMinorMonitored;
+    record->RuleId = 12;
+    memcpy(&record->Summary, Summary, sizeof(FG_MONITOR_HANDLE_SUMMARY));
+    SetRecordPath(record, "\\Device\\HarddiskVolume3\\Users\\user0\\Documents\\report.docx");
+}
+
+static
+VOID
+TestSummaryRecord(
+    VOID
+    )
+{
+    FG_MONITOR_COMPACT_STATE state = { 0 };
+    FG_MONITOR_HANDLE_SUMMARY summary = { 0 };
+    RECORD_STORAGE storage;
+    ULONG size = 0, consumed = 0, request = 0;
+
+    for (request = 0; request < 1000; request++) CountRequest(&summary, 3, request);
+    FgcCountHandleWrite(&summary, 0xFFFFFFFFUL);
+
+    BuildSummaryRecord(&storage, &summary);
+
+    //
+    // The record encoding carries the summary in place, the compact one behind
+    // its presence flag.
+    //
+    size = FgEncodeMonitorRecord(&state, &storage.Record, Coded);
+    CHECK(0 != (Coded[0] & FG_MONITOR_COMPACT_SUMMARY));
+
+    FgResetMonitorCompactState(&state);
+    CHECK(FgDecodeMonitorRecord(&state, Coded, size, &consumed, &Decoded.Record, sizeof(Decoded)));
+    CHECK(size == consumed);
+    CHECK(0 == memcmp(&summary, &Decoded.Record.Summary, sizeof(FG_MONITOR_HANDLE_SUMMARY)));
+    CHECK(IRP_MJ_CLEANUP == Decoded.Record.MajorFunction);
+    CHECK(storage.Record.FilePathSize == Decoded.Record.FilePathSize);
+
+    //
+    // The records of the other requests carry no summary at all.
+    //
+    memset(&summary, 0, sizeof(summary));
+    BuildSummaryRecord(&storage, &summary);
+    storage.Record.MajorFunction = IRP_MJ_WRITE;
+
+    FgResetMonitorCompactState(&state);
+    size = FgEncodeMonitorRecord(&state, &storage.Record, Coded);
+    CHECK(0 == (Coded[0] & FG_MONITOR_COMPACT_SUMMARY));
+
+    FgResetMonitorCompactState(&state);
+    CHECK(FgDecodeMonitorRecord(&state, Coded, size, &consumed, &Decoded.Record, sizeof(Decoded)));
+    CHECK(0 == memcmp(&summary, &Decoded.Record.Summary, sizeof(FG_MONITOR_HANDLE_SUMMARY)));
+}
+
+//
+// A handle writing a file in chunks is recorded once opened and once closed when
+// summarized, rather than once per request. Report the records and bytes either
+// way for growing amounts of requests.
+//
+static
+VOID
+ReportRecordVolume(
+    VOID
+    )
+{
+    static CONST ULONG requestsAmounts[] = { 10, 100, 1000, 10000 };
+    FG_MONITOR_COMPACT_STATE state = { 0 };
+    FG_MONITOR_HANDLE_SUMMARY summary = { 0 };
+    RECORD_STORAGE storage;
+    ULONG amountIdx = 0, request = 0, records = 0;
+    unsigned long long recordBytes = 0, compactBytes = 0, summaryRecordBytes = 0, summaryCompactBytes = 0;
+
+    printf("requests  records  summarized  record bytes  summarized  compact bytes  summarized\n");
+
+    for (amountIdx = 0; amountIdx < sizeof(requestsAmounts) / sizeof(requestsAmounts[0]); amountIdx++) {
+
+        memset(&summary, 0, sizeof(summary));
+        recordBytes = 0;
+        compactBytes = 0;
+        records = 1;
+
+        //
+        // Without the summaries, the open and each counted request are recorded, in
+        // batches of 64 records.
+        //
+        BuildSummaryRecord(&storage, &summary);
+        storage.Record.MajorFunction = IRP_MJ_CREATE;
+        recordBytes += sizeof(FG_MONITOR_RECORD) + storage.Record.FilePathSize;
+        FgResetMonitorCompactState(&state);
+        compactBytes += FgEncodeMonitorRecord(&state, &storage.Record, NULL);
+
+        for (request = 0; request < requestsAmounts[amountIdx]; request++) {
+            CountRequest(&summary, 0, request);
+            if (5 == request % 8) continue;
+
+            storage.Record.MajorFunction = request % 8 < 3 || 7 == request % 8 ? IRP_MJ_WRITE : IRP_MJ_SET_INFORMATION;
+            storage.Record.RecordTime.QuadPart += 1000;
+            storage.Record.LastRecordTime = storage.Record.RecordTime;
+
+            if (0 == records % 64) FgResetMonitorCompactState(&state);
+            recordBytes += sizeof(FG_MONITOR_RECORD) + storage.Record.FilePathSize;
+            compactBytes += FgEncodeMonitorRecord(&state, &storage.Record, NULL);
+            records++;
+        }
+
+        //
+        // With them, the open and the summary on cleanup.
+        //
+        BuildSummaryRecord(&storage, &summary);
+        summaryRecordBytes = 2 * (sizeof(FG_MONITOR_RECORD) + storage.Record.FilePathSize);
+        FgResetMonitorCompactState(&state);
+        summaryCompactBytes = FgEncodeMonitorRecord(&state, &storage.Record, NULL);
+        storage.Record.MajorFunction = IRP_MJ_CREATE;
+        memset(&storage.Record.Summary, 0, sizeof(FG_MONITOR_HANDLE_SUMMARY));
+        FgResetMonitorCompactState(&state);
+        summaryCompactBytes += FgEncodeMonitorRecord(&state, &storage.Record, NULL);
+
+        CHECK(summaryCompactBytes < compactBytes);
+
+        printf("%8lu %8lu %11d %13llu %11llu %14llu %11llu\n",
+               (unsigned long)requestsAmounts[amountIdx], (unsigned long)records, 2,
+               recordBytes, summaryRecordBytes, compactBytes, summaryCompactBytes);
+    }
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestCountedRequests();
+#ifndef _WIN32
+    TestConcurrentRequests();
+#endif
+    TestSummaryRecord();
+    ReportRecordVolume();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All handle summary checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,521 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    HostShim.h
+
+Abstract:
+
+    The Windows types and primitives the headers of Include/ and the pure headers
+    of FileGuardCore are built on, so the logic declared there can be tested on
+    any host.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#ifndef __HOST_SHIM_H__
+#define __HOST_SHIM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <winternl.h>
+#include <fltUser.h>
+
+typedef PVOID PEX_PUSH_LOCK;
+
+#define KeMemoryBarrier() MemoryBarrier()
+
+#ifndef NT_SUCCESS
+#define NT_SUCCESS(_status_) ((NTSTATUS)(_status_) >= 0)
+#endif
+
+#ifndef STATUS_PORT_DISCONNECTED
+#define STATUS_PORT_DISCONNECTED ((NTSTATUS)0xC0000037L)
+#endif
+
+#ifndef FlagOn
+#define FlagOn(_flags_, _single_flag_) ((_flags_) & (_single_flag_))
+#endif
+
+#else
+
+typedef void VOID;
+typedef unsigned char UCHAR, *PUCHAR;
+typedef UCHAR BOOLEAN;
+typedef uint16_t USHORT;
+typedef uint16_t WCHAR, *PWCHAR;
+typedef int32_t LONG;
+typedef uint32_t ULONG, *PULONG;
+typedef int64_t LONGLONG, LONG64;
+typedef uint64_t ULONGLONG, ULONG64;
+typedef uintptr_t ULONG_PTR;
+typedef size_t SIZE_T;
+typedef void *PVOID, *HANDLE, *PEX_PUSH_LOCK;
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY *Flink;
+    struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCHAR Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef const UNICODE_STRING *PCUNICODE_STRING;
+
+typedef union _LARGE_INTEGER {
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _FILE_ID_128 {
+    UCHAR Identifier[16];
+} FILE_ID_128;
+
+typedef struct _FILTER_MESSAGE_HEADER {
+    ULONG ReplyLength;
+    ULONGLONG MessageId;
+} FILTER_MESSAGE_HEADER;
+
+typedef ULONG DEVICE_TYPE;
+
+#define FILE_DEVICE_CD_ROM_FILE_SYSTEM  0x00000003
+#define FILE_DEVICE_DISK_FILE_SYSTEM    0x00000008
+#define FILE_DEVICE_NETWORK_FILE_SYSTEM 0x00000014
+#define FILE_DEVICE_VIRTUAL_DISK        0x00000024
+
+typedef enum _FLT_FILESYSTEM_TYPE {
+    FLT_FSTYPE_UNKNOWN,
+    FLT_FSTYPE_RAW,
+    FLT_FSTYPE_NTFS,
+    FLT_FSTYPE_FAT,
+    FLT_FSTYPE_CDFS,
+    FLT_FSTYPE_UDFS,
+    FLT_FSTYPE_LANMAN,
+    FLT_FSTYPE_WEBDAV,
+    FLT_FSTYPE_RDPDR,
+    FLT_FSTYPE_NFS,
+    FLT_FSTYPE_MS_NETWARE,
+    FLT_FSTYPE_NETWARE,
+    FLT_FSTYPE_BSUDF,
+    FLT_FSTYPE_MUP,
+    FLT_FSTYPE_RSFX,
+    FLT_FSTYPE_ROXIO_UDF1,
+    FLT_FSTYPE_ROXIO_UDF2,
+    FLT_FSTYPE_ROXIO_UDF3,
+    FLT_FSTYPE_TACIT,
+    FLT_FSTYPE_FS_REC,
+    FLT_FSTYPE_INCD,
+    FLT_FSTYPE_INCD_FAT,
+    FLT_FSTYPE_EXFAT,
+    FLT_FSTYPE_PSFS,
+    FLT_FSTYPE_GPFS,
+    FLT_FSTYPE_NPFS,
+    FLT_FSTYPE_MSFS,
+    FLT_FSTYPE_CSVFS,
+    FLT_FSTYPE_REFS
+} FLT_FILESYSTEM_TYPE;
+
+#define TRUE  1
+#define FALSE 0
+
+#define FILE_READ_DATA        0x00000001
+#define FILE_WRITE_DATA       0x00000002
+#define FILE_APPEND_DATA      0x00000004
+#define FILE_READ_EA          0x00000008
+#define FILE_WRITE_EA         0x00000010
+#define FILE_EXECUTE          0x00000020
+#define FILE_READ_ATTRIBUTES  0x00000080
+#define FILE_WRITE_ATTRIBUTES 0x00000100
+#define DELETE                0x00010000
+#define READ_CONTROL          0x00020000
+#define WRITE_DAC             0x00040000
+#define WRITE_OWNER           0x00080000
+#define SYNCHRONIZE           0x00100000
+#define MAXIMUM_ALLOWED       0x02000000
+#define GENERIC_ALL           0x10000000
+#define GENERIC_EXECUTE       0x20000000
+#define GENERIC_WRITE         0x40000000
+#define GENERIC_READ          0x80000000
+#define CONST const
+#define FORCEINLINE static inline
+#define MAXUSHORT 0xffff
+#define MAXULONG  0xffffffffUL
+#define FIELD_OFFSET(_type_, _field_) offsetof(_type_, _field_)
+#define CONTAINING_RECORD(_address_, _type_, _field_) ((_type_*)((char*)(_address_) - offsetof(_type_, _field_)))
+#define RtlCopyMemory(_destination_, _source_, _length_) memcpy((_destination_), (_source_), (_length_))
+#define RtlZeroMemory(_destination_, _length_) memset((_destination_), 0, (_length_))
+#define RtlEqualMemory(_destination_, _source_, _length_) (0 == memcmp((_destination_), (_source_), (_length_)))
+
+#ifndef min
+#define min(_a_, _b_) ((_a_) < (_b_) ? (_a_) : (_b_))
+#endif
+
+#define FlagOn(_flags_, _single_flag_) ((_flags_) & (_single_flag_))
+
+//
+// The interlocked primitives are the compiler atomics, with the kernel ordering.
+//
+#define __volatile volatile
+
+#define InterlockedIncrement(_target_) __extension__({ __atomic_add_fetch((_target_), 1, __ATOMIC_SEQ_CST); })
+#define InterlockedDecrement(_target_) __extension__({ __atomic_sub_fetch((_target_), 1, __ATOMIC_SEQ_CST); })
+#define InterlockedExchange(_target_, _value_) \
+    __extension__({ __atomic_exchange_n((_target_), (_value_), __ATOMIC_SEQ_CST); })
+#define InterlockedExchange64 InterlockedExchange
+#define InterlockedExchangePointer InterlockedExchange
+#define InterlockedIncrement64 InterlockedIncrement
+#define InterlockedAdd64(_target_, _value_) __extension__({ __atomic_add_fetch((_target_), (_value_), __ATOMIC_SEQ_CST); })
+#define InterlockedCompareExchange64(_target_, _exchange_, _comparand_) \
+    __extension__({ LONG64 _comparand = (_comparand_); \
+                    __atomic_compare_exchange_n((_target_), &_comparand, (_exchange_), 0, \
+                                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+                    _comparand; })
+#define InterlockedCompareExchangePointer(_target_, _exchange_, _comparand_) \
+    __extension__({ PVOID _comparand = (_comparand_); \
+                    __atomic_compare_exchange_n((_target_), &_comparand, (PVOID)(_exchange_), 0, \
+                                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+                    _comparand; })
+#define ReadAcquire(_source_) __atomic_load_n((_source_), __ATOMIC_ACQUIRE)
+#define ReadAcquire64 ReadAcquire
+#define ReadNoFence(_source_) __atomic_load_n((_source_), __ATOMIC_RELAXED)
+#define ReadNoFence64 ReadNoFence
+#define ReadPointerNoFence ReadNoFence
+#define WriteRelease(_destination_, _value_) __atomic_store_n((_destination_), (_value_), __ATOMIC_RELEASE)
+#define WriteRelease64 WriteRelease
+#define KeMemoryBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define YieldProcessor() ((void)0)
+#define DECLSPEC_CACHEALIGN __attribute__((aligned(64)))
+
+static inline
+BOOLEAN
+BitScanReverse(
+    ULONG *Index,
+    ULONG Mask
+    )
+{
+    if (0UL == Mask) return FALSE;
+
+    *Index = 31UL - (ULONG)__builtin_clz(Mask);
+    return TRUE;
+}
+
+//
+// The statuses of the kernel routines.
+//
+typedef LONG NTSTATUS;
+
+#define STATUS_SUCCESS           ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT           ((NTSTATUS)0x00000102L)
+#define STATUS_PORT_DISCONNECTED ((NTSTATUS)0xC0000037L)
+
+#define NT_SUCCESS(_status_) ((NTSTATUS)(_status_) >= 0)
+
+//
+// The results and the message transport of the user mode library.
+//
+typedef LONG HRESULT;
+typedef uint32_t DWORD, *LPDWORD;
+typedef void *LPVOID;
+
+#define WINAPI
+
+#define S_OK          ((HRESULT)0L)
+#define S_FALSE       ((HRESULT)1L)
+#define E_INVALIDARG  ((HRESULT)0x80070057L)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#define E_FAIL        ((HRESULT)0x80004005L)
+
+#define SUCCEEDED(_hr_) ((HRESULT)(_hr_) >= 0)
+#define FAILED(_hr_)    ((HRESULT)(_hr_) < 0)
+
+#define HRESULT_FROM_WIN32(_error_) \
+    ((HRESULT)(_error_) <= 0 ? (HRESULT)(_error_) : (HRESULT)(((_error_) & 0x0000FFFF) | (7 << 16) | 0x80000000))
+
+#define ERROR_SUCCESS             0L
+#define ERROR_INSUFFICIENT_BUFFER 122L
+
+#define DUMMYSTRUCTNAME
+#define DUMMYUNIONNAME
+
+#define _In_
+#define _Inout_
+#define _Out_
+#define _In_reads_bytes_(_size_)
+#define _Out_writes_bytes_(_size_)
+#define _Inout_updates_bytes_(_size_)
+#define _Out_writes_bytes_opt_(_size_)
+#define _Out_writes_bytes_to_opt_(_size_, _count_)
+#define _Outptr_
+
+#endif
+
+#ifndef ALIGN_UP_BY
+#define ALIGN_UP_BY(_length_, _alignment_) (((ULONG_PTR)(_length_) + (_alignment_) - 1) & ~((ULONG_PTR)(_alignment_) - 1))
+#endif
+
+//
+// Create dispositions and the information a create completes with, only the kernel
+// headers define all of them.
+//
+#ifndef FILE_OPEN_IF
+#define FILE_SUPERSEDE    0x00000000
+#define FILE_OPEN         0x00000001
+#define FILE_CREATE       0x00000002
+#define FILE_OPEN_IF      0x00000003
+#define FILE_OVERWRITE    0x00000004
+#define FILE_OVERWRITE_IF 0x00000005
+#endif
+
+#ifndef FILE_CREATED
+#define FILE_SUPERSEDED   0x00000000
+#define FILE_OPENED       0x00000001
+#define FILE_CREATED      0x00000002
+#define FILE_OVERWRITTEN  0x00000003
+#endif
+
+//
+// The IRP flags, major functions and section parameters the write callbacks decide
+// by, user mode headers define the page protections only.
+//
+#ifndef IRP_PAGING_IO
+#define IRP_NOCACHE               0x00000001
+#define IRP_PAGING_IO             0x00000002
+#define IRP_SYNCHRONOUS_API       0x00000004
+#define IRP_SYNCHRONOUS_PAGING_IO 0x00000040
+#endif
+
+#ifndef IRP_MJ_WRITE
+#define IRP_MJ_CREATE                              0x00
+#define IRP_MJ_READ                                0x03
+#define IRP_MJ_WRITE                               0x04
+#define IRP_MJ_SET_INFORMATION                     0x06
+#define IRP_MJ_CLEANUP                             0x12
+#define IRP_MJ_MAXIMUM_FUNCTION                    0x1b
+#define IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION ((UCHAR)-1)
+#endif
+
+#ifndef SyncTypeCreateSection
+#define SyncTypeOther         0
+#define SyncTypeCreateSection 1
+#endif
+
+#ifndef PAGE_READWRITE
+#define PAGE_NOACCESS          0x01
+#define PAGE_READONLY          0x02
+#define PAGE_READWRITE         0x04
+#define PAGE_WRITECOPY         0x08
+#define PAGE_EXECUTE           0x10
+#define PAGE_EXECUTE_READ      0x20
+#define PAGE_EXECUTE_READWRITE 0x40
+#define PAGE_EXECUTE_WRITECOPY 0x80
+#endif
+
+//
+// The list and string routines of the kernel, user mode has none of them.
+//
+static inline
+VOID
+InitializeListHead(
+    PLIST_ENTRY ListHead
+    )
+{
+    ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+static inline
+BOOLEAN
+IsListEmpty(
+    const LIST_ENTRY *ListHead
+    )
+{
+    return ListHead->Flink == ListHead;
+}
+
+static inline
+VOID
+InsertHeadList(
+    PLIST_ENTRY ListHead,
+    PLIST_ENTRY Entry
+    )
+{
+    Entry->Flink = ListHead->Flink;
+    Entry->Blink = ListHead;
+    ListHead->Flink->Blink = Entry;
+    ListHead->Flink = Entry;
+}
+
+static inline
+VOID
+InsertTailList(
+    PLIST_ENTRY ListHead,
+    PLIST_ENTRY Entry
+    )
+{
+    Entry->Flink = ListHead;
+    Entry->Blink = ListHead->Blink;
+    ListHead->Blink->Flink = Entry;
+    ListHead->Blink = Entry;
+}
+
+static inline
+BOOLEAN
+RemoveEntryList(
+    PLIST_ENTRY Entry
+    )
+{
+    Entry->Blink->Flink = Entry->Flink;
+    Entry->Flink->Blink = Entry->Blink;
+
+    return Entry->Flink == Entry->Blink;
+}
+
+static inline
+PLIST_ENTRY
+RemoveHeadList(
+    PLIST_ENTRY ListHead
+    )
+{
+    PLIST_ENTRY entry = ListHead->Flink;
+
+    RemoveEntryList(entry);
+
+    return entry;
+}
+
+static inline
+WCHAR
+HostUpcaseUnicodeChar(
+    WCHAR Char
+    )
+{
+    return (Char >= 'a' && Char <= 'z') ? (WCHAR)(Char - ('a' - 'A')) : Char;
+}
+
+static inline
+BOOLEAN
+HostEqualUnicodeString(
+    PCUNICODE_STRING String1,
+    PCUNICODE_STRING String2,
+    BOOLEAN CaseInSensitive
+    )
+{
+    USHORT idx = 0;
+
+    if (String1->Length != String2->Length) return FALSE;
+
+    for (; idx < String1->Length / sizeof(WCHAR); idx++) {
+        if (CaseInSensitive ?
+            HostUpcaseUnicodeChar(String1->Buffer[idx]) != HostUpcaseUnicodeChar(String2->Buffer[idx]) :
+            String1->Buffer[idx] != String2->Buffer[idx]) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static inline
+VOID
+HostInitUnicodeString(
+    PUNICODE_STRING String,
+    PWCHAR Buffer,
+    const char *Text
+    )
+{
+    USHORT idx = 0;
+
+    for (; '\0' != Text[idx]; idx++) Buffer[idx] = (WCHAR)(UCHAR)Text[idx];
+
+    String->Buffer = Buffer;
+    String->Length = (USHORT)(idx * sizeof(WCHAR));
+    String->MaximumLength = String->Length;
+}
+
+//
+// The wildcards of FsRtlIsNameInExpression, with the DOS_STAR, DOS_QM and DOS_DOT.
+//
+#define FsRtlIsUnicodeCharacterWild(_ch_) \
+    ('*' == (_ch_) || '?' == (_ch_) || '<' == (_ch_) || '>' == (_ch_) || '"' == (_ch_))
+
+#define RtlUpcaseUnicodeChar HostUpcaseUnicodeChar
+#define RtlEqualUnicodeString HostEqualUnicodeString
+
+//
+// FsRtlIsNameInExpression with the '*' and '?' wildcards, the expression is upcased
+// and the name is upcased if the case is ignored.
+//
+static inline
+BOOLEAN
+HostIsNameInExpression(
+    PCUNICODE_STRING Expression,
+    PCUNICODE_STRING Name,
+    BOOLEAN IgnoreCase,
+    PVOID UpcaseTable
+    )
+{
+    USHORT expressionLength = Expression->Length / sizeof(WCHAR);
+    USHORT nameLength = Name->Length / sizeof(WCHAR);
+    USHORT expressionIdx = 0, nameIdx = 0;
+    USHORT starIdx = MAXUSHORT, starNameIdx = 0;
+    WCHAR nameChar = 0;
+
+    (void)UpcaseTable;
+
+    while (nameIdx < nameLength) {
+        nameChar = IgnoreCase ? HostUpcaseUnicodeChar(Name->Buffer[nameIdx]) : Name->Buffer[nameIdx];
+
+        if (expressionIdx < expressionLength && '*' == Expression->Buffer[expressionIdx]) {
+            starIdx = expressionIdx++;
+            starNameIdx = nameIdx;
+        } else if (expressionIdx < expressionLength &&
+                   ('?' == Expression->Buffer[expressionIdx] || nameChar == Expression->Buffer[expressionIdx])) {
+            expressionIdx++;
+            nameIdx++;
+        } else if (MAXUSHORT != starIdx) {
+            expressionIdx = starIdx + 1;
+            nameIdx = ++starNameIdx;
+        } else {
+            return FALSE;
+        }
+    }
+
+    while (expressionIdx < expressionLength && '*' == Expression->Buffer[expressionIdx]) expressionIdx++;
+
+    return expressionIdx == expressionLength;
+}
+
+#define FsRtlIsNameInExpression HostIsNameInExpression
+
+#endif
@@ -0,0 +1,440 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    MonitorBatchTests.c
+
+Abstract:
+
+    Tests of the batching of the monitor thread on a simulated clock. Records are
+    published into a ring at the times of synthetic traffic, the monitor thread
+    drains it when a reservation crosses the batch size or the batch delay after
+    its wake expires, as FgcPublishMonitorRecord and FgcMonitorThreadRoutine do.
+    The latency of light traffic stays bounded by the delay, heavy traffic is
+    drained in batches of the batch size, and the batch size distribution of the
+    traces is reported.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HostShim.h"
+#include "FileGuard.h"
+#include "MonitorRing.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+//
+// Times are in microseconds, the batch delay in milliseconds as in the registry.
+//
+#define MS(_ms_) ((LONG64)(_ms_) * 1000)
+
+#define PATH_CHARS    40
+#define RECORDS_MAX   (FG_MONITOR_RING_SIZE / 64)
+
+typedef struct _SIMULATION {
+
+    ULONG BatchSize;
+    ULONG BatchDelay;
+
+    PFG_MONITOR_RING Ring;
+
+    //
+    // The monitor thread was woken and waits for a batch until the deadline.
+    //
+    BOOLEAN Batching;
+    LONG64 Deadline;
+
+    //
+    // Publication times of the records in the ring.
+    //
+    LONG64 Times[RECORDS_MAX];
+    ULONG First;
+    ULONG Amount;
+
+    ULONG Records;
+    ULONG Dropped;
+    ULONG Batches;
+    LONG64 MaxLatency;
+    ULONG Histogram[FG_MONITOR_BATCH_HISTOGRAM_BUCKETS];
+
+} SIMULATION, *PSIMULATION;
+
+static
+VOID
+StartSimulation(
+    _Out_ PSIMULATION Simulation,
+    _In_ ULONG BatchSize,
+    _In_ ULONG BatchDelay
+    )
+{
+    RtlZeroMemory(Simulation, sizeof(SIMULATION));
+    Simulation->BatchSize = BatchSize;
+    Simulation->BatchDelay = BatchDelay;
+
+    Simulation->Ring = aligned_alloc(64, sizeof(FG_MONITOR_RING));
+    if (NULL == Simulation->Ring) abort();
+    RtlZeroMemory(Simulation->Ring, sizeof(FG_MONITOR_RING));
+    Simulation->Ring->Buffer = calloc(1, FG_MONITOR_RING_SIZE);
+    if (NULL == Simulation->Ring->Buffer) abort();
+}
+
+static
+VOID
+StopSimulation(
+    _Inout_ PSIMULATION Simulation
+    )
+{
+    free(Simulation->Ring->Buffer);
+    free(Simulation->Ring);
+}
+
+//
+// Drains the whole ring at a time, the records delivered make a batch.
+//
+static
+VOID
+DrainAt(
+    _Inout_ PSIMULATION Simulation,
+    _In_ LONG64 Now
+    )
+{
+    PFG_MONITOR_RING ring = Simulation->Ring;
+    FG_MONITOR_RING_ENTRY *entry = NULL;
+    LONG64 newTail = ring->Tail;
+    ULONG records = 0;
+
+    while (newTail != ring->Head) {
+        entry = FgcPeekMonitorRingEntry(ring, newTail);
+        if (FG_MONITOR_RING_ENTRY_RECORD == entry->State) {
+            if (Now - Simulation->Times[Simulation->First] > Simulation->MaxLatency) {
+                Simulation->MaxLatency = Now - Simulation->Times[Simulation->First];
+            }
+            Simulation->First = (Simulation->First + 1) % RECORDS_MAX;
+            Simulation->Amount--;
+            records++;
+        }
+        newTail += entry->Size;
+    }
+
+    FgcReleaseMonitorRingSpan(ring, ring->Tail, newTail);
+
+    if (0 != records) {
+        Simulation->Batches++;
+        Simulation->Histogram[FgcGetMonitorBatchBucket(records)]++;
+    }
+
+    Simulation->Batching = FALSE;
+}
+
+static
+VOID
+PublishAt(
+    _Inout_ PSIMULATION Simulation,
+    _In_ LONG64 Now
+    )
+{
+    FG_MONITOR_RING_ENTRY *entry = NULL;
+    ULONG reserved = 0, fill = 0;
+    BOOLEAN ready = FALSE;
+
+    if (Simulation->Batching && Simulation->Deadline <= Now) {
+        DrainAt(Simulation, Simulation->Deadline);
+    }
+
+    Simulation->Records++;
+
+    if (!FgcReserveMonitorRingEntry(Simulation->Ring,
+                                    (ULONG)FG_MONITOR_RING_ENTRY_SIZE(sizeof(FG_MONITOR_RECORD) + PATH_CHARS * sizeof(WCHAR)),
+                                    &entry,
+                                    &reserved,
+                                    &fill)) {
+        Simulation->Dropped++;
+        return;
+    }
+
+    InterlockedExchange(&entry->State, FG_MONITOR_RING_ENTRY_RECORD);
+    Simulation->Times[(Simulation->First + Simulation->Amount++) % RECORDS_MAX] = Now;
+
+    ready = FgcIsMonitorBatchReady(fill, reserved, Simulation->BatchSize);
+
+    //
+    // The publication wakes the monitor thread, which then waits for the batch ready
+    // event until the batch delay expires.
+    //
+    if (!Simulation->Batching) {
+        Simulation->Batching = TRUE;
+        Simulation->Deadline = Now + MS(FgcGetMonitorBatchDelay(Simulation->BatchDelay, FALSE));
+    }
+
+    if (ready || Simulation->Deadline <= Now) {
+        DrainAt(Simulation, Now);
+    }
+}
+
+static
+VOID
+FinishSimulation(
+    _Inout_ PSIMULATION Simulation
+    )
+{
+    if (Simulation->Batching) {
+        DrainAt(Simulation, Simulation->Deadline);
+    }
+
+    CHECK(0 == Simulation->Amount);
+}
+
+static
+VOID
+TestBatchThreshold(
+    VOID
+    )
+{
+    SIMULATION simulation;
+    FG_MONITOR_RING_ENTRY *entry = NULL;
+    ULONG entrySize = (ULONG)FG_MONITOR_RING_ENTRY_SIZE(sizeof(FG_MONITOR_RECORD) + PATH_CHARS * sizeof(WCHAR));
+    ULONG reserved = 0, fill = 0;
+    ULONG crossings = 0, lap = 0;
+
+    //
+    // Only the reservation crossing the batch size ends the delay, once per drain.
+    //
+    StartSimulation(&simulation, 4096, 10);
+
+    for (lap = 0; lap < 3; lap++) {
+        crossings = 0;
+        while (FgcReserveMonitorRingEntry(simulation.Ring, entrySize, &entry, &reserved, &fill)) {
+            InterlockedExchange(&entry->State, FG_MONITOR_RING_ENTRY_RECORD);
+            if (FgcIsMonitorBatchReady(fill, reserved, 4096)) {
+                CHECK(fill >= 4096 && fill - reserved < 4096);
+                crossings++;
+            }
+        }
+
+        CHECK(1 == crossings);
+        FgcReleaseMonitorRingSpan(simulation.Ring, simulation.Ring->Tail, simulation.Ring->Head);
+    }
+
+    //
+    // A reservation padded to the end of the buffer crosses the batch size with its
+    // padding.
+    //
+    CHECK(FgcIsMonitorBatchReady(5000, 2000, 4096));
+    CHECK(!FgcIsMonitorBatchReady(5000, 500, 4096));
+    CHECK(!FgcIsMonitorBatchReady(4000, 200, 4096));
+    CHECK(FgcIsMonitorBatchReady(4096, 200, 4096));
+
+    //
+    // Without a batch size every publication wakes the monitor thread.
+    //
+    CHECK(FgcIsMonitorBatchReady(100, 100, 0));
+    CHECK(FgcIsMonitorBatchReady(FG_MONITOR_RING_SIZE, 100, 0));
+
+    StopSimulation(&simulation);
+}
+
+static
+VOID
+TestBatchDelay(
+    VOID
+    )
+{
+    CHECK(0 == FgcGetMonitorBatchDelay(0, FALSE));
+    CHECK(10 == FgcGetMonitorBatchDelay(10, FALSE));
+
+    //
+    // A stalled drain is retried after a delay even without batching.
+    //
+    CHECK(1 == FgcGetMonitorBatchDelay(0, TRUE));
+    CHECK(10 == FgcGetMonitorBatchDelay(10, TRUE));
+}
+
+static
+VOID
+TestBatchBuckets(
+    VOID
+    )
+{
+    ULONG records = 0;
+    ULONG bucket = 0;
+
+    CHECK(0 == FgcGetMonitorBatchBucket(1));
+    CHECK(1 == FgcGetMonitorBatchBucket(2));
+    CHECK(1 == FgcGetMonitorBatchBucket(3));
+    CHECK(2 == FgcGetMonitorBatchBucket(4));
+    CHECK(FG_MONITOR_BATCH_HISTOGRAM_BUCKETS - 1 == FgcGetMonitorBatchBucket(MAXULONG));
+
+    for (records = 1; records < 4096; records++) {
+        bucket = FgcGetMonitorBatchBucket(records);
+        CHECK(bucket < FG_MONITOR_BATCH_HISTOGRAM_BUCKETS);
+        CHECK((1UL << bucket) <= records);
+        CHECK(FG_MONITOR_BATCH_HISTOGRAM_BUCKETS - 1 == bucket || records < (2UL << bucket));
+    }
+}
+
+static
+VOID
+TestLightTraffic(
+    VOID
+    )
+{
+    SIMULATION simulation;
+    ULONG idx = 0;
+
+    //
+    // A record every 50ms is delivered alone, the delay after its publication.
+    //
+    StartSimulation(&simulation, 16 * 1024, 10);
+    for (idx = 0; idx < 1000; idx++) {
+        PublishAt(&simulation, idx * MS(50));
+    }
+    FinishSimulation(&simulation);
+
+    CHECK(1000 == simulation.Batches);
+    CHECK(1000 == simulation.Histogram[0]);
+    CHECK(MS(10) == simulation.MaxLatency);
+    CHECK(0 == simulation.Dropped);
+
+    StopSimulation(&simulation);
+
+    //
+    // Without a delay the records are drained as they come.
+    //
+    StartSimulation(&simulation, 16 * 1024, 0);
+    for (idx = 0; idx < 1000; idx++) {
+        PublishAt(&simulation, idx * MS(50));
+    }
+    FinishSimulation(&simulation);
+
+    CHECK(1000 == simulation.Batches);
+    CHECK(0 == simulation.MaxLatency);
+
+    StopSimulation(&simulation);
+}
+
+static
+VOID
+TestHeavyTraffic(
+    VOID
+    )
+{
+    SIMULATION simulation;
+    ULONG entrySize = (ULONG)FG_MONITOR_RING_ENTRY_SIZE(sizeof(FG_MONITOR_RECORD) + PATH_CHARS * sizeof(WCHAR));
+    ULONG batchRecords = (16 * 1024 + entrySize - 1) / entrySize;
+    ULONG idx = 0;
+
+    //
+    // A record every 5us fills the batch size long before the delay expires, each
+    // batch is drained by the reservation crossing it.
+    //
+    StartSimulation(&simulation, 16 * 1024, 10);
+    for (idx = 0; idx < 100000; idx++) {
+        PublishAt(&simulation, idx * 5);
+    }
+
+    CHECK(simulation.MaxLatency <= (LONG64)batchRecords * 5);
+
+    //
+    // The records left after the traffic stops wait for the delay.
+    //
+    FinishSimulation(&simulation);
+
+    CHECK(MS(10) == simulation.MaxLatency);
+    CHECK(0 == simulation.Dropped);
+    CHECK(simulation.Batches <= 100000 / batchRecords + 1);
+    CHECK(simulation.Batches - 1 <= simulation.Histogram[FgcGetMonitorBatchBucket(batchRecords)]);
+
+    StopSimulation(&simulation);
+}
+
+static
+VOID
+ReportTraffic(
+    VOID
+    )
+{
+    SIMULATION simulation;
+    ULONG burstRecords[] = { 1, 10, 100, 1000 };
+    ULONG idx = 0, burst = 0, record = 0, bucket = 0;
+
+    //
+    // Bursts 100ms apart, as a file copied or a directory listed now and then.
+    //
+    for (idx = 0; idx < sizeof(burstRecords) / sizeof(burstRecords[0]); idx++) {
+        StartSimulation(&simulation, 16 * 1024, 10);
+        for (burst = 0; burst < 100; burst++) {
+            for (record = 0; record < burstRecords[idx]; record++) {
+                PublishAt(&simulation, burst * MS(100) + record * 2);
+            }
+        }
+        FinishSimulation(&simulation);
+
+        printf("bursts of %4lu records: %5lu batches, max latency %5lld us, batches by size:",
+               (unsigned long)burstRecords[idx], (unsigned long)simulation.Batches, (long long)simulation.MaxLatency);
+        for (bucket = 0; bucket < FG_MONITOR_BATCH_HISTOGRAM_BUCKETS; bucket++) {
+            printf(" %lu", (unsigned long)simulation.Histogram[bucket]);
+        }
+        printf("\n");
+
+        CHECK(simulation.MaxLatency <= MS(10));
+        CHECK(0 == simulation.Dropped);
+
+        StopSimulation(&simulation);
+    }
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestBatchThreshold();
+    TestBatchDelay();
+    TestBatchBuckets();
+    TestLightTraffic();
+    TestHeavyTraffic();
+    ReportTraffic();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All monitor batch checks passed\n");
+    return EXIT_SUCCESS;
+}
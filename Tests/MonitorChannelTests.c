@@ -0,0 +1,431 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    MonitorChannelTests.c
+
+Abstract:
+
+    Tests of the shared memory monitor channel protocol, the entries written the
+    way FgcWriteMonitorRecord does and read the way FglReceiveChannelRecords does.
+    The wrap entries, the room check against a bogus client tail and the detection
+    of overwritten entries are checked, then a producer process streams records to
+    a consumer process through a shared mapping. The consumer polls the head where
+    the client waits for the channel event.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "HostShim.h"
+#include "FileGuard.h"
+#include "FileGuardChannel.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+#define DATA_SIZE      FG_MONITOR_CHANNEL_DATA_SIZE_MIN
+#define PATH_CHARS_MAX 300
+
+//
+// The path of a record is derived from its sequence number, so that the consumer
+// can check every byte it reads.
+//
+#define PATH_CHARS(_sequence_) ((ULONG)((_sequence_) * 13 % PATH_CHARS_MAX + 1))
+#define PATH_CHAR(_sequence_, _idx_) ((WCHAR)((_sequence_) * 7 + (_idx_)))
+#define RECORD_SIZE(_sequence_) ((ULONG)(sizeof(FG_MONITOR_RECORD) + PATH_CHARS(_sequence_) * sizeof(WCHAR)))
+
+typedef struct _CHANNEL_WRITER {
+    PUCHAR Data;
+    LONGLONG Head;
+    ULONGLONG Sequence;
+} CHANNEL_WRITER, *PCHANNEL_WRITER;
+
+typedef struct _CHANNEL_READER {
+    PUCHAR Data;
+    LONGLONG Tail;
+    ULONGLONG Sequence;
+    ULONG Records;
+    ULONG Wraps;
+} CHANNEL_READER, *PCHANNEL_READER;
+
+static
+VOID
+WriteRecord(
+    _Inout_ PCHANNEL_WRITER Writer
+    )
+{
+    FG_MONITOR_CHANNEL_ENTRY *entry = NULL;
+    ULONGLONG sequence = Writer->Sequence;
+    ULONG idx = 0;
+
+    entry = FgPutMonitorChannelEntry(Writer->Data,
+                                     DATA_SIZE,
+                                     &Writer->Head,
+                                     &Writer->Sequence,
+                                     RECORD_SIZE(sequence),
+                                     FG_MONITOR_CHANNEL_ENTRY_RECORD);
+
+    RtlZeroMemory(&entry->Record, sizeof(FG_MONITOR_RECORD));
+    entry->Record.RequestorTid = (ULONG_PTR)sequence;
+    entry->Record.FilePathSize = (USHORT)(PATH_CHARS(sequence) * sizeof(WCHAR));
+    for (idx = 0; idx < PATH_CHARS(sequence); idx++) {
+        entry->Record.Buffer[idx] = PATH_CHAR(sequence, idx);
+    }
+}
+
+//
+// Reads the entries up to a head, FALSE if one of them is broken.
+//
+static
+BOOLEAN
+ReadRecords(
+    _Inout_ PCHANNEL_READER Reader,
+    _In_ LONGLONG Head
+    )
+{
+    FG_MONITOR_CHANNEL_ENTRY *entry = NULL;
+    ULONG idx = 0;
+
+    while (Reader->Tail != Head) {
+
+        entry = (FG_MONITOR_CHANNEL_ENTRY*)(Reader->Data + (Reader->Tail & (DATA_SIZE - 1)));
+        if (!FgCheckMonitorChannelEntry(entry, Reader->Tail, Head, DATA_SIZE, &Reader->Sequence)) {
+            return FALSE;
+        }
+
+        if (FG_MONITOR_CHANNEL_ENTRY_WRAP == entry->Type) {
+            Reader->Wraps++;
+        } else {
+            if (entry->Record.RequestorTid != entry->Sequence ||
+                entry->Record.FilePathSize != PATH_CHARS(entry->Sequence) * sizeof(WCHAR) ||
+                entry->Size != FG_MONITOR_CHANNEL_ENTRY_SIZE(RECORD_SIZE(entry->Sequence))) {
+                return FALSE;
+            }
+
+            for (idx = 0; idx < PATH_CHARS(entry->Sequence); idx++) {
+                if (PATH_CHAR(entry->Sequence, idx) != entry->Record.Buffer[idx]) return FALSE;
+            }
+
+            Reader->Records++;
+        }
+
+        Reader->Tail += entry->Size;
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+TestEntryPlacement(
+    VOID
+    )
+{
+    CHANNEL_WRITER writer = { 0 };
+    CHANNEL_READER reader = { 0 };
+    FG_MONITOR_CHANNEL_ENTRY *entry = NULL;
+
+    writer.Data = reader.Data = calloc(1, DATA_SIZE);
+    if (NULL == writer.Data) abort();
+
+    CHECK(8 == FIELD_OFFSET(FG_MONITOR_CHANNEL_ENTRY, Sequence));
+    CHECK(0 == FG_MONITOR_CHANNEL_ENTRY_SIZE(RECORD_SIZE(0)) % 8);
+
+    //
+    // An entry that does not fit before the end of the data follows a wrap entry
+    // skipping the rest of it, even an 8 bytes one.
+    //
+    writer.Head = reader.Tail = DATA_SIZE - 8;
+    WriteRecord(&writer);
+
+    entry = (FG_MONITOR_CHANNEL_ENTRY*)(writer.Data + DATA_SIZE - 8);
+    CHECK(FG_MONITOR_CHANNEL_ENTRY_WRAP == entry->Type);
+    CHECK(8 == entry->Size);
+    CHECK(writer.Head == DATA_SIZE + FG_MONITOR_CHANNEL_ENTRY_SIZE(RECORD_SIZE(0)));
+    CHECK(ReadRecords(&reader, writer.Head));
+    CHECK(reader.Tail == writer.Head);
+
+    //
+    // An entry ending at the end of the data needs no wrap entry.
+    //
+    writer.Head = reader.Tail = 2 * DATA_SIZE - FG_MONITOR_CHANNEL_ENTRY_SIZE(RECORD_SIZE(writer.Sequence));
+    WriteRecord(&writer);
+
+    CHECK(writer.Head == 2 * DATA_SIZE);
+    CHECK(ReadRecords(&reader, writer.Head));
+
+    writer.Head = reader.Tail = 3 * DATA_SIZE - FG_MONITOR_CHANNEL_ENTRY_SIZE(RECORD_SIZE(writer.Sequence)) + 8;
+    WriteRecord(&writer);
+
+    entry = (FG_MONITOR_CHANNEL_ENTRY*)(writer.Data + (reader.Tail & (DATA_SIZE - 1)));
+    CHECK(FG_MONITOR_CHANNEL_ENTRY_WRAP == entry->Type);
+    CHECK(writer.Head == 3 * DATA_SIZE + FG_MONITOR_CHANNEL_ENTRY_SIZE(RECORD_SIZE(2)));
+    CHECK(ReadRecords(&reader, writer.Head));
+
+    CHECK(3 == reader.Records);
+    CHECK(2 == reader.Wraps);
+    CHECK(3 == reader.Sequence);
+
+    free(writer.Data);
+}
+
+static
+VOID
+TestFitting(
+    VOID
+    )
+{
+    ULONG entrySize = FG_MONITOR_CHANNEL_ENTRY_SIZE(100);
+
+    CHECK(FgIsMonitorChannelFitting(0, 0, DATA_SIZE, 100));
+    CHECK(FgIsMonitorChannelFitting(DATA_SIZE - entrySize, 0, DATA_SIZE, 100));
+    CHECK(!FgIsMonitorChannelFitting(DATA_SIZE - entrySize + 8, 0, DATA_SIZE, 100));
+
+    //
+    // The wrap entry takes room too.
+    //
+    CHECK(FgIsMonitorChannelFitting(DATA_SIZE + 8, 8 + entrySize, DATA_SIZE, 100));
+    CHECK(!FgIsMonitorChannelFitting(2 * DATA_SIZE - 8, DATA_SIZE + entrySize - 8, DATA_SIZE, 100));
+    CHECK(FgIsMonitorChannelFitting(2 * DATA_SIZE - 8, DATA_SIZE + entrySize, DATA_SIZE, 100));
+
+    //
+    // A tail written past the head, or more than the data size behind it, only makes
+    // the channel look full.
+    //
+    CHECK(!FgIsMonitorChannelFitting(1000, 1008, DATA_SIZE, 100));
+    CHECK(!FgIsMonitorChannelFitting(1000, -(LONGLONG)DATA_SIZE, DATA_SIZE, 100));
+    CHECK(!FgIsMonitorChannelFitting(0, 0x7fffffffffffffffLL, DATA_SIZE, 100));
+}
+
+static
+VOID
+TestCorruption(
+    VOID
+    )
+{
+    CHANNEL_WRITER writer = { 0 };
+    CHANNEL_READER reader = { 0 };
+    FG_MONITOR_CHANNEL_ENTRY *entry = NULL;
+    ULONGLONG sequence = 0;
+
+    writer.Data = reader.Data = calloc(1, DATA_SIZE);
+    if (NULL == writer.Data) abort();
+
+    WriteRecord(&writer);
+    entry = (FG_MONITOR_CHANNEL_ENTRY*)writer.Data;
+
+    CHECK(FgCheckMonitorChannelEntry(entry, 0, writer.Head, DATA_SIZE, &sequence));
+    CHECK(1 == sequence);
+
+    //
+    // A record out of sequence, a size not aligned, too small or past the head.
+    //
+    CHECK(!FgCheckMonitorChannelEntry(entry, 0, writer.Head, DATA_SIZE, &sequence));
+
+    sequence = 0;
+    entry->Size += 4;
+    CHECK(!FgCheckMonitorChannelEntry(entry, 0, writer.Head + 8, DATA_SIZE, &sequence));
+    entry->Size = 0;
+    CHECK(!FgCheckMonitorChannelEntry(entry, 0, writer.Head, DATA_SIZE, &sequence));
+    entry->Size = 8;
+    CHECK(!FgCheckMonitorChannelEntry(entry, 0, writer.Head, DATA_SIZE, &sequence));
+    entry->Size = FG_MONITOR_CHANNEL_ENTRY_SIZE(RECORD_SIZE(0));
+    CHECK(!FgCheckMonitorChannelEntry(entry, 0, writer.Head - 8, DATA_SIZE, &sequence));
+    CHECK(0 == sequence);
+
+    //
+    // A wrap entry must end at the end of the data, it has no sequence.
+    //
+    entry->Type = FG_MONITOR_CHANNEL_ENTRY_WRAP;
+    entry->Size = 8;
+    CHECK(!FgCheckMonitorChannelEntry(entry, 0, writer.Head, DATA_SIZE, &sequence));
+    CHECK(FgCheckMonitorChannelEntry(entry, DATA_SIZE - 8, DATA_SIZE, DATA_SIZE, &sequence));
+    CHECK(0 == sequence);
+
+    //
+    // The reader stops at the first broken entry.
+    //
+    writer.Head = 0;
+    writer.Sequence = 0;
+    WriteRecord(&writer);
+    WriteRecord(&writer);
+    entry = (FG_MONITOR_CHANNEL_ENTRY*)(writer.Data + FG_MONITOR_CHANNEL_ENTRY_SIZE(RECORD_SIZE(0)));
+    entry->Sequence = 5;
+    CHECK(!ReadRecords(&reader, writer.Head));
+    CHECK(1 == reader.Records);
+
+    free(writer.Data);
+}
+
+#ifndef _WIN32
+
+#define STREAM_RECORDS 200000
+#define STREAM_SECONDS 30
+
+static
+double
+GetSeconds(
+    VOID
+    )
+{
+    struct timespec now;
+
+    timespec_get(&now, TIME_UTC);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+//
+// The producer process writes the records as the core does, publishing the head
+// after each batch and waiting for room when the consumer lags behind.
+//
+static
+int
+ProduceRecords(
+    _Inout_ FG_MONITOR_CHANNEL_HEADER *Header
+    )
+{
+    CHANNEL_WRITER writer = { 0 };
+    double deadline = GetSeconds() + STREAM_SECONDS;
+
+    writer.Data = FG_MONITOR_CHANNEL_DATA(Header);
+
+    while (writer.Sequence < STREAM_RECORDS) {
+
+        if (!FgIsMonitorChannelFitting(writer.Head, ReadAcquire64(&Header->Tail), Header->DataSize, RECORD_SIZE(writer.Sequence))) {
+            WriteRelease64(&Header->Head, writer.Head);
+            if (GetSeconds() > deadline) return EXIT_FAILURE;
+            sched_yield();
+            continue;
+        }
+
+        WriteRecord(&writer);
+        if (0 == writer.Sequence % 16) {
+            WriteRelease64(&Header->Head, writer.Head);
+        }
+    }
+
+    WriteRelease64(&Header->Head, writer.Head);
+
+    return EXIT_SUCCESS;
+}
+
+static
+VOID
+TestTwoProcesses(
+    VOID
+    )
+{
+    FG_MONITOR_CHANNEL_HEADER *header = NULL;
+    CHANNEL_READER reader = { 0 };
+    LONGLONG head = 0;
+    BOOLEAN intact = TRUE;
+    double start = 0.0, deadline = 0.0;
+    int status = 0;
+    pid_t producer = 0;
+
+    header = mmap(NULL, sizeof(FG_MONITOR_CHANNEL_HEADER) + DATA_SIZE, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    CHECK(MAP_FAILED != header);
+    if (MAP_FAILED == header) return;
+
+    header->DataSize = DATA_SIZE;
+    reader.Data = FG_MONITOR_CHANNEL_DATA(header);
+
+    start = GetSeconds();
+    deadline = start + STREAM_SECONDS;
+
+    producer = fork();
+    CHECK(-1 != producer);
+    if (0 == producer) {
+        _exit(ProduceRecords(header));
+    }
+
+    while (intact && reader.Sequence < STREAM_RECORDS && GetSeconds() < deadline) {
+        head = ReadAcquire64(&header->Head);
+        if (head == reader.Tail) {
+            sched_yield();
+            continue;
+        }
+
+        intact = ReadRecords(&reader, head);
+        WriteRelease64(&header->Tail, reader.Tail);
+    }
+
+    CHECK(producer == waitpid(producer, &status, 0));
+    CHECK(WIFEXITED(status) && EXIT_SUCCESS == WEXITSTATUS(status));
+    CHECK(intact);
+    CHECK(STREAM_RECORDS == reader.Records);
+    CHECK(0 != reader.Wraps);
+    CHECK(header->Head == header->Tail);
+
+    printf("channel: %lu records across processes, %lu wraps, %.0f records/s\n",
+           (unsigned long)reader.Records, (unsigned long)reader.Wraps, reader.Records / (GetSeconds() - start));
+
+    munmap(header, sizeof(FG_MONITOR_CHANNEL_HEADER) + DATA_SIZE);
+}
+
+#endif
+
+int
+main(
+    VOID
+    )
+{
+    TestEntryPlacement();
+    TestFitting();
+    TestCorruption();
+#ifndef _WIN32
+    TestTwoProcesses();
+#endif
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All monitor channel checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,506 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    MonitorDeliveryTests.c
+
+Abstract:
+
+    Tests of the delivery of the monitor records messages through a mock port. The
+    monitor thread is replayed round by round the way FgcDrainMonitorRing and
+    FgcMonitorThreadRoutine run it: the records are drained from a ring into the
+    records message of each subscriber, which is then sent with a timeout to the
+    receives its client keeps posted. A slow client must not stall the others, and
+    every record is delivered, dropped and counted, or still pending.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HostShim.h"
+#include "FileGuard.h"
+#include "MonitorRing.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+#define SUBSCRIBERS_MAX 4
+#define RECORD_SIZE     ((ULONG)(sizeof(FG_MONITOR_RECORD) + 120 * sizeof(WCHAR)))
+
+//
+// The receives FileGuardLib keeps posted to the monitor port.
+//
+#define RECEIVES_MAX 4
+
+typedef struct _MOCK_SUBSCRIBER {
+
+    BOOLEAN Connected;
+
+    //
+    // The records message and the delivery state of the core.
+    //
+    ULONG DataSize;
+    ULONG RecordsAmount;
+    BOOLEAN Congested;
+    ULONG64 Dropped;
+    ULONG SendTimeouts;
+
+    //
+    // The client of the mock port: the receives it posted, how many it posts again
+    // each round, and whether its port is broken.
+    //
+    ULONG Receives;
+    ULONG ReceivesPerRound;
+    BOOLEAN Disconnected;
+    ULONG Delivered;
+
+} MOCK_SUBSCRIBER, *PMOCK_SUBSCRIBER;
+
+typedef struct _MOCK_MONITOR {
+    PFG_MONITOR_RING Ring;
+    MOCK_SUBSCRIBER Subscribers[SUBSCRIBERS_MAX];
+    ULONG Produced;
+    ULONG Batches;
+    ULONG Histogram[FG_MONITOR_BATCH_HISTOGRAM_BUCKETS];
+} MOCK_MONITOR, *PMOCK_MONITOR;
+
+static
+VOID
+StartMonitor(
+    _Out_ PMOCK_MONITOR Monitor
+    )
+{
+    RtlZeroMemory(Monitor, sizeof(MOCK_MONITOR));
+
+    Monitor->Ring = aligned_alloc(64, sizeof(FG_MONITOR_RING));
+    if (NULL == Monitor->Ring) abort();
+    RtlZeroMemory(Monitor->Ring, sizeof(FG_MONITOR_RING));
+    Monitor->Ring->Buffer = calloc(1, FG_MONITOR_RING_SIZE);
+    if (NULL == Monitor->Ring->Buffer) abort();
+}
+
+static
+VOID
+StopMonitor(
+    _Inout_ PMOCK_MONITOR Monitor
+    )
+{
+    free(Monitor->Ring->Buffer);
+    free(Monitor->Ring);
+}
+
+static
+VOID
+Publish(
+    _Inout_ PMOCK_MONITOR Monitor,
+    _In_ ULONG Records
+    )
+{
+    FG_MONITOR_RING_ENTRY *entry = NULL;
+    ULONG reserved = 0, fill = 0;
+
+    for (; 0 != Records; Records--) {
+        Monitor->Produced++;
+        if (!FgcReserveMonitorRingEntry(Monitor->Ring, (ULONG)FG_MONITOR_RING_ENTRY_SIZE(RECORD_SIZE), &entry, &reserved, &fill)) {
+            InterlockedIncrement64(&Monitor->Ring->Dropped);
+            continue;
+        }
+
+        InterlockedExchange(&entry->State, FG_MONITOR_RING_ENTRY_RECORD);
+    }
+}
+
+//
+// The records of the ring are written into the records messages, held while a
+// subscriber has no room for them and is not congested.
+//
+static
+VOID
+Drain(
+    _Inout_ PMOCK_MONITOR Monitor
+    )
+{
+    PFG_MONITOR_RING ring = Monitor->Ring;
+    FG_MONITOR_RING_ENTRY *entry = NULL;
+    PMOCK_SUBSCRIBER subscriber = NULL;
+    LONG64 newTail = ring->Tail;
+    ULONG fitting = 0;
+    ULONG idx = 0;
+    BOOLEAN held = FALSE;
+
+    while (newTail != ring->Head && !held) {
+
+        entry = FgcPeekMonitorRingEntry(ring, newTail);
+        if (NULL == entry) {
+            break;
+        }
+
+        if (FG_MONITOR_RING_ENTRY_RECORD == entry->State) {
+
+            fitting = 0;
+            for (idx = 0; idx < SUBSCRIBERS_MAX; idx++) {
+                subscriber = &Monitor->Subscribers[idx];
+                if (!subscriber->Connected) continue;
+
+                switch (FgcGetMonitorDelivery(FgcIsMonitorMessageFitting(subscriber->DataSize, RECORD_SIZE),
+                                              subscriber->Congested)) {
+                case MonitorDeliveryWrite:
+                    fitting |= 1UL << idx;
+                    break;
+                case MonitorDeliveryHold:
+                    held = TRUE;
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            if (held) {
+                break;
+            }
+
+            for (idx = 0; idx < SUBSCRIBERS_MAX; idx++) {
+                subscriber = &Monitor->Subscribers[idx];
+                if (!subscriber->Connected) continue;
+
+                if (0 != (fitting & (1UL << idx))) {
+                    subscriber->DataSize += RECORD_SIZE;
+                    subscriber->RecordsAmount++;
+                    subscriber->Congested = FALSE;
+                } else {
+                    subscriber->Dropped++;
+                }
+            }
+        }
+
+        newTail += entry->Size;
+    }
+
+    FgcReleaseMonitorRingSpan(ring, ring->Tail, newTail);
+}
+
+//
+// FltSendMessage completing the records message to a posted receive, or timing out.
+//
+static
+NTSTATUS
+MockSendMessage(
+    _Inout_ PMOCK_SUBSCRIBER Subscriber
+    )
+{
+    if (Subscriber->Disconnected) {
+        return STATUS_PORT_DISCONNECTED;
+    }
+
+    if (0 == Subscriber->Receives) {
+        return STATUS_TIMEOUT;
+    }
+
+    Subscriber->Receives--;
+    Subscriber->Delivered += Subscriber->RecordsAmount;
+
+    return STATUS_SUCCESS;
+}
+
+static
+VOID
+Send(
+    _Inout_ PMOCK_MONITOR Monitor
+    )
+{
+    PMOCK_SUBSCRIBER subscriber = NULL;
+    ULONG recordsAmount = 0;
+    ULONG idx = 0;
+
+    for (idx = 0; idx < SUBSCRIBERS_MAX; idx++) {
+
+        subscriber = &Monitor->Subscribers[idx];
+        if (!subscriber->Connected || 0 == subscriber->DataSize) {
+            continue;
+        }
+
+        switch (FgcGetMonitorSendResult(MockSendMessage(subscriber))) {
+        case MonitorSendKept:
+            subscriber->Congested = TRUE;
+            subscriber->SendTimeouts++;
+            continue;
+        case MonitorSendDelivered:
+            recordsAmount += subscriber->RecordsAmount;
+            subscriber->Congested = FALSE;
+            break;
+        default:
+            subscriber->Dropped += subscriber->RecordsAmount;
+            break;
+        }
+
+        subscriber->DataSize = 0;
+        subscriber->RecordsAmount = 0;
+    }
+
+    if (0 != recordsAmount) {
+        Monitor->Batches++;
+        Monitor->Histogram[FgcGetMonitorBatchBucket(recordsAmount)]++;
+    }
+}
+
+static
+VOID
+RunRounds(
+    _Inout_ PMOCK_MONITOR Monitor,
+    _In_ ULONG Rounds,
+    _In_ ULONG RecordsPerRound
+    )
+{
+    PMOCK_SUBSCRIBER subscriber = NULL;
+    ULONG idx = 0;
+
+    for (; 0 != Rounds; Rounds--) {
+        Publish(Monitor, RecordsPerRound);
+        Drain(Monitor);
+        Send(Monitor);
+
+        for (idx = 0; idx < SUBSCRIBERS_MAX; idx++) {
+            subscriber = &Monitor->Subscribers[idx];
+            subscriber->Receives = min(subscriber->Receives + subscriber->ReceivesPerRound, RECEIVES_MAX);
+        }
+    }
+}
+
+//
+// Every record published is received, dropped for the subscriber or in the ring,
+// or pending in the ring or the records message.
+//
+static
+ULONG
+CountRecords(
+    _In_ PMOCK_MONITOR Monitor,
+    _In_ PMOCK_SUBSCRIBER Subscriber
+    )
+{
+    ULONG pending = (ULONG)((Monitor->Ring->Head - Monitor->Ring->Tail) / FG_MONITOR_RING_ENTRY_SIZE(RECORD_SIZE));
+
+    return Subscriber->Delivered + (ULONG)Subscriber->Dropped + Subscriber->RecordsAmount +
+           (ULONG)Monitor->Ring->Dropped + pending;
+}
+
+static
+VOID
+TestDecisions(
+    VOID
+    )
+{
+    CHECK(MonitorDeliveryWrite == FgcGetMonitorDelivery(TRUE, FALSE));
+    CHECK(MonitorDeliveryWrite == FgcGetMonitorDelivery(TRUE, TRUE));
+    CHECK(MonitorDeliveryHold == FgcGetMonitorDelivery(FALSE, FALSE));
+    CHECK(MonitorDeliveryDrop == FgcGetMonitorDelivery(FALSE, TRUE));
+
+    CHECK(FgcIsMonitorMessageFitting(0, FG_MONITOR_SEND_RECORD_BUFFER_SIZE));
+    CHECK(FgcIsMonitorMessageFitting(100, FG_MONITOR_SEND_RECORD_BUFFER_SIZE - 100));
+    CHECK(!FgcIsMonitorMessageFitting(101, FG_MONITOR_SEND_RECORD_BUFFER_SIZE - 100));
+    CHECK(FgcIsMonitorMessageFitting(FG_MONITOR_SEND_RECORD_BUFFER_SIZE, 0));
+
+    //
+    // A timed out send passes NT_SUCCESS, its message must be kept.
+    //
+    CHECK(NT_SUCCESS(STATUS_TIMEOUT));
+    CHECK(MonitorSendKept == FgcGetMonitorSendResult(STATUS_TIMEOUT));
+    CHECK(MonitorSendDelivered == FgcGetMonitorSendResult(STATUS_SUCCESS));
+    CHECK(MonitorSendFailed == FgcGetMonitorSendResult(STATUS_PORT_DISCONNECTED));
+}
+
+static
+VOID
+TestFastClient(
+    VOID
+    )
+{
+    MOCK_MONITOR monitor;
+
+    StartMonitor(&monitor);
+    monitor.Subscribers[0] = (MOCK_SUBSCRIBER){ .Connected = TRUE, .Receives = RECEIVES_MAX, .ReceivesPerRound = RECEIVES_MAX };
+
+    RunRounds(&monitor, 1000, 50);
+
+    CHECK(50000 == monitor.Subscribers[0].Delivered);
+    CHECK(0 == monitor.Subscribers[0].Dropped);
+    CHECK(0 == monitor.Subscribers[0].SendTimeouts);
+    CHECK(0 == monitor.Ring->Dropped);
+    CHECK(1000 == monitor.Histogram[FgcGetMonitorBatchBucket(50)]);
+
+    StopMonitor(&monitor);
+}
+
+static
+VOID
+TestSlowClient(
+    VOID
+    )
+{
+    MOCK_MONITOR monitor;
+    PMOCK_SUBSCRIBER fast = NULL, stalled = NULL, slow = NULL;
+    ULONG bucket = 0;
+
+    //
+    // A client that never posts a receive is congested after its first timeout, the
+    // records are then dropped for it alone. One that posts a receive every fourth
+    // round loses the records it has no room for.
+    //
+    StartMonitor(&monitor);
+    fast = &monitor.Subscribers[0];
+    stalled = &monitor.Subscribers[1];
+    slow = &monitor.Subscribers[2];
+    *fast = (MOCK_SUBSCRIBER){ .Connected = TRUE, .Receives = RECEIVES_MAX, .ReceivesPerRound = RECEIVES_MAX };
+    *stalled = (MOCK_SUBSCRIBER){ .Connected = TRUE };
+    *slow = (MOCK_SUBSCRIBER){ .Connected = TRUE };
+
+    for (bucket = 0; bucket < 250; bucket++) {
+        RunRounds(&monitor, 3, 50);
+        slow->Receives = 1;
+        RunRounds(&monitor, 1, 50);
+    }
+
+    CHECK(0 == monitor.Ring->Dropped);
+    CHECK(50000 == fast->Delivered + fast->RecordsAmount);
+    CHECK(0 == fast->Dropped);
+
+    CHECK(0 == stalled->Delivered);
+    CHECK(0 != stalled->SendTimeouts);
+    CHECK(50000 == CountRecords(&monitor, stalled));
+    CHECK(FG_MONITOR_SEND_RECORD_BUFFER_SIZE / RECORD_SIZE == stalled->RecordsAmount);
+
+    CHECK(0 != slow->Delivered);
+    CHECK(0 != slow->Dropped);
+    CHECK(50000 == CountRecords(&monitor, slow));
+
+    printf("delivery: fast %lu delivered, stalled %lu dropped in %lu timeouts, slow %lu delivered and %lu dropped\n",
+           (unsigned long)fast->Delivered,
+           (unsigned long)stalled->Dropped, (unsigned long)stalled->SendTimeouts,
+           (unsigned long)slow->Delivered, (unsigned long)slow->Dropped);
+
+    StopMonitor(&monitor);
+}
+
+static
+VOID
+TestHeldRecords(
+    VOID
+    )
+{
+    MOCK_MONITOR monitor;
+    PMOCK_SUBSCRIBER client = NULL;
+    ULONG capacity = FG_MONITOR_SEND_RECORD_BUFFER_SIZE / RECORD_SIZE;
+
+    //
+    // Until its first send times out a client without room holds the records in the
+    // ring, they are delivered once it posts a receive.
+    //
+    StartMonitor(&monitor);
+    client = &monitor.Subscribers[0];
+    *client = (MOCK_SUBSCRIBER){ .Connected = TRUE };
+
+    Publish(&monitor, capacity + 10);
+    Drain(&monitor);
+
+    CHECK(capacity == client->RecordsAmount);
+    CHECK(0 == client->Dropped);
+    CHECK(10 * FG_MONITOR_RING_ENTRY_SIZE(RECORD_SIZE) == monitor.Ring->Head - monitor.Ring->Tail);
+
+    client->Receives = 1;
+    Send(&monitor);
+    Drain(&monitor);
+    Send(&monitor);
+
+    CHECK(capacity == client->Delivered);
+    CHECK(10 == client->RecordsAmount);
+    CHECK(1 == client->SendTimeouts);
+    CHECK(monitor.Ring->Head == monitor.Ring->Tail);
+
+    client->Receives = 1;
+    Send(&monitor);
+
+    CHECK(capacity + 10 == client->Delivered);
+    CHECK(0 == client->Dropped);
+    CHECK(!client->Congested);
+
+    StopMonitor(&monitor);
+}
+
+static
+VOID
+TestDisconnectedClient(
+    VOID
+    )
+{
+    MOCK_MONITOR monitor;
+    PMOCK_SUBSCRIBER client = NULL;
+
+    //
+    // The records of a message that could not be sent are dropped and counted, the
+    // next records go into a new message.
+    //
+    StartMonitor(&monitor);
+    client = &monitor.Subscribers[0];
+    *client = (MOCK_SUBSCRIBER){ .Connected = TRUE, .Disconnected = TRUE };
+
+    RunRounds(&monitor, 10, 50);
+
+    CHECK(500 == client->Dropped);
+    CHECK(0 == client->DataSize);
+    CHECK(0 == client->RecordsAmount);
+    CHECK(0 == client->SendTimeouts);
+
+    StopMonitor(&monitor);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestDecisions();
+    TestFastClient();
+    TestSlowClient();
+    TestHeldRecords();
+    TestDisconnectedClient();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All monitor delivery checks passed\n");
+    return EXIT_SUCCESS;
+}
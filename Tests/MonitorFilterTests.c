@@ -0,0 +1,514 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    MonitorFilterTests.c
+
+Abstract:
+
+    Tests of the subscription filters of the monitor subscribers, matched the way
+    FgcDrainMonitorRing does for every drained record. Each field of a filter is
+    checked alone and combined, the section records are selected by their own
+    major function, and a mix of records is matched against many subscribers to
+    measure the matching cost as the subscribers grow.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "HostShim.h"
+#include "FileGuard.h"
+#include "MonitorFilter.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+#define RECORD_BUFFER_SIZE 1024
+#define BENCHMARK_RECORDS 1024
+#define BENCHMARK_MATCHES 2000000UL
+#define BENCHMARK_SUBSCRIBERS_MAX 256
+
+typedef union _RECORD_STORAGE {
+    FG_MONITOR_RECORD Record;
+    UCHAR Buffer[RECORD_BUFFER_SIZE];
+} RECORD_STORAGE;
+
+static RECORD_STORAGE Records[BENCHMARK_RECORDS];
+static FG_MONITOR_FILTER Filters[BENCHMARK_SUBSCRIBERS_MAX];
+
+//
+// The major functions of the records the core sends.
+//
+static CONST UCHAR RecordMajors[] = {
+    IRP_MJ_CREATE,
+    IRP_MJ_WRITE,
+    IRP_MJ_SET_INFORMATION,
+    IRP_MJ_CLEANUP,
+    FG_MONITOR_MAJOR_CREATE_SECTION
+};
+
+static
+ULONG
+NextRandom(
+    _Inout_ ULONG *Seed
+    )
+{
+    *Seed = *Seed * 1103515245UL + 12345UL;
+    return (*Seed >> 16) & 0x7FFF;
+}
+
+static
+double
+GetSeconds(
+    VOID
+    )
+{
+    struct timespec now;
+
+    timespec_get(&now, TIME_UTC);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static
+VOID
+SetRecord(
+    _Out_ RECORD_STORAGE *Storage,
+    _In_ UCHAR MajorFunction,
+    _In_ USHORT RuleMajor,
+    _In_ ULONG_PTR RequestorPid,
+    _In_ ULONG RuleId,
+    _In_ CONST char *RulePathExpression,
+    _In_ CONST char *FilePath
+    )
+{
+    FG_MONITOR_RECORD *record = &Storage->Record;
+    size_t idx = 0, expressionChars = strlen(RulePathExpression), fileChars = strlen(FilePath);
+
+    memset(Storage, 0, sizeof(RECORD_STORAGE));
+
+    record->MajorFunction = MajorFunction;
+    record->RequestorPid = RequestorPid;
+    record->RuleCode.Major = RuleMajor;
+    record->RuleCode.Minor = RuleMinorMonitored;
+    record->RuleId = RuleId;
+    record->RepeatCount = 1UL;
+
+    for (idx = 0; idx < expressionChars; idx++) record->Buffer[idx] = (WCHAR)RulePathExpression[idx];
+    for (idx = 0; idx < fileChars; idx++) record->Buffer[expressionChars + idx] = (WCHAR)FilePath[idx];
+
+    record->RulePathExpressionSize = (USHORT)(expressionChars * sizeof(WCHAR));
+    record->FilePathSize = (USHORT)(fileChars * sizeof(WCHAR));
+}
+
+//
+// Set the prefix upcased, as FgcCreateMonitorSubscriber does on connection.
+//
+static
+VOID
+SetFilterPrefix(
+    _Inout_ FG_MONITOR_FILTER *Filter,
+    _In_ CONST char *PathPrefix
+    )
+{
+    size_t idx = 0, chars = strlen(PathPrefix);
+
+    for (idx = 0; idx < chars; idx++) Filter->PathPrefix[idx] = RtlUpcaseUnicodeChar((WCHAR)PathPrefix[idx]);
+
+    Filter->PathPrefixSize = (USHORT)(chars * sizeof(WCHAR));
+}
+
+static
+VOID
+TestEmptyFilter(
+    VOID
+    )
+{
+    FG_MONITOR_FILTER filter = { 0 };
+    RECORD_STORAGE storage;
+    ULONG idx = 0UL;
+
+    //
+    // A filter without any field set selects every record, the section records
+    // and the out of range majors included.
+    //
+    for (idx = 0UL; idx < sizeof(RecordMajors); idx++) {
+        SetRecord(&storage, RecordMajors[idx], RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+        CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    }
+
+    SetRecord(&storage, IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION, RuleMajorMaximum + 40, 4000, 1UL, "", "");
+    CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+}
+
+static
+VOID
+TestMajorFunctions(
+    VOID
+    )
+{
+    FG_MONITOR_FILTER filter = { 0 };
+    RECORD_STORAGE storage;
+
+    filter.MajorFunctions = FG_MONITOR_FILTER_MAJOR_FUNCTION(IRP_MJ_WRITE) |
+                            FG_MONITOR_FILTER_MAJOR_FUNCTION(IRP_MJ_CLEANUP);
+
+    SetRecord(&storage, IRP_MJ_WRITE, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+    CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_CLEANUP, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+    CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_CREATE, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+
+    //
+    // Majors out of the range of the filter bits are rejected once the field is set,
+    // a shift by them would be undefined.
+    //
+    filter.MajorFunctions = 0xFFFFFFFFUL;
+    SetRecord(&storage, 32, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+}
+
+static
+VOID
+TestSectionRecords(
+    VOID
+    )
+{
+    FG_MONITOR_FILTER filter = { 0 };
+    RECORD_STORAGE storage;
+    ULONG idx = 0UL;
+
+    //
+    // The section records carry their own major function, past the IRP majors and
+    // inside the filter bits, rather than IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION
+    // no filter bit stands for.
+    //
+    CHECK(FG_MONITOR_MAJOR_CREATE_SECTION > IRP_MJ_MAXIMUM_FUNCTION);
+    CHECK(FG_MONITOR_MAJOR_CREATE_SECTION < 32);
+
+    //
+    // A subscriber selects the section records alone.
+    //
+    filter.MajorFunctions = FG_MONITOR_FILTER_MAJOR_FUNCTION(FG_MONITOR_MAJOR_CREATE_SECTION);
+    for (idx = 0UL; idx < sizeof(RecordMajors); idx++) {
+        SetRecord(&storage, RecordMajors[idx], RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+        CHECK((FG_MONITOR_MAJOR_CREATE_SECTION == RecordMajors[idx]) ==
+              FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    }
+
+    //
+    // Or all the records writing a file, through a handle or a mapped section.
+    //
+    filter.MajorFunctions = FG_MONITOR_FILTER_MAJOR_FUNCTION(IRP_MJ_WRITE) |
+                            FG_MONITOR_FILTER_MAJOR_FUNCTION(FG_MONITOR_MAJOR_CREATE_SECTION);
+    SetRecord(&storage, FG_MONITOR_MAJOR_CREATE_SECTION, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+    CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_WRITE, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+    CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_SET_INFORMATION, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+
+    //
+    // A subscriber of the other majors does not receive them.
+    //
+    filter.MajorFunctions = FG_MONITOR_FILTER_MAJOR_FUNCTION(IRP_MJ_CREATE) |
+                            FG_MONITOR_FILTER_MAJOR_FUNCTION(IRP_MJ_SET_INFORMATION);
+    SetRecord(&storage, FG_MONITOR_MAJOR_CREATE_SECTION, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+}
+
+static
+VOID
+TestRuleMajors(
+    VOID
+    )
+{
+    FG_MONITOR_FILTER filter = { 0 };
+    RECORD_STORAGE storage;
+
+    filter.RuleMajors = FG_MONITOR_FILTER_RULE_MAJOR(RuleMajorAccessDenied);
+
+    SetRecord(&storage, IRP_MJ_CREATE, RuleMajorAccessDenied, 4000, 1UL, "", "\\Device\\A");
+    CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_CREATE, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\A");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+
+    filter.RuleMajors = 0xFFFFFFFFUL;
+    SetRecord(&storage, IRP_MJ_CREATE, 32, 4000, 1UL, "", "\\Device\\A");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_CREATE, 0xFFFF, 4000, 1UL, "", "\\Device\\A");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+}
+
+static
+VOID
+TestIds(
+    VOID
+    )
+{
+    FG_MONITOR_FILTER filter = { 0 };
+    RECORD_STORAGE storage;
+    ULONG idx = 0UL;
+
+    filter.ProcessIdsAmount = FG_MONITOR_FILTER_PROCESS_IDS_MAX;
+    for (idx = 0UL; idx < FG_MONITOR_FILTER_PROCESS_IDS_MAX; idx++) {
+        filter.ProcessIds[idx] = 4000UL + idx * 4UL;
+    }
+
+    for (idx = 0UL; idx < FG_MONITOR_FILTER_PROCESS_IDS_MAX; idx++) {
+        SetRecord(&storage, IRP_MJ_CREATE, RuleMajorReadonly, 4000 + idx * 4, 1UL, "", "\\Device\\A");
+        CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+        SetRecord(&storage, IRP_MJ_CREATE, RuleMajorReadonly, 4001 + idx * 4, 1UL, "", "\\Device\\A");
+        CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    }
+
+    //
+    // Only the amount of ids set is compared, the rest of the array is ignored.
+    //
+    filter.ProcessIdsAmount = 1UL;
+    SetRecord(&storage, IRP_MJ_CREATE, RuleMajorReadonly, 4004, 1UL, "", "\\Device\\A");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+
+    memset(&filter, 0, sizeof(filter));
+    filter.RuleIdsAmount = 2UL;
+    filter.RuleIds[0] = 7UL;
+    filter.RuleIds[1] = 9UL;
+
+    SetRecord(&storage, IRP_MJ_CREATE, RuleMajorReadonly, 4000, 9UL, "", "\\Device\\A");
+    CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_CREATE, RuleMajorReadonly, 4000, 8UL, "", "\\Device\\A");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+}
+
+static
+VOID
+TestPathPrefix(
+    VOID
+    )
+{
+    FG_MONITOR_FILTER filter = { 0 };
+    RECORD_STORAGE storage;
+
+    SetFilterPrefix(&filter, "\\Device\\HarddiskVolume3\\Users\\");
+
+    SetRecord(&storage, IRP_MJ_WRITE, RuleMajorReadonly, 4000, 1UL, "", "\\device\\harddiskvolume3\\users\\a.txt");
+    CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_WRITE, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\HarddiskVolume3\\Users\\");
+    CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_WRITE, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\HarddiskVolume3\\Windows\\a.txt");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+
+    //
+    // A path shorter than the prefix is rejected before any character is compared.
+    //
+    SetRecord(&storage, IRP_MJ_WRITE, RuleMajorReadonly, 4000, 1UL, "", "\\Device\\HarddiskVolume3\\Users");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_WRITE, RuleMajorReadonly, 4000, 1UL, "", "");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+
+    //
+    // The file path follows the rule expression in the buffer of the records of the
+    // library, the expression itself is never matched against the prefix.
+    //
+    SetRecord(&storage, IRP_MJ_WRITE, RuleMajorReadonly, 4000, 1UL,
+              "\\Device\\HarddiskVolume3\\Users\\*", "\\Device\\HarddiskVolume3\\Users\\a.txt");
+    CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, IRP_MJ_WRITE, RuleMajorReadonly, 4000, 1UL,
+              "\\Device\\HarddiskVolume3\\Users\\*", "\\Device\\HarddiskVolume2\\Users\\a.txt");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+}
+
+static
+VOID
+TestCombinedFields(
+    VOID
+    )
+{
+    FG_MONITOR_FILTER filter = { 0 };
+    RECORD_STORAGE storage;
+
+    filter.MajorFunctions = FG_MONITOR_FILTER_MAJOR_FUNCTION(FG_MONITOR_MAJOR_CREATE_SECTION);
+    filter.RuleMajors = FG_MONITOR_FILTER_RULE_MAJOR(RuleMajorReadonly);
+    filter.ProcessIdsAmount = 1UL;
+    filter.ProcessIds[0] = 4000UL;
+    filter.RuleIdsAmount = 1UL;
+    filter.RuleIds[0] = 3UL;
+    SetFilterPrefix(&filter, "\\Device\\A\\");
+
+    SetRecord(&storage, FG_MONITOR_MAJOR_CREATE_SECTION, RuleMajorReadonly, 4000, 3UL, "", "\\Device\\A\\b");
+    CHECK(FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+
+    //
+    // Every field must match.
+    //
+    SetRecord(&storage, IRP_MJ_WRITE, RuleMajorReadonly, 4000, 3UL, "", "\\Device\\A\\b");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, FG_MONITOR_MAJOR_CREATE_SECTION, RuleMajorAccessDenied, 4000, 3UL, "", "\\Device\\A\\b");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, FG_MONITOR_MAJOR_CREATE_SECTION, RuleMajorReadonly, 4004, 3UL, "", "\\Device\\A\\b");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, FG_MONITOR_MAJOR_CREATE_SECTION, RuleMajorReadonly, 4000, 4UL, "", "\\Device\\A\\b");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+    SetRecord(&storage, FG_MONITOR_MAJOR_CREATE_SECTION, RuleMajorReadonly, 4000, 3UL, "", "\\Device\\B\\b");
+    CHECK(!FgcIsMonitorRecordSubscribed(&filter, &storage.Record));
+}
+
+//
+// Match a mix of records against growing amounts of subscribers, each with a filter
+// of its own: a quarter select by major functions, a quarter by process ids, a
+// quarter by path prefix, and the rest by all of them. The core serves at most
+// FG_MONITOR_SUBSCRIBERS_MAX subscribers, the larger amounts show how the cost of a
+// drained record would grow with the limit.
+//
+static
+VOID
+BenchmarkSubscribers(
+    VOID
+    )
+{
+    static CONST ULONG subscribersAmounts[] = { 1UL, FG_MONITOR_SUBSCRIBERS_MAX, 16UL, 64UL, BENCHMARK_SUBSCRIBERS_MAX };
+    static CONST char *volumes[] = { "\\Device\\HarddiskVolume1\\", "\\Device\\HarddiskVolume2\\",
+                                     "\\Device\\HarddiskVolume3\\", "\\Device\\HarddiskVolume4\\" };
+    char path[128];
+    ULONG seed = 46UL;
+    ULONG idx = 0UL, amountIdx = 0UL, subscriber = 0UL, sections = 0UL;
+    ULONG subscribersAmount = 0UL, rounds = 0UL, round = 0UL;
+    unsigned long long matches = 0ULL, checks = 0ULL;
+    double start = 0.0, seconds = 0.0;
+
+    for (idx = 0UL; idx < BENCHMARK_RECORDS; idx++) {
+        snprintf(path, sizeof(path), "%sUsers\\u%lu\\file%lu.dat",
+                 volumes[NextRandom(&seed) % 4], (unsigned long)(NextRandom(&seed) % 8),
+                 (unsigned long)NextRandom(&seed));
+        SetRecord(&Records[idx], RecordMajors[NextRandom(&seed) % sizeof(RecordMajors)],
+                  (USHORT)(RuleMajorAccessDenied + NextRandom(&seed) % 2), 4000 + NextRandom(&seed) % 32 * 4,
+                  NextRandom(&seed) % 16, "", path);
+        if (FG_MONITOR_MAJOR_CREATE_SECTION == Records[idx].Record.MajorFunction) sections++;
+    }
+
+    CHECK(0UL != sections);
+
+    for (subscriber = 0UL; subscriber < BENCHMARK_SUBSCRIBERS_MAX; subscriber++) {
+
+        FG_MONITOR_FILTER *filter = &Filters[subscriber];
+
+        memset(filter, 0, sizeof(FG_MONITOR_FILTER));
+
+        if (0UL == subscriber % 4 || 3UL == subscriber % 4) {
+            filter->MajorFunctions = FG_MONITOR_FILTER_MAJOR_FUNCTION(RecordMajors[subscriber % sizeof(RecordMajors)]) |
+                                     FG_MONITOR_FILTER_MAJOR_FUNCTION(FG_MONITOR_MAJOR_CREATE_SECTION);
+        }
+
+        if (1UL == subscriber % 4 || 3UL == subscriber % 4) {
+            filter->ProcessIdsAmount = FG_MONITOR_FILTER_PROCESS_IDS_MAX;
+            for (idx = 0UL; idx < FG_MONITOR_FILTER_PROCESS_IDS_MAX; idx++) {
+                filter->ProcessIds[idx] = 4000UL + (subscriber + idx) % 32UL * 4UL;
+            }
+        }
+
+        if (2UL == subscriber % 4 || 3UL == subscriber % 4) {
+            snprintf(path, sizeof(path), "%sUsers\\u%lu\\", volumes[subscriber / 4 % 4], (unsigned long)(subscriber % 8));
+            SetFilterPrefix(filter, path);
+        }
+    }
+
+    printf("subscribers   records/s     matches/s     deliveries/record\n");
+
+    for (amountIdx = 0UL; amountIdx < sizeof(subscribersAmounts) / sizeof(subscribersAmounts[0]); amountIdx++) {
+
+        subscribersAmount = subscribersAmounts[amountIdx];
+        rounds = (ULONG)(BENCHMARK_MATCHES / (subscribersAmount * BENCHMARK_RECORDS)) + 1UL;
+        matches = 0ULL;
+        checks = 0ULL;
+
+        start = GetSeconds();
+
+        for (round = 0UL; round < rounds; round++) {
+            for (idx = 0UL; idx < BENCHMARK_RECORDS; idx++) {
+                for (subscriber = 0UL; subscriber < subscribersAmount; subscriber++) {
+                    if (FgcIsMonitorRecordSubscribed(&Filters[subscriber], &Records[idx].Record)) {
+                        matches++;
+                    }
+                }
+            }
+        }
+
+        seconds = GetSeconds() - start;
+        if (seconds <= 0.0) seconds = 1e-9;
+
+        checks = (unsigned long long)rounds * BENCHMARK_RECORDS * subscribersAmount;
+
+        //
+        // The filters of a subscriber and the records are fixed, so every round
+        // matches the same amount.
+        //
+        CHECK(0ULL == matches % rounds);
+
+        printf("%11lu %11.0f %13.0f %13.2f\n",
+               (unsigned long)subscribersAmount,
+               (double)rounds * BENCHMARK_RECORDS / seconds,
+               (double)checks / seconds,
+               (double)matches / ((double)rounds * BENCHMARK_RECORDS));
+    }
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestEmptyFilter();
+    TestMajorFunctions();
+    TestSectionRecords();
+    TestRuleMajors();
+    TestIds();
+    TestPathPrefix();
+    TestCombinedFields();
+    BenchmarkSubscribers();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All monitor filter checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,746 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    MonitorRingTests.c
+
+Abstract:
+
+    Tests of the per processor monitor record rings, written and drained the way
+    FgcPublishMonitorRecord and FgcDrainMonitorRing do. The padding at the end of
+    the buffer and the release of a span wrapping around it are checked, random
+    reservations, publications and bounded drains are replayed against a queue
+    model, then many producer threads stress one ring against a draining thread.
+    The records throughput is measured with the drained space released entry by
+    entry and in one span.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "HostShim.h"
+#include "FileGuard.h"
+#include "MonitorRing.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+#define PRODUCERS_MAX 16
+#define PATH_CHARS_MAX 200
+
+//
+// The path of a record is derived from its producer and sequence number, so that
+// the consumer can check every byte it drains.
+//
+#define PATH_CHARS(_producer_, _sequence_) (((_sequence_) * 7 + (_producer_)) % PATH_CHARS_MAX + 1)
+#define PATH_CHAR(_producer_, _sequence_, _idx_) ((WCHAR)((_producer_) * 31 + (_sequence_) + (_idx_)))
+
+typedef struct _RING_CONSUMER {
+
+    //
+    // Records a drain takes at most, zero for all, as when an output fills up. The
+    // drained space is released entry by entry or in one span.
+    //
+    ULONG Limit;
+    BOOLEAN ReleasePerEntry;
+
+    ULONG NextSequence[PRODUCERS_MAX];
+    ULONG Received;
+    ULONG Paddings;
+    ULONG Corrupted;
+} RING_CONSUMER, *PRING_CONSUMER;
+
+static
+PFG_MONITOR_RING
+CreateRing(
+    VOID
+    )
+{
+    PFG_MONITOR_RING ring = aligned_alloc(64, sizeof(FG_MONITOR_RING));
+
+    if (NULL == ring) abort();
+
+    RtlZeroMemory(ring, sizeof(FG_MONITOR_RING));
+    ring->Buffer = aligned_alloc(64, FG_MONITOR_RING_SIZE);
+    if (NULL == ring->Buffer) abort();
+    RtlZeroMemory(ring->Buffer, FG_MONITOR_RING_SIZE);
+
+    return ring;
+}
+
+static
+VOID
+FreeRing(
+    _In_ PFG_MONITOR_RING Ring
+    )
+{
+    free(Ring->Buffer);
+    free(Ring);
+}
+
+static
+double
+GetSeconds(
+    VOID
+    )
+{
+    struct timespec now;
+
+    timespec_get(&now, TIME_UTC);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static
+ULONG
+GetEntrySize(
+    _In_ ULONG Producer,
+    _In_ ULONG Sequence
+    )
+{
+    return (ULONG)FG_MONITOR_RING_ENTRY_SIZE(sizeof(FG_MONITOR_RECORD) + PATH_CHARS(Producer, Sequence) * sizeof(WCHAR));
+}
+
+static
+VOID
+PublishRecord(
+    _Inout_ FG_MONITOR_RING_ENTRY *Entry,
+    _In_ ULONG Producer,
+    _In_ ULONG Sequence
+    )
+{
+    ULONG pathChars = PATH_CHARS(Producer, Sequence);
+    ULONG idx = 0;
+
+    RtlZeroMemory(&Entry->Record, sizeof(FG_MONITOR_RECORD));
+    Entry->Record.RequestorPid = Producer;
+    Entry->Record.RequestorTid = Sequence;
+    Entry->Record.FilePathSize = (USHORT)(pathChars * sizeof(WCHAR));
+    for (idx = 0; idx < pathChars; idx++) {
+        Entry->Record.Buffer[idx] = PATH_CHAR(Producer, Sequence, idx);
+    }
+
+    InterlockedExchange(&Entry->State, FG_MONITOR_RING_ENTRY_RECORD);
+}
+
+//
+// Publishes a record the way FgcPublishMonitorRecord does, the reservation is
+// returned for the batching checks.
+//
+static
+BOOLEAN
+Produce(
+    _Inout_ PFG_MONITOR_RING Ring,
+    _In_ ULONG Producer,
+    _In_ ULONG Sequence,
+    _Out_ PULONG Reserved,
+    _Out_ PULONG Fill
+    )
+{
+    FG_MONITOR_RING_ENTRY *entry = NULL;
+
+    if (!FgcReserveMonitorRingEntry(Ring, GetEntrySize(Producer, Sequence), &entry, Reserved, Fill)) {
+        InterlockedIncrement64(&Ring->Dropped);
+        return FALSE;
+    }
+
+    PublishRecord(entry, Producer, Sequence);
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+IsRecordIntact(
+    _In_ CONST FG_MONITOR_RING_ENTRY *Entry
+    )
+{
+    ULONG producer = (ULONG)Entry->Record.RequestorPid;
+    ULONG sequence = (ULONG)Entry->Record.RequestorTid;
+    ULONG pathChars = PATH_CHARS(producer, sequence);
+    ULONG idx = 0;
+
+    if (producer >= PRODUCERS_MAX ||
+        Entry->Record.FilePathSize != pathChars * sizeof(WCHAR) ||
+        Entry->Size != GetEntrySize(producer, sequence)) {
+        return FALSE;
+    }
+
+    for (idx = 0; idx < pathChars; idx++) {
+        if (PATH_CHAR(producer, sequence, idx) != Entry->Record.Buffer[idx]) return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// Drains the published prefix of the ring the way FgcDrainMonitorRing does, the
+// records of each producer must come in their order, none missing but the dropped.
+//
+static
+ULONG
+Drain(
+    _Inout_ PFG_MONITOR_RING Ring,
+    _Inout_ PRING_CONSUMER Consumer
+    )
+{
+    LONG64 head = ReadAcquire64(&Ring->Head);
+    LONG64 tail = Ring->Tail;
+    LONG64 newTail = tail;
+    FG_MONITOR_RING_ENTRY *entry = NULL;
+    ULONG producer = 0;
+    ULONG drained = 0;
+
+    while (newTail != head) {
+
+        entry = FgcPeekMonitorRingEntry(Ring, newTail);
+        if (NULL == entry) {
+            break;
+        }
+
+        if (FG_MONITOR_RING_ENTRY_RECORD == entry->State && 0 != Consumer->Limit && drained == Consumer->Limit) {
+            break;
+        }
+
+        if (FG_MONITOR_RING_ENTRY_PADDING == entry->State) {
+            Consumer->Paddings++;
+        } else if (!IsRecordIntact(entry)) {
+            Consumer->Corrupted++;
+        } else {
+            producer = (ULONG)entry->Record.RequestorPid;
+            if ((ULONG)entry->Record.RequestorTid < Consumer->NextSequence[producer]) {
+                Consumer->Corrupted++;
+            }
+            Consumer->NextSequence[producer] = (ULONG)entry->Record.RequestorTid + 1;
+            Consumer->Received++;
+            drained++;
+        }
+
+        if (Consumer->ReleasePerEntry) {
+            tail = newTail;
+            newTail += entry->Size;
+            FgcReleaseMonitorRingSpan(Ring, tail, newTail);
+        } else {
+            newTail += entry->Size;
+        }
+    }
+
+    if (!Consumer->ReleasePerEntry) {
+        FgcReleaseMonitorRingSpan(Ring, tail, newTail);
+    }
+
+    return drained;
+}
+
+static
+VOID
+TestEntryLayout(
+    VOID
+    )
+{
+    ULONG recordSize = 0;
+
+    for (recordSize = sizeof(FG_MONITOR_RECORD); recordSize < sizeof(FG_MONITOR_RECORD) + 64; recordSize++) {
+        CHECK(0 == FG_MONITOR_RING_ENTRY_SIZE(recordSize) % sizeof(LONGLONG));
+        CHECK(FG_MONITOR_RING_ENTRY_SIZE(recordSize) >= FIELD_OFFSET(FG_MONITOR_RING_ENTRY, Record) + recordSize);
+        CHECK(FG_MONITOR_RING_ENTRY_SIZE(recordSize) < FIELD_OFFSET(FG_MONITOR_RING_ENTRY, Record) + recordSize + sizeof(LONGLONG));
+    }
+
+    CHECK(0 == (FG_MONITOR_RING_SIZE & (FG_MONITOR_RING_SIZE - 1)));
+    CHECK(0 == FIELD_OFFSET(FG_MONITOR_RING, Head) % 64);
+    CHECK(0 == FIELD_OFFSET(FG_MONITOR_RING, Tail) % 64);
+    CHECK(FIELD_OFFSET(FG_MONITOR_RING, Tail) - FIELD_OFFSET(FG_MONITOR_RING, Head) >= 64);
+}
+
+static
+VOID
+TestPaddingAndWrap(
+    VOID
+    )
+{
+    PFG_MONITOR_RING ring = CreateRing();
+    FG_MONITOR_RING_ENTRY *entry = NULL;
+    RING_CONSUMER consumer = { 0 };
+    ULONG reserved = 0, fill = 0;
+    ULONG entrySize = GetEntrySize(2, 0);
+    ULONG offset = FG_MONITOR_RING_SIZE - entrySize / 2;
+    ULONG idx = 0;
+
+    //
+    // Start near the end of the buffer, as after many laps.
+    //
+    ring->Head = ring->Tail = 5LL * FG_MONITOR_RING_SIZE + offset;
+
+    CHECK(FgcReserveMonitorRingEntry(ring, entrySize, &entry, &reserved, &fill));
+    CHECK((PUCHAR)entry == ring->Buffer);
+    CHECK(reserved == FG_MONITOR_RING_SIZE - offset + entrySize);
+    CHECK(fill == reserved);
+    CHECK(FG_MONITOR_RING_ENTRY_PADDING == ((FG_MONITOR_RING_ENTRY*)(ring->Buffer + offset))->State);
+    CHECK(FG_MONITOR_RING_SIZE - offset == ((FG_MONITOR_RING_ENTRY*)(ring->Buffer + offset))->Size);
+    CHECK(entrySize == entry->Size);
+
+    //
+    // The padding is published with the reservation, the record is not yet.
+    //
+    CHECK(0 == Drain(ring, &consumer));
+    CHECK(1 == consumer.Paddings);
+    CHECK(ring->Tail == 6LL * FG_MONITOR_RING_SIZE);
+    CHECK(FG_MONITOR_RING_ENTRY_FREE == ((FG_MONITOR_RING_ENTRY*)(ring->Buffer + offset))->State);
+
+    PublishRecord(entry, 2, 0);
+    CHECK(1 == Drain(ring, &consumer));
+    CHECK(ring->Tail == ring->Head);
+    CHECK(FG_MONITOR_RING_ENTRY_FREE == entry->State);
+
+    //
+    // A span wrapping around the end of the buffer is zeroed in both parts.
+    //
+    ring->Head = ring->Tail = 7LL * FG_MONITOR_RING_SIZE - 64;
+    for (idx = 0; idx < 4; idx++) {
+        CHECK(Produce(ring, 1, idx, &reserved, &fill));
+    }
+
+    CHECK(4 == Drain(ring, &consumer));
+    for (idx = 0; idx < FG_MONITOR_RING_SIZE; idx++) {
+        if (0 != ring->Buffer[idx]) break;
+    }
+    CHECK(FG_MONITOR_RING_SIZE == idx);
+    CHECK(0 == consumer.Corrupted);
+
+    FreeRing(ring);
+}
+
+static
+VOID
+TestFullRing(
+    VOID
+    )
+{
+    PFG_MONITOR_RING ring = CreateRing();
+    RING_CONSUMER consumer = { 0 };
+    ULONG reserved = 0, fill = 0;
+    ULONG produced = 0;
+
+    //
+    // The reservations fill the ring up to its size and never past it, then the
+    // records are dropped and counted until the ring is drained.
+    //
+    while (Produce(ring, 0, produced, &reserved, &fill)) {
+        CHECK(fill <= FG_MONITOR_RING_SIZE);
+        CHECK(fill == (ULONG)(ring->Head - ring->Tail));
+        produced++;
+    }
+
+    CHECK(1 == ring->Dropped);
+    CHECK(FG_MONITOR_RING_SIZE - (ring->Head - ring->Tail) < (LONG64)GetEntrySize(0, produced));
+    CHECK(produced == Drain(ring, &consumer));
+    CHECK(Produce(ring, 0, produced, &reserved, &fill));
+    CHECK(1 == Drain(ring, &consumer));
+    CHECK(produced + 1 == consumer.Received);
+    CHECK(0 == consumer.Corrupted);
+
+    FreeRing(ring);
+}
+
+static
+VOID
+TestUnpublishedEntry(
+    VOID
+    )
+{
+    PFG_MONITOR_RING ring = CreateRing();
+    FG_MONITOR_RING_ENTRY *first = NULL;
+    RING_CONSUMER consumer = { 0 };
+    ULONG reserved = 0, fill = 0;
+
+    //
+    // A producer preempted between its reservation and its publication holds the
+    // records published behind it until it is done.
+    //
+    CHECK(FgcReserveMonitorRingEntry(ring, GetEntrySize(0, 0), &first, &reserved, &fill));
+    CHECK(Produce(ring, 0, 1, &reserved, &fill));
+    CHECK(0 == Drain(ring, &consumer));
+    CHECK(0 == ring->Tail);
+
+    PublishRecord(first, 0, 0);
+
+    CHECK(2 == Drain(ring, &consumer));
+    CHECK(2 == consumer.NextSequence[0]);
+    CHECK(0 == consumer.Corrupted);
+
+    FreeRing(ring);
+}
+
+#define MODEL_ENTRIES    1024
+#define MODEL_OPERATIONS 200000
+
+typedef struct _MODEL_ENTRY {
+    FG_MONITOR_RING_ENTRY *Entry;
+    ULONG Size;
+    ULONG Sequence;
+    BOOLEAN Padding;
+    BOOLEAN Published;
+} MODEL_ENTRY, *PMODEL_ENTRY;
+
+static
+VOID
+TestQueueModel(
+    VOID
+    )
+{
+    PFG_MONITOR_RING ring = CreateRing();
+    static MODEL_ENTRY model[MODEL_ENTRIES];
+    RING_CONSUMER consumer = { 0 };
+    FG_MONITOR_RING_ENTRY *entry = NULL;
+    LONG64 head = 0, tail = 0;
+    ULONG first = 0, amount = 0;
+    ULONG sequence = 0, received = 0, rejected = 0;
+    ULONG reserved = 0, fill = 0, offset = 0, padding = 0, size = 0, expected = 0;
+    ULONG pending = 0, operation = 0, idx = 0;
+
+    //
+    // The model is a FIFO of the reserved entries, the padding ones included. A drain
+    // takes its published prefix, up to a limit, and the ring has room for an entry
+    // exactly when the FIFO then spans no more than the ring size.
+    //
+    srand(42);
+    for (operation = 0; operation < MODEL_OPERATIONS; operation++) {
+
+        switch (rand() % 4) {
+        case 0:
+        case 1:
+            if (amount + 2 > MODEL_ENTRIES) break;
+
+            size = GetEntrySize(0, sequence);
+            offset = (ULONG)(head & (FG_MONITOR_RING_SIZE - 1));
+            padding = (FG_MONITOR_RING_SIZE - offset < size) ? FG_MONITOR_RING_SIZE - offset : 0;
+
+            if (head + padding + size - tail > FG_MONITOR_RING_SIZE) {
+                CHECK(!FgcReserveMonitorRingEntry(ring, size, &entry, &reserved, &fill));
+                rejected++;
+                break;
+            }
+
+            CHECK(FgcReserveMonitorRingEntry(ring, size, &entry, &reserved, &fill));
+            CHECK(reserved == padding + size);
+            CHECK(fill == (ULONG)(head + padding + size - tail));
+
+            if (0 != padding) {
+                model[(first + amount++) % MODEL_ENTRIES] = (MODEL_ENTRY){ NULL, padding, 0, TRUE, TRUE };
+                head += padding;
+            }
+
+            CHECK((PUCHAR)entry == ring->Buffer + (head & (FG_MONITOR_RING_SIZE - 1)));
+            model[(first + amount++) % MODEL_ENTRIES] = (MODEL_ENTRY){ entry, size, sequence++, FALSE, FALSE };
+            head += size;
+            break;
+
+        case 2:
+            if (0 == amount) break;
+
+            //
+            // The producers publish in any order.
+            //
+            idx = (first + (ULONG)rand() % amount) % MODEL_ENTRIES;
+            if (!model[idx].Published) {
+                PublishRecord(model[idx].Entry, 0, model[idx].Sequence);
+                model[idx].Published = TRUE;
+            }
+            break;
+
+        default:
+            consumer.Limit = (ULONG)rand() % 8;
+            expected = 0;
+            while (0 != amount && model[first].Published &&
+                   (model[first].Padding || 0 == consumer.Limit || expected < consumer.Limit)) {
+                if (!model[first].Padding) expected++;
+                tail += model[first].Size;
+                first = (first + 1) % MODEL_ENTRIES;
+                amount--;
+            }
+
+            CHECK(expected == Drain(ring, &consumer));
+            CHECK(tail == ring->Tail);
+            received += expected;
+            break;
+        }
+
+        CHECK(head == ring->Head);
+    }
+
+    for (idx = 0; idx < amount; idx++) {
+        if (!model[(first + idx) % MODEL_ENTRIES].Padding) pending++;
+    }
+
+    CHECK(0 != rejected);
+    CHECK(received == consumer.Received);
+    CHECK(received + pending == sequence);
+    CHECK(0 == consumer.Corrupted);
+
+    FreeRing(ring);
+}
+
+#ifndef _WIN32
+
+#define STRESS_PRODUCERS 8
+#define STRESS_RECORDS   20000
+#define BENCHMARK_RECORDS 100000
+
+typedef struct _PRODUCER_CONTEXT {
+    PFG_MONITOR_RING Ring;
+    ULONG Producer;
+    ULONG Records;
+    BOOLEAN Retry;
+    ULONG Dropped;
+    ULONG Retries;
+    volatile LONG *Finished;
+} PRODUCER_CONTEXT, *PPRODUCER_CONTEXT;
+
+typedef struct _CONSUMER_CONTEXT {
+    PFG_MONITOR_RING Ring;
+    ULONG Producers;
+    volatile LONG *Finished;
+    RING_CONSUMER Consumer;
+} CONSUMER_CONTEXT, *PCONSUMER_CONTEXT;
+
+static
+void *
+ProducerRoutine(
+    void *Parameter
+    )
+{
+    PPRODUCER_CONTEXT context = Parameter;
+    ULONG reserved = 0, fill = 0;
+    ULONG sequence = 0;
+
+    //
+    // Without retries the records of a full ring are dropped, as in the driver. The
+    // stress retries every other record so that both outcomes are frequent.
+    //
+    for (sequence = 0; sequence < context->Records; sequence++) {
+        while (!Produce(context->Ring, context->Producer, sequence, &reserved, &fill)) {
+            if (!context->Retry && 0 != (sequence & 1)) {
+                context->Dropped++;
+                break;
+            }
+            context->Retries++;
+            sched_yield();
+        }
+    }
+
+    InterlockedIncrement(context->Finished);
+
+    return NULL;
+}
+
+static
+void *
+ConsumerRoutine(
+    void *Parameter
+    )
+{
+    PCONSUMER_CONTEXT context = Parameter;
+    LONG finished = 0;
+
+    //
+    // The producers finished before the last drain published all their records.
+    //
+    do {
+        finished = ReadAcquire(context->Finished);
+        if (0 == Drain(context->Ring, &context->Consumer)) {
+            sched_yield();
+        }
+    } while ((ULONG)finished < context->Producers);
+
+    Drain(context->Ring, &context->Consumer);
+
+    return NULL;
+}
+
+static
+ULONG
+RunProducers(
+    _In_ ULONG Producers,
+    _In_ ULONG Records,
+    _In_ BOOLEAN Retry,
+    _In_ BOOLEAN ReleasePerEntry,
+    _Out_ PRING_CONSUMER Consumer,
+    _Out_ PULONG Retries,
+    _Out_ double *Seconds
+    )
+{
+    PFG_MONITOR_RING ring = CreateRing();
+    PRODUCER_CONTEXT producers[PRODUCERS_MAX];
+    CONSUMER_CONTEXT consumer = { 0 };
+    pthread_t threads[PRODUCERS_MAX + 1];
+    volatile LONG finished = 0;
+    ULONG dropped = 0;
+    ULONG idx = 0;
+    double start = 0.0;
+
+    consumer.Ring = ring;
+    consumer.Producers = Producers;
+    consumer.Finished = &finished;
+    consumer.Consumer.ReleasePerEntry = ReleasePerEntry;
+
+    start = GetSeconds();
+    CHECK(0 == pthread_create(&threads[Producers], NULL, ConsumerRoutine, &consumer));
+    for (idx = 0; idx < Producers; idx++) {
+        producers[idx].Ring = ring;
+        producers[idx].Producer = idx;
+        producers[idx].Records = Records;
+        producers[idx].Retry = Retry;
+        producers[idx].Dropped = 0;
+        producers[idx].Retries = 0;
+        producers[idx].Finished = &finished;
+        CHECK(0 == pthread_create(&threads[idx], NULL, ProducerRoutine, &producers[idx]));
+    }
+
+    for (idx = 0; idx <= Producers; idx++) {
+        CHECK(0 == pthread_join(threads[idx], NULL));
+    }
+    *Seconds = GetSeconds() - start;
+
+    *Retries = 0;
+    for (idx = 0; idx < Producers; idx++) {
+        dropped += producers[idx].Dropped;
+        *Retries += producers[idx].Retries;
+    }
+
+    CHECK((LONG64)dropped <= ring->Dropped);
+    CHECK(ring->Head == ring->Tail);
+    *Consumer = consumer.Consumer;
+
+    FreeRing(ring);
+
+    return dropped;
+}
+
+static
+VOID
+TestConcurrentProducers(
+    VOID
+    )
+{
+    RING_CONSUMER consumer;
+    ULONG dropped = 0;
+    ULONG retries = 0;
+    double seconds = 0.0;
+
+    //
+    // Every record is either received intact and in the order of its producer, or
+    // dropped and counted, none is lost or torn.
+    //
+    dropped = RunProducers(STRESS_PRODUCERS, STRESS_RECORDS, FALSE, FALSE, &consumer, &retries, &seconds);
+
+    CHECK(0 == consumer.Corrupted);
+    CHECK(consumer.Received >= STRESS_PRODUCERS * STRESS_RECORDS / 2);
+    CHECK(consumer.Received + dropped == STRESS_PRODUCERS * STRESS_RECORDS);
+
+    //
+    // And so with the drained space released entry by entry.
+    //
+    dropped = RunProducers(STRESS_PRODUCERS, STRESS_RECORDS, FALSE, TRUE, &consumer, &retries, &seconds);
+
+    CHECK(0 == consumer.Corrupted);
+    CHECK(consumer.Received >= STRESS_PRODUCERS * STRESS_RECORDS / 2);
+    CHECK(consumer.Received + dropped == STRESS_PRODUCERS * STRESS_RECORDS);
+}
+
+static
+VOID
+BenchmarkProducers(
+    VOID
+    )
+{
+    RING_CONSUMER consumer;
+    ULONG producers = 0;
+    ULONG dropped = 0;
+    ULONG retries = 0;
+    ULONG perEntry = 0;
+    double seconds = 0.0;
+
+    //
+    // The producers wait for room rather than drop, the rate is the one the draining
+    // thread sustains against them. Releasing each drained entry hands space back
+    // earlier but writes the shared tail once per record, the retries count how
+    // often the producers found the ring full.
+    //
+    for (producers = 1; producers <= PRODUCERS_MAX; producers *= 4) {
+        for (perEntry = 0; perEntry < 2; perEntry++) {
+            dropped = RunProducers(producers, BENCHMARK_RECORDS / producers, TRUE, (BOOLEAN)perEntry,
+                                   &consumer, &retries, &seconds);
+            CHECK(0 == dropped);
+            CHECK(0 == consumer.Corrupted);
+            CHECK(consumer.Received == BENCHMARK_RECORDS / producers * producers);
+            printf("ring: %2lu producers, %-9s release, %10.0f records/s, %7.3f retries per record\n",
+                   (unsigned long)producers, perEntry ? "per entry" : "span",
+                   consumer.Received / seconds, (double)retries / consumer.Received);
+        }
+    }
+}
+
+#endif
+
+int
+main(
+    VOID
+    )
+{
+    TestEntryLayout();
+    TestPaddingAndWrap();
+    TestFullRing();
+    TestUnpublishedEntry();
+    TestQueueModel();
+#ifndef _WIN32
+    TestConcurrentProducers();
+    BenchmarkProducers();
+#endif
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All monitor ring checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,279 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    ProcessCacheTests.c
+
+Abstract:
+
+    Tests of the process cache buckets. Processes are found by id through their
+    id bucket, and the processes running one image share the rule subset of the
+    rules generation through their image bucket, so a subset is built once per
+    image rather than once per process.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HostShim.h"
+
+//
+// The cache only reads the generation of a rule subset.
+//
+typedef struct _FGC_RULE_SUBSET {
+    LONG Generation;
+} FGC_RULE_SUBSET, *PFGC_RULE_SUBSET;
+
+#include "ProcessCache.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+#define PROCESS_ID(_n_) ((HANDLE)(ULONG_PTR)((_n_) * 4))
+
+#define MODEL_PROCESSES 4096
+#define MODEL_IMAGES    16
+
+typedef struct _TEST_PROCESS {
+    FGC_PROCESS_ENTRY Entry;
+    UNICODE_STRING ImageName;
+    WCHAR ImageBuffer[64];
+} TEST_PROCESS, *PTEST_PROCESS;
+
+static FGC_PROCESS_CACHE Cache;
+
+static
+VOID
+InitializeCache(
+    VOID
+    )
+{
+    ULONG idx = 0;
+
+    RtlZeroMemory(&Cache, sizeof(Cache));
+
+    for (; idx < FG_PROCESS_CACHE_BUCKETS; idx++) {
+        InitializeListHead(&Cache.Buckets[idx]);
+        InitializeListHead(&Cache.ImageBuckets[idx]);
+    }
+}
+
+static
+ULONG
+HashImageName(
+    _In_ PCUNICODE_STRING ImageName
+    )
+{
+    ULONG hash = 0, idx = 0;
+
+    for (; idx < ImageName->Length / sizeof(WCHAR); idx++) {
+        hash = hash * 31 + RtlUpcaseUnicodeChar(ImageName->Buffer[idx]);
+    }
+
+    return hash;
+}
+
+static
+VOID
+InitializeProcess(
+    _Out_ PTEST_PROCESS Process,
+    _In_ ULONG Id,
+    _In_ LONG64 CreateTime,
+    _In_ const char *ImageName
+    )
+{
+    RtlZeroMemory(Process, sizeof(TEST_PROCESS));
+    HostInitUnicodeString(&Process->ImageName, Process->ImageBuffer, ImageName);
+
+    Process->Entry.ProcessId = PROCESS_ID(Id);
+    Process->Entry.CreateTime = CreateTime;
+    Process->Entry.ImageName = &Process->ImageName;
+    Process->Entry.ImageHash = HashImageName(&Process->ImageName);
+}
+
+static
+VOID
+TestLookup(
+    VOID
+    )
+{
+    static TEST_PROCESS processes[3];
+
+    InitializeCache();
+
+    //
+    // The ids a bucket amount apart share an id bucket.
+    //
+    InitializeProcess(&processes[0], 10, 1, "\\DEVICE\\HARDDISKVOLUME1\\A.EXE");
+    InitializeProcess(&processes[1], 10 + FG_PROCESS_CACHE_BUCKETS, 2, "\\DEVICE\\HARDDISKVOLUME1\\B.EXE");
+    InitializeProcess(&processes[2], 11, 3, "\\DEVICE\\HARDDISKVOLUME1\\A.EXE");
+
+    CHECK(NULL == FgcLookupProcessEntry(&Cache, PROCESS_ID(10)));
+
+    FgcInsertProcessEntry(&Cache, &processes[0].Entry);
+    FgcInsertProcessEntry(&Cache, &processes[1].Entry);
+    FgcInsertProcessEntry(&Cache, &processes[2].Entry);
+    CHECK(3 == Cache.EntriesAmount);
+
+    CHECK(&processes[0].Entry == FgcLookupProcessEntry(&Cache, PROCESS_ID(10)));
+    CHECK(&processes[1].Entry == FgcLookupProcessEntry(&Cache, PROCESS_ID(10 + FG_PROCESS_CACHE_BUCKETS)));
+    CHECK(&processes[2].Entry == FgcLookupProcessEntry(&Cache, PROCESS_ID(11)));
+    CHECK(NULL == FgcLookupProcessEntry(&Cache, PROCESS_ID(12)));
+
+    //
+    // An unlinked entry is gone from both of its buckets.
+    //
+    FgcUnlinkProcessEntry(&Cache, &processes[0].Entry);
+    CHECK(2 == Cache.EntriesAmount);
+    CHECK(NULL == FgcLookupProcessEntry(&Cache, PROCESS_ID(10)));
+    CHECK(&processes[1].Entry == FgcLookupProcessEntry(&Cache, PROCESS_ID(10 + FG_PROCESS_CACHE_BUCKETS)));
+
+    FgcUnlinkProcessEntry(&Cache, &processes[1].Entry);
+    FgcUnlinkProcessEntry(&Cache, &processes[2].Entry);
+    CHECK(0 == Cache.EntriesAmount);
+}
+
+static
+VOID
+TestSharedRuleSubset(
+    VOID
+    )
+{
+    static TEST_PROCESS processes[4];
+    FGC_RULE_SUBSET subset = { 7 };
+
+    InitializeCache();
+
+    InitializeProcess(&processes[0], 20, 1, "\\DEVICE\\HARDDISKVOLUME1\\WINDOWS\\NOTEPAD.EXE");
+    InitializeProcess(&processes[1], 21, 2, "\\Device\\HarddiskVolume1\\Windows\\notepad.exe");
+    InitializeProcess(&processes[2], 22, 3, "\\DEVICE\\HARDDISKVOLUME1\\WINDOWS\\CALC.EXE");
+    InitializeProcess(&processes[3], 23, 4, "\\DEVICE\\HARDDISKVOLUME1\\WINDOWS\\NOTEPAD.EXE");
+
+    //
+    // A colliding hash must not share the subset of another image.
+    //
+    processes[2].Entry.ImageHash = processes[0].Entry.ImageHash;
+
+    FgcInsertProcessEntry(&Cache, &processes[0].Entry);
+    FgcInsertProcessEntry(&Cache, &processes[1].Entry);
+    FgcInsertProcessEntry(&Cache, &processes[2].Entry);
+
+    CHECK(processes[0].Entry.ImageHash == processes[1].Entry.ImageHash);
+    CHECK(NULL == FgcLookupSharedRuleSubset(&Cache, &processes[1].Entry, 7));
+
+    processes[0].Entry.RuleSubset = &subset;
+
+    //
+    // The image path is compared case insensitively, and only a subset of the
+    // current generation is shared.
+    //
+    CHECK(&subset == FgcLookupSharedRuleSubset(&Cache, &processes[1].Entry, 7));
+    CHECK(NULL == FgcLookupSharedRuleSubset(&Cache, &processes[1].Entry, 8));
+    CHECK(NULL == FgcLookupSharedRuleSubset(&Cache, &processes[2].Entry, 7));
+
+    //
+    // An entry never finds its own subset, and an entry which is not cached, as
+    // the one of an exiting process, still finds the subset of its image.
+    //
+    CHECK(NULL == FgcLookupSharedRuleSubset(&Cache, &processes[0].Entry, 7));
+    CHECK(&subset == FgcLookupSharedRuleSubset(&Cache, &processes[3].Entry, 7));
+
+    FgcUnlinkProcessEntry(&Cache, &processes[0].Entry);
+    CHECK(NULL == FgcLookupSharedRuleSubset(&Cache, &processes[3].Entry, 7));
+}
+
+static
+VOID
+TestSubsetsBuiltPerImage(
+    VOID
+    )
+{
+    static TEST_PROCESS processes[MODEL_PROCESSES];
+    static FGC_RULE_SUBSET subsets[2 * MODEL_IMAGES];
+    ULONG built = 0, idx = 0;
+    LONG generation = 0;
+    PFGC_RULE_SUBSET subset = NULL;
+    char imageName[64];
+
+    InitializeCache();
+
+    //
+    // Every process gets its subset as FgcGetProcessRuleSubset does: shared from a
+    // process of the same image, or built. The rules change once in the middle.
+    //
+    for (idx = 0; idx < MODEL_PROCESSES; idx++) {
+
+        snprintf(imageName, sizeof(imageName), "\\DEVICE\\HARDDISKVOLUME1\\IMAGE%lu.EXE", (unsigned long)(idx % MODEL_IMAGES));
+        InitializeProcess(&processes[idx], idx + 1, idx, imageName);
+        FgcInsertProcessEntry(&Cache, &processes[idx].Entry);
+
+        generation = idx < MODEL_PROCESSES / 2 ? 1 : 2;
+        subset = FgcLookupSharedRuleSubset(&Cache, &processes[idx].Entry, generation);
+        if (NULL == subset) {
+            CHECK(built < 2 * MODEL_IMAGES);
+            if (built >= 2 * MODEL_IMAGES) break;
+            subset = &subsets[built++];
+            subset->Generation = generation;
+        }
+
+        processes[idx].Entry.RuleSubset = subset;
+    }
+
+    CHECK(2 * MODEL_IMAGES == built);
+    CHECK(MODEL_PROCESSES == Cache.EntriesAmount);
+
+    for (idx = 0; idx < MODEL_PROCESSES; idx++) {
+        CHECK(&processes[idx].Entry == FgcLookupProcessEntry(&Cache, PROCESS_ID(idx + 1)));
+    }
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestLookup();
+    TestSharedRuleSubset();
+    TestSubsetsBuiltPerImage();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All process cache checks passed\n");
+    return EXIT_SUCCESS;
+}
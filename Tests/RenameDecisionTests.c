@@ -0,0 +1,371 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    RenameDecisionTests.c
+
+Abstract:
+
+    Tests of the rename destination decision and of the cache of directories no
+    rule could match any file under. A cached verdict must never outlive the rules
+    partition it was made from.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "HostShim.h"
+#include "RuleExpression.h"
+#include "UnruledDirectories.h"
+#include "RenameDecision.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+#define NAME_CHARS 260
+#define MAX_RULES  8
+
+//
+// The volume state FgcIsDirectoryRuled reads: the expressions of the rules
+// partition, its generation and the cache entries of the instance context.
+//
+typedef struct _VOLUME {
+    UNICODE_STRING VolumeName;
+    WCHAR VolumeBuffer[NAME_CHARS];
+    UNICODE_STRING Rules[MAX_RULES];
+    WCHAR RuleBuffers[MAX_RULES][NAME_CHARS];
+    ULONG RulesAmount;
+    LONG Generation;
+    FG_UNRULED_DIRECTORY_ENTRY UnruledDirectories[FG_UNRULED_DIRECTORIES_AMOUNT];
+    ULONG Evaluations;
+} VOLUME;
+
+static
+VOID
+InitVolume(
+    _Out_ VOLUME *Volume,
+    _In_ const char *VolumeName
+    )
+{
+    memset(Volume, 0, sizeof(VOLUME));
+    HostInitUnicodeString(&Volume->VolumeName, Volume->VolumeBuffer, VolumeName);
+}
+
+//
+// A rule change rebuilds the partition with the next generation.
+//
+static
+VOID
+AddRule(
+    _Inout_ VOLUME *Volume,
+    _In_ const char *Expression
+    )
+{
+    HostInitUnicodeString(&Volume->Rules[Volume->RulesAmount],
+                          Volume->RuleBuffers[Volume->RulesAmount],
+                          Expression);
+    Volume->RulesAmount++;
+    Volume->Generation++;
+}
+
+static
+VOID
+FreeVolume(
+    _Inout_ VOLUME *Volume
+    )
+{
+    ULONG idx = 0;
+
+    for (idx = 0; idx < FG_UNRULED_DIRECTORIES_AMOUNT; idx++) {
+        if (NULL != Volume->UnruledDirectories[idx].DirectoryName) {
+            free(Volume->UnruledDirectories[idx].DirectoryName);
+        }
+    }
+}
+
+static
+ULONG
+HashPath(
+    _In_ PCUNICODE_STRING Path
+    )
+{
+    ULONG hash = 0, idx = 0;
+
+    for (idx = 0; idx < Path->Length / sizeof(WCHAR); idx++) {
+        hash = hash * 31 + HostUpcaseUnicodeChar(Path->Buffer[idx]);
+    }
+
+    return hash;
+}
+
+//
+// FgcIsDirectoryRuled without the locks.
+//
+static
+BOOLEAN
+IsDirectoryRuled(
+    _Inout_ VOLUME *Volume,
+    _In_ const char *DirectoryPath
+    )
+{
+    WCHAR buffer[NAME_CHARS];
+    UNICODE_STRING directoryPath;
+    PFG_UNRULED_DIRECTORY_ENTRY entry = NULL;
+    PUNICODE_STRING directoryName = NULL, oldDirectoryName = NULL;
+    ULONG idx = 0;
+
+    HostInitUnicodeString(&directoryPath, buffer, DirectoryPath);
+
+    entry = FgcGetUnruledDirectoryEntry(Volume->UnruledDirectories, HashPath(&directoryPath));
+    if (FgcIsUnruledDirectoryCached(entry, Volume->Generation, &directoryPath)) return FALSE;
+
+    Volume->Evaluations++;
+    for (idx = 0; idx < Volume->RulesAmount; idx++) {
+        if (FgcIsExpressionAppliedToDirectory(&Volume->Rules[idx], &Volume->VolumeName, &directoryPath)) {
+            return TRUE;
+        }
+    }
+
+    directoryName = malloc(sizeof(UNICODE_STRING) + directoryPath.Length);
+    if (NULL == directoryName) return FALSE;
+
+    directoryName->Buffer = (PWCHAR)(directoryName + 1);
+    directoryName->Length = directoryPath.Length;
+    directoryName->MaximumLength = directoryPath.Length;
+    memcpy(directoryName->Buffer, directoryPath.Buffer, directoryPath.Length);
+
+    oldDirectoryName = FgcCacheUnruledDirectory(entry, directoryName, Volume->Generation);
+    if (NULL != oldDirectoryName) {
+        free(oldDirectoryName);
+    }
+
+    return FALSE;
+}
+
+static
+VOID
+TestDestinationMatch(
+    VOID
+    )
+{
+    static const LONG amounts[] = { 0, 1, 2, 100 };
+
+    FGC_RENAME_DESTINATION_MATCH match = RenameDestinationSkip;
+    ULONG idx = 0;
+    BOOLEAN instanceKnown = FALSE, nameRequired = FALSE;
+
+    for (instanceKnown = FALSE; instanceKnown <= TRUE; instanceKnown++) {
+        for (nameRequired = FALSE; nameRequired <= TRUE; nameRequired++) {
+            for (idx = 0; idx < sizeof(amounts) / sizeof(amounts[0]); idx++) {
+
+                match = FgcGetRenameDestinationMatch(instanceKnown, amounts[idx], nameRequired);
+
+                //
+                // Without the instance context the rules amount is unknown, the whole
+                // rule list is matched.
+                //
+                if (!instanceKnown) {
+                    CHECK(RenameDestinationRules == match);
+                    continue;
+                }
+
+                //
+                // A destination is only looked up if it is matched or recorded.
+                //
+                CHECK((RenameDestinationSkip == match) == (0 == amounts[idx] && !nameRequired));
+                CHECK((RenameDestinationRecord == match) == (0 == amounts[idx] && nameRequired));
+                CHECK((RenameDestinationParent == match) == (0 != amounts[idx]));
+            }
+        }
+    }
+}
+
+static
+VOID
+TestRenameVerdict(
+    VOID
+    )
+{
+    VOLUME volume;
+    ULONG evaluations = 0;
+
+    InitVolume(&volume, "\\DEVICE\\HARDDISKVOLUME1");
+    AddRule(&volume, "\\DEVICE\\HARDDISKVOLUME1\\SECRET\\*");
+    AddRule(&volume, "\\DEVICE\\HARDDISKVOLUME1\\*\\DESKTOP.INI");
+
+    //
+    // A destination whose parent a rule may apply under is matched every time,
+    // only negative verdicts are cached.
+    //
+    CHECK(IsDirectoryRuled(&volume, "\\secret\\"));
+    CHECK(IsDirectoryRuled(&volume, "\\secret\\"));
+    CHECK(2 == volume.Evaluations);
+
+    //
+    // Renames into the same unruled directory are answered by the cache, whatever
+    // the case of the path.
+    //
+    volume.RulesAmount = 1;
+    volume.Evaluations = 0;
+    CHECK(!IsDirectoryRuled(&volume, "\\public\\"));
+    CHECK(!IsDirectoryRuled(&volume, "\\public\\"));
+    CHECK(!IsDirectoryRuled(&volume, "\\PUBLIC\\"));
+    CHECK(!IsDirectoryRuled(&volume, "\\Public\\"));
+    CHECK(1 == volume.Evaluations);
+
+    //
+    // A prefix of a cached directory is another directory.
+    //
+    CHECK(!IsDirectoryRuled(&volume, "\\pub\\"));
+    CHECK(2 == volume.Evaluations);
+
+    evaluations = volume.Evaluations;
+    CHECK(!IsDirectoryRuled(&volume, "\\public\\docs\\"));
+    CHECK(evaluations + 1 == volume.Evaluations);
+
+    FreeVolume(&volume);
+}
+
+static
+VOID
+TestGenerationInvalidation(
+    VOID
+    )
+{
+    VOLUME volume;
+
+    InitVolume(&volume, "\\DEVICE\\HARDDISKVOLUME1");
+    AddRule(&volume, "\\DEVICE\\HARDDISKVOLUME1\\SECRET\\*");
+
+    CHECK(!IsDirectoryRuled(&volume, "\\public\\"));
+    CHECK(!IsDirectoryRuled(&volume, "\\users\\"));
+    CHECK(2 == volume.Evaluations);
+
+    //
+    // A rule added under a cached directory applies at once, the verdict made from
+    // the previous partition is stale.
+    //
+    AddRule(&volume, "\\DEVICE\\HARDDISKVOLUME1\\PUBLIC\\*.DOC");
+    CHECK(IsDirectoryRuled(&volume, "\\public\\"));
+    CHECK(IsDirectoryRuled(&volume, "\\Public\\"));
+
+    //
+    // The other cached directory is evaluated again, then cached for the new
+    // generation.
+    //
+    volume.Evaluations = 0;
+    CHECK(!IsDirectoryRuled(&volume, "\\users\\"));
+    CHECK(!IsDirectoryRuled(&volume, "\\users\\"));
+    CHECK(1 == volume.Evaluations);
+
+    //
+    // A removed rule changes the generation as well.
+    //
+    volume.RulesAmount = 1;
+    volume.Generation++;
+    CHECK(!IsDirectoryRuled(&volume, "\\public\\"));
+
+    //
+    // The generation only has to differ, it may have wrapped around.
+    //
+    volume.Generation = 0x7FFFFFFF;
+    volume.Evaluations = 0;
+    CHECK(!IsDirectoryRuled(&volume, "\\public\\"));
+    volume.Generation = (LONG)0x80000000;
+    CHECK(!IsDirectoryRuled(&volume, "\\public\\"));
+    CHECK(2 == volume.Evaluations);
+
+    FreeVolume(&volume);
+}
+
+static
+VOID
+TestEntryCollision(
+    VOID
+    )
+{
+    WCHAR buffer[NAME_CHARS];
+    UNICODE_STRING path;
+    char other[NAME_CHARS];
+    VOLUME volume;
+    ULONG slot = 0, idx = 0;
+
+    InitVolume(&volume, "\\DEVICE\\HARDDISKVOLUME1");
+    AddRule(&volume, "\\DEVICE\\HARDDISKVOLUME1\\SECRET\\*");
+
+    HostInitUnicodeString(&path, buffer, "\\public\\");
+    slot = HashPath(&path) % FG_UNRULED_DIRECTORIES_AMOUNT;
+
+    for (idx = 0; ; idx++) {
+        snprintf(other, sizeof(other), "\\dir%lu\\", (unsigned long)idx);
+        HostInitUnicodeString(&path, buffer, other);
+        if (slot == HashPath(&path) % FG_UNRULED_DIRECTORIES_AMOUNT) break;
+    }
+
+    //
+    // Directories sharing an entry replace each other, the replaced verdict is
+    // only evaluated again.
+    //
+    CHECK(!IsDirectoryRuled(&volume, "\\public\\"));
+    CHECK(!IsDirectoryRuled(&volume, other));
+    CHECK(2 == volume.Evaluations);
+    CHECK(!IsDirectoryRuled(&volume, other));
+    CHECK(2 == volume.Evaluations);
+    CHECK(!IsDirectoryRuled(&volume, "\\public\\"));
+    CHECK(3 == volume.Evaluations);
+
+    FreeVolume(&volume);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestDestinationMatch();
+    TestRenameVerdict();
+    TestGenerationInvalidation();
+    TestEntryCollision();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All rename decision checks passed\n");
+    return EXIT_SUCCESS;
+}
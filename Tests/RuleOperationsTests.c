@@ -0,0 +1,333 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    RuleOperationsTests.c
+
+Abstract:
+
+    Tests of the operation class masks rules are compiled into. The callbacks of the
+    core only test a bit of the mask cached in the file context, so a compiled mask
+    must hold every class the rule enforces and nothing else. The open decision is
+    checked against every access it may be asked about, and its throughput is
+    measured.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "HostShim.h"
+#include "FileGuard.h"
+
+#define BENCHMARK_ACCESSES  1024
+#define BENCHMARK_DECISIONS 5000000UL
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+static
+FG_RULE_CODE
+MakeRuleCode(
+    _In_ USHORT Major,
+    _In_ USHORT Minor
+    )
+{
+    FG_RULE_CODE code = { 0 };
+
+    code.Major = Major;
+    code.Minor = Minor;
+
+    return code;
+}
+
+static
+VOID
+TestCompileOperations(
+    VOID
+    )
+{
+    FG_RULE_CODE code = { 0 };
+    ULONG operations = 0;
+
+    //
+    // A rule without any class set is enforced on all the classes of its major code.
+    //
+    code = MakeRuleCode(RuleMajorAccessDenied, RuleMinorNone);
+    CHECK(FG_RULE_OPERATIONS_ALL == FG_RULE_COMPILE_OPERATIONS(code, 0));
+
+    code = MakeRuleCode(RuleMajorReadonly, RuleMinorMonitored);
+    CHECK(FG_RULE_OPERATIONS_ALL == FG_RULE_COMPILE_OPERATIONS(code, 0));
+
+    //
+    // A narrowed rule is enforced on the classes it was narrowed to only, each one
+    // on its own and all of them together.
+    //
+    for (operations = 1; operations <= FG_RULE_OPERATIONS_ALL; operations++) {
+        CHECK(operations == FG_RULE_COMPILE_OPERATIONS(code, operations));
+    }
+
+    code = MakeRuleCode(RuleMajorAccessDenied, RuleMinorMonitored);
+    CHECK((FG_RULE_OPERATION_WRITE | FG_RULE_OPERATION_RENAME) ==
+          FG_RULE_COMPILE_OPERATIONS(code, FG_RULE_OPERATION_WRITE | FG_RULE_OPERATION_RENAME));
+    CHECK(0 == (FG_RULE_COMPILE_OPERATIONS(code, FG_RULE_OPERATION_FSCTL) & ~FG_RULE_OPERATION_FSCTL));
+
+    //
+    // A major code which enforces nothing compiles to an empty mask, whatever the
+    // classes asked for.
+    //
+    code = MakeRuleCode(RuleMajorNone, RuleMinorMonitored);
+    CHECK(0 == FG_RULE_COMPILE_OPERATIONS(code, 0));
+    CHECK(0 == FG_RULE_COMPILE_OPERATIONS(code, FG_RULE_OPERATIONS_ALL));
+
+    code = MakeRuleCode(RuleMajorMaximum, RuleMinorMonitored);
+    CHECK(0 == FG_RULE_COMPILE_OPERATIONS(code, FG_RULE_OPERATION_WRITE));
+}
+
+static
+VOID
+TestValidOperations(
+    VOID
+    )
+{
+    ULONG bit = 0;
+
+    CHECK(VALID_RULE_OPERATIONS(0));
+    CHECK(VALID_RULE_OPERATIONS(FG_RULE_OPERATIONS_ALL));
+
+    for (bit = 0; bit < 32; bit++) {
+        CHECK(VALID_RULE_OPERATIONS(1UL << bit) == (0 != ((1UL << bit) & FG_RULE_OPERATIONS_ALL)));
+    }
+
+    CHECK(FG_RULE_OPERATIONS_ALL == (FG_RULE_OPERATION_CREATE | FG_RULE_OPERATION_WRITE |
+                                     FG_RULE_OPERATION_RENAME | FG_RULE_OPERATION_DELETE |
+                                     FG_RULE_OPERATION_TRUNCATE | FG_RULE_OPERATION_FSCTL));
+}
+
+static
+VOID
+TestValidRuleCodes(
+    VOID
+    )
+{
+    USHORT major = 0, minor = 0;
+    FG_RULE_CODE code = { 0 };
+
+    for (major = 0; major <= RuleMajorMaximum; major++) {
+        for (minor = 0; minor <= RuleMinorMaximum; minor++) {
+            code = MakeRuleCode(major, minor);
+            CHECK(VALID_RULE_CODE(code) == (major > RuleMajorNone && major < RuleMajorMaximum &&
+                                            minor > RuleMinorNone && minor < RuleMinorMaximum));
+
+            //
+            // Every valid rule is enforced on some class.
+            //
+            if (VALID_RULE_CODE(code)) {
+                CHECK(0 != FG_RULE_COMPILE_OPERATIONS(code, 0));
+            }
+        }
+    }
+}
+
+static
+double
+GetSeconds(
+    VOID
+    )
+{
+    struct timespec now;
+
+    timespec_get(&now, TIME_UTC);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+//
+// The open decision spelled out with the access right values of winnt.h, so the
+// masks of the header are checked against them rather than against themselves.
+//
+static
+BOOLEAN
+IsOpenDeniedReference(
+    _In_ USHORT Major,
+    _In_ ULONG Operations,
+    _In_ ULONG Access
+    )
+{
+    const ULONG writeData = 0x00000002, appendData = 0x00000004, delete = 0x00010000;
+    const ULONG genericAll = 0x10000000, genericWrite = 0x40000000;
+
+    if (0 == (Operations & 0x00000001)) return FALSE;
+    if (1 == Major) return TRUE;
+    if (2 == Major) return 0 != (Access & (writeData | appendData | delete | genericAll | genericWrite));
+
+    return FALSE;
+}
+
+static
+VOID
+TestOpenDecision(
+    VOID
+    )
+{
+    static const ULONG rights[] = {
+        FILE_READ_DATA, FILE_WRITE_DATA, FILE_APPEND_DATA, FILE_READ_EA, FILE_WRITE_EA,
+        FILE_EXECUTE, FILE_READ_ATTRIBUTES, FILE_WRITE_ATTRIBUTES, DELETE, READ_CONTROL,
+        WRITE_DAC, WRITE_OWNER, SYNCHRONIZE, MAXIMUM_ALLOWED, GENERIC_ALL, GENERIC_EXECUTE,
+        GENERIC_WRITE, GENERIC_READ
+    };
+    const ULONG rightsAmount = sizeof(rights) / sizeof(rights[0]);
+    FG_RULE_CODE code = { 0 };
+    ULONG subset = 0, bit = 0, access = 0, operations = 0, requested = 0;
+    USHORT major = 0;
+
+    //
+    // Every combination of the named access rights, with every major code and with
+    // the create class enforced or not.
+    //
+    for (major = 0; major <= RuleMajorMaximum; major++) {
+        code = MakeRuleCode(major, RuleMinorMonitored);
+        for (requested = 0; requested <= FG_RULE_OPERATIONS_ALL; requested += FG_RULE_OPERATIONS_ALL) {
+            operations = FG_RULE_COMPILE_OPERATIONS(code, 0 == requested ? FG_RULE_OPERATION_WRITE : requested);
+            for (subset = 0; subset < (1UL << rightsAmount); subset++) {
+                for (access = 0, bit = 0; bit < rightsAmount; bit++) {
+                    if (0 != (subset & (1UL << bit))) access |= rights[bit];
+                }
+
+                CHECK(FG_RULE_OPEN_DENIED(code, operations, access) == IsOpenDeniedReference(major, operations, access));
+            }
+        }
+    }
+
+    //
+    // Every single access bit, including the reserved ones, with every narrowed
+    // operation mask.
+    //
+    for (major = 0; major <= RuleMajorMaximum; major++) {
+        code = MakeRuleCode(major, RuleMinorMonitored);
+        for (requested = 0; requested <= FG_RULE_OPERATIONS_ALL; requested++) {
+            operations = FG_RULE_COMPILE_OPERATIONS(code, requested);
+            CHECK(FG_RULE_OPEN_DENIED(code, operations, 0) == IsOpenDeniedReference(major, operations, 0));
+            for (bit = 0; bit < 32; bit++) {
+                CHECK(FG_RULE_OPEN_DENIED(code, operations, 1UL << bit) ==
+                      IsOpenDeniedReference(major, operations, 1UL << bit));
+            }
+        }
+    }
+
+    //
+    // A readonly rule lets a file be read and its attributes be changed, a maximum
+    // allowed open is decided by the access it was granted.
+    //
+    code = MakeRuleCode(RuleMajorReadonly, RuleMinorNone);
+    operations = FG_RULE_COMPILE_OPERATIONS(code, 0);
+    CHECK(!FG_RULE_OPEN_DENIED(code, operations, GENERIC_READ | FILE_WRITE_ATTRIBUTES | SYNCHRONIZE));
+    CHECK(!FG_RULE_OPEN_DENIED(code, operations, MAXIMUM_ALLOWED));
+    CHECK(FG_RULE_OPEN_DENIED(code, operations, FILE_APPEND_DATA));
+    CHECK(FG_RULE_OPEN_DENIED(code, operations, DELETE));
+    CHECK(!FG_RULE_OPEN_DENIED(code, FG_RULE_COMPILE_OPERATIONS(code, FG_RULE_OPERATION_WRITE), FILE_WRITE_DATA));
+}
+
+//
+// Decide the opens of a mix of accesses, as the create callbacks do for each open
+// of a ruled file, against rules of every major code.
+//
+static
+VOID
+BenchmarkOpenDecision(
+    VOID
+    )
+{
+    static const ULONG accesses[] = {
+        FILE_READ_DATA | SYNCHRONIZE, FILE_READ_DATA | FILE_WRITE_DATA | SYNCHRONIZE, FILE_READ_ATTRIBUTES,
+        DELETE | SYNCHRONIZE, FILE_APPEND_DATA | SYNCHRONIZE, MAXIMUM_ALLOWED, GENERIC_READ | GENERIC_WRITE,
+        GENERIC_READ | GENERIC_EXECUTE
+    };
+    ULONG access[BENCHMARK_ACCESSES];
+    FG_RULE_CODE codes[3];
+    ULONG operations[3];
+    ULONG idx = 0, denied = 0, expected = 0, rule = 0;
+    double start = 0.0, seconds = 0.0;
+
+    for (rule = 0; rule < 3; rule++) {
+        codes[rule] = MakeRuleCode((USHORT)(RuleMajorAccessDenied + rule % 2), RuleMinorMonitored);
+        operations[rule] = FG_RULE_COMPILE_OPERATIONS(codes[rule], 2 == rule ? FG_RULE_OPERATION_WRITE : 0);
+    }
+
+    for (idx = 0; idx < BENCHMARK_ACCESSES; idx++) {
+        access[idx] = accesses[(idx * 7 + idx / 8) % (sizeof(accesses) / sizeof(accesses[0]))];
+    }
+
+    for (idx = 0; idx < BENCHMARK_DECISIONS; idx++) {
+        rule = idx % 3;
+        if (IsOpenDeniedReference(codes[rule].Major, operations[rule], access[idx % BENCHMARK_ACCESSES])) expected++;
+    }
+
+    start = GetSeconds();
+
+    for (idx = 0; idx < BENCHMARK_DECISIONS; idx++) {
+        rule = idx % 3;
+        if (FG_RULE_OPEN_DENIED(codes[rule], operations[rule], access[idx % BENCHMARK_ACCESSES])) denied++;
+    }
+
+    seconds = GetSeconds() - start;
+    if (seconds <= 0.0) seconds = 1e-9;
+
+    CHECK(expected == denied);
+
+    printf("open decisions/s %.0f, denied %.2f\n",
+           BENCHMARK_DECISIONS / seconds, (double)denied / BENCHMARK_DECISIONS);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestCompileOperations();
+    TestValidOperations();
+    TestValidRuleCodes();
+    TestOpenDecision();
+    BenchmarkOpenDecision();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All rule operations checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,388 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    RulesMirrorTests.c
+
+Abstract:
+
+    Tests of the rules mirror of FileGuardLib against a mock of the core port. The
+    mock replies to the rules queries as FgcControlMessageNotifyCallback does, so
+    the mirror is checked to transfer the rules only when they changed and to keep
+    up with rules added while it queries them.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HostShim.h"
+#include "FileGuard.h"
+#include "RulesMirror.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+#define MAX_RULES 16
+
+//
+// The rules list of the mock core.
+//
+typedef struct _MOCK_CORE {
+    const char *Expressions[MAX_RULES];
+    ULONG Ids[MAX_RULES];
+    USHORT RulesAmount;
+    ULONG NextRuleId;
+    LONG RulesGeneration;
+
+    ULONG Messages;             // Messages received.
+    ULONG RulesTransferred;     // Rules copied into the replies.
+    BOOLEAN LastQueryIfChanged;
+    HRESULT FailTransport;      // Returned instead of a reply if it is a failure.
+    const char *AddOnQuery;     // Added right after the next query is answered.
+} MOCK_CORE;
+
+static MOCK_CORE Core;
+
+static
+VOID
+AddRule(
+    _In_ const char *Expression
+    )
+{
+    Core.Expressions[Core.RulesAmount] = Expression;
+    Core.Ids[Core.RulesAmount] = Core.NextRuleId++;
+    Core.RulesAmount++;
+    Core.RulesGeneration++;
+}
+
+static
+VOID
+RemoveRule(
+    _In_ USHORT Index
+    )
+{
+    Core.RulesAmount--;
+    memmove(&Core.Expressions[Index], &Core.Expressions[Index + 1], (Core.RulesAmount - Index) * sizeof(Core.Expressions[0]));
+    memmove(&Core.Ids[Index], &Core.Ids[Index + 1], (Core.RulesAmount - Index) * sizeof(Core.Ids[0]));
+    Core.RulesGeneration++;
+}
+
+static
+ULONG
+GetRuleSize(
+    _In_ USHORT Index
+    )
+{
+    return (ULONG)(sizeof(FG_RULE) + (strlen(Core.Expressions[Index]) + 1) * sizeof(WCHAR));
+}
+
+//
+// The QueryRules case of FgcControlMessageNotifyCallback over FgcGetRules.
+//
+static
+HRESULT
+WINAPI
+MockSendMessage(
+    _In_ HANDLE Port,
+    _In_reads_bytes_(InputSize) LPVOID Input,
+    _In_ DWORD InputSize,
+    _Out_writes_bytes_to_opt_(OutputSize, *Returned) LPVOID Output,
+    _In_ DWORD OutputSize,
+    _Out_ LPDWORD Returned
+    )
+{
+    FG_MESSAGE message;
+    PFG_MESSAGE_RESULT result = (PFG_MESSAGE_RESULT)Output;
+    FG_RULE rule;
+    PUCHAR rulePtr = NULL;
+    ULONG rulesSize = 0, idx = 0, chars = 0;
+    WCHAR ch = 0;
+
+    (void)Port;
+
+    Core.Messages++;
+    *Returned = 0;
+
+    if (FAILED(Core.FailTransport)) return Core.FailTransport;
+    if (InputSize < sizeof(FG_MESSAGE) || OutputSize < sizeof(FG_MESSAGE_RESULT)) return E_INVALIDARG;
+
+    //
+    // The message is captured before it is read, as the core does.
+    //
+    memcpy(&message, Input, sizeof(FG_MESSAGE));
+    CHECK(QueryRules == message.Type);
+
+    Core.LastQueryIfChanged = message.QueryIfChanged;
+    result->RulesGeneration = Core.RulesGeneration;
+    result->ResultCode = ERROR_SUCCESS;
+    result->Rules.RulesAmount = 0;
+    result->Rules.RulesSize = 0;
+
+    if (message.QueryIfChanged && message.RulesGeneration == Core.RulesGeneration) {
+        *Returned = sizeof(FG_MESSAGE_RESULT);
+        return S_OK;
+    }
+
+    for (idx = 0; idx < Core.RulesAmount; idx++) rulesSize += GetRuleSize((USHORT)idx);
+
+    result->Rules.RulesAmount = Core.RulesAmount;
+    result->Rules.RulesSize = rulesSize;
+
+    if (rulesSize > OutputSize - sizeof(FG_MESSAGE_RESULT)) {
+        result->ResultCode = ERROR_INSUFFICIENT_BUFFER;
+    } else {
+        rulePtr = result->Rules.RulesBuffer;
+        for (idx = 0; idx < Core.RulesAmount; idx++) {
+            memset(&rule, 0, sizeof(FG_RULE));
+            rule.Code.Major = RuleMajorReadonly;
+            rule.Id = Core.Ids[idx];
+            rule.PathExpressionSize = (USHORT)((strlen(Core.Expressions[idx]) + 1) * sizeof(WCHAR));
+            memcpy(rulePtr, &rule, sizeof(FG_RULE));
+
+            for (chars = 0; chars <= strlen(Core.Expressions[idx]); chars++) {
+                ch = (WCHAR)(UCHAR)Core.Expressions[idx][chars];
+                memcpy(rulePtr + sizeof(FG_RULE) + chars * sizeof(WCHAR), &ch, sizeof(WCHAR));
+            }
+
+            rulePtr += GetRuleSize((USHORT)idx);
+            Core.RulesTransferred++;
+        }
+    }
+
+    *Returned = sizeof(FG_MESSAGE_RESULT) + (ERROR_SUCCESS == result->ResultCode ? rulesSize : 0);
+
+    if (NULL != Core.AddOnQuery) {
+        AddRule(Core.AddOnQuery);
+        Core.AddOnQuery = NULL;
+    }
+
+    return S_OK;
+}
+
+//
+// Checks the mirror holds the rules of the mock core, in order.
+//
+static
+BOOLEAN
+IsMirrorCurrent(
+    _In_ CONST FGL_RULES_MIRROR *Mirror
+    )
+{
+    FG_RULE rule;
+    PUCHAR rulePtr = (PUCHAR)Mirror->Rules;
+    ULONG idx = 0, chars = 0, offset = 0;
+    WCHAR ch = 0;
+
+    if (!Mirror->Synchronized || Core.RulesGeneration != Mirror->RulesGeneration) return FALSE;
+    if (Core.RulesAmount != Mirror->RulesAmount) return FALSE;
+    if ((0 == Core.RulesAmount) != (NULL == Mirror->Rules)) return FALSE;
+
+    for (idx = 0; idx < Core.RulesAmount; idx++) {
+        if (offset + sizeof(FG_RULE) > Mirror->RulesSize) return FALSE;
+
+        memcpy(&rule, rulePtr + offset, sizeof(FG_RULE));
+        if (Core.Ids[idx] != rule.Id) return FALSE;
+        if ((strlen(Core.Expressions[idx]) + 1) * sizeof(WCHAR) != rule.PathExpressionSize) return FALSE;
+
+        for (chars = 0; chars < rule.PathExpressionSize / sizeof(WCHAR); chars++) {
+            memcpy(&ch, rulePtr + offset + sizeof(FG_RULE) + chars * sizeof(WCHAR), sizeof(WCHAR));
+            if ((WCHAR)(UCHAR)Core.Expressions[idx][chars] != ch) return FALSE;
+        }
+
+        offset += (ULONG)FG_RULE_SIZE(&rule);
+    }
+
+    return offset == Mirror->RulesSize;
+}
+
+static
+VOID
+ResetCore(
+    VOID
+    )
+{
+    memset(&Core, 0, sizeof(MOCK_CORE));
+    Core.NextRuleId = 1;
+    Core.RulesGeneration = 100;
+}
+
+static
+VOID
+TestConditionalRefresh(
+    VOID
+    )
+{
+    FGL_RULES_MIRROR mirror = { 0 };
+
+    ResetCore();
+    AddRule("\\DEVICE\\HARDDISKVOLUME1\\SECRET\\*");
+    AddRule("*\\DESKTOP.INI");
+
+    //
+    // The first refresh is unconditional, the mirror knows no size yet so the rules
+    // are queried again with the size reported.
+    //
+    CHECK(S_OK == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    CHECK(!Core.LastQueryIfChanged);
+    CHECK(2 == Core.Messages);
+    CHECK(IsMirrorCurrent(&mirror));
+
+    //
+    // Unchanged rules are not transferred again.
+    //
+    Core.Messages = 0;
+    Core.RulesTransferred = 0;
+    CHECK(S_FALSE == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    CHECK(S_FALSE == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    CHECK(Core.LastQueryIfChanged);
+    CHECK(2 == Core.Messages);
+    CHECK(0 == Core.RulesTransferred);
+    CHECK(IsMirrorCurrent(&mirror));
+
+    //
+    // A removed rule fits the buffer of the last refresh.
+    //
+    Core.Messages = 0;
+    RemoveRule(0);
+    CHECK(S_OK == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    CHECK(1 == Core.Messages);
+    CHECK(1 == Core.RulesTransferred);
+    CHECK(IsMirrorCurrent(&mirror));
+
+    //
+    // An added rule does not, the query is repeated once.
+    //
+    Core.Messages = 0;
+    AddRule("\\DEVICE\\HARDDISKVOLUME2\\*.DOC");
+    CHECK(S_OK == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    CHECK(2 == Core.Messages);
+    CHECK(IsMirrorCurrent(&mirror));
+
+    //
+    // A cleaned up rules list leaves no rule in the mirror.
+    //
+    RemoveRule(0);
+    RemoveRule(0);
+    CHECK(S_OK == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    CHECK(0 == mirror.RulesAmount && NULL == mirror.Rules);
+    CHECK(IsMirrorCurrent(&mirror));
+    CHECK(S_FALSE == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+
+    free(mirror.Buffer);
+}
+
+static
+VOID
+TestConcurrentChanges(
+    VOID
+    )
+{
+    FGL_RULES_MIRROR mirror = { 0 };
+
+    ResetCore();
+    AddRule("\\DEVICE\\HARDDISKVOLUME1\\SECRET\\*");
+
+    //
+    // A rule added between the sizing reply and the query with the reported size,
+    // the query is repeated until the rules fit.
+    //
+    Core.AddOnQuery = "\\DEVICE\\HARDDISKVOLUME1\\PRIVATE\\*";
+    CHECK(S_OK == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    CHECK(3 == Core.Messages);
+    CHECK(IsMirrorCurrent(&mirror));
+
+    //
+    // A rule added right after the rules were returned is only seen by the next
+    // refresh, the mirror holds the generation the rules were returned with.
+    //
+    Core.AddOnQuery = "\\DEVICE\\HARDDISKVOLUME1\\SHARED\\*";
+    RemoveRule(0);
+    CHECK(S_OK == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    CHECK(!IsMirrorCurrent(&mirror));
+    CHECK(S_OK == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    CHECK(IsMirrorCurrent(&mirror));
+
+    free(mirror.Buffer);
+}
+
+static
+VOID
+TestTransportFailure(
+    VOID
+    )
+{
+    FGL_RULES_MIRROR mirror = { 0 }, saved = { 0 };
+
+    ResetCore();
+    AddRule("\\DEVICE\\HARDDISKVOLUME1\\SECRET\\*");
+
+    CHECK(S_OK == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    saved = mirror;
+
+    //
+    // A failed refresh keeps the mirror as it is, the next one brings it up to date.
+    //
+    AddRule("\\DEVICE\\HARDDISKVOLUME1\\PRIVATE\\*");
+    Core.FailTransport = E_FAIL;
+    CHECK(E_FAIL == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    CHECK(0 == memcmp(&saved, &mirror, sizeof(FGL_RULES_MIRROR)));
+
+    Core.FailTransport = S_OK;
+    CHECK(S_OK == FglSynchronizeRulesMirror(MockSendMessage, NULL, &mirror));
+    CHECK(IsMirrorCurrent(&mirror));
+
+    CHECK(E_INVALIDARG == FglSynchronizeRulesMirror(MockSendMessage, NULL, NULL));
+
+    free(mirror.Buffer);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestConditionalRefresh();
+    TestConcurrentChanges();
+    TestTransportFailure();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All rules mirror checks passed\n");
+    return EXIT_SUCCESS;
+}
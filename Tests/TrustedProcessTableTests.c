@@ -0,0 +1,376 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    TrustedProcessTableTests.c
+
+Abstract:
+
+    Tests of the lock free trusted process table. Every operation is checked against
+    a plain model of the trusted processes, and removed slots must not pile up as
+    tombstones in front of empty slots, or the lookup of every untrusted requestor
+    walks the whole table.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "HostShim.h"
+#include "TrustedProcessTable.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+//
+// Process ids are multiples of four, the ids a table size apart share a home slot.
+//
+#define PROCESS_ID(_n_) ((HANDLE)(ULONG_PTR)((_n_) * 4))
+#define COLLIDING_PROCESS_ID(_n_, _k_) PROCESS_ID((_n_) + (_k_) * FG_TRUSTED_PROCESS_TABLE_SIZE)
+
+#define MODEL_PROCESSES 512
+
+static FGC_TRUSTED_PROCESS_TABLE Table;
+
+static
+ULONG
+CountSlots(
+    _In_ HANDLE ProcessId
+    )
+{
+    ULONG idx = 0, amount = 0;
+
+    for (; idx < FG_TRUSTED_PROCESS_TABLE_SIZE; idx++) {
+        if (ProcessId == Table.Slots[idx].ProcessId) amount++;
+    }
+
+    return amount;
+}
+
+static
+BOOLEAN
+IsTombstoneBeforeEmptySlot(
+    VOID
+    )
+{
+    ULONG idx = 0;
+
+    for (; idx < FG_TRUSTED_PROCESS_TABLE_SIZE; idx++) {
+        if (FG_TRUSTED_PROCESS_TOMBSTONE == Table.Slots[idx].ProcessId &&
+            NULL == Table.Slots[FgcTrustedProcessSlotStep(idx, 1)].ProcessId) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static
+VOID
+TestStoreAndFind(
+    VOID
+    )
+{
+    LONG64 createTime = 0;
+    BOOLEAN exist = FALSE;
+
+    RtlZeroMemory(&Table, sizeof(Table));
+
+    CHECK(!FgcFindTrustedProcessSlot(&Table, PROCESS_ID(1), &createTime));
+
+    CHECK(FgcStoreTrustedProcessSlot(&Table, PROCESS_ID(1), 100, &exist));
+    CHECK(!exist);
+    CHECK(FgcFindTrustedProcessSlot(&Table, PROCESS_ID(1), &createTime));
+    CHECK(100 == createTime);
+
+    //
+    // Storing a trusted process again refreshes its creation time in place.
+    //
+    CHECK(FgcStoreTrustedProcessSlot(&Table, PROCESS_ID(1), 200, &exist));
+    CHECK(exist);
+    CHECK(FgcFindTrustedProcessSlot(&Table, PROCESS_ID(1), &createTime));
+    CHECK(200 == createTime);
+    CHECK(1 == CountSlots(PROCESS_ID(1)));
+
+    CHECK(FgcClearTrustedProcessSlot(&Table, PROCESS_ID(1)));
+    CHECK(!FgcClearTrustedProcessSlot(&Table, PROCESS_ID(1)));
+    CHECK(!FgcFindTrustedProcessSlot(&Table, PROCESS_ID(1), &createTime));
+    CHECK(FG_TRUSTED_PROCESS_TABLE_SIZE == CountSlots(NULL));
+}
+
+static
+VOID
+TestCollisions(
+    VOID
+    )
+{
+    LONG64 createTime = 0;
+    BOOLEAN exist = FALSE;
+    ULONG k = 0;
+
+    RtlZeroMemory(&Table, sizeof(Table));
+
+    for (k = 0; k < 4; k++) {
+        CHECK(FgcStoreTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(5, k), k, &exist));
+    }
+
+    //
+    // Removing the head of the probe sequence leaves a tombstone, the processes
+    // stored after it are still found.
+    //
+    CHECK(FgcClearTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(5, 0)));
+    CHECK(1 == CountSlots(FG_TRUSTED_PROCESS_TOMBSTONE));
+    for (k = 1; k < 4; k++) {
+        CHECK(FgcFindTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(5, k), &createTime));
+        CHECK(k == createTime);
+    }
+
+    //
+    // The tombstone is reused by the next process of the sequence.
+    //
+    CHECK(FgcStoreTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(5, 4), 4, &exist));
+    CHECK(0 == CountSlots(FG_TRUSTED_PROCESS_TOMBSTONE));
+    CHECK(PROCESS_ID(5) != Table.Slots[5].ProcessId);
+    CHECK(COLLIDING_PROCESS_ID(5, 4) == Table.Slots[5].ProcessId);
+
+    //
+    // Removing the tail of the sequence empties the tombstones running up to it.
+    //
+    CHECK(FgcClearTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(5, 1)));
+    CHECK(FgcClearTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(5, 2)));
+    CHECK(2 == CountSlots(FG_TRUSTED_PROCESS_TOMBSTONE));
+    CHECK(FgcClearTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(5, 3)));
+    CHECK(0 == CountSlots(FG_TRUSTED_PROCESS_TOMBSTONE));
+    CHECK(FgcFindTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(5, 4), &createTime));
+    CHECK(4 == createTime);
+
+    //
+    // A sequence wrapping around the end of the table.
+    //
+    RtlZeroMemory(&Table, sizeof(Table));
+    for (k = 0; k < 3; k++) {
+        CHECK(FgcStoreTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(FG_TRUSTED_PROCESS_TABLE_SIZE - 1, k), k, &exist));
+    }
+
+    CHECK(COLLIDING_PROCESS_ID(FG_TRUSTED_PROCESS_TABLE_SIZE - 1, 2) == Table.Slots[1].ProcessId);
+    CHECK(FgcClearTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(FG_TRUSTED_PROCESS_TABLE_SIZE - 1, 0)));
+    CHECK(FgcClearTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(FG_TRUSTED_PROCESS_TABLE_SIZE - 1, 1)));
+    CHECK(FgcClearTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(FG_TRUSTED_PROCESS_TABLE_SIZE - 1, 2)));
+    CHECK(FG_TRUSTED_PROCESS_TABLE_SIZE == CountSlots(NULL));
+}
+
+static
+VOID
+TestFullTable(
+    VOID
+    )
+{
+    LONG64 createTime = 0;
+    BOOLEAN exist = FALSE;
+    ULONG n = 0;
+
+    RtlZeroMemory(&Table, sizeof(Table));
+
+    for (n = 1; n <= FG_TRUSTED_PROCESS_TABLE_SIZE; n++) {
+        CHECK(FgcStoreTrustedProcessSlot(&Table, PROCESS_ID(n * 7), n, &exist));
+    }
+
+    CHECK(!FgcStoreTrustedProcessSlot(&Table, PROCESS_ID(1000), 1, &exist));
+    CHECK(!FgcFindTrustedProcessSlot(&Table, PROCESS_ID(1000), &createTime));
+
+    //
+    // A full table still refreshes the processes it holds.
+    //
+    CHECK(FgcStoreTrustedProcessSlot(&Table, PROCESS_ID(7), 99, &exist));
+    CHECK(exist);
+
+    CHECK(FgcClearTrustedProcessSlot(&Table, PROCESS_ID(14)));
+    CHECK(FgcStoreTrustedProcessSlot(&Table, PROCESS_ID(1000), 1, &exist));
+    CHECK(FgcFindTrustedProcessSlot(&Table, PROCESS_ID(1000), &createTime));
+
+    for (n = 1; n <= FG_TRUSTED_PROCESS_TABLE_SIZE; n++) {
+        if (2 != n) CHECK(FgcClearTrustedProcessSlot(&Table, PROCESS_ID(n * 7)));
+    }
+
+    CHECK(FgcClearTrustedProcessSlot(&Table, PROCESS_ID(1000)));
+    CHECK(FG_TRUSTED_PROCESS_TABLE_SIZE == CountSlots(NULL));
+}
+
+static
+VOID
+TestChurnAgainstModel(
+    VOID
+    )
+{
+    static LONG64 model[MODEL_PROCESSES];
+    ULONG live = 0, seed = 12345, step = 0, n = 0;
+    LONG64 createTime = 0;
+    BOOLEAN exist = FALSE, found = FALSE;
+
+    RtlZeroMemory(&Table, sizeof(Table));
+    RtlZeroMemory(model, sizeof(model));
+
+    for (step = 0; step < 200000; step++) {
+
+        seed = seed * 1103515245 + 12345;
+        n = 1 + (seed >> 8) % (MODEL_PROCESSES - 1);
+
+        if (0 == model[n]) {
+            if (live < FG_TRUSTED_PROCESS_TABLE_SIZE / 2) {
+                CHECK(FgcStoreTrustedProcessSlot(&Table, PROCESS_ID(n), step + 1, &exist));
+                CHECK(!exist);
+                model[n] = step + 1;
+                live++;
+            }
+        } else {
+            CHECK(FgcClearTrustedProcessSlot(&Table, PROCESS_ID(n)));
+            model[n] = 0;
+            live--;
+        }
+
+        found = FgcFindTrustedProcessSlot(&Table, PROCESS_ID(n), &createTime);
+        CHECK(found == (0 != model[n]));
+        if (found) CHECK(createTime == model[n]);
+
+        if (0 == step % 1000) {
+            CHECK(!IsTombstoneBeforeEmptySlot());
+            for (n = 1; n < MODEL_PROCESSES; n++) {
+                found = FgcFindTrustedProcessSlot(&Table, PROCESS_ID(n), &createTime);
+                CHECK(found == (0 != model[n]));
+            }
+        }
+    }
+
+    CHECK(!IsTombstoneBeforeEmptySlot());
+
+    for (n = 1; n < MODEL_PROCESSES; n++) {
+        if (0 != model[n]) CHECK(FgcClearTrustedProcessSlot(&Table, PROCESS_ID(n)));
+    }
+
+    //
+    // Once every process is removed no tombstone is left.
+    //
+    CHECK(FG_TRUSTED_PROCESS_TABLE_SIZE == CountSlots(NULL));
+}
+
+#ifndef _WIN32
+
+static volatile LONG StopReader = 0;
+
+static
+void*
+ReaderRoutine(
+    void *Parameter
+    )
+{
+    LONG64 createTime = 0;
+    ULONG misses = 0;
+
+    (void)Parameter;
+
+    while (!ReadAcquire(&StopReader)) {
+        if (!FgcFindTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(9, 3), &createTime) || 33 != createTime) {
+            misses++;
+        }
+    }
+
+    return (void*)(ULONG_PTR)misses;
+}
+
+static
+VOID
+TestConcurrentReader(
+    VOID
+    )
+{
+    pthread_t reader;
+    void *misses = NULL;
+    BOOLEAN exist = FALSE;
+    ULONG round = 0, k = 0;
+
+    RtlZeroMemory(&Table, sizeof(Table));
+
+    //
+    // The reader looks up the last process of a probe sequence while the writer
+    // keeps removing and storing the processes in front of it, turning their slots
+    // into tombstones and back.
+    //
+    for (k = 0; k < 3; k++) {
+        CHECK(FgcStoreTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(9, k), k, &exist));
+    }
+    CHECK(FgcStoreTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(9, 3), 33, &exist));
+
+    CHECK(0 == pthread_create(&reader, NULL, ReaderRoutine, NULL));
+
+    for (round = 0; round < 200000; round++) {
+        k = round % 3;
+        CHECK(FgcClearTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(9, k)));
+        CHECK(FgcStoreTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(9, k), round, &exist));
+        CHECK(FgcStoreTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(10, k), round, &exist));
+        CHECK(FgcClearTrustedProcessSlot(&Table, COLLIDING_PROCESS_ID(10, k)));
+    }
+
+    __atomic_store_n(&StopReader, 1, __ATOMIC_RELEASE);
+    CHECK(0 == pthread_join(reader, &misses));
+    CHECK(NULL == misses);
+}
+
+#endif
+
+int
+main(
+    VOID
+    )
+{
+    TestStoreAndFind();
+    TestCollisions();
+    TestFullTable();
+    TestChurnAgainstModel();
+#ifndef _WIN32
+    TestConcurrentReader();
+#endif
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All trusted process table checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    VolumePartitionTests.c
+
+Abstract:
+
+    Tests of the rules partition of a volume. A create on a volume is only matched
+    against the rules of its partition and a volume with an empty partition skips
+    the name query, so a rule must be in the partition of every volume it could
+    match a file on.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HostShim.h"
+#include "RuleExpression.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+static
+BOOLEAN
+IsAppliedToVolume(
+    _In_ const char *Expression,
+    _In_ const char *VolumeName
+    )
+{
+    WCHAR expressionBuffer[260], volumeBuffer[260];
+    UNICODE_STRING expression, volumeName;
+
+    HostInitUnicodeString(&expression, expressionBuffer, Expression);
+    HostInitUnicodeString(&volumeName, volumeBuffer, VolumeName);
+
+    return FgcIsExpressionAppliedToVolume(&expression, &volumeName);
+}
+
+static
+VOID
+TestVolumePartitions(
+    VOID
+    )
+{
+    static const char *volumes[] = {
+        "\\DEVICE\\HARDDISKVOLUME1",
+        "\\DEVICE\\HARDDISKVOLUME2",
+        "\\DEVICE\\MUP",
+    };
+
+    static const struct {
+        const char *Expression;
+        BOOLEAN Applied[3];
+    } rules[] = {
+        { "\\DEVICE\\HARDDISKVOLUME1\\SECRET\\*",         { TRUE,  FALSE, FALSE } },
+        { "\\DEVICE\\HARDDISKVOLUME2\\LOGS\\*.LOG",       { FALSE, TRUE,  FALSE } },
+        { "\\DEVICE\\HARDDISKVOLUME1\\FILE.TXT",          { TRUE,  FALSE, FALSE } },
+        { "\\DEVICE\\MUP\\SERVER\\SHARE\\*",              { FALSE, FALSE, TRUE  } },
+        { "\\DEVICE\\HARDDISKVOLUME?\\WINDOWS\\*",        { TRUE,  TRUE,  FALSE } },
+        { "\\DEVICE\\*\\CONFIG.INI",                      { TRUE,  TRUE,  TRUE  } },
+        { "*\\DESKTOP.INI",                               { TRUE,  TRUE,  TRUE  } },
+        { "\\DEVICE\\HARDDISKVOLUME<\\*",                 { TRUE,  TRUE,  FALSE } },
+        { "\\DEVICE\\CDROM0\\*",                          { FALSE, FALSE, FALSE } },
+    };
+
+    ULONG rule = 0, volume = 0, amounts[3] = { 0 };
+
+    //
+    // The partition of a volume holds the rules applied to it, counted as the
+    // instance context counts them.
+    //
+    for (rule = 0; rule < sizeof(rules) / sizeof(rules[0]); rule++) {
+        for (volume = 0; volume < 3; volume++) {
+            if (IsAppliedToVolume(rules[rule].Expression, volumes[volume])) amounts[volume]++;
+            CHECK(rules[rule].Applied[volume] == IsAppliedToVolume(rules[rule].Expression, volumes[volume]));
+        }
+    }
+
+    CHECK(6 == amounts[0]);
+    CHECK(5 == amounts[1]);
+    CHECK(3 == amounts[2]);
+
+    //
+    // A volume targeted by no rule has an empty partition.
+    //
+    for (rule = 0; rule < sizeof(rules) / sizeof(rules[0]); rule++) {
+        if ('*' != rules[rule].Expression[0] && NULL == strstr(rules[rule].Expression, "\\DEVICE\\*")) {
+            CHECK(!IsAppliedToVolume(rules[rule].Expression, "\\DEVICE\\FLOPPY0"));
+        }
+    }
+}
+
+static
+VOID
+TestVolumeNameBoundary(
+    VOID
+    )
+{
+    const char *volume1 = "\\DEVICE\\HARDDISKVOLUME1", *volume10 = "\\DEVICE\\HARDDISKVOLUME10";
+
+    //
+    // The name of a volume may be the prefix of the name of another one, a literal
+    // prefix must end with the volume name or go on with a separator.
+    //
+    CHECK(IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME1\\*", volume1));
+    CHECK(!IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME1\\*", volume10));
+    CHECK(!IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME10\\*", volume1));
+    CHECK(IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME10\\*", volume10));
+
+    CHECK(IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME1", volume1));
+    CHECK(!IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME1", volume10));
+    CHECK(!IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME10", volume1));
+
+    CHECK(IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME1\\A\\B.TXT", volume1));
+    CHECK(!IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME1\\A\\B.TXT", volume10));
+
+    //
+    // A wildcard right after the shorter name could match files of both volumes.
+    //
+    CHECK(IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME1*", volume1));
+    CHECK(IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME1*", volume10));
+    CHECK(IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME1?\\*", volume1));
+    CHECK(IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME1?\\*", volume10));
+    CHECK(IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME1>\\*", volume10));
+
+    //
+    // An expression ending inside the volume name matches no file of the volume.
+    //
+    CHECK(!IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME", volume1));
+    CHECK(!IsAppliedToVolume("\\DEVICE\\HARDDISKVOLUME", volume10));
+    CHECK(!IsAppliedToVolume("", volume1));
+
+    //
+    // The expression and the volume name are both upcased, a lower case expression
+    // is a mismatch rather than a match.
+    //
+    CHECK(!IsAppliedToVolume("\\device\\harddiskvolume1\\*", volume1));
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestVolumePartitions();
+    TestVolumeNameBoundary();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All volume partition checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2023 Fxtack
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    WriteDecisionTests.c
+
+Abstract:
+
+    Tests of the decision table of the write callbacks. Paging writes are skipped,
+    the other writes are checked whatever their caching, and only the creation of a
+    section which can write the file is checked. The records of the sections carry
+    a major function the subscriber filters can select.
+
+Environment:
+
+    User mode, any host.
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HostShim.h"
+#include "FileGuard.h"
+#include "WriteDecision.h"
+
+static int Failures = 0;
+
+#define CHECK(_condition_) {                                                  \
+    if (!(_condition_)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition_); \
+        Failures++;                                                           \
+    }                                                                         \
+}
+
+static
+VOID
+TestWrites(
+    VOID
+    )
+{
+    static const struct {
+        ULONG IrpFlags;
+        FGC_WRITE_DECISION Decision;
+    } table[] = {
+        { 0,                                                                WriteDecisionCheck },
+        { IRP_NOCACHE,                                                      WriteDecisionCheck },
+        { IRP_SYNCHRONOUS_API,                                              WriteDecisionCheck },
+        { IRP_NOCACHE | IRP_SYNCHRONOUS_API,                                WriteDecisionCheck },
+        { IRP_PAGING_IO,                                                    WriteDecisionSkip  },
+        { IRP_PAGING_IO | IRP_NOCACHE,                                      WriteDecisionSkip  },
+        { IRP_SYNCHRONOUS_PAGING_IO,                                        WriteDecisionSkip  },
+        { IRP_PAGING_IO | IRP_SYNCHRONOUS_PAGING_IO | IRP_NOCACHE,          WriteDecisionSkip  },
+    };
+
+    ULONG idx = 0, flags = 0;
+    FGC_WRITE_DECISION expected = WriteDecisionSkip;
+
+    for (idx = 0; idx < sizeof(table) / sizeof(table[0]); idx++) {
+        CHECK(table[idx].Decision == FgcGetWriteDecision(IRP_MJ_WRITE, table[idx].IrpFlags, 0, 0));
+    }
+
+    //
+    // Every combination of the low IRP flags, a paging flag alone decides. The section
+    // parameters are ignored for a write.
+    //
+    for (flags = 0; flags < 0x100; flags++) {
+        expected = (0 != (flags & (IRP_PAGING_IO | IRP_SYNCHRONOUS_PAGING_IO))) ? WriteDecisionSkip : WriteDecisionCheck;
+        CHECK(expected == FgcGetWriteDecision(IRP_MJ_WRITE, flags, 0, 0));
+        CHECK(expected == FgcGetWriteDecision(IRP_MJ_WRITE, flags, SyncTypeCreateSection, PAGE_READONLY));
+    }
+}
+
+static
+VOID
+TestSections(
+    VOID
+    )
+{
+    static const ULONG protections[] = {
+        PAGE_NOACCESS, PAGE_READONLY, PAGE_READWRITE, PAGE_WRITECOPY,
+        PAGE_EXECUTE, PAGE_EXECUTE_READ, PAGE_EXECUTE_READWRITE, PAGE_EXECUTE_WRITECOPY
+    };
+
+    ULONG syncType = 0, idx = 0;
+    FGC_WRITE_DECISION expected = WriteDecisionSkip;
+
+    //
+    // Only a created section mapping the file for write is checked, a copy on write
+    // section or one of another synchronization never changes the file.
+    //
+    for (syncType = SyncTypeOther; syncType <= SyncTypeCreateSection + 2; syncType++) {
+        for (idx = 0; idx < sizeof(protections) / sizeof(protections[0]); idx++) {
+            expected = (SyncTypeCreateSection == syncType &&
+                        (PAGE_READWRITE == protections[idx] || PAGE_EXECUTE_READWRITE == protections[idx])) ?
+                       WriteDecisionCheck : WriteDecisionSkip;
+            CHECK(expected == FgcGetWriteDecision(IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION, 0, syncType, protections[idx]));
+
+            //
+            // The IRP flags of a section synchronization do not matter.
+            //
+            CHECK(expected == FgcGetWriteDecision(IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION,
+                                                  IRP_PAGING_IO,
+                                                  syncType,
+                                                  protections[idx]));
+        }
+    }
+
+    //
+    // Other requests are not decided by the write callbacks.
+    //
+    CHECK(WriteDecisionSkip == FgcGetWriteDecision(IRP_MJ_CREATE, 0, SyncTypeCreateSection, PAGE_READWRITE));
+    CHECK(WriteDecisionSkip == FgcGetWriteDecision(IRP_MJ_READ, 0, 0, 0));
+}
+
+static
+VOID
+TestSectionRecordMajor(
+    VOID
+    )
+{
+    //
+    // The records of the sections carry a major function no IRP has, inside the range
+    // of the subscriber filter mask.
+    //
+    CHECK(FG_MONITOR_MAJOR_CREATE_SECTION > IRP_MJ_MAXIMUM_FUNCTION);
+    CHECK(FG_MONITOR_MAJOR_CREATE_SECTION < 32);
+    CHECK(FG_MONITOR_MAJOR_CREATE_SECTION != IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION);
+    CHECK(0 != FG_MONITOR_FILTER_MAJOR_FUNCTION(FG_MONITOR_MAJOR_CREATE_SECTION));
+    CHECK(0 == (FG_MONITOR_FILTER_MAJOR_FUNCTION(FG_MONITOR_MAJOR_CREATE_SECTION) &
+                FG_MONITOR_FILTER_MAJOR_FUNCTION(IRP_MJ_WRITE)));
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestWrites();
+    TestSections();
+    TestSectionRecordMajor();
+
+    if (0 != Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All write decision checks passed\n");
+    return EXIT_SUCCESS;
+}